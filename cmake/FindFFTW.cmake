@@ -7,6 +7,8 @@
 #   FFTW_FOUND               ... true if fftw is found on the system
 #   FFTW_LIBRARIES           ... full path to fftw library
 #   FFTW_INCLUDES            ... fftw include directory
+#   FFTW_THREADS_FOUND       ... true if the multithreaded fftw library is found
+#   FFTW_THREADS_LIBRARIES   ... full path to the multithreaded fftw library
 #
 # The following variables will be checked by the function
 #   FFTW_USE_STATIC_LIBS    ... if true, only static libraries are found
@@ -49,6 +51,14 @@ if( FFTW_ROOT )
     NO_DEFAULT_PATH
   )
 
+  find_library(
+    FFTW_THREADS_LIB
+    NAMES "fftw3_threads"
+    PATHS ${FFTW_ROOT}
+    PATH_SUFFIXES "lib" "lib64"
+    NO_DEFAULT_PATH
+  )
+
   find_library(
     FFTWF_LIB
     NAMES "fftw3f"
@@ -82,6 +92,12 @@ else()
     PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
   )
 
+  find_library(
+    FFTW_THREADS_LIB
+    NAMES "fftw3_threads"
+    PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
+  )
+
   find_library(
     FFTWF_LIB
     NAMES "fftw3f"
@@ -104,6 +120,11 @@ endif( FFTW_ROOT )
 
 set(FFTW_LIBRARIES ${FFTW_LIB})
 
+if(FFTW_THREADS_LIB)
+  set(FFTW_THREADS_FOUND TRUE)
+  set(FFTW_THREADS_LIBRARIES ${FFTW_THREADS_LIB})
+endif()
+
 if(FFTWF_LIB)
   set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${FFTWF_LIB})
 endif()
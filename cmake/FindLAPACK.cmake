@@ -4,7 +4,9 @@
 # Variables defined by this module:
 #  LAPACK_FOUND        - system has LAPACK
 #  LAPACK_LIBRARY      - the LAPACK library (cached)
-#  LAPACK_LIBRARIES    - the LAPACK libraries
+#  LAPACK_BLAS_FOUND   - system has a BLAS library (optimized ones are preferred)
+#  LAPACK_BLAS_LIBRARY - the BLAS library (cached)
+#  LAPACK_LIBRARIES    - the LAPACK libraries (including BLAS, if found)
 
 if(NOT LAPACK_FOUND)
 
@@ -18,4 +20,14 @@ if(NOT LAPACK_FOUND)
 
   set(LAPACK_LIBRARIES ${LAPACK_LIBRARY})
 
+  # look for BLAS, preferring optimized implementations
+  find_library(LAPACK_BLAS_LIBRARY NAMES openblas mkl_rt blas
+    HINTS ${LAPACK_ROOT_DIR} PATH_SUFFIXES lib)
+  mark_as_advanced(LAPACK_BLAS_LIBRARY)
+
+  if(LAPACK_BLAS_LIBRARY)
+    set(LAPACK_BLAS_FOUND TRUE)
+    set(LAPACK_LIBRARIES ${LAPACK_LIBRARIES} ${LAPACK_BLAS_LIBRARY})
+  endif()
+
 endif(NOT LAPACK_FOUND)
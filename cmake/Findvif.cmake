@@ -137,6 +137,10 @@ if(NOT VIF_FOUND)
         add_definitions(-DNO_LAPACK)
     else()
         set(VIF_LIBRARIES ${VIF_LIBRARIES} ${LAPACK_LIBRARIES})
+
+        if (LAPACK_BLAS_FOUND AND NOT NO_BLAS)
+            add_definitions(-DVIF_USE_BLAS)
+        endif()
     endif()
 
     # Handle conditional GSL support
@@ -164,6 +168,13 @@ if(NOT VIF_FOUND)
         add_definitions(-DNO_FFTW)
     else()
         set(VIF_INCLUDE_DIRS ${VIF_INCLUDE_DIRS} ${FFTW_INCLUDES})
+
+        # Multithreaded transforms are opt-in; fftw3_threads must be linked before fftw3
+        if (VIF_USE_FFTW_THREADS AND FFTW_THREADS_FOUND)
+            add_definitions(-DVIF_USE_FFTW_THREADS)
+            set(VIF_LIBRARIES ${VIF_LIBRARIES} ${FFTW_THREADS_LIBRARIES})
+        endif()
+
         set(VIF_LIBRARIES ${VIF_LIBRARIES} ${FFTW_LIBRARIES})
     endif()
 
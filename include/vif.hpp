@@ -31,6 +31,7 @@
 #include "vif/math/histogram.hpp"
 #include "vif/math/random.hpp"
 #include "vif/math/matrix.hpp"
+#include "vif/math/sparse.hpp"
 #include "vif/math/linfit.hpp"
 #include "vif/math/convex_hull.hpp"
 #include "vif/math/complex.hpp"
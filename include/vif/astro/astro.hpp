@@ -2,6 +2,8 @@
 #define VIF_ASTRO_ASTRO_HPP
 
 #include <map>
+#include <mutex>
+#include <memory>
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/utility/thread.hpp"
@@ -340,91 +342,256 @@ namespace astro {
         return {"std", "wmap", "plank"};
     }
 
+    // Precomputed table of the cosmological integrals, from which the luminosity distance,
+    // lookback time, proper size and volume of the universe can be obtained in constant time.
+    // The integrals are computed cumulatively (Simpson rule) on a regular grid in log(1+z), up
+    // to 'zmax', and interpolated with cubic Hermite splines using the exact value of the
+    // integrand at each node. With the default grid, the relative error compared to the direct
+    // numerical integration is below 1e-10 for all redshifts (and below 1e-11 for z > 1e-3).
+    // Redshifts beyond 'zmax' fall back to direct integration.
+    // Once built, a table is never modified and can be shared by multiple threads. Use
+    // get_cosmo_table() to get the shared table of a given cosmology.
+    struct cosmo_table {
+        cosmo_t cosmo;
+        double zmax = 0.0;
+        double du = 0.0;
+
+        vec1d dc;  // comoving distance integral, in units of c/H0
+        vec1d ddc; // derivative of 'dc' with respect to log(1+z)
+        vec1d tl;  // lookback time integral, in units of 1/H0
+        vec1d dtl; // derivative of 'tl' with respect to log(1+z)
+
+        cosmo_table() = default;
+
+        explicit cosmo_table(const cosmo_t& c, double tzmax = 1e4, uint_t npt = 8192) :
+            cosmo(c), zmax(tzmax) {
+
+            vif_check(zmax > 0.0, "maximum redshift must be positive (got ", zmax, ")");
+            vif_check(npt >= 2, "need at least two points in the table (got ", npt, ")");
+
+            du = log(1.0 + zmax)/(npt - 1);
+
+            dc.resize(npt); ddc.resize(npt);
+            tl.resize(npt); dtl.resize(npt);
+
+            dc.safe[0] = 0.0; ddc.safe[0] = dist_integrand(0.0);
+            tl.safe[0] = 0.0; dtl.safe[0] = time_integrand(0.0);
+            for (uint_t i : range(1, npt)) {
+                double zm = exp((i - 0.5)*du) - 1.0;
+                double z1 = exp(i*du) - 1.0;
+                ddc.safe[i] = (1.0 + z1)*dist_integrand(z1);
+                dtl.safe[i] = (1.0 + z1)*time_integrand(z1);
+                dc.safe[i] = dc.safe[i-1] + (du/6.0)*(ddc.safe[i-1] + ddc.safe[i] +
+                    4.0*(1.0 + zm)*dist_integrand(zm));
+                tl.safe[i] = tl.safe[i-1] + (du/6.0)*(dtl.safe[i-1] + dtl.safe[i] +
+                    4.0*(1.0 + zm)*time_integrand(zm));
+            }
+        }
+
+        #ifndef NO_CFITSIO
+        // Read a table previously saved with save()
+        explicit cosmo_table(const std::string& filename) {
+            fits::read_table(filename, ftable(
+                cosmo.H0, cosmo.wL, cosmo.wm, cosmo.wk, zmax, du, dc, ddc, tl, dtl
+            ));
+
+            vif_check(dc.size() >= 2 && ddc.size() == dc.size() && tl.size() == dc.size() &&
+                dtl.size() == dc.size(), "invalid cosmology table in '", filename, "'");
+        }
+
+        void save(const std::string& filename) const {
+            fits::write_table(filename, ftable(
+                cosmo.H0, cosmo.wL, cosmo.wm, cosmo.wk, zmax, du, dc, ddc, tl, dtl
+            ));
+        }
+        #endif
+
+        // Luminosity distance [Mpc]
+        // Note: assumes that cosmo.wk = 0.
+        double lumdist(double z) const {
+            if (z <= 0) return 0.0;
+            return (1.0 + z)*(2.99792458e5/cosmo.H0)*interpolate_integral(dc, ddc, z,
+                [this](double t) { return dist_integrand(t); });
+        }
+
+        // Lookback time [Gyr]
+        double lookback_time(double z) const {
+            if (z <= 0) return 0.0;
+            return (3.09/(cosmo.H0*3.155e-3))*interpolate_integral(tl, dtl, z,
+                [this](double t) { return time_integrand(t); });
+        }
+
+        // Proper size of an object [kpc/arcsec]
+        double propsize(double z) const {
+            if (z <= 0) return dinf;
+            return (1.0/3.6)*(dpi/180.0)*lumdist(z)/((1.0 + z)*(1.0 + z));
+        }
+
+        // Volume of the universe [Mpc^3] within a sphere of redshift 'z'
+        // Note: assumes that cosmo.wk = 0.
+        double vuniverse(double z) const {
+            if (z <= 0) return 0.0;
+            double d = lumdist(z)/(1.0 + z);
+            return (4.0/3.0)*dpi*d*d*d;
+        }
+
+        #define VECTORIZE_TABLE(name) \
+            template<std::size_t Dim, typename Type> \
+            typename vec<Dim,Type>::effective_type name(const vec<Dim,Type>& z) const { \
+                typename vec<Dim,Type>::effective_type r(z.dims); \
+                for (uint_t i : range(z)) { \
+                    r.safe[i] = name(z.safe[i]); \
+                } \
+                return r; \
+            }
+
+        VECTORIZE_TABLE(lumdist)
+        VECTORIZE_TABLE(lookback_time)
+        VECTORIZE_TABLE(propsize)
+        VECTORIZE_TABLE(vuniverse)
+
+        #undef VECTORIZE_TABLE
+
+    private :
+
+        double dist_integrand(double z) const {
+            return 1.0/sqrt((1.0 + z)*(1.0 + z)*(1.0 + z)*cosmo.wm + cosmo.wL);
+        }
+
+        double time_integrand(double z) const {
+            double z1 = 1.0 + z;
+            return 1.0/(z1*sqrt(z1*z1*z1*cosmo.wm + cosmo.wL + z1*z1*cosmo.wk));
+        }
+
+        template<typename F>
+        double interpolate_integral(const vec1d& f, const vec1d& df, double z, F&& integrand) const {
+            if (is_nan(z)) {
+                return dnan;
+            }
+
+            const uint_t npt = f.size();
+            if (z > zmax) {
+                return f.safe[npt-1] + integrate_func(integrand, zmax, z);
+            }
+
+            double x = log(1.0 + z)/du;
+            uint_t i = std::min(uint_t(x), npt-2);
+            double t = x - i;
+            double s = 1.0 - t;
+
+            return (1.0 + 2.0*t)*s*s*f.safe[i] + t*s*s*du*df.safe[i] +
+                t*t*(3.0 - 2.0*t)*f.safe[i+1] - t*t*s*du*df.safe[i+1];
+        }
+    };
+
+}
+
+namespace impl {
+    namespace astro_impl {
+        struct cosmo_table_cache {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<astro::cosmo_table>> tables;
+        };
+
+        inline cosmo_table_cache& get_cosmo_table_cache() {
+            static cosmo_table_cache cache;
+            return cache;
+        }
+
+        inline bool same_cosmo(const astro::cosmo_t& c1, const astro::cosmo_t& c2) {
+            return c1.H0 == c2.H0 && c1.wL == c2.wL && c1.wm == c2.wm && c1.wk == c2.wk;
+        }
+    }
+}
+
+namespace astro {
+
+    // Shared table of the cosmological integrals for the provided cosmology. The table is built
+    // the first time a cosmology is requested, and then kept for the lifetime of the program.
+    // Tables that have already been used by the current thread are found without locking.
+    inline const cosmo_table& get_cosmo_table(const cosmo_t& cosmo) {
+        thread_local const cosmo_table* last = nullptr;
+        if (last && impl::astro_impl::same_cosmo(last->cosmo, cosmo)) {
+            return *last;
+        }
+
+        auto& cache = impl::astro_impl::get_cosmo_table_cache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        for (auto& t : cache.tables) {
+            if (impl::astro_impl::same_cosmo(t->cosmo, cosmo)) {
+                last = t.get();
+                return *last;
+            }
+        }
+
+        cache.tables.emplace_back(new cosmo_table(cosmo));
+        last = cache.tables.back().get();
+        return *last;
+    }
+
+    #ifndef NO_CFITSIO
+    // Read a table saved with cosmo_table::save(), and use it as the shared table for its
+    // cosmology in all subsequent calls (unless a table was already built for this cosmology).
+    inline const cosmo_table& load_cosmo_table(const std::string& filename) {
+        std::unique_ptr<cosmo_table> tab(new cosmo_table(filename));
+
+        auto& cache = impl::astro_impl::get_cosmo_table_cache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        for (auto& t : cache.tables) {
+            if (impl::astro_impl::same_cosmo(t->cosmo, tab->cosmo)) {
+                return *t;
+            }
+        }
+
+        cache.tables.push_back(std::move(tab));
+        return *cache.tables.back();
+    }
+    #endif
+
     // Proper size of an object in [kpc/arcsec] as a function of redshift 'z'.
     // Uses lumdist() internally.
     template<typename T, typename enable = typename std::enable_if<!meta::is_vec<T>::value>::type>
     T propsize(const T& z, const cosmo_t& cosmo) {
-        if (z <= 0) return dinf;
-
-        return (1.0/3.6)*(dpi/180.0)*lumdist(z, cosmo)/pow(1.0+z, 2.0);
+        return get_cosmo_table(cosmo).propsize(z);
     }
 
     // Luminosity distance [Mpc] as a function of redshift 'z'.
     // Note: assumes that cosmo.wk = 0.
-    // There is no analytic form for this function, hence it must be numerically integrated.
-    // Note that this function is costly. If you need to compute it for many redshift values, you are
-    // advised to use the interpolated version below.
+    // There is no analytic form for this function, hence it must be numerically integrated. This
+    // is done only once per cosmology, see cosmo_table.
     template<typename T, typename enable = typename std::enable_if<!meta::is_vec<T>::value>::type>
     T lumdist(const T& z, const cosmo_t& cosmo) {
-        if (z <= 0) return 0.0;
-        return (1.0+z)*(2.99792458e5/cosmo.H0)*integrate_func([&](T t) {
-            return pow(pow((1.0+t),3)*cosmo.wm + cosmo.wL, -0.5);
-        }, 0, z);
+        return get_cosmo_table(cosmo).lumdist(z);
     }
 
     // Lookback time [Gyr] as a function of redshift 'z'.
-    // There is no analytic form for this function, hence it must be numerically integrated.
-    // Note that this function is costly. If you need to compute it for many redshift values, you are
-    // advised to use the interpolated version below.
+    // There is no analytic form for this function, hence it must be numerically integrated. This
+    // is done only once per cosmology, see cosmo_table.
     template<typename T, typename enable = typename std::enable_if<!meta::is_vec<T>::value>::type>
     T lookback_time(const T& z, const cosmo_t& cosmo) {
-        if (z <= 0) return 0.0;
-        return (3.09/(cosmo.H0*3.155e-3))*integrate_func([&](T t) {
-            return pow(pow((1+t),3)*cosmo.wm + cosmo.wL + pow(1+t,2)*cosmo.wk, -0.5)/(1+t);
-        }, 0, z);
+        return get_cosmo_table(cosmo).lookback_time(z);
     }
 
     // Volume of the universe [Mpc^3] within a sphere of redshift 'z'.
     // Note: assumes that cosmo.wk = 0;
-    // There is no analytic form for this function, hence it must be numerically integrated.
-    // Note that this function is costly. If you need to compute it for many redshift values, you are
-    // advised to use the interpolated version below.
     template<typename T, typename enable = typename std::enable_if<!meta::is_vec<T>::value>::type>
     T vuniverse(const T& z, const cosmo_t& cosmo) {
-        if (z <= 0) return 0.0;
-        return (4.0/3.0)*dpi*pow(lumdist(z, cosmo)/(1.0+z), 3);
-    }
-
-    // The above functions have a vectorized version that, when trying to compute lots of elements,
-    // only evaluates the function on a logarithmic grid (dependent on the provided sample), and then
-    // interpolates the result for the full sample, effectively reducing the number of function calls.
-    // The quality of the approximation depends on the sparsity of the sample (sparse samples will be
-    // less good than compact samples), as well as the number of interpolation points, defined as an
-    // argument to the vectorization macro.
-    #define VECTORIZE_INTERPOL(name, npt) \
-        template<std::size_t Dim, typename Type, typename ... Args> \
-        typename vec<Dim,Type>::effective_type name(const vec<Dim,Type>& z, const Args& ... args) { \
-            if (z.size() < 2*npt) { \
-                using rtype = meta::rtype_t<Type>; \
-                vec<Dim,rtype> r = z; \
-                for (auto& t : r) { \
-                    t = name(t, args...); \
-                } \
-                return r; \
-            } else { \
-                auto idz = where(z > 0); \
-                auto mi = min(z[idz]); \
-                auto ma = max(z[idz]); \
-                auto tz = rgen_log(mi, ma, npt); \
-                using rtype = meta::rtype_t<Type>; \
-                vec<1,rtype> td(tz.dims); \
-                for (uint_t i : range(tz)) { \
-                    td[i] = name(tz[i], args...); \
-                } \
-                vec<Dim,rtype> r(z.dims); \
-                r[idz] = interpolate(td, tz, z[idz]); \
-                idz = where(z <= 0); \
-                r[idz] = name(0.0, args...); \
-                return r; \
-            } \
+        return get_cosmo_table(cosmo).vuniverse(z);
+    }
+
+    // Vectorized versions of the above functions.
+    #define VECTORIZE_COSMO(name) \
+        template<std::size_t Dim, typename Type> \
+        typename vec<Dim,Type>::effective_type name(const vec<Dim,Type>& z, const cosmo_t& cosmo) { \
+            return get_cosmo_table(cosmo).name(z); \
         }
 
-    VECTORIZE_INTERPOL(lumdist, 800);
-    VECTORIZE_INTERPOL(lookback_time, 800);
-    VECTORIZE_INTERPOL(propsize, 800);
-    VECTORIZE_INTERPOL(vuniverse, 800);
+    VECTORIZE_COSMO(lumdist)
+    VECTORIZE_COSMO(lookback_time)
+    VECTORIZE_COSMO(propsize)
+    VECTORIZE_COSMO(vuniverse)
 
-    #undef VECTORIZE_INTERPOL
+    #undef VECTORIZE_COSMO
 
     // Absolute luminosity [Lsun] to observed flux [uJy], using luminosity distance 'd' [Mpc],
     // redshift 'z' [1], and rest-frame wavelength 'lam' [um]
@@ -1355,6 +1522,204 @@ namespace astro {
         return r;
     }
 
+    // Precomputed version of sed2flux() for a set of filters and a fixed SED wavelength grid.
+    // Since the flux is linear in the SED, the integral of each filter reduces to a weighted sum
+    // of the SED values, and the weights are stored as a sparse matrix (one row per filter, in
+    // compressed sparse row format). Fluxes are then obtained as a sparse matrix product, which
+    // gives the same result as sed2flux() up to round-off errors.
+    struct sed2flux_operator {
+        uint_t nlam = 0;   // size of the SED wavelength grid
+        vec1u rowptr;      // weights of filter 'f' are at [rowptr[f], rowptr[f+1])
+        vec1u col;         // position in the SED grid
+        vec1d val;         // weight
+        vec1b valid;       // false if the filter is not covered by the SED (the flux is NaN)
+
+        uint_t nfilter() const {
+            return valid.size();
+        }
+
+        // Flux of the SED in filter 'f'
+        template<typename TypeS>
+        double flux(uint_t f, const vec<1,TypeS>& sed) const {
+            if (!valid.safe[f]) return dnan;
+
+            double value = 0.0;
+            for (uint_t k : range(rowptr.safe[f], rowptr.safe[f+1])) {
+                value += val.safe[k]*sed.safe[col.safe[k]];
+            }
+
+            return value;
+        }
+
+        // Flux of the SED in each filter
+        template<typename TypeS>
+        vec1d operator() (const vec<1,TypeS>& sed) const {
+            vif_check(sed.size() == nlam, "incompatible SED and wavelength grid (", sed.size(),
+                " vs. ", nlam, ")");
+
+            vec1d r(nfilter());
+            for (uint_t f : range(r)) {
+                r.safe[f] = flux(f, sed);
+            }
+
+            return r;
+        }
+
+        // Flux of each SED (first dimension) in each filter (second dimension)
+        template<typename TypeS>
+        vec2d operator() (const vec<2,TypeS>& sed) const {
+            vif_check(sed.dims[1] == nlam, "incompatible SED and wavelength grid (", sed.dims[1],
+                " vs. ", nlam, ")");
+
+            const uint_t nsed = sed.dims[0];
+            const uint_t nfil = nfilter();
+            vec2d r(nsed, nfil);
+            for (uint_t s : range(nsed)) {
+                for (uint_t f : range(nfil)) {
+                    if (!valid.safe[f]) {
+                        r.safe(s,f) = dnan;
+                        continue;
+                    }
+
+                    double value = 0.0;
+                    for (uint_t k : range(rowptr.safe[f], rowptr.safe[f+1])) {
+                        value += val.safe[k]*sed.safe(s,col.safe[k]);
+                    }
+
+                    r.safe(s,f) = value;
+                }
+            }
+
+            return r;
+        }
+    };
+
+}
+
+namespace impl {
+    namespace astro_impl {
+        // Same algorithm as sed2flux(), but accumulating the weight of each SED value in 'w'
+        // instead of the flux. Returns false if the filter is not covered by the SED.
+        // Only the elements in [i0,i1] of 'w' are modified, and the non-zero weights are in [i0,i1).
+        template<typename TypeFL, typename TypeFR, typename TypeL>
+        bool sed2flux_weights(const vec<1,TypeFL>& flam, const vec<1,TypeFR>& fres,
+            const vec<1,TypeL>& lam, vec1d& w, uint_t& i0, uint_t& i1) {
+
+            vif_check(flam.dims == fres.dims, "incompatible dimensions for filter x and y arrays "
+                "(", flam.dims, " vs. ", fres.dims, ")");
+            vif_check(!flam.empty(), "filter arrays cannot be empty");
+            vif_check(!lam.empty(), "wavelength array cannot be empty");
+
+            const uint_t nfil = flam.size();
+            const uint_t nsed = lam.size();
+
+            uint_t ised = lower_bound(lam, flam.safe[0]);
+            if (ised == npos || ised == nsed-1) return false;
+            uint_t ifil = 0;
+
+            i0 = ised;
+
+            // Value at the current position: pc0*sed[pi] + pc1*sed[pi+1]
+            double plam = flam.safe[0];
+            double a = (plam - lam.safe[ised])/(lam.safe[ised+1] - lam.safe[ised]);
+            uint_t pi = ised;
+            double pc0 = fres.safe[0]*(1.0 - a);
+            double pc1 = fres.safe[0]*a;
+
+            while (ifil < nfil-1 && ised < nsed-1) {
+                double nlam, nc0, nc1;
+                uint_t ni;
+
+                if (flam.safe[ifil+1] < lam.safe[ised+1]) {
+                    // Next point is from filter
+                    ++ifil;
+                    nlam = flam.safe[ifil];
+                    a = (nlam - lam.safe[ised])/(lam.safe[ised+1] - lam.safe[ised]);
+                    ni = ised;
+                    nc0 = fres.safe[ifil]*(1.0 - a);
+                    nc1 = fres.safe[ifil]*a;
+                } else {
+                    // Next point is from SED
+                    ++ised;
+                    nlam = lam.safe[ised];
+                    ni = ised;
+                    nc0 = astro::sed2flux_interpolate(flam, fres, nlam, ifil);
+                    nc1 = 0.0;
+                }
+
+                const double dl = 0.5*(nlam - plam);
+                w.safe[pi]   += dl*pc0;
+                w.safe[pi+1] += dl*pc1;
+                w.safe[ni]   += dl*nc0;
+                w.safe[ni+1] += dl*nc1;
+
+                plam = nlam;
+                pi = ni; pc0 = nc0; pc1 = nc1;
+            }
+
+            i1 = std::min(ised+2, nsed);
+
+            return ifil == nfil - 1;
+        }
+    }
+}
+
+namespace astro {
+    // Build the sed2flux_operator of a set of filters for SEDs sampled on the wavelength grid
+    // 'lam' (observed frame).
+    template<typename TypeF, typename TypeL>
+    sed2flux_operator make_sed2flux_operator(const vec<1,TypeF>& filters, const vec<1,TypeL>& lam) {
+        const uint_t nfil = filters.size();
+        const uint_t nlam = lam.size();
+
+        sed2flux_operator op;
+        op.nlam = nlam;
+        op.rowptr.resize(nfil+1);
+        op.valid.resize(nfil);
+
+        // Work array with one extra element, so that the last point of the grid can be given
+        // a zero weight for the next element without checking
+        vec1d w(nlam+1);
+        for (uint_t f : range(nfil)) {
+            const filter_t& fil = filters.safe[f];
+
+            uint_t i0 = 0, i1 = 0;
+            op.valid.safe[f] = impl::astro_impl::sed2flux_weights(fil.lam, fil.res, lam, w, i0, i1);
+            if (op.valid.safe[f]) {
+                for (uint_t i : range(i0, i1)) {
+                    op.col.push_back(i);
+                    op.val.push_back(w.safe[i]);
+                }
+            }
+
+            op.rowptr.safe[f+1] = op.col.size();
+
+            for (uint_t i : range(i0, std::min(i1+1, nlam+1))) {
+                w.safe[i] = 0.0;
+            }
+        }
+
+        return op;
+    }
+
+    template<typename TypeL>
+    sed2flux_operator make_sed2flux_operator(const filter_t& filter, const vec<1,TypeL>& lam) {
+        return make_sed2flux_operator(vec<1,filter_t>{filter}, lam);
+    }
+
+    // Build the sed2flux_operator of a set of filters for rest-frame SEDs [Lsun], sampled on the
+    // rest-frame wavelength grid 'lam' [um], and observed at redshift 'z' and luminosity distance
+    // 'd' [Mpc]. The conversion to observed flux density (see lsun2uJy()) is included in the
+    // weights, so that the operator returns fluxes in [uJy].
+    template<typename TypeF, typename TypeL>
+    sed2flux_operator make_sed2flux_operator(const vec<1,TypeF>& filters, const vec<1,TypeL>& lam,
+        double z, double d) {
+
+        sed2flux_operator op = make_sed2flux_operator(filters, lam*(1.0 + z));
+        op.val = lsun2uJy(z, d, lam[op.col], op.val);
+        return op;
+    }
+
     template<typename TypeL, typename TypeS>
     double sed_convert(const filter_t& from, const filter_t& to, double z, double d,
         const vec<1,TypeL>& lam, const vec<1,TypeS>& sed) {
@@ -4,6 +4,7 @@
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
 #include "vif/utility/generic.hpp"
 #include "vif/math/base.hpp"
 #include "vif/math/fourier.hpp"
@@ -425,6 +426,116 @@ namespace astro {
         return gaussian_profile(dims, sigma, dims[0]/2, dims[1]/2);
     }
 
+}
+
+namespace impl {
+    namespace astro_impl {
+        // Check if a 2D kernel is separable, i.e., if it is the outer product of two 1D kernels
+        // k(i,j) = kx[i]*ky[j], to within 'tolerance' times the largest value of the kernel.
+        template<typename T>
+        bool separate_kernel(const vec<2,T>& k, vec1d& kx, vec1d& ky, double tolerance = 1e-10) {
+            // Use the row and column of the largest element as the 1D kernels
+            uint_t imax = 0;
+            double kmax = 0.0;
+            for (uint_t i : range(k)) {
+                if (std::abs(k.safe[i]) > kmax) {
+                    kmax = std::abs(k.safe[i]);
+                    imax = i;
+                }
+            }
+
+            kx.resize(k.dims[0]);
+            ky.resize(k.dims[1]);
+
+            if (kmax == 0.0) {
+                kx[_] = 0.0;
+                ky[_] = 0.0;
+                return true;
+            }
+
+            const uint_t ix0 = imax/k.dims[1], iy0 = imax%k.dims[1];
+            for (uint_t ix : range(k.dims[0])) {
+                kx.safe[ix] = k.safe(ix,iy0);
+            }
+            for (uint_t iy : range(k.dims[1])) {
+                ky.safe[iy] = k.safe(ix0,iy)/double(k.safe(ix0,iy0));
+            }
+
+            for (uint_t ix : range(k.dims[0]))
+            for (uint_t iy : range(k.dims[1])) {
+                if (std::abs(k.safe(ix,iy) - kx.safe[ix]*ky.safe[iy]) > tolerance*kmax) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Direct convolution of an nx x ny image with a (odd sized) kernel, adding the result to
+        // 'r'. Each row of the input image must be padded with nky/2 zeros on both sides.
+        // The work is done on whole row segments, four kernel pixels at a time
+        // (r[y] += w0*map[y+d0] + ... + w3*map[y+d3]), which the compiler can vectorize, and
+        // the columns are processed in blocks so that the rows used by the kernel stay in
+        // the cache.
+        template<typename T>
+        void convolve2d_direct(const T* map, T* r, uint_t nx, uint_t ny, const double* k,
+            uint_t nkx, uint_t nky) {
+
+            const int_t hx = nkx/2;
+            const uint_t stride = ny + 2*(nky/2);
+            const uint_t block = 2048;
+
+            std::vector<T> w;
+            std::vector<const T*> v;
+            w.reserve(nky);
+            v.reserve(nky);
+
+            for (uint_t y0 = 0; y0 < ny; y0 += block) {
+                const uint_t n = std::min(ny, y0 + block) - y0;
+                for (int_t x = 0; x < int_t(nx); ++x) {
+                    T* o = r + x*ny + y0;
+                    for (int_t i = 0; i < int_t(nkx); ++i) {
+                        // Assume image is 0 outside
+                        const int_t sx = x + hx - i;
+                        if (sx < 0 || sx >= int_t(nx)) continue;
+
+                        // Gather non-zero kernel pixels for this row
+                        w.clear();
+                        v.clear();
+                        const T* in = map + sx*stride + y0 + 2*(nky/2);
+                        for (uint_t j = 0; j < nky; ++j) {
+                            if (k[i*nky + j] == 0) continue;
+                            w.push_back(k[i*nky + j]);
+                            v.push_back(in - j);
+                        }
+
+                        uint_t j = 0;
+                        for (; j + 4 <= w.size(); j += 4) {
+                            const T w0 = w[j], w1 = w[j+1], w2 = w[j+2], w3 = w[j+3];
+                            const T* v0 = v[j];
+                            const T* v1 = v[j+1];
+                            const T* v2 = v[j+2];
+                            const T* v3 = v[j+3];
+                            for (uint_t y = 0; y < n; ++y) {
+                                o[y] += w0*v0[y] + w1*v1[y] + w2*v2[y] + w3*v3[y];
+                            }
+                        }
+
+                        for (; j < w.size(); ++j) {
+                            const T w0 = w[j];
+                            const T* v0 = v[j];
+                            for (uint_t y = 0; y < n; ++y) {
+                                o[y] += w0*v0[y];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+namespace astro {
     // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
     // Naive loop implementation: this is slow but simple and reliable.
     template<typename TypeY1, typename TypeY2>
@@ -502,9 +613,10 @@ namespace astro {
     }
 
     // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
+    // The convolution is computed in Fourier space, see also convolve2d().
     // Note: If the FFTW library is not used, falls back to convolve2d_naive().
     template<typename TypeY1, typename TypeY2>
-    auto convolve2d(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel) ->
+    auto convolve2d_fft(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel) ->
         vec<2,decltype(map[0]*kernel[0])> {
 #ifdef NO_FFTW
         return convolve2d_naive(map, kernel);
@@ -521,13 +633,13 @@ namespace astro {
         vec2d tkernel(tmap.dims);
 
         // TODO: optimize this and catch case where kernel is larger than image
-        vec1u px1 = hsx + indgen<uint_t>(hsx);
-        vec1u py1 = hsy + indgen<uint_t>(hsy);
+        vec1u px1 = hsx + indgen<uint_t>(kernel.dims[0]-hsx);
+        vec1u py1 = hsy + indgen<uint_t>(kernel.dims[1]-hsy);
         vec1u px2 = hsx - 1 - indgen<uint_t>(hsx);
         vec1u py2 = hsy - 1 - indgen<uint_t>(hsy);
 
-        vec1u ix1 = indgen<uint_t>(hsx);
-        vec1u iy1 = indgen<uint_t>(hsy);
+        vec1u ix1 = indgen<uint_t>(kernel.dims[0]-hsx);
+        vec1u iy1 = indgen<uint_t>(kernel.dims[1]-hsy);
         vec1u ix2 = tmap.dims[0] - 1 - indgen<uint_t>(hsx);
         vec1u iy2 = tmap.dims[1] - 1 - indgen<uint_t>(hsy);
 
@@ -549,11 +661,20 @@ namespace astro {
         const vec2d& kernel_normal;
         vec2cd kernel_fourier;
         uint_t hsx = 0, hsy = 0;
-        fftw_plan pf, pi;
-        bool pf_built = false, pi_built = false;
+
+        // Map dimensions and border mode for which 'kernel_fourier' was computed
+        std::array<uint_t,2> kernel_dims = {{0, 0}};
+        bool kernel_cyclic = false;
         vec2d tmap;
         vec2cd cimg;
 
+        // Work arrays for convolving cubes
+        vec3d tcube;
+        vec3cd ccube;
+
+        // Maximum number of slices of a cube that are transformed in one go
+        uint_t max_batch = 64;
+
         bool cyclic = false;
 
         explicit convolver2d(const vec2d& k) : kernel_normal(k) {
@@ -566,44 +687,9 @@ namespace astro {
         convolver2d(convolver2d&&) = default;
         convolver2d& operator=(convolver2d&&) = default;
 
-        ~convolver2d() {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            if (pf_built) {
-                fftw_destroy_plan(pf);
-            }
-            if (pi_built) {
-                fftw_destroy_plan(pi);
-            }
-        }
-
     private :
-        void make_plan(const vec2d& v, vec2cd& r) {
-            if (!pf_built) {
-                std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-                pf = fftw_plan_dft_r2c_2d(v.dims[0], v.dims[1],
-                    const_cast<double*>(v.raw_data()),
-                    reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_ESTIMATE);
-                pf_built = true;
-            }
-        }
-
-        void make_plan(vec2cd& v, vec2d& r) {
-            if (!pi_built) {
-                std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-                pi = fftw_plan_dft_c2r_2d(v.dims[0], v.dims[1],
-                    reinterpret_cast<fftw_complex*>(v.raw_data()),
-                    r.raw_data(), FFTW_ESTIMATE);
-                pi_built = true;
-            }
-        }
-
         void fft(const vec2d& v, vec2cd& r) {
-            make_plan(v, r);
-
-            fftw_execute_dft_r2c(pf,
-                const_cast<double*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data())
-            );
+            vif::fft(v, r);
         }
 
         vec2cd fft(const vec2d& v) {
@@ -614,12 +700,9 @@ namespace astro {
 
         // Compute the Fast Fourier Transform (FFT) of the provided 2d array
         void ifft(vec2cd& v, vec2d& r) {
-            make_plan(v, r);
-
-            fftw_execute_dft_c2r(pi,
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                r.raw_data()
-            );
+            // Plans are cached, and the input array can be overwritten
+            impl::fftw_impl::execute_c2r(impl::fftw_impl::plan_dims(v.dims), 2,
+                reinterpret_cast<fftw_complex*>(v.raw_data()), r.raw_data());
         }
 
         // Compute the Fast Fourier Transform (FFT) of the provided 2d array
@@ -629,66 +712,76 @@ namespace astro {
             return r;
         }
 
-    public :
-        void inplace_convolve(vec2d& map) {
-            if (kernel_fourier.empty()) {
-                if (cyclic) {
-                    hsx = 0; hsy = 0;
+        // Put the kernel in Fourier space, for maps of the provided dimensions. The kernel is
+        // only computed again if the dimensions (or border mode) changed since the last call.
+        void prepare_kernel(const std::array<uint_t,2>& dims) {
+            if (!kernel_fourier.empty() && kernel_dims == dims && kernel_cyclic == cyclic) {
+                return;
+            }
 
-                    // Resize kernel to map size, with kernel center at (0,0)
-                    vec2d tkernel = recenter(
-                        kernel_normal, kernel_normal.dims[0]/2, kernel_normal.dims[1]/2, map.dims
-                    );
-                    inplace_shift(tkernel, -int_t(map.dims[0])/2, -int_t(map.dims[1])/2);
+            kernel_dims = dims;
+            kernel_cyclic = cyclic;
 
-                    // Put the kernel in Fourier space
-                    kernel_fourier = this->fft(tkernel);
+            if (cyclic) {
+                hsx = 0; hsy = 0;
 
-                    cimg.resize(map.dims);
-                } else {
-                    hsx = kernel_normal.dims[0]/2; hsy = kernel_normal.dims[1]/2;
+                // Resize kernel to map size, with kernel center at (0,0)
+                vec2d tkernel = recenter(
+                    kernel_normal, kernel_normal.dims[0]/2, kernel_normal.dims[1]/2, dims
+                );
+                inplace_shift(tkernel, -int_t(dims[0])/2, -int_t(dims[1])/2);
+
+                // Put the kernel in Fourier space
+                kernel_fourier = this->fft(tkernel);
+            } else {
+                hsx = kernel_normal.dims[0]/2; hsy = kernel_normal.dims[1]/2;
 
-                    // Resize kernel to map size, with kernel center at (0,0), and some padding
-                    // to avoid cyclic borders (assume image is 0 outside)
-                    vec2d tkernel = enlarge(kernel_normal, {{0, 0, map.dims[0]-1, map.dims[1]-1}});
-                    inplace_shift(tkernel, -int_t(hsx), -int_t(hsy));
+                // Resize kernel to map size, with kernel center at (0,0), and some padding
+                // to avoid cyclic borders (assume image is 0 outside)
+                vec2d tkernel = enlarge(kernel_normal, {{0, 0, dims[0]-1, dims[1]-1}});
+                inplace_shift(tkernel, -int_t(hsx), -int_t(hsy));
 
-                    // Put the kernel in Fourier space
-                    kernel_fourier = this->fft(tkernel);
+                // Put the kernel in Fourier space
+                kernel_fourier = this->fft(tkernel);
+            }
+        }
 
-                    tmap.resize(kernel_fourier.dims);
-                    cimg.resize(kernel_fourier.dims);
-                }
+        // Copy image data into the padded work map, and pad image with zeros to prevent
+        // issues with cyclic borders
+        void pad_map(const double* map, const std::array<uint_t,2>& dims, double* tmap) const {
+            const uint_t ty = kernel_fourier.dims[1];
+            std::fill(tmap, tmap + kernel_fourier.size(), 0.0);
+            for (uint_t ix : range(dims[0])) {
+                std::copy(map + ix*dims[1], map + (ix+1)*dims[1], tmap + (hsx+ix)*ty + hsy);
+            }
+        }
+
+        // Copy image data and shrink back to original dimensions
+        void unpad_map(const double* tmap, const std::array<uint_t,2>& dims, double* map) const {
+            const uint_t ty = kernel_fourier.dims[1];
+            const double norm = (cyclic ? 1.0 : kernel_fourier.size());
+            for (uint_t ix : range(dims[0]))
+            for (uint_t iy : range(dims[1])) {
+                map[ix*dims[1] + iy] = tmap[(hsx+ix)*ty + hsy + iy]/norm;
+            }
+        }
+
+    public :
+        void inplace_convolve(vec2d& map) {
+            prepare_kernel(map.dims);
+
+            if (cimg.dims != kernel_fourier.dims) {
+                cimg.resize(kernel_fourier.dims);
+            }
+            if (!cyclic && tmap.dims != kernel_fourier.dims) {
+                tmap.resize(kernel_fourier.dims);
             }
 
             if (cyclic) {
                 // Copy image data
                 tmap = std::move(map);
             } else {
-                // Copy image data
-                for (uint_t ix : range(map.dims[0]))
-                for (uint_t iy : range(map.dims[1])) {
-                    tmap.safe(hsx+ix,hsy+iy) = map.safe(ix,iy);
-                }
-
-                // Pad image to prevent issues with cyclic borders
-                for (uint_t ix : range(hsx)) {
-                    for (uint_t iy : range(tmap.dims[0])) {
-                        tmap.safe(ix,iy) = 0;
-                    }
-                    for (uint_t iy : range(tmap.dims[0])) {
-                        tmap.safe(tmap.dims[0]-hsx+ix,iy) = 0;
-                    }
-                }
-
-                for (uint_t ix : range(map.dims[0])) {
-                    for (uint_t iy : range(hsy)) {
-                        tmap.safe(hsx+ix,iy) = 0;
-                    }
-                    for (uint_t iy : range(hsy)) {
-                        tmap.safe(hsx+ix,tmap.dims[1]-hsy+iy) = 0;
-                    }
-                }
+                pad_map(map.raw_data(), map.dims, tmap.raw_data());
             }
 
             // Perform the convolution in Fourier space
@@ -702,11 +795,7 @@ namespace astro {
                 // Copy image data
                 map = std::move(tmap);
             } else {
-                // Copy image data and shrink back to original dimensions
-                for (uint_t ix : range(map.dims[0]))
-                for (uint_t iy : range(map.dims[1])) {
-                    map.safe(ix,iy) = tmap.safe(hsx+ix,hsy+iy)/cimg.size();
-                }
+                unpad_map(tmap.raw_data(), map.dims, map.raw_data());
             }
         }
 
@@ -714,6 +803,59 @@ namespace astro {
             inplace_convolve(map);
             return map;
         }
+
+        // Convolve each slice cube(i,_,_) of a cube with the kernel. Slices are transformed
+        // in batches of (at most) 'max_batch' slices.
+        void inplace_convolve(vec3d& cube) {
+            const std::array<uint_t,2> dims = {{cube.dims[1], cube.dims[2]}};
+            const uint_t nslice = dims[0]*dims[1];
+            const uint_t batch = std::max(uint_t(1), std::min(max_batch, cube.dims[0]));
+
+            prepare_kernel(dims);
+
+            const uint_t npix = kernel_fourier.size();
+            if (tcube.dims[0] != batch || tcube.dims[1] != kernel_fourier.dims[0] ||
+                tcube.dims[2] != kernel_fourier.dims[1]) {
+                tcube.resize(batch, kernel_fourier.dims[0], kernel_fourier.dims[1]);
+                ccube.resize(tcube.dims);
+            }
+
+            for (uint_t i0 = 0; i0 < cube.dims[0]; i0 += batch) {
+                const uint_t nb = std::min(batch, cube.dims[0] - i0);
+
+                // Copy image data
+                for (uint_t i : range(nb)) {
+                    pad_map(cube.raw_data() + (i0+i)*nslice, dims, tcube.raw_data() + i*npix);
+                }
+
+                // Perform the convolution in Fourier space
+                impl::fftw_impl::execute_r2c(impl::fftw_impl::plan_dims(kernel_fourier.dims), 2,
+                    tcube.raw_data(), reinterpret_cast<fftw_complex*>(ccube.raw_data()),
+                    nb, npix, npix);
+
+                const auto* k = kernel_fourier.raw_data();
+                for (uint_t i : range(nb)) {
+                    auto* c = ccube.raw_data() + i*npix;
+                    for (uint_t j : range(npix)) {
+                        c[j] *= k[j];
+                    }
+                }
+
+                // Go back to real space
+                impl::fftw_impl::execute_c2r(impl::fftw_impl::plan_dims(kernel_fourier.dims), 2,
+                    reinterpret_cast<fftw_complex*>(ccube.raw_data()), tcube.raw_data(),
+                    nb, npix, npix);
+
+                for (uint_t i : range(nb)) {
+                    unpad_map(tcube.raw_data() + i*npix, dims, cube.raw_data() + (i0+i)*nslice);
+                }
+            }
+        }
+
+        vec3d convolve(vec3d cube) {
+            inplace_convolve(cube);
+            return cube;
+        }
     };
 #else
     struct convolver2d {
@@ -733,6 +875,200 @@ namespace astro {
         return convolver2d(k);
     }
 
+    // Perform the direct convolution of two 2D arrays, assuming the second one is the kernel.
+    // If the kernel is separable (e.g., a Gaussian), it is applied as two 1D convolutions.
+    template<typename TypeY1, typename TypeY2>
+    auto convolve2d_direct(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel) ->
+        vec<2,decltype(map[0]*kernel[0])> {
+        vif_check(kernel.dims[0]%2 == 1 && kernel.dims[1]%2 == 1,
+            "kernel must have odd dimensions (", kernel.dims, ")");
+
+        using rtype = decltype(map[0]*kernel[0]);
+
+        // Pad image rows with zeros, as required by the kernel
+        const uint_t hsy = kernel.dims[1]/2;
+        vec<2,rtype> tmap(map.dims[0], map.dims[1] + 2*hsy);
+        for (uint_t ix : range(map.dims[0]))
+        for (uint_t iy : range(map.dims[1])) {
+            tmap.safe(ix,iy+hsy) = map.safe(ix,iy);
+        }
+
+        vec<2,rtype> r(map.dims);
+
+        vec1d kx, ky;
+        if (impl::astro_impl::separate_kernel(kernel, kx, ky) &&
+            kernel.dims[0] > 1 && kernel.dims[1] > 1) {
+            // Convolve the rows, then the columns
+            vec<2,rtype> tmp(map.dims);
+            impl::astro_impl::convolve2d_direct(tmap.raw_data(), tmp.raw_data(),
+                map.dims[0], map.dims[1], ky.raw_data(), 1, ky.size());
+            impl::astro_impl::convolve2d_direct(tmp.raw_data(), r.raw_data(),
+                map.dims[0], map.dims[1], kx.raw_data(), kx.size(), 1);
+        } else {
+            vec2d tkernel = kernel;
+            impl::astro_impl::convolve2d_direct(tmap.raw_data(), r.raw_data(),
+                map.dims[0], map.dims[1], tkernel.raw_data(), kernel.dims[0], kernel.dims[1]);
+        }
+
+        return r;
+    }
+
+    enum class convolve2d_method {
+        direct, separable, fft
+    };
+
+    // Choose the fastest method to convolve a map of dimensions 'dims' with a kernel: direct
+    // summation (small kernels), two 1D convolutions (separable kernels, e.g., Gaussians), or
+    // FFT (large kernels).
+    template<typename TypeY>
+    convolve2d_method convolve2d_best_method(const std::array<uint_t,2>& dims,
+        const vec<2,TypeY>& kernel) {
+
+        if (kernel.dims[0]%2 == 0 || kernel.dims[1]%2 == 0) {
+            // Only supported by FFT
+            return convolve2d_method::fft;
+        }
+
+        // Approximate cost per pixel of each method, in units of multiply-add operations
+        const double inf = std::numeric_limits<double>::infinity();
+        double cost_direct = kernel.size();
+        if (kernel.dims[0] > 15 || kernel.dims[1] > 15) {
+            // Large kernel: only use direct summation if there is no alternative
+            cost_direct *= 1e3;
+        }
+
+        vec1d kx, ky;
+        double cost_sep = impl::astro_impl::separate_kernel(kernel, kx, ky) ?
+            1.0 + kernel.dims[0] + kernel.dims[1] : inf;
+
+#ifdef NO_FFTW
+        double cost_fft = inf;
+#else
+        double cost_fft = 5.0*std::log2(double(dims[0] + kernel.dims[0])*
+            double(dims[1] + kernel.dims[1]));
+#endif
+
+        if (cost_fft < std::min(cost_direct, cost_sep)) {
+            return convolve2d_method::fft;
+        } else if (cost_sep < cost_direct) {
+            return convolve2d_method::separable;
+        } else {
+            return convolve2d_method::direct;
+        }
+    }
+
+    // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
+    // Uses the fastest method, see convolve2d_best_method().
+    template<typename TypeY1, typename TypeY2>
+    auto convolve2d(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel) ->
+        vec<2,decltype(map[0]*kernel[0])> {
+        if (convolve2d_best_method(map.dims, kernel) == convolve2d_method::fft) {
+            return convolve2d_fft(map, kernel);
+        } else {
+            return convolve2d_direct(map, kernel);
+        }
+    }
+
+    struct convolve2d_tiled_params {
+        uint_t thread = 1u;     // number of tiles convolved concurrently
+        uint_t tile_size = 0u;  // size of the FFT of each tile, including the padding required
+                                // by the kernel (0: automatic)
+    };
+
+    // Perform the convolution of two 2D arrays, assuming the second one is the kernel. Contrary
+    // to convolve2d(), which transforms the whole map at once, the map is processed in square
+    // tiles (overlap-save method), so the memory usage does not grow with the size of the map.
+    // Tiles can be processed in parallel.
+    // Note: If the FFTW library is not used, falls back to convolve2d_naive().
+    template<typename TypeY1, typename TypeY2>
+    auto convolve2d_tiled(const vec<2,TypeY1>& map, const vec<2,TypeY2>& kernel,
+        convolve2d_tiled_params p = convolve2d_tiled_params{}) ->
+        vec<2,decltype(map[0]*kernel[0])> {
+#ifdef NO_FFTW
+        return convolve2d_naive(map, kernel);
+#else
+        vif_check(kernel.dims[0]%2 == 1 && kernel.dims[1]%2 == 1,
+            "kernel must have odd dimensions (", kernel.dims, ")");
+
+        using impl::fftw_impl::good_size;
+
+        const uint_t hsx = kernel.dims[0]/2, hsy = kernel.dims[1]/2;
+
+        if (p.tile_size == 0) {
+            p.tile_size = good_size(std::max(uint_t(1024), 8*std::max(kernel.dims[0], kernel.dims[1])));
+        }
+
+        vif_check(p.tile_size > 2*std::max(hsx, hsy), "tile size must be larger than the kernel "
+            "(", p.tile_size, " vs. ", kernel.dims, ")");
+
+        // Size of the FFTs, and size of the region of the map that is convolved in each tile
+        const std::array<uint_t,2> tdims = {{
+            std::min(p.tile_size, good_size(map.dims[0] + 2*hsx)),
+            std::min(p.tile_size, good_size(map.dims[1] + 2*hsy))
+        }};
+
+        const uint_t ntx = tdims[0] - 2*hsx, nty = tdims[1] - 2*hsy;
+
+        // Resize kernel to tile size, with kernel center at (0,0)
+        vec2d tkernel = enlarge(vec2d(kernel),
+            {{0, 0, tdims[0]-kernel.dims[0], tdims[1]-kernel.dims[1]}});
+        inplace_shift(tkernel, -int_t(hsx), -int_t(hsy));
+
+        // Put the kernel in Fourier space, and include normalization
+        vec2cd kernel_fourier = fft(tkernel);
+        kernel_fourier /= double(tkernel.size());
+
+        vec<2,decltype(map[0]*kernel[0])> r(map.dims);
+        if (map.empty()) return r;
+
+        const uint_t ntilex = (map.dims[0] + ntx - 1)/ntx;
+        const uint_t ntiley = (map.dims[1] + nty - 1)/nty;
+        const uint_t ntile = ntilex*ntiley;
+
+        // Each thread picks the next tile to convolve, until all are done
+        const uint_t nthread = std::max(uint_t(1), std::min(p.thread, ntile));
+        std::vector<vec2d> tmaps(nthread, vec2d(tdims));
+        std::vector<vec2cd> cimgs(nthread, vec2cd(tdims));
+        impl::parallel_for_each(ntile, nthread, [&](uint_t t, uint_t ith) {
+            vec2d& tmap = tmaps[ith];
+            vec2cd& cimg = cimgs[ith];
+
+            // Region of the map covered by this tile (output), and corresponding
+            // region of the map required (input, padded with zeros outside the map)
+            const uint_t x0 = (t/ntiley)*ntx, y0 = (t%ntiley)*nty;
+            const uint_t nx = std::min(ntx, map.dims[0]-x0), ny = std::min(nty, map.dims[1]-y0);
+
+            const uint_t ix0 = (x0 >= hsx ? x0 - hsx : 0);
+            const uint_t iy0 = (y0 >= hsy ? y0 - hsy : 0);
+            const uint_t ix1 = std::min(map.dims[0], x0 + nx + hsx);
+            const uint_t iy1 = std::min(map.dims[1], y0 + ny + hsy);
+
+            // Copy image data
+            tmap[_] = 0.0;
+            for (uint_t ix = ix0; ix < ix1; ++ix)
+            for (uint_t iy = iy0; iy < iy1; ++iy) {
+                tmap.safe(ix+hsx-x0,iy+hsy-y0) = map.safe(ix,iy);
+            }
+
+            // Perform the convolution in Fourier space
+            fft(tmap, cimg);
+            cimg *= kernel_fourier;
+
+            // Go back to real space, the input array can be overwritten
+            impl::fftw_impl::execute_c2r(impl::fftw_impl::plan_dims(tdims), 2,
+                reinterpret_cast<fftw_complex*>(cimg.raw_data()), tmap.raw_data());
+
+            // Copy the part of the tile that is not affected by cyclic borders
+            for (uint_t ix : range(nx))
+            for (uint_t iy : range(ny)) {
+                r.safe(x0+ix,y0+iy) = tmap.safe(hsx+ix,hsy+iy);
+            }
+        });
+
+        return r;
+#endif
+    }
+
     // Perform the convolution of two 2D arrays, assuming the second one is the kernel.
     // Note: If the FFTW library is not used, falls back to convolve2d_naive().
     template<typename T = void>
@@ -753,15 +1089,16 @@ namespace astro {
         vec<2,decltype(func(flatten(img)))> {
 
         vec<2,decltype(func(flatten(img)))> res(img.dims);
+        vec<1,meta::rtype_t<T>> tmp;
+        tmp.reserve(sqr(2*hsize+1));
         for (uint_t x = 0; x < img.dims[0]; ++x)
         for (uint_t y = 0; y < img.dims[1]; ++y) {
             uint_t x0 = x >= hsize ? x - hsize : 0;
-            uint_t x1 = x < img.dims[0]-hsize ? x + hsize : img.dims[0]-1;
+            uint_t x1 = x + hsize < img.dims[0] ? x + hsize : img.dims[0]-1;
             uint_t y0 = y >= hsize ? y - hsize : 0;
-            uint_t y1 = y < img.dims[1]-hsize ? y + hsize : img.dims[1]-1;
+            uint_t y1 = y + hsize < img.dims[1] ? y + hsize : img.dims[1]-1;
 
-            vec<1,meta::rtype_t<T>> tmp;
-            tmp.reserve((x1-x0)*(y1-y0));
+            tmp.clear();
             for (uint_t tx = x0; tx <= x1; ++tx)
             for (uint_t ty = y0; ty <= y1; ++ty) {
                 tmp.push_back(img.safe(tx,ty));
@@ -772,6 +1109,416 @@ namespace astro {
 
         return res;
     }
+}
+
+namespace impl {
+    namespace astro_impl {
+        // Call f(i0,i1) on 'nthread' contiguous bands covering [0,n), in parallel
+        template<typename F>
+        void for_each_band(uint_t n, uint_t nthread, F&& f) {
+            nthread = std::max(uint_t(1), std::min(nthread, n));
+            if (nthread == 1) {
+                f(uint_t(0), n);
+                return;
+            }
+
+            parallel_for_each(nthread, nthread, [&](uint_t i, uint_t) {
+                f(i*n/nthread, (i+1)*n/nthread);
+            });
+        }
+
+        // Apply the 1D filter 'f(in, out, n)' along the two dimensions of 'v'. Each thread
+        // works on its own copy of 'f'.
+        template<typename F>
+        void boxcar_separable(vec2d& v, uint_t nthread, const F& tf) {
+            const uint_t nx = v.dims[0], ny = v.dims[1];
+
+            // Along rows
+            for_each_band(nx, nthread, [&](uint_t x0, uint_t x1) {
+                F f = tf;
+                std::vector<double> out(ny);
+                for (uint_t x = x0; x < x1; ++x) {
+                    double* row = v.raw_data() + x*ny;
+                    f(row, out.data(), ny);
+                    std::copy(out.begin(), out.end(), row);
+                }
+            });
+
+            // Along columns, gathered by blocks of 8 to make good use of the cache
+            const uint_t nb = 8;
+            for_each_band((ny + nb - 1)/nb, nthread, [&](uint_t b0, uint_t b1) {
+                F f = tf;
+                std::vector<double> in(nb*nx), out(nx);
+                for (uint_t b = b0; b < b1; ++b) {
+                    const uint_t y0 = b*nb, n = std::min(nb, ny - y0);
+                    for (uint_t x = 0; x < nx; ++x)
+                    for (uint_t c = 0; c < n; ++c) {
+                        in[c*nx + x] = v.safe(x,y0+c);
+                    }
+
+                    for (uint_t c = 0; c < n; ++c) {
+                        f(in.data() + c*nx, out.data(), nx);
+                        for (uint_t x = 0; x < nx; ++x) {
+                            v.safe(x,y0+c) = out[x];
+                        }
+                    }
+                }
+            });
+        }
+
+        // Running sum over a window of half-size 'h' (clipped at the edges)
+        inline void boxcar_sum_line(const double* in, double* out, uint_t n, uint_t h) {
+            double s = 0.0;
+            for (uint_t i = 0; i < std::min(h, n); ++i) {
+                s += in[i];
+            }
+
+            for (uint_t i = 0; i < n; ++i) {
+                if (i + h < n) s += in[i+h];
+                out[i] = s;
+                if (i >= h) s -= in[i-h];
+            }
+        }
+
+        // Running maximum over a window of half-size 'h' (clipped at the edges), using the
+        // van Herk/Gil-Werman algorithm: three comparisons per element, for any window size
+        template<typename C>
+        struct boxcar_extremum_line {
+            uint_t h = 0;
+            std::vector<double> p, g, r;
+
+            void operator() (const double* in, double* out, uint_t n) {
+                const double bad = C::worst();
+                const uint_t w = 2*h+1, l = n + 2*h;
+                p.assign(l, bad);
+                g.resize(l);
+                r.resize(l);
+
+                std::copy(in, in + n, p.begin() + h);
+
+                // Extremum from the start of each block of 'w' elements, and to the end
+                for (uint_t k = 0; k < l; ++k) {
+                    g[k] = (k % w == 0 ? p[k] : C::best(g[k-1], p[k]));
+                }
+                for (uint_t k = l; k-- > 0;) {
+                    r[k] = (k % w == w-1 || k == l-1 ? p[k] : C::best(r[k+1], p[k]));
+                }
+
+                for (uint_t i = 0; i < n; ++i) {
+                    out[i] = C::best(r[i], g[i+w-1]);
+                }
+            }
+        };
+
+        struct boxcar_max_t {
+            static double worst() { return -std::numeric_limits<double>::infinity(); }
+            static double best(double a, double b) { return a > b ? a : b; }
+        };
+
+        struct boxcar_min_t {
+            static double worst() { return std::numeric_limits<double>::infinity(); }
+            static double best(double a, double b) { return a < b ? a : b; }
+        };
+
+        // Number of values in each window for which 'valid(value)' is true
+        template<typename T, typename F>
+        vec2d boxcar_count_if(const vec<2,T>& img, uint_t hsize, uint_t nthread, F&& valid) {
+            vec2d n(img.dims);
+            for (uint_t i : range(img)) {
+                n.safe[i] = valid(img.safe[i]);
+            }
+
+            boxcar_separable(n, nthread, [hsize](const double* in, double* out, uint_t nn) {
+                boxcar_sum_line(in, out, nn, hsize);
+            });
+
+            return n;
+        }
+
+        // Number of finite values in each window
+        template<typename T>
+        vec2d boxcar_count(const vec<2,T>& img, uint_t hsize, uint_t nthread) {
+            return boxcar_count_if(img, hsize, nthread, [](meta::rtype_t<T> v) {
+                return is_finite(v);
+            });
+        }
+
+        // Running minimum or maximum, NaN values are ignored
+        template<typename C, typename T>
+        vec<2,meta::rtype_t<T>> boxcar_extremum(const vec<2,T>& img, uint_t hsize,
+            uint_t nthread) {
+
+            vec2d v(img.dims);
+            bool nan = false;
+            for (uint_t i : range(img)) {
+                if (is_nan(img.safe[i])) {
+                    v.safe[i] = C::worst();
+                    nan = true;
+                } else {
+                    v.safe[i] = img.safe[i];
+                }
+            }
+
+            boxcar_extremum_line<C> line;
+            line.h = hsize;
+            boxcar_separable(v, nthread, line);
+
+            if (nan) {
+                // Windows with only infinite values are valid, they must not be masked
+                vec2d n = boxcar_count_if(img, hsize, nthread, [](meta::rtype_t<T> v) {
+                    return !is_nan(v);
+                });
+
+                for (uint_t i : range(v)) {
+                    if (n.safe[i] == 0) v.safe[i] = dnan;
+                }
+            }
+
+            return vec<2,meta::rtype_t<T>>(v);
+        }
+
+        // Set of integer ranks, with fast insertion, removal and selection of the k-th element.
+        // Ranks are stored as bits, with counts for each group of 64 bits (4096 ranks) and
+        // each group of 64 groups (262144 ranks). As in Huang's algorithm, selection starts from
+        // the position of the previous selection, which is fast when the window slides.
+        struct rank_set {
+            std::vector<std::uint64_t> bits;
+            std::vector<std::uint16_t> c1;
+            std::vector<std::uint32_t> c2;
+            uint_t b2 = 0, below2 = 0;
+
+            explicit rank_set(uint_t nrank) :
+                bits(nrank/64 + 1), c1(nrank/4096 + 1), c2(nrank/262144 + 1) {}
+
+            void insert(uint_t r) {
+                bits[r/64] |= std::uint64_t(1) << (r%64);
+                ++c1[r/4096];
+                ++c2[r/262144];
+                if (r/262144 < b2) ++below2;
+            }
+
+            void erase(uint_t r) {
+                bits[r/64] &= ~(std::uint64_t(1) << (r%64));
+                --c1[r/4096];
+                --c2[r/262144];
+                if (r/262144 < b2) --below2;
+            }
+
+            // Rank of the k-th smallest element (k starts at 0)
+            uint_t select(uint_t k) {
+                while (below2 > k) {
+                    --b2;
+                    below2 -= c2[b2];
+                }
+                while (below2 + c2[b2] <= k) {
+                    below2 += c2[b2];
+                    ++b2;
+                }
+
+                k -= below2;
+                uint_t i1 = b2*64;
+                while (c1[i1] <= k) {
+                    k -= c1[i1];
+                    ++i1;
+                }
+
+                uint_t iw = i1*64;
+                while (uint_t(__builtin_popcountll(bits[iw])) <= k) {
+                    k -= __builtin_popcountll(bits[iw]);
+                    ++iw;
+                }
+
+                std::uint64_t w = bits[iw];
+                for (; k > 0; --k) {
+                    w &= w - 1;
+                }
+
+                return iw*64 + __builtin_ctzll(w);
+            }
+        };
+    }
+}
+
+namespace astro {
+    // Sum of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at the
+    // edges of the image), ignoring NaN values. Cost does not depend on the size of the window.
+    template<typename T>
+    vec2d boxcar_sum(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        vec2d v(img.dims);
+        for (uint_t i : range(img)) {
+            v.safe[i] = (is_finite(img.safe[i]) ? img.safe[i] : 0.0);
+        }
+
+        impl::astro_impl::boxcar_separable(v, nthread,
+            [hsize](const double* in, double* out, uint_t n) {
+                impl::astro_impl::boxcar_sum_line(in, out, n, hsize);
+            });
+
+        return v;
+    }
+
+    // Mean of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at the
+    // edges of the image), ignoring NaN values. Cost does not depend on the size of the window.
+    template<typename T>
+    vec2d boxcar_mean(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        vec2d v = boxcar_sum(img, hsize, nthread);
+        vec2d n = impl::astro_impl::boxcar_count(img, hsize, nthread);
+        for (uint_t i : range(v)) {
+            v.safe[i] = (n.safe[i] > 0 ? v.safe[i]/n.safe[i] : dnan);
+        }
+
+        return v;
+    }
+
+    // Variance of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at
+    // the edges of the image), ignoring NaN values. Cost does not depend on the size of the
+    // window.
+    template<typename T>
+    vec2d boxcar_variance(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        // Subtract the global mean to limit round-off errors
+        double m0 = 0.0;
+        uint_t n0 = 0;
+        for (uint_t i : range(img)) {
+            if (is_finite(img.safe[i])) {
+                m0 += img.safe[i];
+                ++n0;
+            }
+        }
+
+        if (n0 > 0) m0 /= n0;
+
+        vec2d v(img.dims), v2(img.dims);
+        for (uint_t i : range(img)) {
+            v.safe[i] = (is_finite(img.safe[i]) ? img.safe[i] - m0 : 0.0);
+            v2.safe[i] = sqr(v.safe[i]);
+        }
+
+        auto sum = [hsize](const double* in, double* out, uint_t n) {
+            impl::astro_impl::boxcar_sum_line(in, out, n, hsize);
+        };
+
+        impl::astro_impl::boxcar_separable(v, nthread, sum);
+        impl::astro_impl::boxcar_separable(v2, nthread, sum);
+
+        vec2d n = impl::astro_impl::boxcar_count(img, hsize, nthread);
+        for (uint_t i : range(v)) {
+            if (n.safe[i] > 0) {
+                v.safe[i] = std::max(0.0, v2.safe[i]/n.safe[i] - sqr(v.safe[i]/n.safe[i]));
+            } else {
+                v.safe[i] = dnan;
+            }
+        }
+
+        return v;
+    }
+
+    // Minimum of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at
+    // the edges of the image), ignoring NaN values. Cost does not depend on the size of the
+    // window.
+    template<typename T>
+    vec<2,meta::rtype_t<T>> boxcar_min(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        return impl::astro_impl::boxcar_extremum<impl::astro_impl::boxcar_min_t>(
+            img, hsize, nthread);
+    }
+
+    // Maximum of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at
+    // the edges of the image), ignoring NaN values. Cost does not depend on the size of the
+    // window.
+    template<typename T>
+    vec<2,meta::rtype_t<T>> boxcar_max(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        return impl::astro_impl::boxcar_extremum<impl::astro_impl::boxcar_max_t>(
+            img, hsize, nthread);
+    }
+
+    // Percentile 'p' (between 0 and 1) of the pixels in a square window of size 2*hsize+1
+    // around each pixel (clipped at the edges of the image), ignoring NaN values. Same
+    // definition as percentile(). The cost grows linearly with the size of the window.
+    template<typename T>
+    vec<2,meta::rtype_t<T>> boxcar_percentile(const vec<2,T>& img, uint_t hsize, double p,
+        uint_t nthread = 1) {
+
+        const uint_t nx = img.dims[0], ny = img.dims[1];
+
+        // Sort non-NaN pixels (including infinities, as percentile() does) and give them a rank
+        vec1u rank = replicate(npos, img.size());
+        vec1u ids; ids.reserve(img.size());
+        for (uint_t i : range(img)) {
+            if (!is_nan(img.safe[i])) ids.push_back(i);
+        }
+
+        std::sort(ids.begin(), ids.end(), [&img](uint_t i, uint_t j) {
+            return img.safe[i] < img.safe[j];
+        });
+
+        for (uint_t i : range(ids)) {
+            rank.safe[ids.safe[i]] = i;
+        }
+
+        vec<2,meta::rtype_t<T>> res(img.dims);
+
+        // Slide the window down each column
+        impl::astro_impl::for_each_band(ny, nthread, [&](uint_t y0, uint_t y1) {
+            impl::astro_impl::rank_set set(ids.size());
+
+            for (uint_t y = y0; y < y1; ++y) {
+                const uint_t ya = (y >= hsize ? y - hsize : 0);
+                const uint_t yb = std::min(ny, y + hsize + 1);
+
+                uint_t n = 0;
+                auto add_row = [&](uint_t x) {
+                    const uint_t* r = rank.raw_data() + x*ny;
+                    for (uint_t ty = ya; ty < yb; ++ty) {
+                        if (r[ty] != npos) {
+                            set.insert(r[ty]);
+                            ++n;
+                        }
+                    }
+                };
+
+                auto remove_row = [&](uint_t x) {
+                    const uint_t* r = rank.raw_data() + x*ny;
+                    for (uint_t ty = ya; ty < yb; ++ty) {
+                        if (r[ty] != npos) {
+                            set.erase(r[ty]);
+                            --n;
+                        }
+                    }
+                };
+
+                for (uint_t x = 0; x < std::min(hsize, nx); ++x) {
+                    add_row(x);
+                }
+
+                for (uint_t x = 0; x < nx; ++x) {
+                    if (x + hsize < nx) add_row(x + hsize);
+
+                    if (n == 0) {
+                        res.safe(x,y) = std::numeric_limits<meta::rtype_t<T>>::quiet_NaN();
+                    } else {
+                        uint_t k = clamp(n*p, 0u, n-1);
+                        res.safe(x,y) = img.safe[ids.safe[set.select(k)]];
+                    }
+
+                    if (x >= hsize) remove_row(x - hsize);
+                }
+
+                // Clear the window for the next column
+                for (uint_t x = (nx > hsize ? nx - hsize : 0); x < nx; ++x) {
+                    remove_row(x);
+                }
+            }
+        });
+
+        return res;
+    }
+
+    // Median of the pixels in a square window of size 2*hsize+1 around each pixel (clipped at
+    // the edges of the image), ignoring NaN values. Same definition as median(). The cost grows
+    // linearly with the size of the window.
+    template<typename T>
+    vec<2,meta::rtype_t<T>> boxcar_median(const vec<2,T>& img, uint_t hsize, uint_t nthread = 1) {
+        return boxcar_percentile(img, hsize, 0.5, nthread);
+    }
 
     inline vec2b mask_inflate(vec2b m, uint_t d) {
         if (d != 0) {
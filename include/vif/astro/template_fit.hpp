@@ -5,10 +5,32 @@
 #include "vif/math/mpfit.hpp"
 
 namespace vif {
+namespace impl {
+    namespace astro_impl {
+        // Check if all the SEDs of a library are sampled on the same wavelength grid
+        template<typename T>
+        bool same_lam_grid(const vec<2,T>& lam) {
+            if (lam.empty()) return false;
+
+            for (uint_t s : range(1, lam.dims[0]))
+            for (uint_t l : range(lam.dims[1])) {
+                if (lam.safe(s,l) != lam.safe(0,l)) return false;
+            }
+
+            return true;
+        }
+    }
+}
+
 namespace astro {
     // Convolve each SED with the response curve of the filters
     template<typename TLib, typename TFi>
     vec2d template_observed(const TLib& lib, const vec<1,TFi>& filters) {
+        if (impl::astro_impl::same_lam_grid(lib.lam)) {
+            // All SEDs share the same wavelength grid, precompute the filter integrals
+            return make_sed2flux_operator(filters, lib.lam.safe(0,_).concretise())(lib.sed);
+        }
+
         const uint_t nsed = lib.sed.dims[0];
         const uint_t nfilter = filters.size();
 
@@ -21,13 +43,20 @@ namespace astro {
     }
 
     template<typename TLib, typename TFi>
-    vec2d template_observed(TLib lib, double z, double d, const vec<1,TFi>& filters) {
+    vec2d template_observed(const TLib& lib, double z, double d, const vec<1,TFi>& filters) {
+        if (impl::astro_impl::same_lam_grid(lib.lam)) {
+            // All SEDs share the same wavelength grid, precompute the filter integrals including
+            // the conversion to the observed frame
+            return make_sed2flux_operator(filters, lib.lam.safe(0,_).concretise(), z, d)(lib.sed);
+        }
+
         // Move each SED to the observed frame
-        lib.sed = lsun2uJy(z, d, lib.lam, lib.sed);
-        lib.lam *= (1.0 + z);
+        TLib tlib = lib;
+        tlib.sed = lsun2uJy(z, d, tlib.lam, tlib.sed);
+        tlib.lam *= (1.0 + z);
 
         // Convolve each SED with the response curve of the filters
-        return template_observed(lib, filters);
+        return template_observed(tlib, filters);
     }
 
     template<typename TLib, typename TFi, typename TZ, typename TD>
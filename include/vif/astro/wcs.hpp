@@ -1,6 +1,7 @@
 #ifndef VIF_IO_ASTRO_WCS_HPP
 #define VIF_IO_ASTRO_WCS_HPP
 
+#include <unordered_set>
 #include "vif/core/error.hpp"
 #include "vif/utility/thread.hpp"
 #include "vif/io/fits.hpp"
@@ -35,26 +36,28 @@ namespace astro {
             hdr = "END" + std::string(77, ' ');
         }
 
+        fits::indexed_header ihdr(hdr);
+
         if (is_finite(params.pixel_scale)) {
-            if (!fits::setkey(hdr, "CDELT1", -params.pixel_scale/3600.0)) {
+            if (!fits::setkey(ihdr, "CDELT1", -params.pixel_scale/3600.0)) {
                 error("make_wcs_header: could not set keyword 'CDELT1' to '",
                     -params.pixel_scale, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "CDELT2", params.pixel_scale/3600.0)) {
+            if (!fits::setkey(ihdr, "CDELT2", params.pixel_scale/3600.0)) {
                 error("make_wcs_header: could not set keyword 'CDELT2' to '",
                     params.pixel_scale, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "CTYPE1", "'RA---TAN'")) {
+            if (!fits::setkey(ihdr, "CTYPE1", "'RA---TAN'")) {
                 error("make_wcs_header: could not set keyword 'CTYPE1' to 'RA---TAN'");
                 return false;
             }
-            if (!fits::setkey(hdr, "CTYPE2", "'DEC--TAN'")) {
+            if (!fits::setkey(ihdr, "CTYPE2", "'DEC--TAN'")) {
                 error("make_wcs_header: could not set keyword 'CTYPE2' to 'DEC--TAN'");
                 return false;
             }
-            if (!fits::setkey(hdr, "EQUINOX", 2000.0)) {
+            if (!fits::setkey(ihdr, "EQUINOX", 2000.0)) {
                 error("make_wcs_header: could not set keyword 'EQUINOX' to '",
                     2000.0, "'");
                 return false;
@@ -62,12 +65,12 @@ namespace astro {
         }
 
         if (is_finite(params.pixel_ref_x) && is_finite(params.pixel_ref_y)) {
-            if (!fits::setkey(hdr, "CRPIX1", params.pixel_ref_x)) {
+            if (!fits::setkey(ihdr, "CRPIX1", params.pixel_ref_x)) {
                 error("make_wcs_header: could not set keyword 'CRPIX1' to '",
                     params.pixel_ref_x, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "CRPIX2", params.pixel_ref_y)) {
+            if (!fits::setkey(ihdr, "CRPIX2", params.pixel_ref_y)) {
                 error("make_wcs_header: could not set keyword 'CRPIX2' to '",
                     params.pixel_ref_y, "'");
                 return false;
@@ -75,12 +78,12 @@ namespace astro {
         }
 
         if (is_finite(params.sky_ref_ra) && is_finite(params.sky_ref_dec)) {
-            if (!fits::setkey(hdr, "CRVAL1", params.sky_ref_ra)) {
+            if (!fits::setkey(ihdr, "CRVAL1", params.sky_ref_ra)) {
                 error("make_wcs_header: could not set keyword 'CRVAL1' to '",
                     params.sky_ref_ra, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "CRVAL2", params.sky_ref_dec)) {
+            if (!fits::setkey(ihdr, "CRVAL2", params.sky_ref_dec)) {
                 error("make_wcs_header: could not set keyword 'CRVAL2' to '",
                     params.sky_ref_dec, "'");
                 return false;
@@ -88,36 +91,38 @@ namespace astro {
         }
 
         if (params.dims_x != npos && params.dims_y != npos) {
-            if (!fits::setkey(hdr, "NAXES", 2u)) {
+            if (!fits::setkey(ihdr, "NAXES", 2u)) {
                 error("make_wcs_header: could not set keyword 'NAXES' to '", 2u, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "NAXIS1", params.dims_x)) {
+            if (!fits::setkey(ihdr, "NAXIS1", params.dims_x)) {
                 error("make_wcs_header: could not set keyword 'NAXIS1' to '",
                     params.dims_x, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "NAXIS2", params.dims_y)) {
+            if (!fits::setkey(ihdr, "NAXIS2", params.dims_y)) {
                 error("make_wcs_header: could not set keyword 'NAXIS2' to '",
                     params.dims_y, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "META_0", 2u)) {
+            if (!fits::setkey(ihdr, "META_0", 2u)) {
                 error("make_wcs_header: could not set keyword 'META_0' to '", 2u, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "META_1", params.dims_x)) {
+            if (!fits::setkey(ihdr, "META_1", params.dims_x)) {
                 error("make_wcs_header: could not set keyword 'META_1' to '",
                     params.dims_x, "'");
                 return false;
             }
-            if (!fits::setkey(hdr, "META_2", params.dims_y)) {
+            if (!fits::setkey(ihdr, "META_2", params.dims_y)) {
                 error("make_wcs_header: could not set keyword 'META_2' to '",
                     params.dims_y, "'");
                 return false;
             }
         }
 
+        hdr = ihdr.str();
+
         return true;
     }
 
@@ -209,49 +214,95 @@ namespace astro {
         return make_wcs_header(params, hdr);
     }
 
-    inline fits::header filter_wcs(const fits::header& hdr) {
-        // List of keywords taken from 'cphead' (WCSTools)
-        vec1s keywords = {"RA", "DEC", "EPOCH", "EQUINOX", "RADECSYS", "SECPIX", "IMWCS",
+    // Keep only the astrometry keywords of a header
+    inline fits::header filter_wcs(const fits::indexed_header& hdr) {
+        // List of keyword prefixes taken from 'cphead' (WCSTools)
+        static const std::unordered_set<std::string> keywords = {
+            "RA", "DEC", "EPOCH", "EQUINOX", "RADECSYS", "SECPIX", "IMWCS",
             "CD1_1", "CD1_2", "CD2_1", "CD2_2", "PC1_1", "PC1_2", "PC2_1", "PC2_2",
             "PC001001", "PC001002", "PC002001", "PC002002", "LATPOLE", "LONPOLE",
-            "SECPIX", "CTYPE", "CRVAL", "CDELT", "CRPIX", "CROTA",
-            "CUNIT", "CO1_", "CO2_", "PROJP", "PV1_", "PV2_", "END"};
-
-        vec1s okeys = cut(hdr, 80);
-        vec1s nkeys;
-        for (auto& k : okeys) {
-            for (auto& wk : keywords) {
-                if (begins_with(k, wk)) {
-                    nkeys.push_back(k);
+            "CTYPE", "CRVAL", "CDELT", "CRPIX", "CROTA",
+            "CUNIT", "CO1_", "CO2_", "PROJP", "PV1_", "PV2_"};
+
+        fits::header nhdr;
+        for (uint_t i : range(hdr.size())) {
+            // Check all the prefixes of the keyword (at most 8 characters)
+            const std::string& card = hdr.card(i);
+            for (uint_t l = 2; l <= 8; ++l) {
+                if (keywords.find(card.substr(0, l)) != keywords.end()) {
+                    nhdr += card;
+                    break;
                 }
             }
         }
 
-        return collapse(nkeys);
+        return nhdr + "END" + std::string(77, ' ');
+    }
+
+    inline fits::header filter_wcs(const fits::header& hdr) {
+        return filter_wcs(fits::indexed_header(hdr));
     }
 }
 
 namespace impl {
 namespace wcs_impl {
-    inline void cure_header(fits::header& hdr) {
-        auto keys = fits::parse_header(hdr);
+    // Check if a keyword matches 'prefix' followed by a number
+    inline bool keyword_is_numbered(const std::string& key, const std::string& prefix) {
+        if (key.size() <= prefix.size() || !begins_with(key, prefix)) return false;
+        for (uint_t i : range(prefix.size(), key.size())) {
+            if (!std::isdigit(static_cast<unsigned char>(key[i]))) return false;
+        }
+
+        return true;
+    }
+
+    // Check if a keyword is a SIP distortion coefficient: [AB]P?_([0-9]+_[0-9]+|ORDER)
+    inline bool keyword_is_sip(const std::string& key) {
+        if (key.size() < 3 || (key[0] != 'A' && key[0] != 'B')) return false;
+        uint_t p = (key[1] == 'P' ? 2 : 1);
+        if (key.size() <= p+1 || key[p] != '_') return false;
+
+        std::string rest = key.substr(p+1);
+        if (rest == "ORDER") return true;
 
+        auto u = rest.find('_');
+        if (u == rest.npos || u == 0 || u == rest.size()-1) return false;
+        for (uint_t i : range(rest)) {
+            if (i != u && !std::isdigit(static_cast<unsigned char>(rest[i]))) return false;
+        }
+
+        return true;
+    }
+
+    // Check if a keyword belongs to a lookup distortion:
+    // (D[PQ]|D2IM|(C[PQ]|D2IM)(ERR|DIS|EXT))[0-9]+
+    inline bool keyword_is_lookup_distortion(const std::string& key) {
+        for (const char* p : {"DP", "DQ", "D2IM", "CPERR", "CPDIS", "CPEXT", "CQERR", "CQDIS",
+            "CQEXT", "D2IMERR", "D2IMDIS", "D2IMEXT"}) {
+            if (keyword_is_numbered(key, p)) return true;
+        }
+
+        return false;
+    }
+
+    inline void cure_header(fits::indexed_header& hdr) {
         bool cpdis_err = false;
         bool sipdis_err = false;
 
-        vec1b keep = replicate(true, keys.size());
-        for (uint_t i : range(keys)) {
-            auto& k = keys[i];
+        for (uint_t i : range(hdr.size())) {
+            const auto& k = hdr.key(i);
+            if (k.novalue) continue;
 
-            if (regex_match(k.key, "^CUNIT[0-9]+$")) {
+            if (keyword_is_numbered(k.key, "CUNIT")) {
                 // Fix non-standard units
                 std::string v = trim(k.value, "' ");
                 if (v == "micron" || v == "microns") {
-                    k.value = "'um'";
+                    hdr.set_raw_value(k.key, "'um'");
                 } else if (v == "degree" || v == "degrees") {
-                    k.value = "'deg'";
+                    hdr.set_raw_value(k.key, "'deg'");
                 }
-            } else if (regex_match(k.key, "^C[PQ]DIS[0-9]+$") && regex_match(k.value, "Lookup")) {
+            } else if ((keyword_is_numbered(k.key, "CPDIS") || keyword_is_numbered(k.key, "CQDIS")) &&
+                k.value.find("Lookup") != k.value.npos) {
                 // Identify use of lookup distortion which is not supported by WCSLIB right now
                 if (!cpdis_err) {
                     warning("this header contains one or more CPDIS keyword with value "
@@ -259,7 +310,7 @@ namespace wcs_impl {
                     warning("the keywords will be removed and distortion will be ignored");
                     cpdis_err = true;
                 }
-            } else if (regex_match(k.key, "^[AB]P?_([0-9]+_[0-9]+|ORDER)$")) {
+            } else if (keyword_is_sip(k.key)) {
                 // Identify use of SIP distortion with A and B matrices which gives incorrect results
                 if (!sipdis_err) {
                     warning("this header contains one or more SIP distortion keyword "
@@ -270,27 +321,18 @@ namespace wcs_impl {
             }
         }
 
-        if (cpdis_err) {
-            for (uint_t i : range(keys)) {
-                auto& k = keys[i];
-
-                if (regex_match(k.key, "^(D[PQ]|D2IM|(C[PQ]|D2IM)(ERR|DIS|EXT))[0-9]+$")) {
-                    keep[i] = false;
-                }
-            }
-        }
-
-        if (sipdis_err) {
-            for (uint_t i : range(keys)) {
-                auto& k = keys[i];
-
-                if (regex_match(k.key, "^[AB]P?_([0-9]+_[0-9]+|ORDER)$")) {
-                    keep[i] = false;
-                }
-            }
+        if (cpdis_err || sipdis_err) {
+            hdr.remove_if([&](uint_t, const fits::header_keyword& k) {
+                return !k.novalue && ((cpdis_err && keyword_is_lookup_distortion(k.key)) ||
+                    (sipdis_err && keyword_is_sip(k.key)));
+            });
         }
+    }
 
-        hdr = fits::serialize_header(keys[where(keep)]);
+    inline void cure_header(fits::header& hdr) {
+        fits::indexed_header ihdr(hdr);
+        cure_header(ihdr);
+        hdr = ihdr.str();
     }
 }
 }
@@ -369,9 +411,12 @@ namespace astro {
             type = replicate(axis_type::unknown, naxis);
         }
 
-        explicit wcs(fits::header hdr) {
+        explicit wcs(const fits::header& hdr) : wcs(fits::indexed_header(hdr)) {}
+
+        explicit wcs(fits::indexed_header ihdr) {
             // Cure header for ingestion by WCSlib
-            impl::wcs_impl::cure_header(hdr);
+            impl::wcs_impl::cure_header(ihdr);
+            fits::header hdr = ihdr.str();
 
             // Feed the header to WCSLib to extract the astrometric parameters
             int nreject = 0, status = 0;
@@ -419,7 +464,7 @@ namespace astro {
             dims.resize(naxis);
             for (uint_t i : range(dims)) {
                 uint_t dim = npos;
-                if (fits::getkey(hdr, "NAXIS"+to_string(i+1), dim)) {
+                if (fits::getkey(ihdr, "NAXIS"+to_string(i+1), dim)) {
                     dims[naxis-1-i] = dim;
                 }
             }
@@ -646,6 +691,15 @@ namespace astro {
         return astro::wcs(hdr);
     }
 
+    template<typename Dummy = void>
+    astro::wcs extast(const fits::indexed_header& hdr) {
+#ifdef NO_WCSLIB
+        static_assert(!std::is_same<Dummy,Dummy>::value, "WCS support is disabled, "
+            "please enable the WCSLib library to use this function");
+#endif
+        return astro::wcs(hdr);
+    }
+
 }
 
 namespace impl {
@@ -862,16 +916,16 @@ namespace astro {
             return get_pixel_size(sects[0], aspix);
         } else {
             fits::input_image iimg(file);
-            fits::header hdr;
+            fits::indexed_header hdr;
             for (uint_t i : range(iimg.hdu_count())) {
                 iimg.reach_hdu(i);
                 if (iimg.axis_count() != 0) {
-                    hdr = iimg.read_header();
+                    hdr = fits::indexed_header(iimg.read_header());
                     break;
                 }
             }
 
-            auto wcs = astro::wcs(hdr);
+            auto wcs = astro::wcs(std::move(hdr));
             if (!get_pixel_size(wcs, aspix)) {
                 warning("could not extract WCS information");
                 note("parsing '", file, "'");
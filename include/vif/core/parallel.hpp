@@ -0,0 +1,82 @@
+#ifndef VIF_CORE_PARALLEL_HPP
+#define VIF_CORE_PARALLEL_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include "vif/core/typedefs.hpp"
+
+namespace vif {
+namespace impl {
+    // Call f(i,t) for each i in [0,n) from 'nthread' threads (including the calling thread),
+    // where 't' in [0,nthread) identifies the thread making the call (e.g., to select a
+    // workspace). Indices are handed out in increasing order, as threads become available.
+    // If a call throws, the indices that are not yet started are skipped, all threads are
+    // joined, and the exception thrown for the lowest index is rethrown in the calling thread,
+    // so that the error reported does not depend on thread scheduling.
+    template<typename F>
+    void parallel_for_each(uint_t n, uint_t nthread, F&& f) {
+        nthread = std::max(uint_t(1), std::min(nthread, n));
+        if (nthread == 1) {
+            for (uint_t i = 0; i < n; ++i) {
+                f(i, uint_t(0));
+            }
+
+            return;
+        }
+
+        std::atomic<uint_t> next(0);
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        uint_t ierror = n;
+
+        auto worker = [&](uint_t t) {
+            uint_t i;
+            while ((i = next++) < n) {
+                try {
+                    f(i, t);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (i < ierror) {
+                        ierror = i;
+                        error = std::current_exception();
+                    }
+
+                    next = n;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(nthread-1);
+        try {
+            for (uint_t t = 1; t < nthread; ++t) {
+                threads.emplace_back(worker, t);
+            }
+        } catch (...) {
+            // Could not start a thread, stop the others before reporting the error
+            next = n;
+            for (auto& t : threads) {
+                t.join();
+            }
+
+            throw;
+        }
+
+        worker(0);
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+}
+
+#endif
@@ -8,8 +8,19 @@
 #include <array>
 #include <typeinfo>
 #include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
 #include <limits>
 #include <typeinfo>
+#include <clocale>
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
 #include "vif/core/vec.hpp"
 #include "vif/core/range.hpp"
 #include "vif/core/meta.hpp"
@@ -131,13 +142,151 @@ namespace vif {
         }
     }
 
+namespace impl {
+namespace string_conversion_impl {
+    // Switch the calling thread to the "C" locale for the lifetime of this object, so that
+    // the C library functions (snprintf, strtod, ...) always use '.' as decimal separator.
+    // uselocale() only affects the current thread, and is cheap enough to be called for
+    // each conversion.
+    class c_locale_guard {
+    public :
+        c_locale_guard() : old_(uselocale(c_locale_())) {}
+        ~c_locale_guard() {
+            uselocale(old_);
+        }
+
+        c_locale_guard(const c_locale_guard&) = delete;
+        c_locale_guard& operator=(const c_locale_guard&) = delete;
+
+    private :
+        static locale_t c_locale_() {
+            static locale_t loc = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+            return loc;
+        }
+
+        locale_t old_;
+    };
+
     template<typename T>
-    std::string to_string(const T& t) {
+    struct format_kind : std::integral_constant<int,
+        std::is_same<T,bool>::value ? 1 :
+        std::is_same<T,char>::value || std::is_same<T,signed char>::value ||
+        std::is_same<T,unsigned char>::value ? 0 :
+        std::is_integral<T>::value ? 2 :
+        std::is_same<T,float>::value || std::is_same<T,double>::value ? 3 : 0> {};
+
+    // Format an integer backward from the end of a buffer (which must be large enough to
+    // hold all the digits and the sign). Returns a pointer to the first character.
+    template<typename T>
+    char* format_integer(char* e, T v) {
+        using U = typename std::make_unsigned<T>::type;
+
+        bool neg = v < 0;
+        U u = (neg ? U(0) - U(v) : U(v));
+
+        char* p = e;
+        do {
+            *--p = '0' + char(u % 10);
+            u /= 10;
+        } while (u != 0);
+
+        if (neg) *--p = '-';
+
+        return p;
+    }
+
+    // Format a floating point number with the given printf() conversion ('g', 'e' or 'f')
+    // and precision, as std::ostream does in the "C" locale. Returns the number of characters
+    // of the full output, which is truncated if larger than the buffer (like snprintf).
+    inline std::size_t format_float(char* buffer, std::size_t n, double v, char conv, int prec) {
+        char fmt[] = "%.*g";
+        fmt[3] = conv;
+        c_locale_guard cloc;
+        return std::snprintf(buffer, n, fmt, prec, v);
+    }
+
+    inline std::string format_float_string(double v, char conv, int prec) {
+        char buffer[64];
+        std::size_t n = format_float(buffer, sizeof(buffer), v, conv, prec);
+        if (n < sizeof(buffer)) {
+            return std::string(buffer, n);
+        }
+
+        std::string s(n+1, '\0');
+        format_float(&s[0], n+1, v, conv, prec);
+        s.resize(n);
+        return s;
+    }
+
+    // printf() conversion equivalent to each format tag
+    inline void float_format(const format_scientific_t&, char& conv, int& prec) {
+        conv = 'e'; prec = 6;
+    }
+
+    inline void float_format(const format_fixed_t&, char& conv, int& prec) {
+        conv = 'f'; prec = 6;
+    }
+
+    inline void float_format(const format_precision_t& f, char& conv, int& prec) {
+        conv = 'g'; prec = f.pre;
+    }
+
+    template<typename T>
+    std::string to_string_(const T& t, std::integral_constant<int,0>) {
         std::ostringstream ss;
         ss << t;
         return ss.str();
     }
 
+    inline std::string to_string_(bool t, std::integral_constant<int,1>) {
+        return t ? "1" : "0";
+    }
+
+    template<typename T>
+    std::string to_string_(T t, std::integral_constant<int,2>) {
+        char buffer[32];
+        char* e = buffer + sizeof(buffer);
+        return std::string(format_integer(e, t), e);
+    }
+
+    template<typename T>
+    std::string to_string_(T t, std::integral_constant<int,3>) {
+        // Default std::ostream format
+        return format_float_string(t, 'g', 6);
+    }
+
+    template<typename F, typename T>
+    std::string to_string_fmt_(const format_t<F,T>& t, std::integral_constant<int,0>) {
+        return to_string_(t, std::integral_constant<int,0>{});
+    }
+
+    template<typename F, typename T, int K>
+    std::string to_string_fmt_(const format_t<F,T>& t, std::integral_constant<int,K>) {
+        // Format has no effect on these types
+        return to_string_(t.obj, std::integral_constant<int,K>{});
+    }
+
+    template<typename F, typename T>
+    std::string to_string_fmt_(const format_t<F,T>& t, std::integral_constant<int,3>) {
+        char conv; int prec;
+        float_format(t.fmt, conv, prec);
+        return format_float_string(t.obj, conv, prec);
+    }
+}
+}
+
+    template<typename T>
+    std::string to_string(const T& t) {
+        return impl::string_conversion_impl::to_string_(t,
+            impl::string_conversion_impl::format_kind<T>{});
+    }
+
+    template<typename F, typename T>
+    std::string to_string(const impl::format_t<F,T>& t) {
+        return impl::string_conversion_impl::to_string_fmt_(t,
+            impl::string_conversion_impl::format_kind<typename std::decay<T>::type>{});
+    }
+
     inline std::string to_string(const std::string& t) {
         return t;
     }
@@ -190,8 +339,10 @@ namespace impl {
     }
 }
 
+namespace impl {
+namespace string_conversion_impl {
     template<typename T>
-    bool from_string(const std::string& s, T& t) {
+    bool from_string_stream(const std::string& s, T& t) {
         std::istringstream ss(s);
         ss >> t;
 
@@ -205,6 +356,320 @@ namespace impl {
             return impl::from_string_fallback(s, t, std::is_floating_point<T>{});
         }
     }
+}
+}
+
+namespace impl {
+namespace string_conversion_impl {
+    // Same definition of white spaces as std::istream
+    inline bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    inline void trim_spaces(const char*& b, const char*& e) {
+        while (b != e && is_space(*b)) ++b;
+        while (e != b && is_space(*(e-1))) --e;
+    }
+
+    // Integer parsing, with the same behavior as std::istream, i.e., unsigned integers
+    // accept a minus sign and wrap around, and overflows are errors.
+    template<typename T>
+    bool parse_integer(const char* b, const char* e, T& t) {
+        using U = typename std::make_unsigned<T>::type;
+
+        trim_spaces(b, e);
+        if (b == e) return false;
+
+        bool neg = false;
+        if (*b == '+' || *b == '-') {
+            neg = (*b == '-');
+            ++b;
+            if (b == e) return false;
+        }
+
+        const U limit = (std::is_signed<T>::value ?
+            U(std::numeric_limits<T>::max()) + (neg ? 1 : 0) : std::numeric_limits<U>::max());
+
+        U v = 0;
+        for (; b != e; ++b) {
+            if (!is_digit(*b)) return false;
+            U d = *b - '0';
+            if (v > (limit - d)/10) return false;
+            v = v*10 + d;
+        }
+
+        if (neg) {
+            if (std::is_signed<T>::value && v == limit) {
+                t = std::numeric_limits<T>::min();
+            } else {
+                t = T(U(0) - v);
+            }
+        } else {
+            t = T(v);
+        }
+
+        return true;
+    }
+
+    inline bool parse_bool(const char* b, const char* e, bool& t) {
+        long v = 0;
+        if (!parse_integer(b, e, v) || (v != 0 && v != 1)) return false;
+        t = (v == 1);
+        return true;
+    }
+
+    template<typename T>
+    struct float_traits;
+
+    template<>
+    struct float_traits<float> {
+        static constexpr std::uint64_t max_exact_mantissa = std::uint64_t(1) << 24;
+        static constexpr int max_exact_exponent = 10;
+
+        static float power10(int e) {
+            static const float p[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f,
+                1e9f, 1e10f};
+            return p[e];
+        }
+
+        static float strto(const char* s, char** end) {
+            return std::strtof(s, end);
+        }
+    };
+
+    template<>
+    struct float_traits<double> {
+        static constexpr std::uint64_t max_exact_mantissa = std::uint64_t(1) << 53;
+        static constexpr int max_exact_exponent = 22;
+
+        static double power10(int e) {
+            static const double p[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            return p[e];
+        }
+
+        static double strto(const char* s, char** end) {
+            return std::strtod(s, end);
+        }
+    };
+
+    template<>
+    struct float_traits<long double> {
+        // Never use the fast path
+        static constexpr std::uint64_t max_exact_mantissa = 0;
+        static constexpr int max_exact_exponent = -1;
+
+        static long double power10(int) {
+            return 1.0;
+        }
+
+        static long double strto(const char* s, char** end) {
+            return std::strtold(s, end);
+        }
+    };
+
+    // Floating point parsing, with the same behavior as std::istream (plus the special values
+    // handled by from_string_fallback). Decimal numbers whose mantissa and power of ten can be
+    // exactly represented are converted directly (Clinger's fast path, which is exact),
+    // the others are converted by strtod() after the syntax has been validated.
+    template<typename T>
+    bool parse_float(const char* b, const char* e, T& t) {
+        trim_spaces(b, e);
+        const char* b0 = b;
+
+        bool neg = false;
+        if (b != e && (*b == '+' || *b == '-')) {
+            neg = (*b == '-');
+            ++b;
+        }
+
+        // Read mantissa, keeping up to 19 significant digits
+        std::uint64_t m = 0;
+        int nd = 0;
+        int exp10 = 0;
+        bool digits = false;
+        bool truncated = false;
+        const char* p = b;
+        for (; p != e && is_digit(*p); ++p) {
+            digits = true;
+            int d = *p - '0';
+            if (nd < 19) {
+                if (m != 0 || d != 0) {
+                    m = m*10 + d;
+                    ++nd;
+                }
+            } else {
+                ++exp10;
+                truncated = truncated || d != 0;
+            }
+        }
+
+        if (p != e && *p == '.') {
+            ++p;
+            for (; p != e && is_digit(*p); ++p) {
+                digits = true;
+                int d = *p - '0';
+                if (nd < 19) {
+                    if (m != 0 || d != 0) {
+                        m = m*10 + d;
+                        ++nd;
+                    }
+                    --exp10;
+                } else {
+                    truncated = truncated || d != 0;
+                }
+            }
+        }
+
+        if (!digits) {
+            // Not a number, try special strings (nan, inf, ...)
+            return impl::from_string_fallback(std::string(b0, e), t, std::true_type{});
+        }
+
+        // Read exponent
+        if (p != e && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool eneg = false;
+            if (p != e && (*p == '+' || *p == '-')) {
+                eneg = (*p == '-');
+                ++p;
+            }
+
+            if (p == e || !is_digit(*p)) return false;
+
+            int ev = 0;
+            for (; p != e && is_digit(*p); ++p) {
+                if (ev < 100000) {
+                    ev = ev*10 + (*p - '0');
+                }
+            }
+
+            exp10 += (eneg ? -ev : ev);
+        }
+
+        if (p != e) return false;
+
+        if (m == 0) {
+            t = (neg ? -T(0) : T(0));
+            return true;
+        }
+
+#if FLT_EVAL_METHOD == 0
+        using traits = float_traits<T>;
+        if (!truncated && m <= traits::max_exact_mantissa &&
+            exp10 >= -traits::max_exact_exponent && exp10 <= traits::max_exact_exponent) {
+            T v = T(m);
+            if (exp10 < 0) {
+                v /= traits::power10(-exp10);
+            } else {
+                v *= traits::power10(exp10);
+            }
+
+            t = (neg ? -v : v);
+            return true;
+        }
+#endif
+
+        // Slow path: needs a null-terminated string for strtod()
+        char buffer[128];
+        std::string sbuffer;
+        const char* str;
+        std::size_t n = e - b0;
+        if (n < sizeof(buffer)) {
+            std::copy(b0, e, buffer);
+            buffer[n] = '\0';
+            str = buffer;
+        } else {
+            sbuffer.assign(b0, e);
+            str = sbuffer.c_str();
+        }
+
+        char* end = nullptr;
+        errno = 0;
+        T v;
+        {
+            c_locale_guard cloc;
+            v = float_traits<T>::strto(str, &end);
+        }
+        if (end != str + n) return false;
+        if (errno == ERANGE && std::abs(v) == std::numeric_limits<T>::infinity()) return false;
+
+        t = v;
+        return true;
+    }
+
+    template<typename T>
+    struct parse_kind : std::integral_constant<int,
+        std::is_same<T,bool>::value ? 1 :
+        std::is_same<T,char>::value || std::is_same<T,signed char>::value ||
+        std::is_same<T,unsigned char>::value ? 0 :
+        std::is_integral<T>::value ? 2 :
+        std::is_floating_point<T>::value ? 3 : 0> {};
+
+    template<typename T>
+    bool parse(const char* b, const char* e, T& t, std::integral_constant<int,0>);
+
+    inline bool parse(const char* b, const char* e, bool& t, std::integral_constant<int,1>) {
+        return parse_bool(b, e, t);
+    }
+
+    template<typename T>
+    bool parse(const char* b, const char* e, T& t, std::integral_constant<int,2>) {
+        return parse_integer(b, e, t);
+    }
+
+    template<typename T>
+    bool parse(const char* b, const char* e, T& t, std::integral_constant<int,3>) {
+        return parse_float(b, e, t);
+    }
+}
+}
+
+    // Convert the string in the range [b,e) into a value. For numbers, this is much faster
+    // than going through a std::istringstream, and always uses the "C" locale (i.e., '.' as
+    // decimal separator) whatever the current global locale.
+    template<typename T>
+    bool from_string(const char* b, const char* e, T& t) {
+        return impl::string_conversion_impl::parse(b, e, t,
+            impl::string_conversion_impl::parse_kind<T>{});
+    }
+
+namespace impl {
+namespace string_conversion_impl {
+    template<typename T>
+    bool parse(const char* b, const char* e, T& t, std::integral_constant<int,0>) {
+        // Generic types: use the stream operator
+        return from_string_stream(std::string(b, e), t);
+    }
+
+    // Format a floating point number with the smallest number of significant digits that
+    // allows reading back the exact same value. Same return value as format_float().
+    template<typename T>
+    std::size_t format_float_exact(char* buffer, std::size_t n, T v) {
+        const int min_digits = std::numeric_limits<T>::digits10;
+        const int max_digits = std::numeric_limits<T>::max_digits10;
+
+        if (std::isfinite(v)) {
+            for (int p = min_digits; p < max_digits; ++p) {
+                std::size_t l = format_float(buffer, n, v, 'g', p);
+                T r;
+                if (l < n && parse_float(buffer, buffer + l, r) && r == v) return l;
+            }
+        }
+
+        return format_float(buffer, n, v, 'g', std::isfinite(v) ? max_digits : 6);
+    }
+}
+}
+
+    template<typename T>
+    bool from_string(const std::string& s, T& t) {
+        return from_string(s.data(), s.data() + s.size(), t);
+    }
 
     template<std::size_t Dim = 1, typename T = std::string, typename O,
     typename enable = typename std::enable_if<
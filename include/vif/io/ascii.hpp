@@ -4,10 +4,20 @@
 #include <fstream>
 #include <tuple>
 #include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
 #include "vif/math/base.hpp"
+#include "vif/io/filesystem.hpp"
 
 namespace vif {
 namespace ascii {
@@ -23,6 +33,8 @@ namespace ascii {
         uint_t skip_first = 0;
         std::string delim = " \t";
         bool delim_single = false;
+        uint_t nthread = 0;
+        bool cache = false;
 
         input_format() = default;
         input_format(bool sk, const std::string sp, uint_t sf, const std::string& d, bool ds) :
@@ -44,6 +56,7 @@ namespace ascii {
         std::string delim = " ";
         std::string header_chars = "# ";
         vec1s header;
+        bool full_precision = false;
 
         output_format() = default;
         output_format(bool aw, uint_t mw, const std::string& d) :
@@ -75,74 +88,167 @@ namespace impl {
     namespace ascii_impl {
         using placeholder_t = vif::impl::placeholder_t;
 
-        struct line_splitter_t {
-            std::string line;
-            uint_t pos = 0;
-
-            std::string delim = " \t";
-            bool delim_single = false;
+        // Read-only view of the content of a file, memory-mapped when possible
+        class mapped_file {
+            const char* data_ = nullptr;
+            std::size_t size_ = 0;
+            void* map_ = nullptr;
+            std::string buffer_;
+
+        public :
+            explicit mapped_file(const std::string& filename) {
+                int fd = ::open(filename.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    throw ascii::exception("cannot open file");
+                }
 
-            bool skip_word() {
-                if (delim_single) {
-                    if (pos == line.npos) return false;
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw ascii::exception("cannot open file");
+                }
 
-                    if (pos != 0) {
-                        pos += delim.size();
+                size_ = st.st_size;
+                if (size_ != 0 && S_ISREG(st.st_mode)) {
+                    void* m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (m != MAP_FAILED) {
+                        ::madvise(m, size_, MADV_SEQUENTIAL);
+                        map_ = m;
+                        data_ = static_cast<const char*>(m);
                     }
+                }
 
-                    uint_t p1 = line.find(delim, pos);
-                    if (p1 == line.npos) {
-                        pos = p1;
-                    } else {
-                        pos = p1 + delim.size();
+                ::close(fd);
+
+                if (!map_) {
+                    // Could not map the file (empty, pipe, ...), read it in memory instead
+                    std::ifstream in(filename, std::ios::binary);
+                    if (!in.is_open()) {
+                        throw ascii::exception("cannot open file");
                     }
 
-                    pos = p1;
-                } else {
-                    uint_t p0 = line.find_first_not_of(delim, pos);
-                    if (p0 == line.npos) return false;
+                    buffer_.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+                    data_ = buffer_.data();
+                    size_ = buffer_.size();
+                }
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
 
-                    pos = line.find_first_of(delim, p0);
+            ~mapped_file() {
+                if (map_) {
+                    ::munmap(map_, size_);
                 }
+            }
 
-                return true;
+            const char* begin() const {
+                return data_;
             }
 
-            bool next_word(std::string& sub) {
-                if (delim_single) {
-                    if (pos == line.npos) return false;
+            const char* end() const {
+                return data_ + size_;
+            }
 
-                    if (pos != 0) {
-                        pos += delim.size();
-                    }
+            std::size_t size() const {
+                return size_;
+            }
+        };
 
-                    uint_t p1 = line.find(delim, pos);
-                    if (p1 == line.npos) {
-                        sub = line.substr(pos);
-                        pos = p1;
-                    } else {
-                        sub = line.substr(pos, p1-pos);
-                        pos = p1 + delim.size();
-                    }
+        // Extract the next line from [pos,end), without the end-of-line characters.
+        // Returns false when there are no more lines.
+        inline bool next_line(const char*& pos, const char* end, const char*& lb, const char*& le) {
+            if (pos == end) return false;
 
-                    pos = p1;
-                } else {
-                    uint_t p0 = line.find_first_not_of(delim, pos);
-                    if (p0 == line.npos) return false;
+            lb = pos;
+            le = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            if (le) {
+                pos = le + 1;
+            } else {
+                le = end;
+                pos = end;
+            }
+
+            while (le != lb && *(le-1) == '\r') --le;
+
+            return true;
+        }
+
+        // Check if a line contains no data (empty or commented out)
+        inline bool is_skipped_line(const char* lb, const char* le, const ascii::input_format& opts) {
+            const char* p = lb;
+            while (p != le && (*p == ' ' || *p == '\t')) ++p;
+            if (p == le) return true;
+
+            if (opts.auto_skip) {
+                if (opts.skip_pattern.empty()) return p == lb;
+                return uint_t(le - p) >= opts.skip_pattern.size() &&
+                    std::equal(opts.skip_pattern.begin(), opts.skip_pattern.end(), p);
+            }
+
+            return false;
+        }
+
+        // Split a line into words, without copying the content of the line
+        struct line_splitter_t {
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            const char* pos = nullptr;
+            bool done = false;
 
-                    pos = line.find_first_of(delim, p0);
-                    if (pos == line.npos) {
-                        sub = line.substr(p0);
+            std::string delim = " \t";
+            bool delim_single = false;
+
+            void set_line(const char* b, const char* e) {
+                begin = b;
+                end = e;
+                pos = b;
+                done = false;
+            }
+
+            std::string line() const {
+                return std::string(begin, end);
+            }
+
+            bool is_delim(char c) const {
+                return delim.find(c) != delim.npos;
+            }
+
+            bool next_word(const char*& wb, const char*& we) {
+                if (delim_single) {
+                    if (done) return false;
+
+                    wb = pos;
+                    we = (delim.empty() ? end : std::search(pos, end, delim.begin(), delim.end()));
+                    if (we == end) {
+                        pos = end;
+                        done = true;
                     } else {
-                        sub = line.substr(p0, pos-p0);
+                        pos = we + delim.size();
                     }
+                } else {
+                    while (pos != end && is_delim(*pos)) ++pos;
+                    if (pos == end) return false;
+
+                    wb = pos;
+                    while (pos != end && !is_delim(*pos)) ++pos;
+                    we = pos;
                 }
 
                 return true;
             }
 
-            void reset() {
-                pos = 0;
+            bool next_word(std::string& sub) {
+                const char* wb; const char* we;
+                if (!next_word(wb, we)) return false;
+                sub.assign(wb, we);
+                return true;
+            }
+
+            bool skip_word() {
+                const char* wb; const char* we;
+                return next_word(wb, we);
             }
         };
 
@@ -170,6 +276,7 @@ namespace impl {
         template<typename T, typename ... Args>
         void read_table_resize_(uint_t n, vec<1,T>& v, Args& ... args) {
             v.resize(n);
+            if (v.data.capacity() > n + n/4) v.data.shrink_to_fit();
             read_table_resize_(n, args...);
         }
 
@@ -183,6 +290,7 @@ namespace impl {
         template<typename Type, typename ... VArgs>
         void read_table_resize_cols_(uint_t n, uint_t m, vec<2,Type>& v, VArgs&... args) {
             v.resize(n, m);
+            if (v.data.capacity() > v.size() + v.size()/4) v.data.shrink_to_fit();
             read_table_resize_cols_(n, m, args...);
         }
 
@@ -215,15 +323,16 @@ namespace impl {
 
         template<typename T>
         void read_value_(line_splitter_t& spl, uint_t i, uint_t j, T& v) {
-            std::string fallback;
-            if (!spl.next_word(fallback)) {
+            const char* wb; const char* we;
+            if (!spl.next_word(wb, we)) {
                 throw ascii::exception("cannot extract value from file, too few columns on line l."+
                     to_string(i+1));
             }
 
-            if (!from_string(fallback, v)) {
-                throw ascii::exception("cannot extract value '"+fallback+"' from file, wrong type for l."+
-                    to_string(i+1)+":"+to_string(j+1)+" (expected '"+pretty_type(T())+"'):\n"+spl.line);
+            if (!from_string(wb, we, v)) {
+                throw ascii::exception("cannot extract value '"+std::string(wb, we)+"' from file, "
+                    "wrong type for l."+to_string(i+1)+":"+to_string(j+1)+" (expected '"+
+                    pretty_type(T())+"'):\n"+spl.line());
             }
         }
 
@@ -304,6 +413,503 @@ namespace impl {
             read_value_(spl, i, j, v);
             read_table_(spl, i, ++j, args...);
         }
+
+        template<typename ... Args>
+        uint_t read_table_serial_(const mapped_file& file, const ascii::input_format& opts,
+            Args& ... args) {
+
+            line_splitter_t spl;
+            spl.delim = opts.delim;
+            spl.delim_single = opts.delim_single;
+
+            // Read data in a single pass, growing the vectors as needed
+            uint_t i = 0;
+            uint_t capacity = 0;
+            uint_t to_skip = opts.skip_first;
+            const char* pos = file.begin();
+            const char* lb; const char* le;
+            while (next_line(pos, file.end(), lb, le)) {
+                if (is_skipped_line(lb, le, opts)) {
+                    continue;
+                }
+
+                if (to_skip > 0) {
+                    --to_skip;
+                    continue;
+                }
+
+                if (i == capacity) {
+                    if (capacity == 0) {
+                        // Do not allocate more than one row before we know there is a second one,
+                        // so reading a single value into a scalar is allowed
+                        capacity = 1;
+                    } else if (capacity == 1) {
+                        // Guess the number of rows from the size of this one. A single short
+                        // line could lead to a gross overestimate, so the guess is capped and
+                        // larger tables are handled by the geometric growth below.
+                        const uint_t max_guess = 65536;
+                        capacity = std::max(uint_t(2), std::min(max_guess,
+                            uint_t((file.end() - lb)/(le - lb + 1)) + 1));
+                    } else {
+                        capacity *= 2;
+                    }
+
+                    read_table_resize_(capacity, args...);
+                }
+
+                spl.set_line(lb, le);
+                uint_t j = 0;
+                read_table_(spl, i, j, args...);
+                ++i;
+            }
+
+            // Trim vectors to the actual number of rows
+            read_table_resize_(i, args...);
+
+            return i;
+        }
+
+        // Number of byte ranges to split a file into for parallel reading (1: serial read)
+        inline uint_t parallel_chunk_count(std::size_t size, uint_t nthread) {
+            // Do not bother splitting chunks smaller than this
+            const std::size_t min_chunk_size = 1024*1024;
+
+            if (nthread <= 1) return 1;
+
+            // Use more chunks than threads to balance the load
+            return std::max(uint_t(1), std::min(uint_t(4*nthread), uint_t(size/min_chunk_size)));
+        }
+
+        struct file_chunk_t {
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            uint_t nrow = 0;   // number of data lines in this chunk
+            uint_t skip = 0;   // number of data lines to skip at the beginning (skip_first)
+            uint_t offset = 0; // index of the first row of this chunk in the output
+        };
+
+        // Call f(k) for k in [0,nchunk) from nthread threads. If several chunks fail, the
+        // error of the first chunk in the file is rethrown.
+        template<typename F>
+        void for_each_chunk_(uint_t nthread, uint_t nchunk, const F& f) {
+            parallel_for_each(nchunk, nthread, [&](uint_t k, uint_t) {
+                f(k);
+            });
+        }
+
+        template<typename ... Args>
+        uint_t read_table_parallel_(const mapped_file& file, const ascii::input_format& opts,
+            uint_t nchunk, Args& ... args) {
+
+            // Split the file in line-aligned chunks
+            std::vector<file_chunk_t> chunks(nchunk);
+            const char* pos = file.begin();
+            for (uint_t k : range(nchunk)) {
+                chunks[k].begin = pos;
+                if (k == nchunk-1) {
+                    pos = file.end();
+                } else {
+                    const char* p = std::max(pos, file.begin() + file.size()*(k+1)/nchunk);
+                    p = static_cast<const char*>(std::memchr(p, '\n', file.end() - p));
+                    pos = (p ? p + 1 : file.end());
+                }
+
+                chunks[k].end = pos;
+            }
+
+            uint_t nthread = std::min(opts.nthread, nchunk);
+
+            // First pass: count data lines in each chunk
+            for_each_chunk_(nthread, nchunk, [&](uint_t k) {
+                file_chunk_t& c = chunks[k];
+                const char* p = c.begin;
+                const char* lb; const char* le;
+                while (next_line(p, c.end, lb, le)) {
+                    if (!is_skipped_line(lb, le, opts)) ++c.nrow;
+                }
+            });
+
+            // Locate chunks in the output vectors
+            uint_t n = 0;
+            uint_t to_skip = opts.skip_first;
+            for (auto& c : chunks) {
+                c.skip = std::min(c.nrow, to_skip);
+                to_skip -= c.skip;
+                c.offset = n;
+                n += c.nrow - c.skip;
+            }
+
+            read_table_resize_(n, args...);
+
+            // Second pass: read data
+            for_each_chunk_(nthread, nchunk, [&](uint_t k) {
+                file_chunk_t& c = chunks[k];
+
+                line_splitter_t spl;
+                spl.delim = opts.delim;
+                spl.delim_single = opts.delim_single;
+
+                uint_t i = c.offset;
+                uint_t to_skip = c.skip;
+                const char* p = c.begin;
+                const char* lb; const char* le;
+                while (next_line(p, c.end, lb, le)) {
+                    if (is_skipped_line(lb, le, opts)) {
+                        continue;
+                    }
+
+                    if (to_skip > 0) {
+                        --to_skip;
+                        continue;
+                    }
+
+                    spl.set_line(lb, le);
+                    uint_t j = 0;
+                    read_table_(spl, i, j, args...);
+                    ++i;
+                }
+            });
+
+            return n;
+        }
+
+        // Binary cache of the columns read from an ASCII table. The file starts with a magic
+        // string and a key describing the source file, the reading options and the layout of
+        // the columns that were read, followed by the number of rows and the raw data of each
+        // column (strings are stored as an array of offsets followed by the characters).
+        // There is one cache file per set of reading options and column layout, identified by
+        // the hash of the corresponding part of the key
+        inline std::string cache_file_name(const std::string& name, const std::string& layout) {
+            return name+"."+hash(layout).substr(0, 8)+".vifcache";
+        }
+
+        static const char cache_magic[] = "VIFASCC1";
+
+        template<typename T>
+        struct is_cacheable : std::integral_constant<bool,
+            std::is_arithmetic<T>::value || std::is_same<T,std::string>::value> {};
+
+        template<typename T>
+        std::string cache_type_tag() {
+            if (std::is_same<T,std::string>::value) return "s";
+            if (!is_cacheable<T>::value) return "?";
+            return (std::is_floating_point<T>::value ? "f" :
+                std::is_signed<T>::value ? "i" : "u")+to_string(sizeof(T));
+        }
+
+        // Call the visitor on each argument of read_table()
+        template<typename F>
+        void cache_visit_cols_(F&, uint_t) {}
+
+        template<typename F, typename T, typename ... VArgs>
+        void cache_visit_cols_(F& f, uint_t m, vec<2,T>& v, VArgs& ... args);
+        template<typename F, typename ... VArgs>
+        void cache_visit_cols_(F& f, uint_t m, impl::placeholder_t, VArgs& ... args);
+
+        template<typename F, typename T, typename ... VArgs>
+        void cache_visit_cols_(F& f, uint_t m, vec<2,T>& v, VArgs& ... args) {
+            f.columns(m, v);
+            cache_visit_cols_(f, m, args...);
+        }
+
+        template<typename F, typename ... VArgs>
+        void cache_visit_cols_(F& f, uint_t m, impl::placeholder_t, VArgs& ... args) {
+            f.skip(m);
+            cache_visit_cols_(f, m, args...);
+        }
+
+        template<typename F, typename U, typename ... VArgs, uint_t ... S>
+        void cache_visit_cols_i_(F& f, std::tuple<U,VArgs&...>& v, meta::seq_t<S...>) {
+            cache_visit_cols_(f, std::get<0>(v), std::get<S>(v)...);
+        }
+
+        template<typename F>
+        void cache_visit_(F&) {}
+
+        template<typename F, typename T, typename ... Args>
+        void cache_visit_(F& f, vec<1,T>& v, Args& ... args);
+        template<typename F, typename U, typename ... VArgs, typename ... Args>
+        void cache_visit_(F& f, std::tuple<U,VArgs&...> v, Args& ... args);
+        template<typename F, typename ... Args>
+        void cache_visit_(F& f, impl::placeholder_t, Args& ... args);
+        template<typename F, typename T, typename ... Args,
+            typename enable = typename std::enable_if<is_other<T>::value>::type>
+        void cache_visit_(F& f, T& v, Args& ... args);
+
+        template<typename F, typename T, typename ... Args>
+        void cache_visit_(F& f, vec<1,T>& v, Args& ... args) {
+            f.column(v);
+            cache_visit_(f, args...);
+        }
+
+        template<typename F, typename U, typename ... VArgs, typename ... Args>
+        void cache_visit_(F& f, std::tuple<U,VArgs&...> v, Args& ... args) {
+            cache_visit_cols_i_(f, v, typename meta::gen_seq<1, sizeof...(VArgs)>::type());
+            cache_visit_(f, args...);
+        }
+
+        template<typename F, typename ... Args>
+        void cache_visit_(F& f, impl::placeholder_t, Args& ... args) {
+            f.skip(1);
+            cache_visit_(f, args...);
+        }
+
+        template<typename F, typename T, typename ... Args, typename enable>
+        void cache_visit_(F& f, T& v, Args& ... args) {
+            f.scalar(v);
+            cache_visit_(f, args...);
+        }
+
+        // Builds the description of the column layout
+        struct cache_layout_t {
+            std::string layout;
+            bool cacheable = true;
+
+            template<typename T>
+            void add(const std::string& prefix) {
+                layout += prefix+cache_type_tag<T>()+";";
+                cacheable = cacheable && is_cacheable<T>::value;
+            }
+
+            template<typename T>
+            void column(vec<1,T>&) {
+                add<meta::dtype_t<T>>("c");
+            }
+
+            template<typename T>
+            void columns(uint_t m, vec<2,T>&) {
+                add<meta::dtype_t<T>>(to_string(m)+"x");
+            }
+
+            template<typename T>
+            void scalar(T&) {
+                add<T>("v");
+            }
+
+            void skip(uint_t m) {
+                layout += to_string(m)+"_;";
+            }
+        };
+
+        // Writes the columns to the cache file
+        struct cache_writer_t {
+            std::ofstream& out;
+            uint_t nrow = 0;
+
+            explicit cache_writer_t(std::ofstream& o) : out(o) {}
+
+            void write_uint(std::uint64_t v) {
+                out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+            }
+
+            template<typename T>
+            void write(const T* data, uint_t n, std::true_type) {
+                out.write(reinterpret_cast<const char*>(data), n*sizeof(T));
+            }
+
+            void write(const std::string* data, uint_t n, std::true_type) {
+                std::uint64_t offset = 0;
+                write_uint(offset);
+                for (uint_t i : range(n)) {
+                    offset += data[i].size();
+                    write_uint(offset);
+                }
+
+                for (uint_t i : range(n)) {
+                    out.write(data[i].data(), data[i].size());
+                }
+            }
+
+            template<typename T>
+            void write(const T*, uint_t, std::false_type) {}
+
+            template<typename T>
+            void column(vec<1,T>& v) {
+                write(v.data.data(), v.size(), is_cacheable<meta::dtype_t<T>>{});
+            }
+
+            template<typename T>
+            void columns(uint_t, vec<2,T>& v) {
+                write(v.data.data(), v.size(), is_cacheable<meta::dtype_t<T>>{});
+            }
+
+            template<typename T>
+            void scalar(T& v) {
+                write(&v, nrow, is_cacheable<T>{});
+            }
+
+            void skip(uint_t) {}
+        };
+
+        // Reads the columns from the cache file
+        struct cache_reader_t {
+            const char* pos = nullptr;
+            const char* end = nullptr;
+            uint_t nrow = 0;
+            bool good = true;
+
+            bool read_uint(std::uint64_t& v) {
+                if (uint_t(end - pos) < sizeof(v)) return false;
+                std::memcpy(&v, pos, sizeof(v));
+                pos += sizeof(v);
+                return true;
+            }
+
+            template<typename T>
+            bool read(T* data, uint_t n, std::true_type) {
+                if (uint_t(end - pos)/sizeof(T) < n) return false;
+                std::memcpy(data, pos, n*sizeof(T));
+                pos += n*sizeof(T);
+                return true;
+            }
+
+            bool read(std::string* data, uint_t n, std::true_type) {
+                if (uint_t(end - pos)/sizeof(std::uint64_t) < n+1) return false;
+                const char* offsets = pos;
+                const char* chars = pos + (n+1)*sizeof(std::uint64_t);
+
+                std::uint64_t o0, o1;
+                std::memcpy(&o0, offsets, sizeof(o0));
+                for (uint_t i : range(n)) {
+                    std::memcpy(&o1, offsets + (i+1)*sizeof(o1), sizeof(o1));
+                    if (o1 < o0 || o1 > std::uint64_t(end - chars)) return false;
+                    data[i].assign(chars + o0, chars + o1);
+                    o0 = o1;
+                }
+
+                pos = chars + o0;
+                return true;
+            }
+
+            template<typename T>
+            bool read(T*, uint_t, std::false_type) {
+                return false;
+            }
+
+            template<typename T>
+            void column(vec<1,T>& v) {
+                if (!good) return;
+                v.resize(nrow);
+                good = read(v.data.data(), v.size(), is_cacheable<meta::dtype_t<T>>{});
+            }
+
+            template<typename T>
+            void columns(uint_t m, vec<2,T>& v) {
+                if (!good) return;
+                v.resize(nrow, m);
+                good = read(v.data.data(), v.size(), is_cacheable<meta::dtype_t<T>>{});
+            }
+
+            template<typename T>
+            void scalar(T& v) {
+                if (!good) return;
+                good = nrow <= 1 && read(&v, nrow, is_cacheable<T>{});
+            }
+
+            void skip(uint_t) {}
+        };
+
+        // Build the key identifying the content of the cache file. Returns false if the
+        // data cannot be cached.
+        template<typename ... Args>
+        bool read_table_cache_key_(const std::string& name, const ascii::input_format& opts,
+            std::string& cname, std::string& key, Args& ... args) {
+
+            cache_layout_t layout;
+            cache_visit_(layout, args...);
+            if (!layout.cacheable) return false;
+
+            struct stat st;
+            if (::stat(name.c_str(), &st) != 0) return false;
+
+        #ifdef __APPLE__
+            long mtime_ns = st.st_mtimespec.tv_nsec;
+        #else
+            long mtime_ns = st.st_mtim.tv_nsec;
+        #endif
+
+            std::string format = to_string(opts.auto_skip)+"|"+
+                to_string(opts.skip_pattern.size())+":"+opts.skip_pattern+"|"+
+                to_string(opts.skip_first)+"|"+to_string(opts.delim.size())+":"+opts.delim+"|"+
+                to_string(opts.delim_single)+"|"+layout.layout;
+
+            cname = cache_file_name(name, format);
+            key = to_string(st.st_size)+"|"+to_string(st.st_mtime)+"."+to_string(mtime_ns)+"|"+
+                format;
+
+            return true;
+        }
+
+        template<typename ... Args>
+        bool read_table_cache_(const std::string& cname, const std::string& key, Args& ... args) {
+            if (!file::exists(cname)) return false;
+
+            try {
+                mapped_file file(cname);
+
+                cache_reader_t reader;
+                reader.pos = file.begin();
+                reader.end = file.end();
+
+                const std::size_t nmagic = sizeof(cache_magic)-1;
+                if (file.size() < nmagic || !std::equal(cache_magic, cache_magic+nmagic, reader.pos)) {
+                    return false;
+                }
+
+                reader.pos += nmagic;
+
+                std::uint64_t nkey, nrow;
+                if (!reader.read_uint(nkey) || nkey != key.size() ||
+                    uint_t(reader.end - reader.pos) < nkey ||
+                    !std::equal(key.begin(), key.end(), reader.pos)) {
+                    return false;
+                }
+
+                reader.pos += nkey;
+
+                if (!reader.read_uint(nrow)) return false;
+                reader.nrow = nrow;
+
+                cache_visit_(reader, args...);
+
+                return reader.good && reader.pos == reader.end;
+            } catch (ascii::exception&) {
+                return false;
+            }
+        }
+
+        template<typename ... Args>
+        void write_table_cache_(const std::string& cname, const std::string& key, uint_t nrow,
+            Args& ... args) {
+            // Write to a temporary file first, so that other processes never see an
+            // incomplete cache file
+            std::string tname = cname+"."+to_string(::getpid())+".tmp";
+
+            {
+                std::ofstream out(tname, std::ios::binary);
+                if (!out.is_open()) return;
+
+                cache_writer_t writer(out);
+                writer.nrow = nrow;
+
+                out.write(cache_magic, sizeof(cache_magic)-1);
+                writer.write_uint(key.size());
+                out.write(key.data(), key.size());
+                writer.write_uint(writer.nrow);
+
+                cache_visit_(writer, args...);
+
+                if (!out) {
+                    out.close();
+                    file::remove(tname);
+                    return;
+                }
+            }
+
+            if (!file::move(tname, cname)) {
+                file::remove(tname);
+            }
+        }
     }
 }
 
@@ -324,54 +930,27 @@ namespace ascii {
         vif_check(file::exists(name), "cannot open file '"+name+"'");
 
         try {
-            impl::ascii_impl::line_splitter_t spl;
-            spl.delim = opts.delim;
-            spl.delim_single = opts.delim_single;
-
-            std::ifstream file(name);
-
-            // Count number of lines
-            uint_t n = 0; {
-                while (!file.eof()) {
-                    ascii::getline(file, spl.line);
-
-                    auto p = spl.line.find_first_not_of(" \t");
-                    if (p == spl.line.npos || (opts.auto_skip && spl.line.find(opts.skip_pattern) == p)) {
-                        continue;
-                    }
-
-                    ++n;
-                }
-
-                n -= opts.skip_first;
+            // Try reading from the cache first
+            std::string cname, key;
+            bool cache = opts.cache &&
+                impl::ascii_impl::read_table_cache_key_(name, opts, cname, key, args...);
+            if (cache && impl::ascii_impl::read_table_cache_(cname, key, args...)) {
+                return;
             }
 
-            // Resize all vectors
-            impl::ascii_impl::read_table_resize_(n, args...);
-
-            // Read data
-            file.clear();
-            file.seekg(0);
-
-            uint_t i = 0;
-            uint_t to_skip = opts.skip_first;
-            while (!file.eof()) {
-                spl.reset();
-                ascii::getline(file, spl.line);
-
-                auto p = spl.line.find_first_not_of(" \t");
-                if (p == spl.line.npos || (opts.auto_skip && spl.line.find(opts.skip_pattern) == p)) {
-                    continue;
-                }
+            uint_t nrow = 0; {
+                impl::ascii_impl::mapped_file file(name);
 
-                if (to_skip > 0) {
-                    --to_skip;
-                    continue;
+                uint_t nchunk = impl::ascii_impl::parallel_chunk_count(file.size(), opts.nthread);
+                if (nchunk > 1) {
+                    nrow = impl::ascii_impl::read_table_parallel_(file, opts, nchunk, args...);
+                } else {
+                    nrow = impl::ascii_impl::read_table_serial_(file, opts, args...);
                 }
+            }
 
-                uint_t j = 0;
-                impl::ascii_impl::read_table_(spl, i, j, args...);
-                ++i;
+            if (cache) {
+                impl::ascii_impl::write_table_cache_(cname, key, nrow, args...);
             }
         } catch (ascii::exception& e) {
             vif_check(false, std::string(e.what())+" (reading "+name+")");
@@ -388,27 +967,150 @@ namespace ascii {
 
 namespace impl {
     namespace ascii_impl {
+        // Text representation of a single value, formatted in a fixed buffer to avoid memory
+        // allocations. Produces the same output as to_string().
+        struct cell_t {
+            char buffer[64];
+            std::string fallback;
+            const char* data = buffer;
+            std::size_t size = 0;
+
+            // Write floating point numbers with enough digits to be read back exactly
+            bool full_precision = false;
+
+            void set_fallback(std::string s) {
+                fallback = std::move(s);
+                data = fallback.data();
+                size = fallback.size();
+            }
+        };
+
+        template<typename T>
+        struct cell_kind : std::integral_constant<int,
+            std::is_same<T,std::string>::value ? 4 :
+            string_conversion_impl::format_kind<T>::value> {};
+
+        inline void format_float_(cell_t& c, double v, char conv, int prec) {
+            std::size_t n = string_conversion_impl::format_float(
+                c.buffer, sizeof(c.buffer), v, conv, prec);
+            if (n < sizeof(c.buffer)) {
+                c.data = c.buffer;
+                c.size = n;
+            } else {
+                c.set_fallback(string_conversion_impl::format_float_string(v, conv, prec));
+            }
+        }
+
+        template<typename T>
+        void format_cell_(cell_t& c, const T& v, std::integral_constant<int,0>) {
+            c.set_fallback(to_string(v));
+        }
+
+        inline void format_cell_(cell_t& c, bool v, std::integral_constant<int,1>) {
+            c.buffer[0] = (v ? '1' : '0');
+            c.data = c.buffer;
+            c.size = 1;
+        }
+
+        template<typename T>
+        void format_cell_(cell_t& c, T v, std::integral_constant<int,2>) {
+            char* e = c.buffer + sizeof(c.buffer);
+            c.data = string_conversion_impl::format_integer(e, v);
+            c.size = e - c.data;
+        }
+
+        template<typename T>
+        void format_cell_(cell_t& c, T v, std::integral_constant<int,3>) {
+            if (c.full_precision) {
+                // Always fits in the buffer
+                c.data = c.buffer;
+                c.size = string_conversion_impl::format_float_exact(c.buffer, sizeof(c.buffer), v);
+            } else {
+                // Default std::ostream format
+                format_float_(c, v, 'g', 6);
+            }
+        }
+
+        inline void format_cell_(cell_t& c, const std::string& v, std::integral_constant<int,4>) {
+            c.data = v.data();
+            c.size = v.size();
+        }
+
+        template<typename T>
+        void format_cell_(cell_t& c, const T& v) {
+            format_cell_(c, v, cell_kind<T>{});
+        }
+
+        template<typename F, typename T>
+        void format_cell_fmt_(cell_t& c, const impl::format_t<F,T>& v, std::integral_constant<int,0>) {
+            // Unknown type (or nested formats), let the stream handle it
+            c.set_fallback(to_string(v));
+        }
+
+        template<typename F, typename T, int K>
+        void format_cell_fmt_(cell_t& c, const impl::format_t<F,T>& v, std::integral_constant<int,K>) {
+            // Format has no effect on these types
+            format_cell_(c, v.obj);
+        }
+
+        template<typename F, typename T>
+        void format_cell_fmt_(cell_t& c, const impl::format_t<F,T>& v, std::integral_constant<int,3>) {
+            char conv; int prec;
+            string_conversion_impl::float_format(v.fmt, conv, prec);
+            format_float_(c, v.obj, conv, prec);
+        }
+
+        template<typename F, typename T>
+        void format_cell_(cell_t& c, const impl::format_t<F,T>& v) {
+            format_cell_fmt_(c, v, cell_kind<typename std::decay<T>::type>{});
+        }
+
         struct file_writer {
             std::ofstream out;
+            std::string buffer;
             std::string delim;
 
             uint_t j = 0;
             vec1u cwidth;
+            cell_t cell;
 
             vec1s header;
             std::string header_chars;
 
+            // Size of the output buffer, written to the file when full
+            static const std::size_t buffer_size = 1024*1024;
+
+            file_writer() {
+                buffer.reserve(buffer_size + 4096);
+            }
+
+            void flush() {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+
             void end_line() {
-                out << '\n';
+                buffer += '\n';
                 j = 0;
+
+                if (buffer.size() >= buffer_size) {
+                    flush();
+                }
             }
 
-            void write(std::string s) {
+            template<typename T>
+            void write(const T& v) {
+                format_cell_(cell, v);
+
                 if (j != 0) {
-                    out << delim;
+                    buffer += delim;
+                }
+
+                if (cell.size < cwidth.safe[j]) {
+                    buffer.append(cwidth.safe[j] - cell.size, ' ');
                 }
 
-                out << align_right(std::move(s), cwidth[j]);
+                buffer.append(cell.data, cell.size);
 
                 ++j;
             }
@@ -416,7 +1118,7 @@ namespace impl {
             void write_header() {
                 if (header.empty()) return;
 
-                out << header_chars;
+                buffer += header_chars;
                 for (uint_t i : range(header)) {
                     uint_t hw = cwidth[i];
                     if (i == 0 && hw >= header_chars.size()) {
@@ -424,30 +1126,30 @@ namespace impl {
                     }
 
                     if (i != 0) {
-                        out << delim;
+                        buffer += delim;
                     }
 
-                    out << align_right(header[i], hw);
+                    buffer += align_right(header[i], hw);
                 }
 
-                out << "\n";
+                buffer += "\n";
             }
         };
 
-        struct cache_writer {
-            vec2s data;
-            uint_t k = 0;
-
+        // Computes the width of each column, without storing the formatted values
+        struct width_writer {
             uint_t j = 0;
             vec1u cwidth;
+            cell_t cell;
 
             void end_line() {
                 j = 0;
             }
 
-            void write(std::string s) {
-                data.safe[k] = align_right(std::move(s), cwidth[j]);
-                ++k;
+            template<typename T>
+            void write(const T& v) {
+                format_cell_(cell, v);
+                cwidth.safe[j] = std::max(cwidth.safe[j], uint_t(cell.size));
                 ++j;
             }
         };
@@ -546,8 +1248,8 @@ namespace impl {
         template<typename O, uint_t D, typename Type, typename ... Args>
         void write_table_do_(O&& out, uint_t i, const vec<D,Type>& v, const Args& ... args) {
             using DType = typename std::decay<decltype(v[0])>::type;
-            write_table_do_impl_(out, i, v, [](const DType& t) {
-                return to_string(t);
+            write_table_do_impl_(out, i, v, [](const DType& t) -> const DType& {
+                return t;
             }, args...);
         }
 
@@ -555,7 +1257,7 @@ namespace impl {
         void write_table_do_(O&& out, uint_t i, const F& v, const Args& ... args) {
             using DType = typename std::decay<decltype(v.obj[0])>::type;
             write_table_do_impl_(out, i, v.obj, [&](const DType& t) {
-                return to_string(v.forward(t));
+                return v.forward(t);
             }, args...);
         }
 
@@ -584,8 +1286,8 @@ namespace impl {
             const Args& ... args) {
 
             using DType = typename std::decay<decltype(v[0])>::type;
-            write_table_do_tuple_impl_(out, i, k, v, [](const DType& t) {
-                return to_string(t);
+            write_table_do_tuple_impl_(out, i, k, v, [](const DType& t) -> const DType& {
+                return t;
             }, args...);
         }
 
@@ -593,7 +1295,7 @@ namespace impl {
         void write_table_do_tuple_(O&& out, uint_t i, uint_t k, const F& v, const Args& ... args) {
             using DType = typename std::decay<decltype(v.obj[0])>::type;
             write_table_do_tuple_impl_(out, i, k, v.obj, [&](const DType& t) {
-                return to_string(v.forward(t));
+                return v.forward(t);
             }, args...);
         }
 
@@ -644,22 +1346,16 @@ namespace ascii {
         }
 
         file.cwidth = replicate(opts.min_width, c);
+        file.cell.full_precision = opts.full_precision;
 
         try {
             if (opts.auto_width) {
-                // Pre-serialize data to compute column width
-                impl::ascii_impl::cache_writer cache;
-                cache.data.resize(r, c);
-                cache.cwidth = file.cwidth;
+                // Format data a first time to compute column width
+                impl::ascii_impl::width_writer width;
+                width.cwidth = file.cwidth;
+                width.cell.full_precision = opts.full_precision;
                 for (uint_t i : range(r)) {
-                    impl::ascii_impl::write_table_do_(cache, i, args...);
-                }
-
-                // Compute width
-                for (uint_t j : range(c)) {
-                    for (auto& s : cache.data.stride(_,j)) {
-                        cache.cwidth.safe[j] = std::max(cache.cwidth.safe[j], s.size());
-                    }
+                    impl::ascii_impl::write_table_do_(width, i, args...);
                 }
 
                 // Increase width if header is larger
@@ -669,35 +1365,22 @@ namespace ascii {
                         if (j == 0) {
                             hs += opts.header_chars.size();
                         }
-                        cache.cwidth.safe[j] = std::max(cache.cwidth.safe[j], hs);
+                        width.cwidth.safe[j] = std::max(width.cwidth.safe[j], hs);
                     }
                 }
 
-                // Go back to writing to file
-                file.cwidth = cache.cwidth;
-
-                // Write header
-                file.write_header();
-
-                // Write pre-serialized data
-                for (uint_t i : range(r)) {
-                    for (uint_t j : range(c)) {
-                        file.write(cache.data.safe(i,j));
-                    }
-
-                    file.end_line();
-                }
-            } else {
-                // Write directly to file
+                file.cwidth = width.cwidth;
+            }
 
-                // Write header
-                file.write_header();
+            // Write header
+            file.write_header();
 
-                // Write data
-                for (uint_t i : range(r)) {
-                    impl::ascii_impl::write_table_do_(file, i, args...);
-                }
+            // Write data
+            for (uint_t i : range(r)) {
+                impl::ascii_impl::write_table_do_(file, i, args...);
             }
+
+            file.flush();
         } catch (ascii::exception& e) {
             vif_check(false, std::string(e.what())+" (writing "+filename+")");
         }
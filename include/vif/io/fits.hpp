@@ -9,6 +9,13 @@
 
 #ifndef NO_CFITSIO
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <functional>
+
 namespace vif {
 namespace fits {
     // Return the number of dimensions of a FITS file
@@ -201,6 +208,220 @@ namespace fits {
         fits::output_table(filename).write_columns(t);
     }
 
+}
+
+namespace impl {
+namespace fits_impl {
+    // Make a standalone copy of a column to be written asynchronously
+    template<typename T>
+    meta::decay_t<T> async_column_copy(T&& t) {
+        return std::forward<T>(t);
+    }
+
+    template<std::size_t Dim, typename Type>
+    vec<Dim,meta::rtype_t<Type*>> async_column_copy(const vec<Dim,Type*>& v) {
+        return v.concretise();
+    }
+
+    template<std::size_t Dim, typename Type>
+    vec<Dim,meta::rtype_t<Type*>> async_column_copy(vec<Dim,Type*>& v) {
+        return v.concretise();
+    }
+
+    template<std::size_t Dim, typename Type>
+    vec<Dim,meta::rtype_t<Type*>> async_column_copy(vec<Dim,Type*>&& v) {
+        return v.concretise();
+    }
+}
+}
+
+namespace fits {
+    // Check if cfitsio was compiled with the reentrant option, i.e., if it can safely be
+    // called from several threads at the same time
+    inline bool is_reentrant() {
+        return fits_is_reentrant() != 0;
+    }
+
+    // Write FITS files in a background thread, so that computations can continue while
+    // cfitsio is busy writing the data to disk. The data is moved (or copied) into the
+    // writer, so the caller is free to modify its own variables after the call.
+    // At most 'max_queued' files can be waiting to be written; beyond this, calls will block
+    // until a file is written, which bounds the memory used by pending data.
+    // Errors are reported through the std::future returned by each call, and by flush()
+    // which rethrows the first error that occurred since the previous call to flush().
+    // Call flush() before the writer is destroyed to handle these errors: the destructor
+    // cannot throw, so it only prints a warning for an error that was not reported.
+    // Note: cfitsio can only be used from several threads at the same time if it was
+    // compiled with the reentrant option. If it was not, the writer will by default
+    // write the files immediately in the calling thread ('background = false').
+    class async_writer {
+    public :
+        explicit async_writer(uint_t max_queued = 2, bool background = fits::is_reentrant()) :
+            max_queued_(std::max(max_queued, uint_t(1))), background_(background) {
+            if (background_) {
+                thread_ = std::thread(&async_writer::consume_loop_, this);
+            }
+        }
+
+        async_writer(const async_writer&) = delete;
+        async_writer& operator=(const async_writer&) = delete;
+
+        ~async_writer() {
+            {
+                std::unique_lock<std::mutex> l(mutex_);
+                stop_ = true;
+            }
+
+            cond_push_.notify_all();
+            if (thread_.joinable()) {
+                thread_.join();
+            }
+
+            if (error_) {
+                try {
+                    std::rethrow_exception(error_);
+                } catch (std::exception& e) {
+                    warning("async_writer: error not reported by flush(): ", e.what());
+                } catch (...) {
+                    warning("async_writer: error not reported by flush()");
+                }
+            }
+        }
+
+        // Queue a generic writing job
+        template<typename F>
+        std::future<void> push(F&& f) {
+            std::packaged_task<void()> task([this, f]() {
+                try {
+                    f();
+                } catch (...) {
+                    std::unique_lock<std::mutex> l(mutex_);
+                    if (!error_) {
+                        error_ = std::current_exception();
+                    }
+
+                    throw;
+                }
+            });
+
+            std::future<void> res = task.get_future();
+
+            if (!background_) {
+                // Not safe to use cfitsio from another thread, write now
+                task();
+                return res;
+            }
+
+            {
+                std::unique_lock<std::mutex> l(mutex_);
+                cond_pop_.wait(l, [this]() { return jobs_.size() < max_queued_; });
+                jobs_.push_back(std::move(task));
+            }
+
+            cond_push_.notify_one();
+
+            return res;
+        }
+
+        // Write an image in a FITS file
+        template<std::size_t Dim, typename Type, typename enable = typename std::enable_if<
+            !std::is_pointer<Type>::value>::type>
+        std::future<void> write(const std::string& filename, vec<Dim,Type> v,
+            fits::header hdr = "") {
+
+            auto data = std::make_shared<vec<Dim,Type>>(std::move(v));
+            auto header = std::make_shared<fits::header>(std::move(hdr));
+            return push([filename, data, header]() {
+                if (header->empty()) {
+                    fits::write(filename, *data);
+                } else {
+                    fits::write(filename, *data, *header);
+                }
+            });
+        }
+
+        template<std::size_t Dim, typename Type>
+        std::future<void> write(const std::string& filename, const vec<Dim,Type*>& v,
+            fits::header hdr = "") {
+            return write(filename, v.concretise(), std::move(hdr));
+        }
+
+        // Write several columns in a FITS file
+        template<typename ... Args>
+        std::future<void> write_table(const std::string& filename, const std::string& names,
+            Args&& ... args) {
+
+            auto job = std::bind([filename, names](const meta::decay_t<
+                decltype(vif::impl::fits_impl::async_column_copy(std::declval<Args>()))>& ... cols) {
+                fits::write_table(filename, names, cols...);
+            }, vif::impl::fits_impl::async_column_copy(std::forward<Args>(args))...);
+
+            auto pjob = std::make_shared<decltype(job)>(std::move(job));
+            return push([pjob]() { (*pjob)(); });
+        }
+
+        // Wait until all the files are written
+        void flush() {
+            std::unique_lock<std::mutex> l(mutex_);
+            cond_pop_.wait(l, [this]() { return jobs_.empty() && !busy_; });
+
+            if (error_) {
+                std::exception_ptr e = error_;
+                error_ = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+
+        uint_t pending() const {
+            std::unique_lock<std::mutex> l(mutex_);
+            return jobs_.size() + (busy_ ? 1 : 0);
+        }
+
+    private :
+
+        void consume_loop_() {
+            while (true) {
+                std::packaged_task<void()> task;
+
+                {
+                    std::unique_lock<std::mutex> l(mutex_);
+                    cond_push_.wait(l, [this]() { return stop_ || !jobs_.empty(); });
+                    if (jobs_.empty()) {
+                        // Stop requested and nothing left to write
+                        return;
+                    }
+
+                    task = std::move(jobs_.front());
+                    jobs_.pop_front();
+                    busy_ = true;
+                }
+
+                // Let a blocked producer push a new job while we write this one
+                cond_pop_.notify_all();
+
+                task();
+
+                {
+                    std::unique_lock<std::mutex> l(mutex_);
+                    busy_ = false;
+                }
+
+                cond_pop_.notify_all();
+            }
+        }
+
+        const uint_t max_queued_;
+        const bool background_;
+        std::deque<std::packaged_task<void()>> jobs_;
+        mutable std::mutex mutex_;
+        std::condition_variable cond_push_;
+        std::condition_variable cond_pop_;
+        std::exception_ptr error_;
+        bool busy_ = false;
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
     // Append an new column to an existing FITS table
     // Note: if the column already exsits in the file, it will be overwritten
 
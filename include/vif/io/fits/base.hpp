@@ -2,6 +2,7 @@
 #define VIF_IO_FITS_BASE_HPP
 
 #include <string>
+#include <unordered_map>
 #include "vif/core/vec.hpp"
 #include "vif/core/print.hpp"
 #include "vif/core/error.hpp"
@@ -1018,6 +1019,243 @@ namespace fits {
 
         return hdr;
     }
+
+    // Parsed header with a hash index on the keyword names, for O(1) getkey/setkey.
+    // Use this instead of the raw fits::header when reading or modifying many keywords
+    // from the same header. The original 80-character cards are kept for each entry, and
+    // str() only writes new cards for the keywords that were added or modified; all the
+    // other cards (including COMMENT and HISTORY) are left untouched.
+    class indexed_header {
+    public :
+        indexed_header() = default;
+
+        explicit indexed_header(const fits::header& hdr) {
+            const std::size_t ncard = (hdr.size() + 79)/80;
+            keys_.reserve(ncard);
+            cards_.reserve(ncard);
+
+            for (std::size_t i : range(ncard)) {
+                std::string card = hdr.substr(i*80, 80);
+                if (card.size() < 80) {
+                    card += std::string(80 - card.size(), ' ');
+                }
+
+                std::string name = trim(card.substr(0, 8));
+                if (name == "END") break;
+
+                if (name == "CONTINUE" && !keys_.empty() && !keys_.back().novalue) {
+                    // Long string value, spread over multiple cards
+                    cards_.back() += card;
+                    keys_.back() = parse_header(cards_.back())[0];
+                    continue;
+                }
+
+                header_keyword k;
+                if (is_value_card_(card, name)) {
+                    k = parse_header(card)[0];
+                } else {
+                    // Commentary card (COMMENT, HISTORY, blank keyword, ...)
+                    k.key = name;
+                    k.comment = trim(card.substr(8));
+                }
+
+                keys_.push_back(std::move(k));
+                cards_.push_back(std::move(card));
+            }
+
+            build_index_();
+
+            hdr_ = hdr;
+            dirty_ = false;
+        }
+
+        bool has_key(const std::string& key) const {
+            return index_.find(key) != index_.end();
+        }
+
+        // Number of entries in the header (not including the END keyword)
+        uint_t size() const {
+            return keys_.size();
+        }
+
+        // Parsed content of entry 'i'
+        const header_keyword& key(uint_t i) const {
+            return keys_.safe[i];
+        }
+
+        // Raw content of entry 'i' (one or more 80-character cards)
+        const std::string& card(uint_t i) const {
+            vif_check(i < cards_.size(), "index out of bounds (", i, " vs. ", cards_.size(), ")");
+            return cards_[i];
+        }
+
+        // Return the raw value of a keyword (including quotes for strings), or nullptr
+        // if the keyword does not exist
+        const std::string* raw_value(const std::string& key) const {
+            auto iter = index_.find(key);
+            if (iter == index_.end()) return nullptr;
+            return &keys_.safe[iter->second].value;
+        }
+
+        // Set the raw value of a keyword (including quotes for strings), creating it if needed.
+        // If no comment is provided, the existing comment is kept.
+        void set_raw_value(const std::string& key, const std::string& value,
+            const std::string& comment = "") {
+
+            uint_t id;
+            auto iter = index_.find(key);
+            if (iter == index_.end()) {
+                keys_.push_back(header_keyword{});
+                cards_.emplace_back();
+                id = keys_.size()-1;
+
+                auto& k = keys_.back();
+                k.key = key;
+                k.novalue = false;
+
+                index_.emplace(key, id);
+            } else {
+                id = iter->second;
+            }
+
+            auto& k = keys_.safe[id];
+            k.value = value;
+            if (!comment.empty()) {
+                k.comment = "/ "+comment;
+            }
+
+            cards_[id] = serialize_header(fits::parsed_header{k});
+
+            dirty_ = true;
+        }
+
+        void remove_key(const std::string& key) {
+            auto iter = index_.find(key);
+            if (iter == index_.end()) return;
+
+            const uint_t id = iter->second;
+            remove_if([&](uint_t i, const header_keyword&) { return i == id; });
+        }
+
+        // Remove all the entries for which pred(i, key(i)) returns true
+        template<typename F>
+        void remove_if(F&& pred) {
+            uint_t n = 0;
+            for (uint_t i : range(keys_)) {
+                if (pred(i, const_cast<const header_keyword&>(keys_.safe[i]))) continue;
+
+                if (n != i) {
+                    keys_.safe[n] = std::move(keys_.safe[i]);
+                    cards_[n] = std::move(cards_[i]);
+                }
+
+                ++n;
+            }
+
+            if (n == keys_.size()) return;
+
+            keys_.resize(n);
+            cards_.resize(n);
+            build_index_();
+
+            dirty_ = true;
+        }
+
+        const fits::parsed_header& keys() const {
+            return keys_;
+        }
+
+        // Serialize the header back to FITS format (including the END keyword)
+        const fits::header& str() const {
+            if (dirty_) {
+                std::size_t n = 80;
+                for (auto& c : cards_) {
+                    n += c.size();
+                }
+
+                hdr_.clear();
+                hdr_.reserve(n);
+                for (auto& c : cards_) {
+                    hdr_ += c;
+                }
+
+                hdr_ += "END" + std::string(77, ' ');
+                dirty_ = false;
+            }
+
+            return hdr_;
+        }
+
+    private :
+        static bool is_value_card_(const std::string& card, const std::string& name) {
+            if (begins_with(card, "HIERARCH ")) {
+                return card.find('=') != card.npos;
+            }
+
+            // The standard requires a space after '=', but some writers omit it
+            return name != "COMMENT" && name != "HISTORY" && card[8] == '=';
+        }
+
+        void build_index_() {
+            index_.clear();
+            index_.reserve(keys_.size());
+            for (uint_t i : range(keys_)) {
+                if (!keys_.safe[i].novalue) {
+                    // Only keep the first occurrence, as getkey() on a fits::header
+                    index_.emplace(keys_.safe[i].key, i);
+                }
+            }
+        }
+
+        fits::parsed_header keys_;
+        std::vector<std::string> cards_;
+        std::unordered_map<std::string,uint_t> index_;
+        mutable fits::header hdr_ = "END" + std::string(77, ' ');
+        mutable bool dirty_ = false;
+    };
+
+    template<typename T>
+    bool getkey(const fits::indexed_header& hdr, const std::string& key, T& v) {
+        const std::string* value = hdr.raw_value(key);
+        if (!value) return false;
+        return from_string(*value, v);
+    }
+
+    inline bool getkey(const fits::indexed_header& hdr, const std::string& key, std::string& v) {
+        const std::string* value = hdr.raw_value(key);
+        if (!value) return false;
+        if (value->find_first_of("'") == 0) {
+            v = trim(*value, "'");
+        } else {
+            v = *value;
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    bool setkey(fits::indexed_header& hdr, const std::string& key, const T& v,
+        const std::string& comment = "") {
+
+        if (key.size() > 8) return false;
+
+        std::string value;
+        if (std::is_same<T,double>::value) {
+            value = to_string(format::precision(v, 16));
+        } else {
+            value = to_string(v);
+        }
+
+        // Check the keyword fits in one entry: "KEYWORD = value / comment"
+        if (10 + std::max(value.size(), std::size_t(20)) +
+            (comment.empty() ? 0 : comment.size() + 3) > 80) {
+            return false;
+        }
+
+        hdr.set_raw_value(key, value, comment);
+
+        return true;
+    }
 }
 }
 
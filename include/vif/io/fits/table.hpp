@@ -7,6 +7,8 @@
 
 #ifndef NO_CFITSIO
 
+#include <cstring>
+
 namespace vif {
 namespace fits {
     // Reading options
@@ -118,6 +120,37 @@ namespace impl {
 
         template<typename T>
         struct is_readable_column_type<impl::named_t<T>> : is_readable_column_type<meta::decay_t<T>> {};
+
+        inline bool is_trimmed_char(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        // Assign a null-terminated string to 's', trimming white spaces on both ends.
+        // Same as s = trim(std::string(b)), without the intermediate allocations.
+        inline void assign_trimmed(std::string& s, const char* b) {
+            const char* e = b + std::strlen(b);
+            while (b != e && is_trimmed_char(*b)) ++b;
+            while (e != b && is_trimmed_char(*(e-1))) --e;
+            s.assign(b, e);
+        }
+
+        // Contiguous buffer for reading or writing string columns with cfitsio, which
+        // requires an array of 'char*'. All strings are stored in a single memory block,
+        // with a fixed stride of 'width+1' characters.
+        struct string_buffer {
+            std::vector<char> block;
+            std::vector<char*> ptrs;
+
+            string_buffer(uint_t n, uint_t width) : block(n*(width+1), '\0'), ptrs(n) {
+                for (uint_t i : range(n)) {
+                    ptrs[i] = block.data() + i*(width+1);
+                }
+            }
+
+            char** data() {
+                return ptrs.data();
+            }
+        };
     }
 }
 
@@ -415,27 +448,20 @@ namespace fits {
                 return;
             }
 
-            char** buffer = new char*[v.size()];
-            for (uint_t i : range(v)) {
-                buffer[i] = new char[naxes[0]+1];
-            }
-
             long nelem = v.size();
+            impl::fits_impl::string_buffer buffer(nelem, naxes[0]);
 
             char def = '\0';
             int null;
             fits_read_col(
                 fptr_, impl::fits_impl::traits<std::string>::ttype, cid, 1, 1, nelem, &def,
-                buffer, &null, &status_
+                buffer.data(), &null, &status_
             );
             fits::vif_check_cfitsio(status_, "could not read column '"+cname+"'");
 
             for (uint_t i : range(v)) {
-                v.safe[i] = trim(std::string(buffer[i]));
-                delete[] buffer[i];
+                impl::fits_impl::assign_trimmed(v.safe[i], buffer.ptrs[i]);
             }
-
-            delete[] buffer;
         }
 
         void read_column_impl_(const table_read_options&, std::string& v, const std::string& cname,
@@ -1113,32 +1139,39 @@ namespace fits {
             fits::vif_check_cfitsio(status_, "could not write column '"+tcolname+"'");
         }
 
-        template<std::size_t Dim>
-        void write_column_impl_(const std::string& tcolname, int cid,
-            const vec<Dim,std::string>& value, const vec<1,long>& dims) {
+        template<std::size_t Dim, typename Type>
+        void write_column_string_impl_(const std::string& tcolname, int cid,
+            const vec<Dim,Type>& value, const vec<1,long>& dims) {
 
             const uint_t nmax = dims[0];
 
             // cfitsio doesn't like writing empty string or columns
             if (nmax == 0 || value.empty()) return;
 
-            char** buffer = new char*[value.size()];
+            impl::fits_impl::string_buffer buffer(value.size(), nmax);
             for (uint_t i : range(value)) {
-                buffer[i] = new char[nmax+1];
-                strcpy(buffer[i], value[i].c_str());
+                const std::string& str = value.safe[i];
+                std::memcpy(buffer.ptrs[i], str.data(), str.size());
             }
 
             fits_write_col(
                 fptr_, impl::fits_impl::traits<std::string>::ttype, cid, 1, 1,
-                value.size(), buffer, &status_
+                value.size(), buffer.data(), &status_
             );
             fits::vif_check_cfitsio(status_, "could not write column '"+tcolname+"'");
+        }
 
-            for (uint_t i : range(value)) {
-                delete[] buffer[i];
-            }
+        template<std::size_t Dim>
+        void write_column_impl_(const std::string& tcolname, int cid,
+            const vec<Dim,std::string>& value, const vec<1,long>& dims) {
+            write_column_string_impl_(tcolname, cid, value, dims);
+        }
 
-            delete[] buffer;
+        template<std::size_t Dim>
+        void write_column_impl_(const std::string& tcolname, int cid,
+            const vec<Dim,std::string*>& value, const vec<1,long>& dims) {
+            // No need to concretise the view, strings are copied into the buffer anyway
+            write_column_string_impl_(tcolname, cid, value, dims);
         }
 
         void write_column_impl_(const std::string& tcolname, int cid,
@@ -1234,6 +1267,8 @@ namespace fits {
             return v;
         }
 
+    protected :
+
         template<typename Type>
         std::string write_column_make_tform_(meta::type_list<Type>, const vec<1,long>& dims) {
             uint_t size = 1;
@@ -1266,6 +1301,8 @@ namespace fits {
                 "' (dims "+to_string(dims)+")");
         }
 
+    private :
+
         struct do_write_struct_ {
             output_table* tbl;
             std::string base;
@@ -1711,6 +1748,356 @@ namespace fits {
             update_elements_impl_(tcolname, ci.column_id, value, firstrow, firstelem);
         }
     };
+
+    // Output FITS table filled by appending rows (write only, overwrites existing files).
+    // The columns must first be declared with add_column() (or add_columns() for a
+    // reflected struct), then rows are written by batches with append_rows(). This avoids
+    // keeping the whole table in memory. The file on disk can be brought up to date with
+    // flush(), e.g., to keep partial results if the program is interrupted.
+    class output_table_stream : public output_table {
+    public :
+
+        output_table_stream() :
+            impl::fits_impl::file_base(impl::fits_impl::table_file, impl::fits_impl::write_only),
+            output_table() {
+            format_ = fits::table_format::row_oriented;
+        }
+
+        explicit output_table_stream(const std::string& filename) :
+            impl::fits_impl::file_base(impl::fits_impl::table_file, filename, impl::fits_impl::write_only),
+            output_table(filename) {
+            format_ = fits::table_format::row_oriented;
+        }
+
+        output_table_stream(output_table_stream&&) noexcept = default;
+        output_table_stream(const output_table_stream&) = delete;
+        output_table_stream& operator = (output_table_stream&&) noexcept = delete;
+        output_table_stream& operator = (const output_table_stream&&) = delete;
+
+        // Declare a new column, with dimensions 'row_dims' for each row (empty for scalars)
+        template<typename Type>
+        void add_column(const std::string& tcolname, const vec1u& row_dims = vec1u()) {
+            static_assert(!std::is_same<Type, std::string>::value,
+                "use add_string_column() for string columns");
+            static_assert(impl::fits_impl::is_writable_column_type<Type>::value,
+                "this type cannot be written into a FITS file");
+
+            vec<1,long> dims(row_dims.size());
+            for (uint_t i : range(row_dims)) {
+                dims.safe[i] = row_dims.safe[row_dims.size()-1-i];
+            }
+
+            add_column_(tcolname, impl::fits_impl::traits<Type>::ttype, 0, row_dims,
+                write_column_make_tform_(meta::type_list<Type>{}, dims), dims);
+        }
+
+        // Declare a new string column, where each string is at most 'width' characters long
+        void add_string_column(const std::string& tcolname, uint_t width,
+            const vec1u& row_dims = vec1u()) {
+
+            vif_check(width > 0, "string column '", tcolname, "' must have a non-zero width");
+
+            vec<1,long> dims(row_dims.size()+1);
+            dims.safe[0] = width;
+            for (uint_t i : range(row_dims)) {
+                dims.safe[i+1] = row_dims.safe[row_dims.size()-1-i];
+            }
+
+            add_column_(tcolname, TSTRING, width, row_dims,
+                write_column_make_tform_(meta::type_list<std::string>{}, dims), dims);
+        }
+
+        // Declare all the columns of a reflected struct, using 't' as a prototype. The type of
+        // each column is that of the corresponding member, and the dimensions of each row are
+        // given by the dimensions of the member excluding the first one. Scalar members are
+        // stored in columns with one value per row, and must be appended one row at a time.
+        // String columns are made wide enough to store the longest string of the prototype.
+        template<typename T, typename enable = typename std::enable_if<reflex::enabled<T>::value>::type>
+        void add_columns(const T& t) {
+            #ifdef NO_REFLECTION
+            static_assert(!std::is_same<T,T>::value,
+                "this function requires reflection capabilities (NO_REFLECTION=0)");
+            #endif
+
+            reflex::foreach_member(reflex::wrap(t), do_add_struct_{this, ""});
+        }
+
+        // Append rows to the table. Arguments must be a sequence of 'column name', 'value',
+        // where all the values have the same number of rows (i.e., first dimension).
+        // Columns that are not provided are filled with zeros or empty strings.
+        template<typename ... Args>
+        void append_rows(Args&& ... args) {
+            static_assert(sizeof...(Args) % 2 == 0,
+                "arguments must be a sequence of 'column name', 'value'");
+
+            check_is_open_();
+
+            // Check all the columns before writing anything, so that an invalid column
+            // does not leave the table with a partially written row
+            uint_t nrow = npos;
+            append_rows_impl_(false, nrow, args...);
+            if (nrow == npos) return;
+
+            append_rows_impl_(true, nrow, args...);
+            nrow_ += nrow;
+        }
+
+        // Append all the members of a reflected struct as new rows
+        template<typename T, typename enable = typename std::enable_if<
+            reflex::enabled<meta::decay_t<T>>::value>::type>
+        void append_rows(T&& t) {
+            #ifdef NO_REFLECTION
+            static_assert(!std::is_same<T,T>::value,
+                "this function requires reflection capabilities (NO_REFLECTION=0)");
+            #endif
+
+            check_is_open_();
+
+            uint_t nrow = npos;
+            reflex::foreach_member(reflex::wrap(t), do_append_struct_{this, "", nrow, false});
+            if (nrow == npos) return;
+
+            reflex::foreach_member(reflex::wrap(t), do_append_struct_{this, "", nrow, true});
+            nrow_ += nrow;
+        }
+
+        // Number of rows written so far
+        uint_t row_count() const {
+            return nrow_;
+        }
+
+    private :
+
+        struct column_t {
+            std::string name;
+            int cid = 0;
+            int ttype = 0;
+            uint_t width = 0;
+            vec1u row_dims;
+        };
+
+        vec<1,column_t> columns_;
+        std::unordered_map<std::string,uint_t> index_;
+        uint_t nrow_ = 0;
+
+        void add_column_(const std::string& tcolname, int ttype, uint_t width,
+            const vec1u& row_dims, const std::string& tform, const vec<1,long>& dims) {
+
+            check_is_open_();
+            vif_check(nrow_ == 0, "cannot add column '", tcolname, "' after rows have been written");
+
+            std::string colname = to_upper(tcolname);
+            vif_check(index_.find(colname) == index_.end(),
+                "column '", colname, "' has already been declared");
+
+            create_table_();
+
+            int cid;
+            fits_get_num_cols(fptr_, &cid, &status_);
+            fits::vif_check_cfitsio(status_, "could not get number of columns in HDU");
+            ++cid;
+
+            fits_insert_col(
+                fptr_, cid, const_cast<char*>(colname.c_str()),
+                const_cast<char*>(tform.c_str()), &status_
+            );
+            fits::vif_check_cfitsio(status_, "could not create column '"+tcolname+"'");
+
+            write_column_write_tdim_(tcolname, cid, dims);
+
+            column_t c;
+            c.name = colname;
+            c.cid = cid;
+            c.ttype = ttype;
+            c.width = width;
+            c.row_dims = row_dims;
+
+            index_.emplace(colname, columns_.size());
+            columns_.push_back(std::move(c));
+        }
+
+        template<std::size_t Dim, typename Type>
+        const column_t& append_check_(const std::string& tcolname, const vec<Dim,Type>& value,
+            uint_t& nrow) const {
+
+            std::string colname = to_upper(tcolname);
+            auto iter = index_.find(colname);
+            vif_check(iter != index_.end(), "column '", colname, "' has not been declared");
+
+            const column_t& c = columns_.safe[iter->second];
+            vif_check(Dim == c.row_dims.size()+1, "wrong number of dimensions for column '",
+                colname, "' (expected ", c.row_dims.size()+1, ", got ", Dim, ")");
+
+            for (uint_t i : range(c.row_dims)) {
+                vif_check(value.dims[i+1] == c.row_dims.safe[i], "wrong dimensions for column '",
+                    colname, "' (expected ", c.row_dims, " per row, got ", value.dims, ")");
+            }
+
+            if (nrow == npos) {
+                nrow = value.dims[0];
+            } else {
+                vif_check(nrow == value.dims[0], "incompatible number of rows in '",
+                    colname, "' (expected ", nrow, ", got ", value.dims[0], ")");
+            }
+
+            return c;
+        }
+
+        // Append a column to the current rows. When 'write' is false, only check that the
+        // value can be written in this column; the data is only written when 'write' is true.
+        template<std::size_t Dim, typename Type>
+        void append_column_(const std::string& tcolname, const vec<Dim,Type>& value, uint_t& nrow,
+            bool write) {
+            static_assert(impl::fits_impl::is_writable_column_type<Type>::value,
+                "this variable cannot be written into a FITS file");
+
+            const column_t& c = append_check_(tcolname, value, nrow);
+            vif_check(c.ttype != TSTRING, "cannot write non-string data in string column '",
+                c.name, "'");
+
+            // cfitsio doesn't like writing empty columns
+            if (!write || value.empty()) return;
+
+            fits_write_col(fptr_, impl::fits_impl::traits<Type>::ttype, c.cid, nrow_+1, 1,
+                value.size(), const_cast<typename vec<Dim,Type>::dtype*>(value.raw_data()),
+                &status_);
+            fits::vif_check_cfitsio(status_, "could not write column '"+c.name+"'");
+        }
+
+        template<std::size_t Dim>
+        void append_column_(const std::string& tcolname, const vec<Dim,std::string>& value,
+            uint_t& nrow, bool write) {
+
+            const column_t& c = append_check_(tcolname, value, nrow);
+            vif_check(c.ttype == TSTRING, "cannot write string data in non-string column '",
+                c.name, "'");
+
+            if (!write) {
+                for (auto& str : value) {
+                    vif_check(str.size() <= c.width, "string too long for column '", c.name,
+                        "' (maximum ", c.width, " characters, got '", str, "')");
+                }
+
+                return;
+            }
+
+            if (value.empty()) return;
+
+            impl::fits_impl::string_buffer buffer(value.size(), c.width);
+            for (uint_t i : range(value)) {
+                const std::string& str = value.safe[i];
+                std::memcpy(buffer.ptrs[i], str.data(), str.size());
+            }
+
+            fits_write_col(fptr_, TSTRING, c.cid, nrow_+1, 1, value.size(), buffer.data(),
+                &status_);
+            fits::vif_check_cfitsio(status_, "could not write column '"+c.name+"'");
+        }
+
+        template<std::size_t Dim, typename Type>
+        void append_column_(const std::string& tcolname, const vec<Dim,Type*>& value,
+            uint_t& nrow, bool write) {
+            append_column_(tcolname, value.concretise(), nrow, write);
+        }
+
+        // Scalars are written as a single row
+        template<typename Type, typename enable = typename std::enable_if<
+            std::is_arithmetic<Type>::value || std::is_same<Type,std::string>::value>::type>
+        void append_column_(const std::string& tcolname, const Type& value, uint_t& nrow,
+            bool write) {
+            append_column_(tcolname, vec<1,Type>{value}, nrow, write);
+        }
+
+        void append_rows_impl_(bool, uint_t&) {}
+
+        template<typename T, typename ... Args>
+        void append_rows_impl_(bool write, uint_t& nrow, const std::string& tcolname,
+            const T& value, const Args& ... args) {
+            append_column_(tcolname, value, nrow, write);
+            append_rows_impl_(write, nrow, args...);
+        }
+
+        template<std::size_t Dim, typename Type>
+        void add_column_from_(const std::string& name, const vec<Dim,Type>& v) {
+            vec1u row_dims(Dim-1);
+            for (uint_t i : range(Dim-1)) {
+                row_dims.safe[i] = v.dims[i+1];
+            }
+
+            add_column<meta::rtype_t<Type>>(name, row_dims);
+        }
+
+        template<std::size_t Dim>
+        void add_column_from_(const std::string& name, const vec<Dim,std::string>& v) {
+            vec1u row_dims(Dim-1);
+            for (uint_t i : range(Dim-1)) {
+                row_dims.safe[i] = v.dims[i+1];
+            }
+
+            uint_t width = 1;
+            for (auto& str : v) {
+                width = std::max(width, uint_t(str.size()));
+            }
+
+            add_string_column(name, width, row_dims);
+        }
+
+        template<std::size_t Dim, typename Type>
+        void add_column_from_(const std::string& name, const vec<Dim,Type*>& v) {
+            add_column_from_(name, v.concretise());
+        }
+
+        // Scalars are stored in columns with one value per row
+        template<typename Type, typename enable = typename std::enable_if<
+            std::is_arithmetic<Type>::value || std::is_same<Type,std::string>::value>::type>
+        void add_column_from_(const std::string& name, const Type& v) {
+            add_column_from_(name, vec<1,Type>{v});
+        }
+
+        struct do_add_struct_ {
+            output_table_stream* tbl;
+            std::string base;
+
+            template<typename P>
+            void operator () (const reflex::member_t& m, P&& v) {
+                add_(base+to_upper(m.name), std::forward<P>(v),
+                    reflex::enabled<meta::decay_t<P>>{});
+            }
+
+            template<typename T>
+            void add_(const std::string& name, const T& v, std::false_type) {
+                tbl->add_column_from_(name, v);
+            }
+
+            template<typename T>
+            void add_(const std::string& name, const T& v, std::true_type) {
+                reflex::foreach_member(reflex::wrap(v), do_add_struct_{tbl, name+"."});
+            }
+        };
+
+        struct do_append_struct_ {
+            output_table_stream* tbl;
+            std::string base;
+            uint_t& nrow;
+            bool write;
+
+            template<typename P>
+            void operator () (const reflex::member_t& m, P&& v) {
+                append_(base+to_upper(m.name), std::forward<P>(v),
+                    reflex::enabled<meta::decay_t<P>>{});
+            }
+
+            template<typename T>
+            void append_(const std::string& name, const T& v, std::false_type) {
+                tbl->append_column_(name, v, nrow, write);
+            }
+
+            template<typename T>
+            void append_(const std::string& name, const T& v, std::true_type) {
+                reflex::foreach_member(reflex::wrap(v), do_append_struct_{tbl, name+".", nrow, write});
+            }
+        };
+    };
 }
 }
 
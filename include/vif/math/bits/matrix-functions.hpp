@@ -140,49 +140,10 @@ namespace matrix {
 
             const uint_t n = alpha.dims[0];
 
-            bad = false;
             lu = std::move(alpha);
-            ipiv = indgen(n);
-            ns = 0;
-
-            for (uint_t k : range(n)) {
-                // Find pivot
-                double akk = abs(lu.safe(k,k));
-                if (!no_pivot) {
-                    for (uint_t j : range(k+1, n)) {
-                        double ajk = abs(lu.safe(j,k));
-                        if (akk < ajk) {
-                            akk = ajk;
-                            ipiv.safe[k] = j;
-                        }
-                    }
-
-                    // Apply pivot
-                    if (ipiv.safe[k] != k) {
-                        ++ns;
-
-                        for (uint_t j : range(n)) {
-                            std::swap(lu.safe(ipiv.safe[k],j), lu.safe(k,j));
-                        }
-                    }
-                }
-
-                // If the matrix is singular, return an error
-                if (lu.safe(k,k) == 0.0) {
-                    bad = true;
-                }
-
-                // Find upper elements of row
-                for (uint_t j : range(k+1, n)) {
-                    lu.safe(k,j) /= lu.safe(k,k);
-                }
+            ipiv.resize(n);
 
-                // Update remaining matrix elements
-                for (uint_t i : range(k+1, n))
-                for (uint_t j : range(k+1, n)) {
-                    lu.safe(i,j) -= lu.safe(i,k)*lu.safe(k,j);
-                }
-            }
+            bad = !impl::matrix_impl::getrf(n, lu.raw_data(), n, ipiv.raw_data(), ns, no_pivot);
 
             return !bad;
         }
@@ -307,30 +268,8 @@ namespace matrix {
             l = std::move(alpha);
 
         #ifdef NO_LAPACK
-            const uint_t n = alpha.dims[0];
-            for (uint_t i : range(n)) {
-                for (uint_t j : range(i+1)) {
-                    double s = 0.0;
-                    for (uint_t k : range(j)) {
-                        s += l.safe(i,k)*l.safe(j,k);
-                    }
-
-                    if (i == j) {
-                        s = l.safe(i,i) - s;
-                        if (s <= 0.0) {
-                            bad = true;
-                            return false;
-                        }
-                        l.safe(i,i) = sqrt(s);
-                    } else {
-                        l.safe(i,j) = (l.safe(i,j) - s)/l.safe(j,j);
-                    }
-                }
-
-                for (uint_t j : range(i+1, n)) {
-                    l.safe(i,j) = 0.0;
-                }
-            }
+            const uint_t n = l.dims[0];
+            bad = !impl::matrix_impl::potrf(n, l.raw_data(), n);
         #else
             char uplo = 'U';
             int n = l.dims[0];
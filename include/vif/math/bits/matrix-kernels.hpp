@@ -0,0 +1,432 @@
+#ifndef VIF_INCLUDING_MATH_MATRIX_BITS
+#error this file is not meant to be included separately, include "vif/math/matrix.hpp" instead
+#endif
+
+// Low level dense matrix kernels, working on row-major arrays of double.
+// These are dispatched to the system BLAS when requested (i.e., if VIF_USE_BLAS is defined, as
+// done by the CMake scripts when a BLAS library is found; the program must then be linked to
+// this library), else they use the built-in cache-blocked implementations below, which are
+// written so that the compiler can vectorize the inner loops, and are multithreaded for large
+// enough matrices (see matrix::set_threads()).
+
+namespace vif {
+namespace impl {
+namespace matrix_impl {
+    // Block sizes of the built-in kernels
+    static const uint_t gemm_kc = 128; // rows of B kept in cache
+    static const uint_t gemm_nc = 512; // columns of B kept in cache
+    static const uint_t factor_nb = 64; // panel width in LU and Cholesky decompositions
+
+    // Minimum number of floating point operations to use multiple threads
+    static const uint_t parallel_threshold = 4*1024*1024;
+
+    inline uint_t& kernel_threads() {
+        static uint_t nthread = 1;
+        return nthread;
+    }
+
+    // Split the rows [0,n) into contiguous chunks (multiple of 4 rows) and call f(i0,i1) on
+    // each of them in parallel. If 'lower' is true, the work on row i is assumed to be
+    // proportional to i (e.g., lower triangle of a matrix), and chunks are balanced accordingly.
+    template<typename F>
+    void parallel_rows(uint_t n, double flops, bool lower, F&& f) {
+        uint_t nthread = std::min(kernel_threads(), n/4);
+        if (nthread <= 1 || flops < parallel_threshold) {
+            f(uint_t(0), n);
+            return;
+        }
+
+        std::vector<uint_t> bounds(nthread+1);
+        bounds[0] = 0;
+        for (uint_t t = 1; t < nthread; ++t) {
+            double x = double(t)/nthread;
+            uint_t i = (lower ? sqrt(x) : x)*n;
+            i -= i % 4;
+            bounds[t] = std::max(bounds[t-1], i);
+        }
+
+        bounds[nthread] = n;
+
+        parallel_for_each(nthread, nthread, [&](uint_t t, uint_t) {
+            if (bounds[t+1] > bounds[t]) {
+                f(bounds[t], bounds[t+1]);
+            }
+        });
+    }
+
+    // C[i0:i1,0:n] += alpha*A[i0:i1,0:k]*B[0:k,0:n]
+    // If 'lower' is true, only the columns j < i+4 are computed on row i (this covers the lower
+    // triangle, plus at most three elements above the diagonal).
+    inline void gemm_rows(uint_t i0, uint_t i1, uint_t n, uint_t k, double alpha,
+        const double* a, uint_t lda, const double* b, uint_t ldb, double* c, uint_t ldc,
+        bool lower) {
+
+        for (uint_t k0 = 0; k0 < k; k0 += gemm_kc) {
+            const uint_t k1 = std::min(k, k0 + gemm_kc);
+            for (uint_t j0 = 0; j0 < n; j0 += gemm_nc) {
+                const uint_t j1 = std::min(n, j0 + gemm_nc);
+
+                // Four rows of C at a time, so that each row of B is read once for four rows
+                uint_t i = i0;
+                for (; i + 4 <= i1; i += 4) {
+                    const uint_t je = (lower ? std::min(j1, i + 4) : j1);
+                    if (je <= j0) continue;
+
+                    double* c0 = c + (i+0)*ldc;
+                    double* c1 = c + (i+1)*ldc;
+                    double* c2 = c + (i+2)*ldc;
+                    double* c3 = c + (i+3)*ldc;
+                    for (uint_t p = k0; p < k1; ++p) {
+                        const double a0 = alpha*a[(i+0)*lda+p];
+                        const double a1 = alpha*a[(i+1)*lda+p];
+                        const double a2 = alpha*a[(i+2)*lda+p];
+                        const double a3 = alpha*a[(i+3)*lda+p];
+                        const double* bp = b + p*ldb;
+                        for (uint_t j = j0; j < je; ++j) {
+                            const double tb = bp[j];
+                            c0[j] += a0*tb;
+                            c1[j] += a1*tb;
+                            c2[j] += a2*tb;
+                            c3[j] += a3*tb;
+                        }
+                    }
+                }
+
+                // Remaining rows
+                for (; i < i1; ++i) {
+                    const uint_t je = (lower ? std::min(j1, i + 1) : j1);
+                    if (je <= j0) continue;
+
+                    double* c0 = c + i*ldc;
+                    for (uint_t p = k0; p < k1; ++p) {
+                        const double a0 = alpha*a[i*lda+p];
+                        const double* bp = b + p*ldb;
+                        for (uint_t j = j0; j < je; ++j) {
+                            c0[j] += a0*bp[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    inline void scale_rows(uint_t m, uint_t n, double beta, double* c, uint_t ldc) {
+        if (beta == 1.0) return;
+
+        for (uint_t i = 0; i < m; ++i) {
+            double* ci = c + i*ldc;
+            if (beta == 0.0) {
+                std::fill(ci, ci + n, 0.0);
+            } else {
+                for (uint_t j = 0; j < n; ++j) {
+                    ci[j] *= beta;
+                }
+            }
+        }
+    }
+
+    // General matrix product: C = alpha*A*B + beta*C, with A (m x k), B (k x n), C (m x n)
+    inline void gemm(uint_t m, uint_t n, uint_t k, double alpha, const double* a, uint_t lda,
+        const double* b, uint_t ldb, double beta, double* c, uint_t ldc) {
+
+        if (m == 0 || n == 0) return;
+
+    #if !defined(NO_LAPACK) && defined(VIF_USE_BLAS)
+        if (k != 0) {
+            // Row-major C = A*B is column-major C^T = B^T*A^T
+            const char trans = 'N';
+            const int in = n, im = m, ik = k, ilda = lda, ildb = ldb, ildc = ldc;
+            blas::dgemm_(&trans, &trans, &in, &im, &ik, &alpha, b, &ildb, a, &ilda, &beta,
+                c, &ildc);
+            return;
+        }
+    #endif
+
+        scale_rows(m, n, beta, c, ldc);
+        if (k == 0 || alpha == 0.0) return;
+
+        parallel_rows(m, double(m)*n*k, false, [&](uint_t i0, uint_t i1) {
+            gemm_rows(i0, i1, n, k, alpha, a, lda, b, ldb, c, ldc, false);
+        });
+    }
+
+    // Matrix-vector product: y = alpha*A*x + beta*y, with A (m x n)
+    // or y = alpha*A^T*x + beta*y if 'trans' is true
+    inline void gemv(bool trans, uint_t m, uint_t n, double alpha, const double* a, uint_t lda,
+        const double* x, double beta, double* y) {
+
+        const uint_t ny = (trans ? n : m);
+        if (ny == 0) return;
+
+    #if !defined(NO_LAPACK) && defined(VIF_USE_BLAS)
+        if (m != 0 && n != 0) {
+            // Row-major A is column-major A^T
+            const char ctrans = (trans ? 'N' : 'T');
+            const int in = n, im = m, ilda = lda, inc = 1;
+            blas::dgemv_(&ctrans, &in, &im, &alpha, a, &ilda, x, &inc, &beta, y, &inc);
+            return;
+        }
+    #endif
+
+        scale_rows(1, ny, beta, y, ny);
+        if (alpha == 0.0) return;
+
+        if (!trans) {
+            // Dot products, four rows at a time
+            uint_t i = 0;
+            for (; i + 4 <= m; i += 4) {
+                const double* a0 = a + (i+0)*lda;
+                const double* a1 = a + (i+1)*lda;
+                const double* a2 = a + (i+2)*lda;
+                const double* a3 = a + (i+3)*lda;
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                for (uint_t j = 0; j < n; ++j) {
+                    const double tx = x[j];
+                    s0 += a0[j]*tx;
+                    s1 += a1[j]*tx;
+                    s2 += a2[j]*tx;
+                    s3 += a3[j]*tx;
+                }
+
+                y[i+0] += alpha*s0;
+                y[i+1] += alpha*s1;
+                y[i+2] += alpha*s2;
+                y[i+3] += alpha*s3;
+            }
+
+            for (; i < m; ++i) {
+                const double* a0 = a + i*lda;
+                double s0 = 0.0;
+                for (uint_t j = 0; j < n; ++j) {
+                    s0 += a0[j]*x[j];
+                }
+
+                y[i] += alpha*s0;
+            }
+        } else {
+            // Linear combination of the rows
+            for (uint_t i = 0; i < m; ++i) {
+                const double* ai = a + i*lda;
+                const double tx = alpha*x[i];
+                for (uint_t j = 0; j < n; ++j) {
+                    y[j] += tx*ai[j];
+                }
+            }
+        }
+    }
+
+    // Transpose the (m x n) matrix A into B (n x m)
+    inline void transpose_to(uint_t m, uint_t n, const double* a, uint_t lda,
+        double* b, uint_t ldb) {
+
+        const uint_t bs = 32;
+        for (uint_t i0 = 0; i0 < m; i0 += bs)
+        for (uint_t j0 = 0; j0 < n; j0 += bs) {
+            const uint_t i1 = std::min(m, i0 + bs);
+            const uint_t j1 = std::min(n, j0 + bs);
+            for (uint_t i = i0; i < i1; ++i)
+            for (uint_t j = j0; j < j1; ++j) {
+                b[j*ldb+i] = a[i*lda+j];
+            }
+        }
+    }
+
+    // Symmetric rank-k update: C = alpha*A*A^T + beta*C, with A (n x k), C (n x n)
+    // Both triangles of C are computed.
+    inline void syrk(uint_t n, uint_t k, double alpha, const double* a, uint_t lda,
+        double beta, double* c, uint_t ldc) {
+
+        if (n == 0) return;
+
+    #if !defined(NO_LAPACK) && defined(VIF_USE_BLAS)
+        if (k != 0) {
+            // Row-major A is column-major A^T, and the upper triangle in column-major is the
+            // lower triangle in row-major
+            const char uplo = 'U', trans = 'T';
+            const int in = n, ik = k, ilda = lda, ildc = ldc;
+            blas::dsyrk_(&uplo, &trans, &in, &ik, &alpha, a, &ilda, &beta, c, &ildc);
+        } else {
+            scale_rows(n, n, beta, c, ldc);
+        }
+    #else
+        scale_rows(n, n, beta, c, ldc);
+
+        if (k != 0 && alpha != 0.0) {
+            std::vector<double> at(k*n);
+            transpose_to(n, k, a, lda, at.data(), n);
+
+            parallel_rows(n, 0.5*double(n)*n*k, true, [&](uint_t i0, uint_t i1) {
+                gemm_rows(i0, i1, n, k, alpha, a, lda, at.data(), n, c, ldc, true);
+            });
+        }
+    #endif
+
+        // Copy lower triangle into upper triangle
+        for (uint_t i = 0; i < n; ++i)
+        for (uint_t j = i+1; j < n; ++j) {
+            c[i*ldc+j] = c[j*ldc+i];
+        }
+    }
+
+    // Cholesky decomposition A = L*L^T, in place in the lower triangle of A (n x n), the upper
+    // triangle is set to zero. Returns false if A is not positive definite.
+    inline bool potrf(uint_t n, double* a, uint_t lda) {
+        std::vector<double> lt;
+
+        for (uint_t k0 = 0; k0 < n; k0 += factor_nb) {
+            const uint_t k1 = std::min(n, k0 + factor_nb);
+            const uint_t nk = k1 - k0;
+
+            // Factor diagonal block
+            for (uint_t i = k0; i < k1; ++i) {
+                double* ai = a + i*lda;
+                for (uint_t j = k0; j <= i; ++j) {
+                    const double* aj = a + j*lda;
+                    double s = ai[j];
+                    for (uint_t p = k0; p < j; ++p) {
+                        s -= ai[p]*aj[p];
+                    }
+
+                    if (i == j) {
+                        if (s <= 0.0) {
+                            return false;
+                        }
+
+                        ai[i] = sqrt(s);
+                    } else {
+                        ai[j] = s/aj[j];
+                    }
+                }
+            }
+
+            if (k1 == n) break;
+
+            // Solve for the panel below the diagonal block
+            const uint_t nr = n - k1;
+            parallel_rows(nr, 0.5*double(nr)*nk*nk, false, [&](uint_t r0, uint_t r1) {
+                for (uint_t i = k1 + r0; i < k1 + r1; ++i) {
+                    double* ai = a + i*lda;
+                    for (uint_t j = k0; j < k1; ++j) {
+                        const double* aj = a + j*lda;
+                        double s = ai[j];
+                        for (uint_t p = k0; p < j; ++p) {
+                            s -= ai[p]*aj[p];
+                        }
+
+                        ai[j] = s/aj[j];
+                    }
+                }
+            });
+
+            // Update trailing matrix (lower triangle only)
+            lt.resize(nk*nr);
+            transpose_to(nr, nk, a + k1*lda + k0, lda, lt.data(), nr);
+
+            parallel_rows(nr, double(nr)*nr*nk, true, [&](uint_t r0, uint_t r1) {
+                gemm_rows(r0, r1, nr, nk, -1.0, a + k1*lda + k0, lda, lt.data(), nr,
+                    a + k1*lda + k1, lda, true);
+            });
+        }
+
+        for (uint_t i = 0; i < n; ++i) {
+            std::fill(a + i*lda + i + 1, a + i*lda + n, 0.0);
+        }
+
+        return true;
+    }
+
+    // LU decomposition P*A = L*U with partial pivoting (unless 'no_pivot' is true), in place in
+    // A (n x n). L is lower triangular, and U is upper triangular with unit diagonal (Crout).
+    // ipiv[k] is the row that was swapped with row k at step k, and 'ns' counts the number of
+    // swaps. Returns false if the matrix is singular.
+    inline bool getrf(uint_t n, double* a, uint_t lda, uint_t* ipiv, uint_t& ns, bool no_pivot) {
+        bool bad = false;
+        ns = 0;
+
+        for (uint_t k = 0; k < n; ++k) {
+            ipiv[k] = k;
+        }
+
+        for (uint_t k0 = 0; k0 < n; k0 += factor_nb) {
+            const uint_t k1 = std::min(n, k0 + factor_nb);
+
+            // Factor the panel of columns [k0,k1)
+            for (uint_t k = k0; k < k1; ++k) {
+                if (!no_pivot) {
+                    // Find pivot
+                    double akk = std::abs(a[k*lda+k]);
+                    for (uint_t i = k+1; i < n; ++i) {
+                        double aik = std::abs(a[i*lda+k]);
+                        if (akk < aik) {
+                            akk = aik;
+                            ipiv[k] = i;
+                        }
+                    }
+
+                    // Apply pivot
+                    if (ipiv[k] != k) {
+                        ++ns;
+                        std::swap_ranges(a + k*lda, a + k*lda + n, a + ipiv[k]*lda);
+                    }
+                }
+
+                double* ak = a + k*lda;
+                if (ak[k] == 0.0) {
+                    bad = true;
+                }
+
+                for (uint_t j = k+1; j < k1; ++j) {
+                    ak[j] /= ak[k];
+                }
+
+                for (uint_t i = k+1; i < n; ++i) {
+                    double* ai = a + i*lda;
+                    const double aik = ai[k];
+                    for (uint_t j = k+1; j < k1; ++j) {
+                        ai[j] -= aik*ak[j];
+                    }
+                }
+            }
+
+            if (k1 == n) break;
+
+            // Compute the rows of U to the right of the panel
+            for (uint_t k = k0; k < k1; ++k) {
+                double* ak = a + k*lda;
+                for (uint_t p = k0; p < k; ++p) {
+                    const double akp = ak[p];
+                    const double* ap = a + p*lda;
+                    for (uint_t j = k1; j < n; ++j) {
+                        ak[j] -= akp*ap[j];
+                    }
+                }
+
+                for (uint_t j = k1; j < n; ++j) {
+                    ak[j] /= ak[k];
+                }
+            }
+
+            // Update trailing matrix
+            const uint_t nr = n - k1;
+            gemm(nr, nr, k1 - k0, -1.0, a + k1*lda + k0, lda, a + k0*lda + k1, lda,
+                1.0, a + k1*lda + k1, lda);
+        }
+
+        return !bad;
+    }
+}
+}
+
+namespace matrix {
+    // Set the number of threads used by the built-in matrix kernels for large matrices
+    // (0: use all available cores). When using an external BLAS library, the number of threads
+    // is controlled by the library itself (e.g., OPENBLAS_NUM_THREADS).
+    inline void set_threads(uint_t nthread) {
+        if (nthread == 0) {
+            nthread = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        impl::matrix_impl::kernel_threads() = nthread;
+    }
+}
+}
@@ -473,6 +473,62 @@ namespace matrix {
     }
 }
 
+namespace impl {
+namespace matrix_impl {
+    // Use the dense matrix kernels only for contiguous arrays of double
+    template<typename TypeA, typename TypeB>
+    using use_kernels = std::integral_constant<bool,
+        std::is_same<meta::data_type_t<TypeA>, double>::value &&
+        std::is_same<meta::data_type_t<TypeB>, double>::value>;
+
+    // matrix * matrix
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const TypeA& a, const TypeB& b, matrix::mat<TypeR>& r, std::true_type) {
+        gemm(a.dims[0], b.dims[1], a.dims[1], 1.0, a.raw_data(), a.dims[1],
+            b.raw_data(), b.dims[1], 0.0, r.raw_data(), r.dims[1]);
+    }
+
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const TypeA& a, const TypeB& b, matrix::mat<TypeR>& r, std::false_type) {
+        for (uint_t i : range(a.dims[0]))
+        for (uint_t k : range(a.dims[1]))
+        for (uint_t j : range(b.dims[1])) {
+            r.safe(i,j) += a.safe(i,k)*b.safe(k,j);
+        }
+    }
+
+    // matrix * 1D vector
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const TypeA& a, const vec<1,TypeB>& b, vec<1,TypeR>& r, std::true_type) {
+        gemv(false, a.dims[0], a.dims[1], 1.0, a.raw_data(), a.dims[1], b.raw_data(), 0.0,
+            r.raw_data());
+    }
+
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const TypeA& a, const vec<1,TypeB>& b, vec<1,TypeR>& r, std::false_type) {
+        for (uint_t i : range(a.dims[0]))
+        for (uint_t k : range(a.dims[1])) {
+            r.safe(i) += a.safe(i,k)*b.safe(k);
+        }
+    }
+
+    // 1D vector * matrix
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const vec<1,TypeA>& a, const TypeB& b, vec<1,TypeR>& r, std::true_type) {
+        gemv(true, b.dims[0], b.dims[1], 1.0, b.raw_data(), b.dims[1], a.raw_data(), 0.0,
+            r.raw_data());
+    }
+
+    template<typename TypeA, typename TypeB, typename TypeR>
+    void multiply(const vec<1,TypeA>& a, const TypeB& b, vec<1,TypeR>& r, std::false_type) {
+        for (uint_t k : range(b.dims[0]))
+        for (uint_t i : range(b.dims[1])) {
+            r.safe(i) += a.safe(k)*b.safe(k,i);
+        }
+    }
+}
+}
+
 namespace matrix {
     // matrix * matrix
     template<typename TypeA, typename TypeB, typename enable = typename std::enable_if<
@@ -484,11 +540,7 @@ namespace matrix {
 
         using ntype_t = decltype(a(0,0)*b(0,0));
         mat<ntype_t> r(a.dims[0],b.dims[1]);
-        for (uint_t i : range(a.dims[0]))
-        for (uint_t k : range(a.dims[1]))
-        for (uint_t j : range(b.dims[1])) {
-            r.safe(i,j) += a.safe(i,k)*b.safe(k,j);
-        }
+        impl::matrix_impl::multiply(a, b, r, impl::matrix_impl::use_kernels<TypeA,TypeB>{});
 
         return r;
     }
@@ -503,10 +555,7 @@ namespace matrix {
 
         using ntype_t = decltype(a(0,0)*b(0,0));
         vec<1,ntype_t> r(a.dims[0]);
-        for (uint_t i : range(a.dims[0]))
-        for (uint_t k : range(a.dims[1])) {
-            r.safe(i) += a.safe(i,k)*b.safe(k);
-        }
+        impl::matrix_impl::multiply(a, b, r, impl::matrix_impl::use_kernels<TypeA,vec<1,TypeB>>{});
 
         return r;
     }
@@ -521,10 +570,7 @@ namespace matrix {
 
         using ntype_t = decltype(a(0,0)*b(0,0));
         vec<1,ntype_t> r(b.dims[1]);
-        for (uint_t k : range(b.dims[0]))
-        for (uint_t i : range(b.dims[1])) {
-            r.safe(i) += a.safe(k)*b.safe(k,i);
-        }
+        impl::matrix_impl::multiply(a, b, r, impl::matrix_impl::use_kernels<vec<1,TypeB>,TypeA>{});
 
         return r;
     }
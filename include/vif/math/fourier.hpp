@@ -4,7 +4,10 @@
 #ifndef NO_FFTW
 #include <fftw3.h>
 #endif
+#include <array>
+#include <unordered_map>
 #include "vif/core/vec.hpp"
+#include "vif/core/error.hpp"
 #include "vif/utility/thread.hpp"
 #include "vif/math/complex.hpp"
 
@@ -17,113 +20,447 @@ namespace vif {
     }
 
     #ifndef NO_FFTW
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    inline void fft(const vec2d& v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_r2c_2d(v.dims[0], v.dims[1],
-                const_cast<double*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_ESTIMATE);
+    namespace fftw {
+        // Amount of effort spent by FFTW to find the fastest way to compute a transform.
+        // Anything above 'estimate' requires running (and timing) several transforms the first
+        // time a new array size is used, which only pays off if many FFTs of the same size are
+        // computed. The results of this planning ("wisdom") can be saved and reused by later
+        // programs, see set_wisdom_file().
+        enum class planning {
+            estimate, measure, patient, exhaustive
+        };
+    }
+
+    namespace impl {
+    namespace fftw_impl {
+        enum class transform {
+            r2c, c2r, c2c_forward, c2c_backward
+        };
+
+        // Identifies a plan. Plans can be reused to transform any array of the same dimensions,
+        // as long as the data has the same alignment in memory.
+        struct plan_key {
+            transform type;
+            std::array<int,3> dims = {{0, 0, 0}};
+            int ndim = 0;
+            int align_in = 0;
+            int align_out = 0;
+            bool inplace = false;
+            unsigned flags = 0;
+            int nthread = 1;
+
+            // Batched transforms: number of transforms, and distance between the first
+            // element of two consecutive transforms (in units of the input/output type)
+            int howmany = 1;
+            int dist_in = 0;
+            int dist_out = 0;
+
+            bool operator == (const plan_key& k) const {
+                return type == k.type && dims == k.dims && ndim == k.ndim &&
+                    align_in == k.align_in && align_out == k.align_out &&
+                    inplace == k.inplace && flags == k.flags && nthread == k.nthread &&
+                    howmany == k.howmany && dist_in == k.dist_in && dist_out == k.dist_out;
+            }
+        };
+
+        struct plan_key_hash {
+            std::size_t operator() (const plan_key& k) const {
+                std::size_t h = std::size_t(k.type);
+                auto combine = [&h](std::size_t v) {
+                    h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+                };
+
+                for (int d : k.dims) combine(d);
+                combine(k.align_in);
+                combine(k.align_out);
+                combine(k.inplace);
+                combine(k.flags);
+                combine(k.nthread);
+                combine(k.howmany);
+                combine(k.dist_in);
+                combine(k.dist_out);
+                return h;
+            }
+        };
+
+        using plan_map = std::unordered_map<plan_key,fftw_plan,plan_key_hash>;
+
+        inline unsigned planning_flags(fftw::planning p) {
+            switch (p) {
+                case fftw::planning::measure :    return FFTW_MEASURE;
+                case fftw::planning::patient :    return FFTW_PATIENT;
+                case fftw::planning::exhaustive : return FFTW_EXHAUSTIVE;
+                default :                         return FFTW_ESTIMATE;
+            }
         }
 
-        fftw_execute(p);
+        // Process-wide cache of FFTW plans
+        struct plan_cache {
+            std::mutex mutex;
+            plan_map plans;
+            std::atomic<uint_t> generation;
+            std::atomic<unsigned> flags;
+            std::atomic<int> nthread;
+            std::string wisdom_file;
 
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
+            plan_cache() : generation(0), flags(FFTW_ESTIMATE), nthread(1) {
+                // Make sure the mutex is destroyed after the cache
+                fftw_planner_mutex();
+
+            #ifdef VIF_USE_FFTW_THREADS
+                fftw_init_threads();
+            #endif
+            }
+
+            plan_cache(const plan_cache&) = delete;
+            plan_cache& operator=(const plan_cache&) = delete;
+
+            ~plan_cache() {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::lock_guard<std::mutex> plock(fftw_planner_mutex());
+
+                if (!wisdom_file.empty()) {
+                    fftw_export_wisdom_to_filename(wisdom_file.c_str());
+                }
+
+                for (auto& p : plans) {
+                    fftw_destroy_plan(p.second);
+                }
+            }
+
+            // Remove all the plans (they must not be in use)
+            void clear() {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::lock_guard<std::mutex> plock(fftw_planner_mutex());
+
+                for (auto& p : plans) {
+                    fftw_destroy_plan(p.second);
+                }
+
+                plans.clear();
+                ++generation;
+            }
+
+            fftw_plan make_plan(const plan_key& k) {
+                // Create the plan on scratch arrays of the same size and alignment, since FFTW
+                // overwrites the arrays while measuring plans
+                std::size_t n = 1;
+                for (int i = 0; i < k.ndim; ++i) {
+                    n *= k.dims[i];
+                }
+
+                const std::size_t nmax = (k.howmany - 1)*std::size_t(std::max(k.dist_in, k.dist_out));
+                const std::size_t bytes = (n + nmax)*sizeof(fftw_complex) + 16;
+                char* buf_in = static_cast<char*>(fftw_malloc(bytes));
+                char* buf_out = (k.inplace ? buf_in : static_cast<char*>(fftw_malloc(bytes)));
+
+                double* rin = reinterpret_cast<double*>(buf_in + k.align_in);
+                double* rout = reinterpret_cast<double*>(buf_out + k.align_out);
+                fftw_complex* cin = reinterpret_cast<fftw_complex*>(rin);
+                fftw_complex* cout = reinterpret_cast<fftw_complex*>(rout);
+
+            #ifdef VIF_USE_FFTW_THREADS
+                fftw_plan_with_nthreads(k.nthread);
+            #endif
+
+                const int* d = k.dims.data();
+                fftw_plan p;
+                switch (k.type) {
+                case transform::r2c :
+                    p = fftw_plan_many_dft_r2c(k.ndim, d, k.howmany,
+                        rin, nullptr, 1, k.dist_in, cout, nullptr, 1, k.dist_out, k.flags);
+                    break;
+                case transform::c2r :
+                    p = fftw_plan_many_dft_c2r(k.ndim, d, k.howmany,
+                        cin, nullptr, 1, k.dist_in, rout, nullptr, 1, k.dist_out, k.flags);
+                    break;
+                case transform::c2c_forward :
+                    p = fftw_plan_many_dft(k.ndim, d, k.howmany,
+                        cin, nullptr, 1, k.dist_in, cout, nullptr, 1, k.dist_out,
+                        FFTW_FORWARD, k.flags);
+                    break;
+                default :
+                    p = fftw_plan_many_dft(k.ndim, d, k.howmany,
+                        cin, nullptr, 1, k.dist_in, cout, nullptr, 1, k.dist_out,
+                        FFTW_BACKWARD, k.flags);
+                    break;
+                }
+
+                if (!k.inplace) fftw_free(buf_out);
+                fftw_free(buf_in);
+
+                return p;
+            }
+
+            fftw_plan get(const plan_key& k) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                auto iter = plans.find(k);
+                if (iter != plans.end()) {
+                    return iter->second;
+                }
+
+                fftw_plan p; {
+                    std::lock_guard<std::mutex> plock(fftw_planner_mutex());
+                    p = make_plan(k);
+                }
+
+                vif_check(p != nullptr, "could not create FFTW plan");
+
+                plans.insert(std::make_pair(k, p));
+                return p;
+            }
+        };
+
+        inline plan_cache& get_plan_cache() {
+            static plan_cache cache;
+            return cache;
         }
-    }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    inline vec2cd fft(const vec2d& v) {
-        vec2cd r(v.dims);
-        fft(v, r);
-        return r;
-    }
+        // Find a plan matching the provided arrays. Plans that have already been used by the
+        // current thread are found without locking.
+        inline fftw_plan get_plan(plan_key k, const void* in, const void* out) {
+            plan_cache& cache = get_plan_cache();
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d complex array
-    inline void fft_c2c(const vec2cd& v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_2d(v.dims[0], v.dims[1],
-                const_cast<fftw_complex*>(reinterpret_cast<const fftw_complex*>(v.raw_data())),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_FORWARD, FFTW_ESTIMATE);
+            k.align_in = fftw_alignment_of(static_cast<double*>(const_cast<void*>(in)));
+            k.align_out = fftw_alignment_of(static_cast<double*>(const_cast<void*>(out)));
+            k.inplace = (in == out);
+            k.flags = cache.flags;
+            k.nthread = cache.nthread;
+
+            thread_local plan_map local;
+            thread_local uint_t local_generation = 0;
+            if (local_generation != cache.generation) {
+                local.clear();
+                local_generation = cache.generation;
+            }
+
+            auto iter = local.find(k);
+            if (iter != local.end()) {
+                return iter->second;
+            }
+
+            fftw_plan p = cache.get(k);
+            local.insert(std::make_pair(k, p));
+            return p;
         }
 
-        fftw_execute(p);
+        template<std::size_t D>
+        std::array<int,3> plan_dims(const std::array<uint_t,D>& d) {
+            std::array<int,3> r = {{0, 0, 0}};
+            for (uint_t i = 0; i < D; ++i) {
+                r[i] = d[i];
+            }
 
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
+            return r;
         }
-    }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    inline vec2cd fft_c2c(const vec2cd& v) {
-        vec2cd r(v.dims);
-        fft_c2c(v, r);
-        return r;
-    }
+        // Describe 'howmany' transforms of dimensions 'dims', stored one after the other
+        inline plan_key make_key(transform type, const std::array<int,3>& dims, int ndim,
+            int howmany, int dist_in, int dist_out) {
+            plan_key k;
+            k.type = type;
+            k.dims = dims;
+            k.ndim = ndim;
+            k.howmany = howmany;
+            k.dist_in = dist_in;
+            k.dist_out = dist_out;
+            return k;
+        }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline void ifft(vec2cd v, vec2d& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_c2r_2d(v.dims[0], v.dims[1],
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                r.raw_data(), FFTW_ESTIMATE);
+        inline void execute_r2c(const std::array<int,3>& dims, int ndim, const double* in,
+            fftw_complex* out, int howmany = 1, int dist_in = 0, int dist_out = 0) {
+            fftw_plan p = get_plan(make_key(transform::r2c, dims, ndim,
+                howmany, dist_in, dist_out), in, out);
+            fftw_execute_dft_r2c(p, const_cast<double*>(in), out);
+        }
+
+        inline void execute_c2r(const std::array<int,3>& dims, int ndim, fftw_complex* in,
+            double* out, int howmany = 1, int dist_in = 0, int dist_out = 0) {
+            fftw_plan p = get_plan(make_key(transform::c2r, dims, ndim,
+                howmany, dist_in, dist_out), in, out);
+            fftw_execute_dft_c2r(p, in, out);
         }
 
-        fftw_execute(p);
+        inline void execute_c2c(const std::array<int,3>& dims, int ndim, const fftw_complex* in,
+            fftw_complex* out, bool forward, int howmany = 1, int dist_in = 0, int dist_out = 0) {
+            fftw_plan p = get_plan(make_key(forward ? transform::c2c_forward :
+                transform::c2c_backward, dims, ndim, howmany, dist_in, dist_out), in, out);
+            fftw_execute_dft(p, const_cast<fftw_complex*>(in), out);
+        }
 
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
+        // Smallest size larger or equal to 'n' that only has 2, 3, 5 and 7 as prime factors,
+        // for which FFTW is most efficient
+        inline uint_t good_size(uint_t n) {
+            for (n = std::max(n, uint_t(1));; ++n) {
+                uint_t m = n;
+                for (uint_t f : {2u, 3u, 5u, 7u}) {
+                    while (m % f == 0) m /= f;
+                }
+
+                if (m <= 1) return n;
+            }
         }
-    }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline vec2d ifft(vec2cd v) {
-        vec2d r(v.dims);
-        ifft(v, r);
-        return r;
+        // Dimensions of the individual transforms of a batch (all but the first dimension)
+        template<std::size_t D>
+        std::array<int,3> plan_dims_many(const std::array<uint_t,D>& d) {
+            std::array<int,3> r = {{0, 0, 0}};
+            for (uint_t i = 1; i < D; ++i) {
+                r[i-1] = d[i];
+            }
+
+            return r;
+        }
+    }
     }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline void ifft_c2c(vec2cd v, vec2cd& r) {
-        fftw_plan p;
-        {
-            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            p = fftw_plan_dft_2d(v.dims[0], v.dims[1],
-                reinterpret_cast<fftw_complex*>(v.raw_data()),
-                reinterpret_cast<fftw_complex*>(r.raw_data()), FFTW_BACKWARD, FFTW_ESTIMATE);
+    namespace fftw {
+        // Set the planning effort for new FFTs (default: estimate)
+        inline void set_planning(planning p) {
+            impl::fftw_impl::get_plan_cache().flags = impl::fftw_impl::planning_flags(p);
         }
 
-        fftw_execute(p);
+        // Set the number of threads used to compute each new FFT (default: 1). A value of zero
+        // uses all the available cores. Has no effect unless VIF_USE_FFTW_THREADS is defined
+        // (and the program linked to -lfftw3_threads).
+        inline void set_threads(uint_t nthread) {
+            if (nthread == 0) {
+                nthread = std::max(1u, std::thread::hardware_concurrency());
+            }
 
-        {
+        #ifdef VIF_USE_FFTW_THREADS
+            impl::fftw_impl::get_plan_cache().nthread = nthread;
+        #endif
+        }
+
+        // Load planning results from a file, returns false if the file could not be read
+        inline bool load_wisdom(const std::string& filename) {
             std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
-            fftw_destroy_plan(p);
+            return fftw_import_wisdom_from_filename(filename.c_str()) != 0;
+        }
+
+        // Save planning results to a file, returns false if the file could not be written
+        inline bool save_wisdom(const std::string& filename) {
+            std::lock_guard<std::mutex> lock(impl::fftw_planner_mutex());
+            return fftw_export_wisdom_to_filename(filename.c_str()) != 0;
+        }
+
+        // Load planning results from a file (if it exists), and save them back to that file
+        // when the program ends
+        inline void set_wisdom_file(const std::string& filename) {
+            auto& cache = impl::fftw_impl::get_plan_cache();
+            {
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                cache.wisdom_file = filename;
+            }
+
+            load_wisdom(filename);
         }
-    }
 
-    // Compute the Fast Fourier Transform (FFT) of the provided 2d array
-    // NB: the FFTW routine does not preserve the data in input, so the
-    // input array has to be copied
-    inline vec2cd ifft_c2c(vec2cd v) {
-        vec2cd r(v.dims);
-        ifft_c2c(v, r);
-        return r;
+        // Destroy all cached plans. No FFT must be running while this function is called.
+        inline void clear_plans() {
+            impl::fftw_impl::get_plan_cache().clear();
+        }
     }
+
+    // Compute the Fast Fourier Transform (FFT) of the provided real array.
+    // NB: only the non-redundant half of the transform is computed, and it is stored at the
+    // beginning of the output array (as dims[0]*...*(dims[N-1]/2+1) contiguous values). This is
+    // also the layout expected by the inverse transform ifft().
+    // NB: the inverse transforms ifft() and ifft_c2c() are not normalized, the result has to be
+    // divided by the number of elements.
+    #define MAKE_FFT_FUNCTIONS(N) \
+        inline void fft(const vec##N##d& v, vec##N##cd& r) { \
+            impl::fftw_impl::execute_r2c(impl::fftw_impl::plan_dims(v.dims), N, \
+                v.raw_data(), reinterpret_cast<fftw_complex*>(r.raw_data())); \
+        } \
+        \
+        inline vec##N##cd fft(const vec##N##d& v) { \
+            vec##N##cd r(v.dims); \
+            fft(v, r); \
+            return r; \
+        } \
+        \
+        inline void fft_c2c(const vec##N##cd& v, vec##N##cd& r) { \
+            impl::fftw_impl::execute_c2c(impl::fftw_impl::plan_dims(v.dims), N, \
+                reinterpret_cast<const fftw_complex*>(v.raw_data()), \
+                reinterpret_cast<fftw_complex*>(r.raw_data()), true); \
+        } \
+        \
+        inline vec##N##cd fft_c2c(const vec##N##cd& v) { \
+            vec##N##cd r(v.dims); \
+            fft_c2c(v, r); \
+            return r; \
+        } \
+        \
+        /* NB: the FFTW routine does not preserve the data in input, so the */ \
+        /* input array has to be copied */ \
+        inline void ifft(vec##N##cd v, vec##N##d& r) { \
+            impl::fftw_impl::execute_c2r(impl::fftw_impl::plan_dims(v.dims), N, \
+                reinterpret_cast<fftw_complex*>(v.raw_data()), r.raw_data()); \
+        } \
+        \
+        inline vec##N##d ifft(vec##N##cd v) { \
+            vec##N##d r(v.dims); \
+            ifft(v, r); \
+            return r; \
+        } \
+        \
+        inline void ifft_c2c(vec##N##cd v, vec##N##cd& r) { \
+            impl::fftw_impl::execute_c2c(impl::fftw_impl::plan_dims(v.dims), N, \
+                reinterpret_cast<const fftw_complex*>(v.raw_data()), \
+                reinterpret_cast<fftw_complex*>(r.raw_data()), false); \
+        } \
+        \
+        inline vec##N##cd ifft_c2c(vec##N##cd v) { \
+            vec##N##cd r(v.dims); \
+            ifft_c2c(v, r); \
+            return r; \
+        }
+
+    MAKE_FFT_FUNCTIONS(1)
+    MAKE_FFT_FUNCTIONS(2)
+    MAKE_FFT_FUNCTIONS(3)
+
+    #undef MAKE_FFT_FUNCTIONS
+
+    // Compute the FFT of each row (vec2d) or slice (vec3d) of the provided array, i.e., the
+    // transform is performed on all but the first dimension. The result is the same as calling
+    // fft() on each v(i,_) or v(i,_,_), but all the transforms are computed in one go.
+    #define MAKE_FFT_MANY_FUNCTIONS(N) \
+        inline void fft_many(const vec##N##d& v, vec##N##cd& r) { \
+            const int dist = v.size()/std::max(v.dims[0], uint_t(1)); \
+            impl::fftw_impl::execute_r2c(impl::fftw_impl::plan_dims_many(v.dims), N-1, \
+                v.raw_data(), reinterpret_cast<fftw_complex*>(r.raw_data()), \
+                v.dims[0], dist, dist); \
+        } \
+        \
+        inline vec##N##cd fft_many(const vec##N##d& v) { \
+            vec##N##cd r(v.dims); \
+            fft_many(v, r); \
+            return r; \
+        } \
+        \
+        /* NB: the FFTW routine does not preserve the data in input, so the */ \
+        /* input array has to be copied */ \
+        inline void ifft_many(vec##N##cd v, vec##N##d& r) { \
+            const int dist = v.size()/std::max(v.dims[0], uint_t(1)); \
+            impl::fftw_impl::execute_c2r(impl::fftw_impl::plan_dims_many(v.dims), N-1, \
+                reinterpret_cast<fftw_complex*>(v.raw_data()), r.raw_data(), \
+                v.dims[0], dist, dist); \
+        } \
+        \
+        inline vec##N##d ifft_many(vec##N##cd v) { \
+            vec##N##d r(v.dims); \
+            ifft_many(v, r); \
+            return r; \
+        }
+
+    MAKE_FFT_MANY_FUNCTIONS(2)
+    MAKE_FFT_MANY_FUNCTIONS(3)
+
+    #undef MAKE_FFT_MANY_FUNCTIONS
     #endif
 }
 
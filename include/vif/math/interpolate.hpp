@@ -8,6 +8,60 @@
 #include "vif/math/base.hpp"
 
 namespace vif {
+    namespace impl {
+        // Same as lower_bound(x, t), i.e., the position of the last element of 'x' that is lower
+        // or equal to 't', or npos if there is none. The search starts from the position 'i'
+        // (e.g., found for a previous value), and only requires O(log d) operations where 'd' is
+        // the distance between the two positions. Sorted values are thus located in a single
+        // sweep through 'x'.
+        template<std::size_t D, typename TX, typename T>
+        uint_t interpolate_locate(const vec<D,TX>& x, const T& t, uint_t i) {
+            const int_t n = x.size();
+            if (n == 0) return npos;
+
+            int_t lo, hi;
+            if (i == npos || int_t(i) >= n) i = 0;
+
+            if (x.safe[i] <= t) {
+                // Search forward, x[lo] <= t
+                lo = i;
+                hi = lo + 1;
+                int_t step = 1;
+                while (hi < n && x.safe[hi] <= t) {
+                    lo = hi;
+                    step *= 2;
+                    hi = lo + step;
+                }
+
+                if (hi > n) hi = n;
+            } else {
+                // Search backward, x[hi] > t
+                hi = i;
+                lo = hi - 1;
+                int_t step = 1;
+                while (lo >= 0 && !(x.safe[lo] <= t)) {
+                    hi = lo;
+                    step *= 2;
+                    lo = hi - step;
+                }
+
+                if (lo < 0) lo = -1;
+            }
+
+            // Binary search between the two bounds
+            while (hi - lo > 1) {
+                int_t mid = lo + (hi - lo)/2;
+                if (x.safe[mid] <= t) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            return lo < 0 ? npos : uint_t(lo);
+        }
+    }
+
     inline double interpolate(double y1, double y2, double x1, double x2, double x) {
         double a = (x - x1)/(x2 - x1);
         return y1 + (y2 - y1)*a;
@@ -37,8 +91,9 @@ namespace vif {
 
         uint_t nmax = x.size();
         vec<DX,decltype(y[0]*x[0])> r; r.reserve(nx.size());
+        uint_t low = npos;
         for (auto& tx : nx) {
-            uint_t low = lower_bound(x, tx);
+            low = impl::interpolate_locate(x, tx, low);
 
             rtypey ylow, yup;
             rtypex xlow, xup;
@@ -122,8 +177,9 @@ namespace vif {
         std::pair<vec<DX,decltype(y[0]*x[0])>,vec<DX,decltype(y[0]*x[0])>> p;
         p.first.reserve(nx.size());
         p.second.reserve(nx.size());
+        uint_t low = npos;
         for (auto& tx : nx) {
-            uint_t low = lower_bound(x, tx);
+            low = impl::interpolate_locate(x, tx, low);
 
             rtypey ylow, yup;
             rtypee elow, eup;
@@ -365,8 +421,9 @@ namespace vif {
         vec1d b, c, d;
         impl::interpolate_3spline_make_coefs(y, x, b, c, d);
 
+        uint_t k = npos;
         for (uint_t i : range(xn)) {
-            uint_t k = lower_bound(x, xn.safe[i]);
+            k = impl::interpolate_locate(x, xn.safe[i], k);
             if (k == npos) {
                 double th = xn[i] - x[0];
                 yn[i] = y[0] + b[0]*th;
@@ -457,6 +514,180 @@ namespace vif {
         }
     }
 
+    // Reusable interpolation of the data 'y' of position 'x', for repeated queries.
+    // The interpolation coefficients (slopes for linear interpolation, or the cubic spline
+    // coefficients) are computed once in the constructor, and the object can then be evaluated
+    // any number of times on scalar or vector positions, giving the same results as interpolate()
+    // and interpolate_3spline(). Consecutive positions in a vector are located starting from the
+    // previous one, so that sorted positions are evaluated in a single sweep through 'x'. If 'x'
+    // is regularly spaced, positions are located in constant time. As for the other functions,
+    // 'x' must be properly sorted.
+    struct interpolator {
+        enum class method {
+            linear, cubic_spline
+        };
+
+        method meth = method::linear;
+        vec1d x, y;
+        vec1d b, c, d;
+
+        // Regular grid
+        bool regular = false;
+        double x0 = 0.0, idx = 0.0;
+
+        interpolator() = default;
+
+        template<typename TY, typename TX>
+        interpolator(const vec<1,TY>& ty, const vec<1,TX>& tx, method m = method::linear) {
+            vif_check(ty.size() == tx.size(),
+                "'x' and 'y' arrays must contain the same number of elements");
+            vif_check(ty.size() >= 2,
+                "'x' and 'y' arrays must contain at least 2 elements");
+
+            meth = m;
+            x = tx;
+            y = ty;
+
+            const uint_t n = x.size();
+            if (meth == method::linear) {
+                b.resize(n);
+                for (uint_t i : range(n-1)) {
+                    b.safe[i] = (y.safe[i+1] - y.safe[i])/(x.safe[i+1] - x.safe[i]);
+                }
+
+                b.safe[n-1] = b.safe[n-2];
+            } else {
+                impl::interpolate_3spline_make_coefs(y, x, b, c, d);
+            }
+
+            // Check if the grid is regular, in which case the position can be guessed directly.
+            // It is only used as a starting point for the search, so the tolerance only affects
+            // performances, not the result.
+            double dx = (x.safe[n-1] - x.safe[0])/(n-1);
+            regular = dx > 0;
+            for (uint_t i = 1; i < n && regular; ++i) {
+                regular = abs(x.safe[i] - (x.safe[0] + i*dx)) < 1e-3*dx;
+            }
+
+            if (regular) {
+                x0 = x.safe[0];
+                idx = 1.0/dx;
+            }
+        }
+
+        uint_t size() const {
+            return x.size();
+        }
+
+        // Position of the last element of 'x' that is lower or equal to 't' (npos if none), using
+        // 'hint' as a starting point (can be npos).
+        uint_t locate(double t, uint_t hint = npos) const {
+            if (regular) {
+                double p = floor((t - x0)*idx);
+                if (p >= 0.0 && p < x.size()) {
+                    hint = p;
+                }
+            }
+
+            return impl::interpolate_locate(x, t, hint);
+        }
+
+        double operator() (double t) const {
+            return evaluate_(t, locate(t));
+        }
+
+        template<std::size_t D, typename T>
+        vec<D,double> operator() (const vec<D,T>& t) const {
+            return evaluate_block_(t, false);
+        }
+
+        double derivative(double t) const {
+            return derivative_(t, locate(t));
+        }
+
+        template<std::size_t D, typename T>
+        vec<D,double> derivative(const vec<D,T>& t) const {
+            return evaluate_block_(t, true);
+        }
+
+    private :
+
+        double evaluate_(double t, uint_t k) const {
+            if (meth == method::linear) {
+                const uint_t n = x.size();
+                if (k == npos) {
+                    k = 0;
+                } else if (k == n-1) {
+                    k = n-2;
+                }
+
+                return y.safe[k] + b.safe[k]*(t - x.safe[k]);
+            } else {
+                if (k == npos) {
+                    return y.safe[0] + b.safe[0]*(t - x.safe[0]);
+                } else {
+                    double th = t - x.safe[k];
+                    return y.safe[k] + th*(b.safe[k] + th*(c.safe[k] + th*d.safe[k]));
+                }
+            }
+        }
+
+        double derivative_(double t, uint_t k) const {
+            if (meth == method::linear) {
+                return b.safe[k == npos ? 0 : k];
+            } else {
+                if (k == npos) {
+                    return b.safe[0];
+                } else {
+                    double th = t - x.safe[k];
+                    return b.safe[k] + th*(2.0*c.safe[k] + 3.0*th*d.safe[k]);
+                }
+            }
+        }
+
+        template<std::size_t D, typename T>
+        vec<D,double> evaluate_block_(const vec<D,T>& t, bool deriv) const {
+            vec<D,double> r(t.dims);
+
+            // Work in blocks: first locate all the positions in the block, then evaluate the
+            // interpolant in a separate loop without branches on the search
+            const uint_t nblock = 256;
+            uint_t ks[nblock];
+            double ts[nblock];
+
+            const uint_t ntot = t.size();
+            uint_t k = npos;
+            for (uint_t i0 = 0; i0 < ntot; i0 += nblock) {
+                const uint_t i1 = std::min(ntot, i0 + nblock);
+                for (uint_t i = i0; i < i1; ++i) {
+                    ts[i-i0] = t.safe[i];
+                    k = locate(ts[i-i0], k);
+                    ks[i-i0] = k;
+                }
+
+                double* pr = r.raw_data() + i0;
+                if (meth == method::linear || deriv) {
+                    for (uint_t i = 0; i < i1-i0; ++i) {
+                        pr[i] = (deriv ? derivative_(ts[i], ks[i]) : evaluate_(ts[i], ks[i]));
+                    }
+                } else {
+                    // Cubic spline: linear extrapolation below x[0] uses the first segment
+                    // with c = d = 0, handled by a select rather than a branch
+                    for (uint_t i = 0; i < i1-i0; ++i) {
+                        const bool below = ks[i] == npos;
+                        const uint_t kk = below ? 0 : ks[i];
+                        const double th = ts[i] - x.safe[kk];
+                        const double tc = below ? 0.0 : c.safe[kk];
+                        const double td = below ? 0.0 : d.safe[kk];
+                        pr[i] = y.safe[kk] + th*(b.safe[kk] + th*(tc + th*td));
+                    }
+                }
+            }
+
+            return r;
+        }
+    };
+
     // Perform bicubic interpolation of the regularly gridded data 'map' at the new positions
     // 'x' and 'y'.
     // Assumes that the data array only contains finite elements. If this is not the case,
@@ -30,4 +30,23 @@ namespace lapack {
     extern "C" void dtrtri_(char* uplo, char* diag, int* n, double* a, int* lda, int* info);
 }
 
+#ifdef VIF_USE_BLAS
+// BLAS functions imported from fortran library
+// Note: only used if VIF_USE_BLAS is defined, since linking to LAPACK alone does not
+// guarantee that these symbols are available
+// --------------------------------------------
+
+namespace blas {
+    extern "C" void dgemm_(const char* transa, const char* transb, const int* m, const int* n,
+        const int* k, const double* alpha, const double* a, const int* lda, const double* b,
+        const int* ldb, const double* beta, double* c, const int* ldc);
+    extern "C" void dgemv_(const char* trans, const int* m, const int* n, const double* alpha,
+        const double* a, const int* lda, const double* x, const int* incx, const double* beta,
+        double* y, const int* incy);
+    extern "C" void dsyrk_(const char* uplo, const char* trans, const int* n, const int* k,
+        const double* alpha, const double* a, const int* lda, const double* beta, double* c,
+        const int* ldc);
+}
+#endif
+
 #endif
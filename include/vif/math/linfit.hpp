@@ -4,6 +4,7 @@
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
 #include "vif/math/base.hpp"
 #include "vif/math/matrix.hpp"
 
@@ -31,6 +32,31 @@ namespace vif {
         MEMBERS2("linfit_result", MAKE_MEMBER(success), MAKE_MEMBER(chi2), MAKE_MEMBER(params));
     };
 
+    // Algorithm used to solve the non-negative linear problem in linfit_nn()
+    enum class linfit_nn_method {
+        active_set,    // Lawson & Hanson active set method (exact, default)
+        multiplicative // multiplicative updates (approximate, iterative)
+    };
+
+    // Result of linfit_many(), one row per fit
+    struct linfit_many_result {
+        vec1b success; // [nfit]
+        vec1d chi2;    // [nfit]
+        vec2d params;  // [nfit,nparam]
+        vec2d errors;  // [nfit,nparam]
+        vec3d cov;     // [nfit,nparam,nparam], only if linfit_many_params::covariance is set
+
+        // Reflection data
+        MEMBERS1(success, chi2, params, errors, cov);
+        MEMBERS2("linfit_many_result", MAKE_MEMBER(success), MAKE_MEMBER(chi2),
+            MAKE_MEMBER(params), MAKE_MEMBER(errors), MAKE_MEMBER(cov));
+    };
+
+    struct linfit_many_params {
+        uint_t thread = 1;       // number of threads to use (default: 1)
+        bool covariance = false; // also compute the covariance matrix of each fit (default: false)
+    };
+
     namespace impl {
         template<typename T, typename TypeE>
         void linfit_make_cache_(vec2d& cache, const TypeE& ye, uint_t i, T&& t) {
@@ -54,19 +80,11 @@ namespace vif {
             // Solving 'y +/- e = sum over i of a[i]*x[i]' to get all a[i]'s
             alpha.resize(np,np);
             beta.resize(np);
-            for (uint_t i : range(np)) {
-                for (uint_t j : range(np)) {
-                    if (i <= j) {
-                        alpha.safe(i,j) = 0.0;
-                        // alpha(i,j) = sum over all points of x[i]*x[j]/e^2
-                        for (uint_t m : range(nm)) {
-                            alpha.safe(i,j) += cache.safe(i,m)*cache.safe(j,m);
-                        }
-                    } else {
-                        alpha.safe(i,j) = alpha.safe(j,i);
-                    }
-                }
 
+            // alpha(i,j) = sum over all points of x[i]*x[j]/e^2
+            impl::matrix_impl::syrk(np, nm, 1.0, cache.raw_data(), nm, 0.0, alpha.raw_data(), np);
+
+            for (uint_t i : range(np)) {
                 beta.safe[i] = 0.0;
                 // beta[i] = sum over all points of x[i]*y/e^2
                 for (uint_t m : range(nm)) {
@@ -116,22 +134,16 @@ namespace vif {
             return fr;
         }
 
-        template<typename TypeY, typename TypeE>
-        linfit_nn_result linfit_do_nn_(const TypeY& y, const TypeE& ye, const vec2d& cache) {
-            linfit_nn_result fr;
-
-            uint_t np = cache.dims[0];
-            uint_t nm = cache.dims[1];
+        // Solve the non-negative problem alpha*p = beta (p >= 0) with multiplicative updates
+        inline bool linfit_nn_multiplicative_(const matrix::mat2d& alpha, const vec1d& beta,
+            vec1d& params) {
 
-            matrix::mat2d alpha;
-            vec1d beta;
-            auto ny = flatten(y/ye);
-            linfit_make_alpha_beta_(ny, cache, alpha, beta);
+            uint_t np = beta.size();
 
             // Initialize coefficients
-            fr.params.resize(np);
+            params.resize(np);
             for (uint_t m : range(np)) {
-                fr.params.safe[m] = (beta.safe[m] > 0.0 ? 1.0 : 0.0);
+                params.safe[m] = (beta.safe[m] > 0.0 ? 1.0 : 0.0);
             }
 
             uint_t titer = 0;
@@ -144,24 +156,242 @@ namespace vif {
                 for (uint_t m0 : range(np)) {
                     double av = 0.0;
                     for (uint_t m1 : range(np)) {
-                        av += alpha.safe(m0,m1)*fr.params.safe[m1];
+                        av += alpha.safe(m0,m1)*params.safe[m1];
                     }
 
                     // Update coeff
-                    double old = fr.params.safe[m0];
-                    fr.params.safe[m0] *= beta.safe[m0]/av;
+                    double old = params.safe[m0];
+                    params.safe[m0] *= beta.safe[m0]/av;
 
-                    ta += abs(fr.params.safe[m0] - old);
+                    ta += abs(params.safe[m0] - old);
                     tb += old;
                 }
 
                 ++titer;
             } while (ta/tb > fit_tftol && titer < titermax);
 
-            if (titer == titermax) {
-                fr.success = false;
+            return titer != titermax;
+        }
+
+        // Solve alpha(idx,idx)*s = beta(idx) with a Cholesky decomposition, using 'l' as
+        // workspace. Returns false if the sub-matrix is singular.
+        inline bool linfit_nn_subsolve_(const matrix::mat2d& alpha, const vec1d& beta,
+            const std::vector<uint_t>& idx, std::vector<double>& l, std::vector<double>& s) {
+
+            const uint_t k = idx.size();
+            l.resize(k*k);
+            s.resize(k);
+
+            for (uint_t i : range(k)) {
+                for (uint_t j : range(k)) {
+                    l[i*k+j] = alpha.safe(idx[i],idx[j]);
+                }
+
+                s[i] = beta.safe[idx[i]];
+            }
+
+            if (!impl::matrix_impl::potrf(k, l.data(), k)) {
+                return false;
+            }
+
+            const double eps = k*std::numeric_limits<double>::epsilon();
+            for (uint_t i : range(k)) {
+                if (sqr(l[i*k+i]) <= eps*alpha.safe(idx[i],idx[i])) {
+                    return false;
+                }
+            }
+
+            // Forward and back substitution
+            for (uint_t i : range(k)) {
+                for (uint_t j : range(i)) {
+                    s[i] -= l[i*k+j]*s[j];
+                }
+
+                s[i] /= l[i*k+i];
+            }
+
+            for (uint_t i = k; i-- > 0;) {
+                for (uint_t j : range(i+1, k)) {
+                    s[i] -= l[j*k+i]*s[j];
+                }
+
+                s[i] /= l[i*k+i];
+            }
+
+            return true;
+        }
+
+        // Solve the non-negative problem alpha*p = beta (p >= 0) with the active set method of
+        // Lawson & Hanson (1974), working directly on the normal equations as in the "fast NNLS"
+        // variant of Bro & De Jong (1997). On input, 'passive' can contain a guess of the
+        // parameters that are not zero (e.g., from a previous fit), and on output it contains
+        // the parameters that are not zero in the solution.
+        inline bool linfit_nn_active_set_(const matrix::mat2d& alpha, const vec1d& beta,
+            vec1d& params, vec1b& passive) {
+
+            const uint_t np = beta.size();
+            params.resize(np);
+            params[_] = 0.0;
+
+            if (passive.size() != np) {
+                passive.resize(np);
+                passive[_] = false;
+            }
+
+            // Parameters that cannot be added to the passive set (degenerate)
+            vec1b excluded(np);
+
+            std::vector<uint_t> idx;
+            std::vector<double> l, s;
+            auto make_idx = [&]() {
+                idx.clear();
+                for (uint_t i : range(np)) {
+                    if (passive.safe[i]) idx.push_back(i);
+                }
+            };
+
+            // Warm start: remove from the passive set the parameters that would be negative
+            make_idx();
+            while (!idx.empty()) {
+                if (!linfit_nn_subsolve_(alpha, beta, idx, l, s)) {
+                    passive[_] = false;
+                    idx.clear();
+                    break;
+                }
+
+                bool neg = false;
+                for (uint_t i : range(idx)) {
+                    if (s[i] <= 0.0) {
+                        passive.safe[idx[i]] = false;
+                        neg = true;
+                    }
+                }
+
+                if (!neg) {
+                    for (uint_t i : range(idx)) {
+                        params.safe[idx[i]] = s[i];
+                    }
+
+                    break;
+                }
+
+                make_idx();
             }
 
+            double bmax = 0.0;
+            for (uint_t i : range(np)) {
+                bmax = std::max(bmax, abs(beta.safe[i]));
+            }
+
+            const double tol = 10.0*np*std::numeric_limits<double>::epsilon()*bmax;
+            const uint_t itermax = 3*np + 10;
+
+            for (uint_t iter = 0; iter < itermax; ++iter) {
+                // Find the parameter with the largest gradient, w = beta - alpha*p
+                uint_t jmax = npos;
+                double wmax = tol;
+                for (uint_t j : range(np)) {
+                    if (passive.safe[j] || excluded.safe[j]) continue;
+
+                    double w = beta.safe[j];
+                    for (uint_t i : range(np)) {
+                        w -= alpha.safe(j,i)*params.safe[i];
+                    }
+
+                    if (w > wmax) {
+                        wmax = w;
+                        jmax = j;
+                    }
+                }
+
+                if (jmax == npos) {
+                    // Converged
+                    return true;
+                }
+
+                passive.safe[jmax] = true;
+                make_idx();
+
+                // Solve on the passive set, and step back while some parameters are negative
+                while (true) {
+                    if (!linfit_nn_subsolve_(alpha, beta, idx, l, s)) {
+                        // Degenerate with the other parameters, do not use it
+                        passive.safe[jmax] = false;
+                        excluded.safe[jmax] = true;
+                        make_idx();
+                        if (!linfit_nn_subsolve_(alpha, beta, idx, l, s)) {
+                            return false;
+                        }
+                    }
+
+                    double a = 1.0;
+                    uint_t imin = npos;
+                    for (uint_t i : range(idx)) {
+                        // Parameters that would become negative (x > s[i] ensures the
+                        // denominator is strictly positive; if x == s[i] == 0, the parameter
+                        // does not move and does not limit the step)
+                        const double x = params.safe[idx[i]];
+                        if (s[i] <= 0.0 && x > s[i]) {
+                            double ta = x/(x - s[i]);
+                            if (imin == npos || ta < a) {
+                                a = ta;
+                                imin = i;
+                            }
+                        }
+                    }
+
+                    if (imin == npos) {
+                        for (uint_t i : range(idx)) {
+                            params.safe[idx[i]] = s[i];
+                        }
+
+                        break;
+                    }
+
+                    // Move towards the solution until the first parameter reaches zero
+                    for (uint_t i : range(idx)) {
+                        double& x = params.safe[idx[i]];
+                        x += a*(s[i] - x);
+                        if (i == imin || x <= 0.0) {
+                            x = 0.0;
+                            passive.safe[idx[i]] = false;
+                        }
+                    }
+
+                    make_idx();
+                }
+            }
+
+            return false;
+        }
+
+        inline bool linfit_nn_solve_(const matrix::mat2d& alpha, const vec1d& beta,
+            vec1d& params, vec1b& passive, linfit_nn_method method) {
+
+            if (method == linfit_nn_method::multiplicative) {
+                return linfit_nn_multiplicative_(alpha, beta, params);
+            } else {
+                return linfit_nn_active_set_(alpha, beta, params, passive);
+            }
+        }
+
+        template<typename TypeY, typename TypeE>
+        linfit_nn_result linfit_do_nn_(const TypeY& y, const TypeE& ye, const vec2d& cache,
+            linfit_nn_method method = linfit_nn_method::active_set) {
+
+            linfit_nn_result fr;
+
+            uint_t np = cache.dims[0];
+            uint_t nm = cache.dims[1];
+
+            matrix::mat2d alpha;
+            vec1d beta;
+            auto ny = flatten(y/ye);
+            linfit_make_alpha_beta_(ny, cache, alpha, beta);
+
+            vec1b passive;
+            fr.success = linfit_nn_solve_(alpha, beta, fr.params, passive, method);
+
             vec1d model(nm);
             for (uint_t m : range(nm)) {
                 model.safe[m] = 0.0;
@@ -232,8 +462,12 @@ namespace vif {
         return impl::linfit_do_(y, ye, cache);
     }
 
+    // Fit a linear combination of the provided arrays to 'y' (with uncertainties 'ye'), with
+    // the constraint that all the coefficients must be positive or zero. The problem is solved
+    // with the given 'method'.
     template<typename TypeY, typename TypeE, typename ... Args>
-    linfit_nn_result linfit_nn(const TypeY& y, const TypeE& ye, Args&&... args) {
+    linfit_nn_result linfit_nn(linfit_nn_method method, const TypeY& y, const TypeE& ye,
+        Args&&... args) {
         bool bad = !meta::same_dims_or_scalar(y, ye, args...);
         if (bad) {
             vif_check(meta::same_dims_or_scalar(y, ye), "incompatible dimensions between Y and "
@@ -247,12 +481,21 @@ namespace vif {
         vec2d cache(np,nm);
         impl::linfit_make_cache_(cache, ye, 0, std::forward<Args>(args)...);
 
-        return impl::linfit_do_nn_(y, ye, cache);
+        return impl::linfit_do_nn_(y, ye, cache, method);
+    }
+
+    // Same as above, using the exact linfit_nn_method::active_set. Note: this function used
+    // to solve the problem with the approximate multiplicative updates; pass
+    // linfit_nn_method::multiplicative as first argument to get the previous behavior.
+    template<typename TypeY, typename TypeE, typename enable = typename std::enable_if<
+        !std::is_same<TypeY, linfit_nn_method>::value>::type, typename ... Args>
+    linfit_nn_result linfit_nn(const TypeY& y, const TypeE& ye, Args&&... args) {
+        return linfit_nn(linfit_nn_method::active_set, y, ye, std::forward<Args>(args)...);
     }
 
     template<std::size_t Dim, typename TypeY, typename TypeE, typename TypeX>
     linfit_nn_result linfit_nn_pack(const vec<Dim,TypeY>& y, const vec<Dim,TypeE>& ye,
-        const vec<Dim+1,TypeX>& x) {
+        const vec<Dim+1,TypeX>& x, linfit_nn_method method = linfit_nn_method::active_set) {
         bool good = true;
         for (uint_t i : range(Dim)) {
             if (x.dims[i+1] != ye.dims[i] || x.dims[i+1] != y.dims[i]) {
@@ -275,7 +518,7 @@ namespace vif {
             cache.safe(i,j) = x.safe[i*x.pitch(0) + j]/ye.safe[j];
         }
 
-        return impl::linfit_do_nn_(y, ye, cache);
+        return impl::linfit_do_nn_(y, ye, cache, method);
     }
 
     template<typename TypeE>
@@ -286,6 +529,10 @@ namespace vif {
         matrix::mat2d alpha;
         linfit_result fr;
 
+        // Non-negative fit, see fit_nn()
+        linfit_nn_result fr_nn;
+        vec1b            nn_passive;
+
         struct pack_tag {};
 
     private :
@@ -427,6 +674,40 @@ namespace vif {
             update_chi2(y);
         }
 
+        // Fit with the constraint that all parameters are positive or zero. The result is
+        // stored in 'fr_nn'. With the active set method, the set of non-zero parameters found
+        // in the previous call is used as starting point, which is faster when fitting similar
+        // data several times.
+        template<typename TypeY>
+        void fit_nn(const TypeY& y, linfit_nn_method method = linfit_nn_method::active_set) {
+            vif_check(meta::same_dims_or_scalar(y, ye), "incompatible dimensions between Y and "
+                "YE arrays (", meta::dims(y), " vs. ", meta::dims(ye), ")");
+
+            uint_t np = cache.dims[0];
+            uint_t nm = cache.dims[1];
+
+            auto tmp = flatten(y/ye);
+            for (uint_t i : range(np)) {
+                beta.safe[i] = 0.0;
+                // beta[i] = sum over all points of x[i]*y/e^2
+                for (uint_t m : range(nm)) {
+                    beta.safe[i] += cache.safe(i,m)*tmp.safe[m];
+                }
+            }
+
+            fr_nn.success = impl::linfit_nn_solve_(alpha, beta, fr_nn.params, nn_passive, method);
+
+            fr_nn.chi2 = 0.0;
+            for (uint_t m : range(nm)) {
+                double model = 0.0;
+                for (uint_t i : range(np)) {
+                    model += fr_nn.params.safe[i]*cache.safe(i,m);
+                }
+
+                fr_nn.chi2 += sqr(model - tmp.safe[m]);
+            }
+        }
+
         template<typename TypeY>
         void update_chi2(const TypeY& y) {
             uint_t np = cache.dims[0];
@@ -454,6 +735,308 @@ namespace vif {
         return linfit_batch_t<TypeE>(typename linfit_batch_t<TypeE>::pack_tag{},
             e, std::forward<Args>(args)...);
     }
+
+    namespace impl {
+        // Call f(i0,i1,t) on chunks of [0,n) from 'nthread' threads, where 't' is the index of
+        // the calling thread (to select a workspace)
+        template<typename F>
+        void linfit_many_parallel_(uint_t n, uint_t nthread, F&& f) {
+            const uint_t chunk = 64;
+            nthread = std::max(uint_t(1), std::min(nthread, (n + chunk - 1)/chunk));
+            if (nthread == 1) {
+                f(uint_t(0), n, uint_t(0));
+                return;
+            }
+
+            parallel_for_each((n + chunk - 1)/chunk, nthread, [&](uint_t c, uint_t t) {
+                f(c*chunk, std::min(n, (c+1)*chunk), t);
+            });
+        }
+
+        struct linfit_many_workspace_ {
+            std::vector<double> cache, ny, model, alpha, linv, tmp;
+        };
+
+        // Cholesky decomposition of the (np x np) alpha matrix, in place. Fails if the matrix is
+        // not positive definite, or if a pivot lost all its precision (degenerate components).
+        inline bool linfit_many_factor_(uint_t np, double* alpha, double* tmp) {
+            for (uint_t i : range(np)) {
+                tmp[i] = alpha[i*np+i];
+            }
+
+            if (!impl::matrix_impl::potrf(np, alpha, np)) {
+                return false;
+            }
+
+            const double eps = np*std::numeric_limits<double>::epsilon();
+            for (uint_t i : range(np)) {
+                if (sqr(alpha[i*np+i]) <= eps*tmp[i]) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Given the Cholesky factor 'l' of the (np x np) alpha matrix, compute the inverse of
+        // 'l' in 'linv' (lower triangle)
+        inline void linfit_many_invert_(uint_t np, const double* l, double* linv) {
+            for (uint_t j : range(np)) {
+                for (uint_t i : range(j)) {
+                    linv[i*np+j] = 0.0;
+                }
+
+                linv[j*np+j] = 1.0/l[j*np+j];
+                for (uint_t i : range(j+1, np)) {
+                    double s = 0.0;
+                    for (uint_t k : range(j, i)) {
+                        s -= l[i*np+k]*linv[k*np+j];
+                    }
+
+                    linv[i*np+j] = s/l[i*np+i];
+                }
+            }
+        }
+
+        // Compute the errors (and, if 'cov' is not null, the covariance matrix) from the
+        // inverse of the Cholesky factor, since alpha^-1 = linv^T*linv
+        inline void linfit_many_errors_(uint_t np, const double* linv, double* err, double* cov) {
+            for (uint_t i : range(np)) {
+                double s = 0.0;
+                for (uint_t k : range(i, np)) {
+                    s += linv[k*np+i]*linv[k*np+i];
+                }
+
+                err[i] = sqrt(s);
+            }
+
+            if (cov) {
+                for (uint_t i : range(np))
+                for (uint_t j : range(i+1)) {
+                    double s = 0.0;
+                    for (uint_t k : range(i, np)) {
+                        s += linv[k*np+i]*linv[k*np+j];
+                    }
+
+                    cov[i*np+j] = cov[j*np+i] = s;
+                }
+            }
+        }
+
+        // Compute the best fit parameters 'p' = linv^T*linv*beta, using 'tmp' as workspace
+        inline void linfit_many_params_(uint_t np, const double* linv, const double* beta,
+            double* tmp, double* p) {
+
+            for (uint_t i : range(np)) {
+                double s = 0.0;
+                for (uint_t k : range(i+1)) {
+                    s += linv[i*np+k]*beta[k];
+                }
+
+                tmp[i] = s;
+            }
+
+            for (uint_t i : range(np)) {
+                double s = 0.0;
+                for (uint_t k : range(i, np)) {
+                    s += linv[k*np+i]*tmp[k];
+                }
+
+                p[i] = s;
+            }
+        }
+
+        // Chi2 of the model p*cache against the weighted data 'ny'
+        inline double linfit_many_chi2_(uint_t np, uint_t nm, const double* cache,
+            const double* p, const double* ny, double* model) {
+
+            impl::matrix_impl::gemv(true, np, nm, 1.0, cache, nm, p, 0.0, model);
+
+            double chi2 = 0.0;
+            for (uint_t m : range(nm)) {
+                chi2 += sqr(model[m] - ny[m]);
+            }
+
+            return chi2;
+        }
+
+        inline void linfit_many_init_(linfit_many_result& res, uint_t nfit, uint_t np,
+            const linfit_many_params& opts) {
+
+            res.success.resize(nfit);
+            res.chi2.resize(nfit);
+            res.params.resize(nfit, np);
+            res.errors.resize(nfit, np);
+            if (opts.covariance) {
+                res.cov.resize(nfit, np, np);
+            }
+        }
+
+        inline void linfit_many_fail_(linfit_many_result& res, uint_t k, uint_t np) {
+            res.success.safe[k] = false;
+            res.chi2.safe[k] = dnan;
+            for (uint_t i : range(np)) {
+                res.params.safe(k,i) = dnan;
+                res.errors.safe(k,i) = dnan;
+            }
+
+            if (!res.cov.empty()) {
+                for (uint_t i : range(np*np)) {
+                    res.cov.safe[k*np*np + i] = dnan;
+                }
+            }
+        }
+    }
+
+    // Solve 'nfit' independent linear problems sharing the same model components 'x'
+    // ([nparam,npt]), with data 'y' ([nfit,npt]) and uncertainties 'ye' ([nfit,npt]).
+    // This is equivalent to calling linfit_pack() on each row of 'y' and 'ye', but does not
+    // allocate memory for each fit, and can use multiple threads.
+    template<typename TypeY, typename TypeE, typename TypeX>
+    linfit_many_result linfit_many(const vec<2,TypeY>& y, const vec<2,TypeE>& ye,
+        const vec<2,TypeX>& x, const linfit_many_params& opts = linfit_many_params()) {
+
+        vif_check(y.dims == ye.dims, "incompatible dimensions between Y and YE arrays (",
+            y.dims, " vs. ", ye.dims, ")");
+        vif_check(x.dims[1] == y.dims[1], "incompatible dimensions between X and Y arrays (",
+            x.dims, " vs. ", y.dims, ")");
+
+        const uint_t nfit = y.dims[0];
+        const uint_t nm = y.dims[1];
+        const uint_t np = x.dims[0];
+
+        linfit_many_result res;
+        impl::linfit_many_init_(res, nfit, np, opts);
+
+        std::vector<impl::linfit_many_workspace_> wsp(std::max(uint_t(1), opts.thread));
+        impl::linfit_many_parallel_(nfit, opts.thread, [&](uint_t k0, uint_t k1, uint_t t) {
+            auto& w = wsp[t];
+            w.cache.resize(np*nm);
+            w.ny.resize(nm);
+            w.model.resize(nm);
+            w.alpha.resize(np*np);
+            w.linv.resize(np*np);
+            w.tmp.resize(2*np);
+
+            for (uint_t k : range(k0, k1)) {
+                // Weighted data and model components
+                for (uint_t m : range(nm)) {
+                    const double iye = 1.0/ye.safe(k,m);
+                    w.ny[m] = y.safe(k,m)*iye;
+                    for (uint_t i : range(np)) {
+                        w.cache[i*nm+m] = x.safe(i,m)*iye;
+                    }
+                }
+
+                // alpha(i,j) = sum over all points of x[i]*x[j]/e^2
+                impl::matrix_impl::syrk(np, nm, 1.0, w.cache.data(), nm, 0.0, w.alpha.data(), np);
+                // beta[i] = sum over all points of x[i]*y/e^2
+                double* beta = w.tmp.data() + np;
+                impl::matrix_impl::gemv(false, np, nm, 1.0, w.cache.data(), nm, w.ny.data(),
+                    0.0, beta);
+
+                if (!impl::linfit_many_factor_(np, w.alpha.data(), w.tmp.data())) {
+                    impl::linfit_many_fail_(res, k, np);
+                    continue;
+                }
+
+                impl::linfit_many_invert_(np, w.alpha.data(), w.linv.data());
+
+                double* p = &res.params.safe(k,0);
+                impl::linfit_many_params_(np, w.linv.data(), beta, w.tmp.data(), p);
+                impl::linfit_many_errors_(np, w.linv.data(), &res.errors.safe(k,0),
+                    opts.covariance ? &res.cov.safe[k*np*np] : nullptr);
+
+                res.success.safe[k] = true;
+                res.chi2.safe[k] = impl::linfit_many_chi2_(np, nm, w.cache.data(), p,
+                    w.ny.data(), w.model.data());
+            }
+        });
+
+        return res;
+    }
+
+    // Same as above, but all the fits share the same uncertainties 'ye' ([npt]). The linear
+    // system then only needs to be inverted once.
+    template<typename TypeY, typename TypeE, typename TypeX>
+    linfit_many_result linfit_many(const vec<2,TypeY>& y, const vec<1,TypeE>& ye,
+        const vec<2,TypeX>& x, const linfit_many_params& opts = linfit_many_params()) {
+
+        vif_check(y.dims[1] == ye.dims[0], "incompatible dimensions between Y and YE arrays (",
+            y.dims, " vs. ", ye.dims, ")");
+        vif_check(x.dims[1] == y.dims[1], "incompatible dimensions between X and Y arrays (",
+            x.dims, " vs. ", y.dims, ")");
+
+        const uint_t nfit = y.dims[0];
+        const uint_t nm = y.dims[1];
+        const uint_t np = x.dims[0];
+
+        linfit_many_result res;
+        impl::linfit_many_init_(res, nfit, np, opts);
+
+        // Setup the linear system once
+        vec1d iye = 1.0/ye;
+        vec2d cache(np, nm);
+        for (uint_t i : range(np))
+        for (uint_t m : range(nm)) {
+            cache.safe(i,m) = x.safe(i,m)*iye.safe[m];
+        }
+
+        vec2d alpha(np, np);
+        impl::matrix_impl::syrk(np, nm, 1.0, cache.raw_data(), nm, 0.0, alpha.raw_data(), np);
+
+        vec1d tmp(np);
+        if (!impl::linfit_many_factor_(np, alpha.raw_data(), tmp.raw_data())) {
+            for (uint_t k : range(nfit)) {
+                impl::linfit_many_fail_(res, k, np);
+            }
+
+            return res;
+        }
+
+        vec2d linv(np, np);
+        vec1d err(np);
+        vec2d cov(np, np);
+        impl::linfit_many_invert_(np, alpha.raw_data(), linv.raw_data());
+        impl::linfit_many_errors_(np, linv.raw_data(), err.raw_data(), cov.raw_data());
+
+        // Best fit parameters are obtained with p = proj*y, with proj = alpha^-1*cache
+        vec2d proj(np, nm);
+        impl::matrix_impl::gemm(np, nm, np, 1.0, cov.raw_data(), np, cache.raw_data(), nm,
+            0.0, proj.raw_data(), nm);
+
+        std::vector<impl::linfit_many_workspace_> wsp(std::max(uint_t(1), opts.thread));
+        impl::linfit_many_parallel_(nfit, opts.thread, [&](uint_t k0, uint_t k1, uint_t t) {
+            auto& w = wsp[t];
+            w.ny.resize(nm);
+            w.model.resize(nm);
+
+            for (uint_t k : range(k0, k1)) {
+                for (uint_t m : range(nm)) {
+                    w.ny[m] = y.safe(k,m)*iye.safe[m];
+                }
+
+                double* p = &res.params.safe(k,0);
+                impl::matrix_impl::gemv(false, np, nm, 1.0, proj.raw_data(), nm, w.ny.data(),
+                    0.0, p);
+
+                for (uint_t i : range(np)) {
+                    res.errors.safe(k,i) = err.safe[i];
+                }
+
+                if (opts.covariance) {
+                    std::copy(cov.raw_data(), cov.raw_data() + np*np,
+                        res.cov.raw_data() + k*np*np);
+                }
+
+                res.success.safe[k] = true;
+                res.chi2.safe[k] = impl::linfit_many_chi2_(np, nm, cache.raw_data(), p,
+                    w.ny.data(), w.model.data());
+            }
+        });
+
+        return res;
+    }
 }
 
 #endif
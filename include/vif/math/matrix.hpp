@@ -7,9 +7,12 @@
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
 #include "vif/math/base.hpp"
+#include <thread>
 
 #define VIF_INCLUDING_MATH_MATRIX_BITS
+#include "vif/math/bits/matrix-kernels.hpp"
 #include "vif/math/bits/matrix-types.hpp"
 #include "vif/math/bits/matrix-functions.hpp"
 #undef VIF_INCLUDING_MATH_MATRIX_BITS
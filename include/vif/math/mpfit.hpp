@@ -4,6 +4,7 @@
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
 #include "vif/utility/generic.hpp"
 #include "vif/math/base.hpp"
 #include "vif/math/matrix.hpp"
@@ -19,8 +20,10 @@ namespace vif {
     //  - In IDL, the MPFIT routine does support not recursive calls (i.e. fitting a model that itself
     //    calls MPFIT). There is a way around this problem, although it is tedious. The C++ version
     //    supports recursion naturally.
+    //  - Explicit derivatives are given as a separate function returning the whole Jacobian
+    //    matrix, rather than by the deviate function itself.
+    //  - Finite-difference derivatives can be computed in parallel.
     //  - For simplicity, the C++ version does not support:
-    //      - specifying explicit derivatives,
     //      - registering a callback for each iteration,
     //      - tied parameters.
     //
@@ -46,6 +49,15 @@ namespace vif {
         matrix::mat2d covar;
     };
 
+    // Result of mpfit_many(), one row per fit
+    struct mpfit_many_result {
+        vec1b success; // [nfit]
+        vec1d chi2;    // [nfit]
+        vec1u iter;    // [nfit]
+        vec2d params;  // [nfit,nparam]
+        vec2d errors;  // [nfit,nparam], unless mpfit_options::nocovar is set
+    };
+
     struct mpfit_options {
         mpfit_options() : nparam(0) {}
 
@@ -85,6 +97,8 @@ namespace vif {
         double ftol = 1e-10;   // maximum relative change of chi2 to select solution
         double xtol = 1e-10;   // target relative error on the solution
         bool nocovar = false;  // do not compute errors and covariance matrix (faster)
+        uint_t thread = 1;     // number of threads used to compute finite-difference derivatives;
+                               // the deviate function must then be thread safe (default: 1)
     };
 
     // Numerically stable sqrt(total(sqr(v)))
@@ -113,17 +127,20 @@ namespace vif {
         }
     }
 
-    // Compute the Jacobian matrix with finite difference derivatives
+    // Compute the Jacobian matrix with finite difference derivatives.
+    // The result is stored in 'fjac', which must have dimensions [x.size(), fvec.size()]. 'xp'
+    // is a workspace (one parameter vector per thread) which can be reused between calls.
     template<typename F>
-    vec2d mpfit_fdjac2(F&& deviate, const vec1d& xall, const vec1u& ifree, const vec1d& x,
-        const vec1d& fvec, const mpfit_options& options) {
+    void mpfit_fdjac2(F&& deviate, const vec1d& xall, const vec1u& ifree, const vec1d& x,
+        const vec1d& fvec, const mpfit_options& options, vec2d& fjac, std::vector<vec1d>& xp) {
 
         const double eps = sqrt(std::numeric_limits<double>::epsilon());
 
         const uint_t m = fvec.size();
         const uint_t n = x.size();
 
-        vec2d fjac(n, m);
+        vif_check(fjac.dims[0] == n && fjac.dims[1] == m, "incompatible dimensions for "
+            "Jacobian matrix (", fjac.dims, " vs. {", n, ", ", m, "})");
 
         // Calculate the step
         vec1d h(n);
@@ -151,27 +168,70 @@ namespace vif {
             }
         }
 
-        // Compute the matrix for each parameter
-        for (uint_t p : range(n)) {
+        // Compute the matrix for one parameter, using the parameter vector 'txp'
+        auto do_param = [&](uint_t p, vec1d& txp) {
             uint_t ip = ifree[p];
 
-            vec1d xp = xall;
-            xp[ip] += h[p];
-            vec1d fp = flatten(deviate(xp));
+            txp.safe[ip] = xall.safe[ip] + h.safe[p];
+            vec1d fp = flatten(deviate(txp));
+            vif_check(fp.size() == m, "deviate function returned a different number of "
+                "elements (", fp.size(), " vs. ", m, ")");
 
             if (options.deriv[ip] == mpfit_options::deriv_backward ||
                 options.deriv[ip] == mpfit_options::deriv_forward ||
                 options.deriv[ip] == mpfit_options::deriv_auto) {
                 // One sided derivative
-                fjac(p,_) = (fp - fvec)/h[p];
+                const double ih = 1.0/h.safe[p];
+                for (uint_t k : range(m)) {
+                    fjac.safe(p,k) = (fp.safe[k] - fvec.safe[k])*ih;
+                }
             } else {
                 // Two sided derivative
-                xp[ip] = xall[ip] - h[p];
-                vec1d fm = flatten(deviate(xp));
-                fjac(p,_) = (fp - fm)/(2.0*h[p]);
+                txp.safe[ip] = xall.safe[ip] - h.safe[p];
+                vec1d fm = flatten(deviate(txp));
+                vif_check(fm.size() == m, "deviate function returned a different number of "
+                    "elements (", fm.size(), " vs. ", m, ")");
+
+                const double ih = 0.5/h.safe[p];
+                for (uint_t k : range(m)) {
+                    fjac.safe(p,k) = (fp.safe[k] - fm.safe[k])*ih;
+                }
             }
+
+            txp.safe[ip] = xall.safe[ip];
+        };
+
+        const uint_t nthread = std::max(uint_t(1), std::min(options.thread, n));
+        if (xp.size() < nthread) {
+            xp.resize(nthread);
         }
 
+        for (uint_t t : range(nthread)) {
+            xp[t] = xall;
+        }
+
+        if (nthread == 1) {
+            for (uint_t p : range(n)) {
+                do_param(p, xp[0]);
+            }
+
+            return;
+        }
+
+        // Each thread picks the next parameter to compute, until all are done
+        impl::parallel_for_each(n, nthread, [&](uint_t p, uint_t t) {
+            do_param(p, xp[t]);
+        });
+    }
+
+    // Compute the Jacobian matrix with finite difference derivatives
+    template<typename F>
+    vec2d mpfit_fdjac2(F&& deviate, const vec1d& xall, const vec1u& ifree, const vec1d& x,
+        const vec1d& fvec, const mpfit_options& options) {
+
+        vec2d fjac(x.size(), fvec.size());
+        std::vector<vec1d> xp;
+        mpfit_fdjac2(deviate, xall, ifree, x, fvec, options, fjac, xp);
         return fjac;
     }
 
@@ -521,8 +581,23 @@ namespace vif {
         return r;
     }
 
-    template<typename F>
-    mpfit_result mpfit(F&& deviate, vec1d xall, mpfit_options options = mpfit_options()) {
+namespace impl {
+namespace mpfit_impl {
+    // Work arrays of the solver. They are resized as needed by each fit, and can be reused
+    // between fits of similar dimensions to avoid reallocating them.
+    struct workspace {
+        vec1d x, fvec, qtf, diag, wa1, wa2, wa4;
+        vec2d jac, fjac;
+        vec1u ipiv;
+        std::vector<vec1d> xp; // finite-difference parameter vectors, see mpfit_fdjac2()
+    };
+
+    // Generic implementation, 'jacobian' is called to fill the Jacobian matrix (of dimensions
+    // [nfree, npt]) at the current position
+    template<typename F, typename J>
+    mpfit_result mpfit(F&& deviate, J&& jacobian, vec1d xall, mpfit_options options,
+        workspace& ws) {
+
         const double eps = std::numeric_limits<double>::epsilon();
 
         mpfit_result res;
@@ -550,12 +625,22 @@ namespace vif {
 
         const uint_t n = ifree.size();
 
+        vec1d& x = ws.x;
+        vec1d& fvec = ws.fvec;
+        vec1d& qtf = ws.qtf;
+        vec1d& diag = ws.diag;
+        vec1d& wa1 = ws.wa1;
+        vec1d& wa2 = ws.wa2;
+        vec1d& wa4 = ws.wa4;
+        vec2d& fjac = ws.fjac;
+        vec1u& ipiv = ws.ipiv;
+
         // Initialization
-        vec1d x = xall[ifree];
-        vec1d fvec = flatten(deviate(xall));
+        x = xall[ifree];
+        fvec = flatten(deviate(xall));
         double fnorm = mpfit_enorm(fvec);
         double fnorm1 = fnorm;
-        vec1d qtf(n);
+        qtf.resize(n);
 
         const uint_t npt = fvec.size();
 
@@ -565,28 +650,28 @@ namespace vif {
         double delta = dnan;
         double par = 0.0;
         double xnorm = dnan;
-        vec1d diag;
-        vec2d fjac;
-        vec1u ipiv;
+
+        // Full Jacobian matrix, allocated once and reused at each iteration
+        vec2d& jac = ws.jac;
+        jac.resize(n, npt);
 
         // l.3243 mpfit.pro
         while (true) {
-            fjac = mpfit_fdjac2(deviate, xall, ifree, x, fvec, options);
+            jacobian(xall, ifree, x, fvec, options, jac);
 
             // Set derivatives of frozen parameters to zero
             for (uint_t p : range(n)) {
-                if (!is_nan(llim[p]) && total(fvec*fjac(p,_)) > 0.0) {
-                    fjac(p,_) = 0.0;
+                if (!is_nan(llim[p]) && total(fvec*jac(p,_)) > 0.0) {
+                    jac(p,_) = 0.0;
                 }
-                if (!is_nan(ulim[p]) && total(fvec*fjac(p,_)) < 0.0) {
-                    fjac(p,_) = 0.0;
+                if (!is_nan(ulim[p]) && total(fvec*jac(p,_)) < 0.0) {
+                    jac(p,_) = 0.0;
                 }
             }
 
             // Compute QR factorization of the Jacobian
             // l.3338 mpfit.pro
-            vec1d wa1, wa2;
-            mpfit_qrfac(fjac, ipiv, wa1, wa2);
+            mpfit_qrfac(jac, ipiv, wa1, wa2);
 
             if (iter == 1u) {
                 diag = wa2;
@@ -602,20 +687,20 @@ namespace vif {
 
             // Form (Q transpose)*fvec and store the first n components in qtf
             // l.3371 mpfit.pro
-            vec1d wa4 = fvec;
+            wa4 = fvec;
             for (uint_t p : range(n)) {
                 uint_t lp = ipiv[p];
-                if (fjac(lp,p) != 0.0) {
-                    wa4[p-_] -= fjac(lp,p-_)*total(fjac(lp,p-_)*wa4[p-_])/fjac(lp,p);
+                if (jac(lp,p) != 0.0) {
+                    wa4[p-_] -= jac(lp,p-_)*total(jac(lp,p-_)*wa4[p-_])/jac(lp,p);
                 }
 
-                fjac(lp,p) = wa1(p);
+                jac(lp,p) = wa1(p);
                 qtf[p] = wa4[p];
             }
 
             // Reform the Jacobian matrix (only need square R factor)
             // l.3388 mpfit.pro
-            fjac = fjac(ipiv,_-(n-1));
+            fjac = jac(ipiv,_-(n-1));
 
             // Check for overflow
             bool stop = false;
@@ -867,6 +952,43 @@ namespace vif {
 
         return res;
     }
+}
+}
+
+    template<typename F>
+    mpfit_result mpfit(F&& deviate, vec1d xall, mpfit_options options = mpfit_options()) {
+        impl::mpfit_impl::workspace ws;
+        return impl::mpfit_impl::mpfit(deviate, [&](const vec1d& txall, const vec1u& ifree,
+            const vec1d& x, const vec1d& fvec, const mpfit_options& opts, vec2d& jac) {
+            mpfit_fdjac2(deviate, txall, ifree, x, fvec, opts, jac, ws.xp);
+        }, std::move(xall), std::move(options), ws);
+    }
+
+    // Same as above, but with explicit derivatives. The function 'jacobian' takes the same
+    // argument as 'deviate', and must return the derivative of the deviates with respect to
+    // each parameter, as an array of dimensions [nparam, ...] where the trailing dimensions are
+    // those of the array returned by 'deviate'. The rows of frozen parameters are ignored.
+    template<typename F, typename J, typename enable = typename std::enable_if<
+        !meta::is_vec<J>::value>::type>
+    mpfit_result mpfit(F&& deviate, J&& jacobian, vec1d xall,
+        mpfit_options options = mpfit_options()) {
+
+        impl::mpfit_impl::workspace ws;
+        return impl::mpfit_impl::mpfit(deviate, [&](const vec1d& txall, const vec1u& ifree,
+            const vec1d&, const vec1d& fvec, const mpfit_options&, vec2d& jac) {
+
+            auto tj = jacobian(txall);
+            const uint_t m = fvec.size();
+            vif_check(tj.dims[0] == txall.size() && tj.size() == txall.size()*m,
+                "incompatible dimensions for the Jacobian matrix (", tj.dims, " vs. ",
+                txall.size(), " parameters and ", m, " deviates)");
+
+            for (uint_t p : range(ifree))
+            for (uint_t k : range(m)) {
+                jac.safe(p,k) = tj.safe[ifree.safe[p]*m + k];
+            }
+        }, std::move(xall), std::move(options), ws);
+    }
 
     // Wrapper around mpfit() for standard deviate (y - ytest)/yerr, where y and yerr are given and
     // ytest is compted from a model function taking as a first argument the position x at which to
@@ -887,6 +1009,131 @@ namespace vif {
             return (y - model(x,p))/ye;
         }, params, options);
     }
+
+    // Solve 'nfit' independent non-linear problems with the same parameters. The deviate
+    // function is called as deviate(k,p) to get the deviates of fit 'k' for parameters 'p',
+    // and the initial parameters of fit 'k' are given in params(k,_). The options are shared by
+    // all fits, and 'thread' sets the number of fits that are solved concurrently (the deviate
+    // function must then be thread safe). Note that options.thread still applies to each fit,
+    // so the total number of threads can be up to thread*options.thread. Each thread reuses the
+    // same solver work arrays for all the fits it solves.
+    template<typename F>
+    mpfit_many_result mpfit_many(F&& deviate, const vec2d& params,
+        mpfit_options options = mpfit_options(), uint_t thread = 1) {
+
+        const uint_t nfit = params.dims[0];
+        const uint_t np = params.dims[1];
+
+        if (options.nparam == 0u) {
+            // No per-parameter option provided, use defaults but keep the global options
+            mpfit_options defaults(np);
+            options.nparam      = np;
+            options.upper_limit = defaults.upper_limit;
+            options.lower_limit = defaults.lower_limit;
+            options.frozen      = defaults.frozen;
+            options.max_step    = defaults.max_step;
+            options.deriv       = defaults.deriv;
+            options.deriv_step  = defaults.deriv_step;
+            options.deriv_rstep = defaults.deriv_rstep;
+        } else {
+            vif_check(options.nparam == np, "incompatible number of elements in options "
+                "with provided parameters (", options.nparam, " vs ", np, ")");
+        }
+
+        const uint_t nthread = std::max(uint_t(1), std::min(thread, nfit));
+
+        mpfit_many_result res;
+        res.success.resize(nfit);
+        res.chi2.resize(nfit);
+        res.iter.resize(nfit);
+        res.params.resize(nfit, np);
+        if (!options.nocovar) {
+            res.errors.resize(nfit, np);
+        }
+
+        // Solver work arrays and initial parameters, one per thread
+        struct fit_workspace {
+            impl::mpfit_impl::workspace ws;
+            vec1d p;
+        };
+
+        auto do_fit = [&](uint_t k, fit_workspace& w) {
+            w.p.resize(np);
+            for (uint_t i : range(np)) {
+                w.p.safe[i] = params.safe(k,i);
+            }
+
+            auto fdev = [&](const vec1d& tp) {
+                return deviate(k, tp);
+            };
+
+            mpfit_result fr = impl::mpfit_impl::mpfit(fdev, [&](const vec1d& txall,
+                const vec1u& ifree, const vec1d& x, const vec1d& fvec, const mpfit_options& opts,
+                vec2d& jac) {
+                mpfit_fdjac2(fdev, txall, ifree, x, fvec, opts, jac, w.ws.xp);
+            }, w.p, options, w.ws);
+
+            res.success.safe[k] = fr.success;
+            res.chi2.safe[k] = fr.chi2;
+            res.iter.safe[k] = fr.iter;
+            for (uint_t i : range(np)) {
+                res.params.safe(k,i) = fr.params.safe[i];
+            }
+
+            if (!options.nocovar) {
+                for (uint_t i : range(np)) {
+                    res.errors.safe(k,i) = fr.errors.safe[i];
+                }
+            }
+        };
+
+        std::vector<fit_workspace> ws(nthread);
+
+        if (nthread == 1) {
+            for (uint_t k : range(nfit)) {
+                do_fit(k, ws[0]);
+            }
+
+            return res;
+        }
+
+        // Each thread picks the next fit to solve, until all are done
+        impl::parallel_for_each(nfit, nthread, [&](uint_t k, uint_t t) {
+            do_fit(k, ws[t]);
+        });
+
+        return res;
+    }
+
+    // Wrapper around mpfit_many() for standard deviates (y - ytest)/yerr, where each row of 'y'
+    // and 'ye' ([nfit,npt]) is a separate fit, and ytest is computed from a model function
+    // taking as first argument the position 'x' at which to compute the model (shared by all
+    // fits) and the function parameters.
+    template<typename F, typename TX, typename TY, typename TYE>
+    mpfit_many_result mpfitfun_many(const vec<2,TY>& y, const vec<2,TYE>& ye, const TX& x,
+        F&& model, const vec2d& params, const mpfit_options& options = mpfit_options(),
+        uint_t thread = 1) {
+
+        vif_check(y.dims == ye.dims, "incompatible dimensions between Y and YE arrays (",
+            y.dims, " vs. ", ye.dims, ")");
+        vif_check(y.dims[0] == params.dims[0], "incompatible number of fits between Y and "
+            "initial parameters (", y.dims[0], " vs. ", params.dims[0], ")");
+
+        const uint_t nm = y.dims[1];
+
+        return mpfit_many([&](uint_t k, const vec1d& p) {
+            auto m = model(x, p);
+            vif_check(m.size() == nm, "model function returned an incorrect number of "
+                "elements (", m.size(), " vs. ", nm, ")");
+
+            vec1d d(nm);
+            for (uint_t i : range(nm)) {
+                d.safe[i] = (y.safe(k,i) - m.safe[i])/ye.safe(k,i);
+            }
+
+            return d;
+        }, params, options, thread);
+    }
 }
 
 #endif
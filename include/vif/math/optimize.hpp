@@ -4,6 +4,8 @@
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/core/range.hpp"
+#include "vif/core/parallel.hpp"
+#include "vif/math/base.hpp"
 
 #ifndef NO_GSL
 #include <gsl/gsl_multimin.h>
@@ -16,11 +18,18 @@ namespace vif {
         uint_t max_iter = 1000;
     };
 
+    // Output of the minimizers. 'success' is true if the minimizer stopped on one of its
+    // convergence criteria, or because no lower value could be found along the search
+    // direction (no progress possible, e.g., at a minimum where numerical noise dominates).
+    // It is false if the maximum number of iterations was reached, or if the function
+    // returned a non-finite value at the current point. 'neval' counts the calls to the
+    // function (values and/or gradients; numerical gradients count as one call).
     struct minimize_result {
         bool success = false;
         vec1d params;
         double value = dnan;
         uint_t niter = 0;
+        uint_t neval = 0;
     };
 
     enum class minimize_function_output {
@@ -35,18 +44,24 @@ namespace vif {
 
         return minimize_result{};
     #else
-        using func_ptr = typename std::decay<decltype(func)>::type*;
-
         // Initialize return value
         minimize_result ret;
         ret.params.resize(start.dims);
 
         const uint_t n = start.size();
 
+        // Count function evaluations
+        auto cfunc = [&](const vec1d& x, minimize_function_output o) {
+            ++ret.neval;
+            return func(x, o);
+        };
+
+        using func_ptr = decltype(&cfunc);
+
         // Initialize minimized function
         gsl_multimin_function_fdf mf;
         mf.n = n;
-        mf.params = reinterpret_cast<void*>(&func);
+        mf.params = reinterpret_cast<void*>(&cfunc);
 
         mf.f = [](const gsl_vector* x, void* p) {
             const uint_t tn = x->size;
@@ -151,6 +166,470 @@ namespace vif {
         return ret;
     #endif
     }
+
+    struct minimize_lbfgs_params {
+        uint_t history = 10;         // number of previous steps used to approximate the Hessian
+        double gtol = 1e-6;          // stop when all (projected) gradient components are below
+                                     // this value
+        double ftol = 1e-12;         // stop when the relative decrease of the function is below
+                                     // this value
+        uint_t max_iter = 1000;      // maximum number of iterations
+        vec1d lower, upper;          // bounds on the parameters (empty or nan = no bound)
+        double gradient_step = 1e-6; // relative step for finite-difference gradients
+        uint_t thread = 1;           // number of threads for finite-difference gradients
+    };
+
+namespace impl {
+namespace optimize_impl {
+    // Signatures supported by minimize_lbfgs():
+    //  - double f(const vec1d& x, vec1d& g): returns the value and writes the gradient in 'g',
+    //  - vec1d f(const vec1d& x, minimize_function_output o): as for minimize_bfgs(),
+    //  - double f(const vec1d& x): returns the value, the gradient is computed numerically.
+    struct lbfgs_gradient_ref_tag {};
+    struct lbfgs_gradient_vec_tag {};
+    struct lbfgs_value_only_tag {};
+
+    template<typename F>
+    struct lbfgs_func_kind_impl_ {
+        template <typename U> static lbfgs_gradient_ref_tag dummy(typename std::decay<
+            decltype(std::declval<U&>()(std::declval<const vec1d&>(), std::declval<vec1d&>()))
+        >::type*, int);
+        template <typename U> static lbfgs_gradient_vec_tag dummy(typename std::decay<
+            decltype(std::declval<U&>()(std::declval<const vec1d&>(),
+                minimize_function_output::all))
+        >::type*, long);
+        template <typename U> static lbfgs_value_only_tag dummy(...);
+        using type = decltype(dummy<F>(0, 0));
+    };
+
+    template<typename F>
+    using lbfgs_func_kind = typename lbfgs_func_kind_impl_<typename std::decay<F>::type>::type;
+
+    struct lbfgs_workspace {
+        uint_t n = 0;
+        vec1d lower, upper;
+        std::vector<vec1d> xt; // one parameter vector per thread for numerical gradients
+        vec1d fv;              // function values for numerical gradients
+    };
+
+    template<typename F>
+    double lbfgs_eval(F& func, const vec1d& x, vec1d& g, lbfgs_workspace&,
+        const minimize_lbfgs_params&, lbfgs_gradient_ref_tag) {
+        return func(x, g);
+    }
+
+    template<typename F>
+    double lbfgs_eval(F& func, const vec1d& x, vec1d& g, lbfgs_workspace& w,
+        const minimize_lbfgs_params&, lbfgs_gradient_vec_tag) {
+
+        vec1d r = func(x, minimize_function_output::all);
+        vif_check(r.size() == w.n+1, "function must return its value and gradient (expected ",
+            w.n+1, " values, got ", r.size(), ")");
+
+        for (uint_t i : range(w.n)) {
+            g.safe[i] = r.safe[i+1];
+        }
+
+        return r.safe[0];
+    }
+
+    template<typename F>
+    double lbfgs_eval(F& func, const vec1d& x, vec1d& g, lbfgs_workspace& w,
+        const minimize_lbfgs_params& opts, lbfgs_value_only_tag) {
+
+        const uint_t n = w.n;
+        const double f0 = func(x);
+
+        // Central differences, or one-sided close to the bounds. The 2*n evaluations
+        // are independent and are shared among the threads. The function is never evaluated
+        // outside of the bounds.
+        w.fv.resize(2*n);
+        auto do_param = [&](uint_t i, vec1d& xt) {
+            double h = opts.gradient_step*std::max(1.0, abs(x.safe[i]));
+            bool up = !(x.safe[i] + h > w.upper.safe[i]);
+            bool dn = !(x.safe[i] - h < w.lower.safe[i]);
+
+            if (!up && !dn) {
+                // Bounds closer than 2*h: reduce the step so that it fits on the side of
+                // the farthest bound
+                h = 0.5*(w.upper.safe[i] - w.lower.safe[i]);
+                if (h <= 0.0) {
+                    // Parameter fixed by its bounds
+                    g.safe[i] = 0.0;
+                    return;
+                }
+
+                up = (w.upper.safe[i] - x.safe[i] >= x.safe[i] - w.lower.safe[i]);
+            }
+
+            if (up && dn) {
+                xt.safe[i] = x.safe[i] + h;
+                w.fv.safe[2*i+0] = func(xt);
+                xt.safe[i] = x.safe[i] - h;
+                w.fv.safe[2*i+1] = func(xt);
+                g.safe[i] = (w.fv.safe[2*i+0] - w.fv.safe[2*i+1])/(2.0*h);
+            } else if (up) {
+                xt.safe[i] = std::min(x.safe[i] + h, w.upper.safe[i]);
+                g.safe[i] = (func(xt) - f0)/(xt.safe[i] - x.safe[i]);
+            } else {
+                xt.safe[i] = std::max(x.safe[i] - h, w.lower.safe[i]);
+                g.safe[i] = (f0 - func(xt))/(x.safe[i] - xt.safe[i]);
+            }
+
+            xt.safe[i] = x.safe[i];
+        };
+
+        const uint_t nthread = std::max(uint_t(1), std::min(opts.thread, n));
+        w.xt.resize(nthread);
+        for (uint_t t : range(nthread)) {
+            w.xt[t] = x;
+        }
+
+        if (nthread == 1) {
+            for (uint_t i : range(n)) {
+                do_param(i, w.xt[0]);
+            }
+
+            return f0;
+        }
+
+        impl::parallel_for_each(n, nthread, [&](uint_t i, uint_t t) {
+            do_param(i, w.xt[t]);
+        });
+
+        return f0;
+    }
+
+    inline double lbfgs_dot(const vec1d& a, const vec1d& b) {
+        double r = 0.0;
+        for (uint_t i : range(a)) {
+            r += a.safe[i]*b.safe[i];
+        }
+
+        return r;
+    }
+
+    // Minimizer of the cubic interpolating f and its derivative at 'a' and 'b', restricted to
+    // the interval [lo,hi] (see Nocedal & Wright 2006, eq. 3.59)
+    inline double lbfgs_cubic_min(double a, double fa, double da, double b, double fb,
+        double db, double lo, double hi) {
+
+        double d1 = da + db - 3.0*(fa - fb)/(a - b);
+        double d2s = d1*d1 - da*db;
+        double r = 0.5*(lo + hi);
+        if (d2s >= 0.0) {
+            double d2 = (b > a ? 1.0 : -1.0)*sqrt(d2s);
+            double t = b - (b - a)*(db + d2 - d1)/(db - da + 2.0*d2);
+            if (is_finite(t)) r = t;
+        }
+
+        // Stay away from the edges of the interval
+        const double margin = 0.1*(hi - lo);
+        return std::min(std::max(r, lo + margin), hi - margin);
+    }
+}
+}
+
+    // Minimize a function with the limited-memory BFGS algorithm (L-BFGS), optionally with
+    // bound constraints on the parameters (projected L-BFGS, similar in spirit to L-BFGS-B).
+    // Unlike minimize_bfgs(), this does not need the GSL, only stores 'opts.history' vectors
+    // instead of the full Hessian, and does not allocate memory in the iteration loop.
+    // The function can either provide its gradient, or let it be computed numerically (see
+    // impl::optimize_impl::lbfgs_func_kind for the supported signatures).
+    template<typename F>
+    minimize_result minimize_lbfgs(const minimize_lbfgs_params& opts, const vec1d& start,
+        F&& func) {
+
+        using namespace impl::optimize_impl;
+        using kind = lbfgs_func_kind<F>;
+
+        const uint_t n = start.size();
+        const uint_t m = std::max(uint_t(1), opts.history);
+
+        lbfgs_workspace w;
+        w.n = n;
+        w.lower = replicate(-dinf, n);
+        w.upper = replicate(+dinf, n);
+        if (!opts.lower.empty()) {
+            vif_check(opts.lower.size() == n, "lower bounds must have as many elements as the "
+                "parameters (", opts.lower.size(), " vs. ", n, ")");
+            for (uint_t i : range(n)) {
+                if (!is_nan(opts.lower.safe[i])) w.lower.safe[i] = opts.lower.safe[i];
+            }
+        }
+        if (!opts.upper.empty()) {
+            vif_check(opts.upper.size() == n, "upper bounds must have as many elements as the "
+                "parameters (", opts.upper.size(), " vs. ", n, ")");
+            for (uint_t i : range(n)) {
+                if (!is_nan(opts.upper.safe[i])) w.upper.safe[i] = opts.upper.safe[i];
+            }
+        }
+
+        bool bounded = false;
+        for (uint_t i : range(n)) {
+            vif_check(w.lower.safe[i] <= w.upper.safe[i], "lower bound is larger than upper "
+                "bound for parameter ", i, " (", w.lower.safe[i], " > ", w.upper.safe[i], ")");
+            bounded = bounded || is_finite(w.lower.safe[i]) || is_finite(w.upper.safe[i]);
+        }
+
+        auto project = [&](vec1d& x) {
+            for (uint_t i : range(n)) {
+                x.safe[i] = std::min(std::max(x.safe[i], w.lower.safe[i]), w.upper.safe[i]);
+            }
+        };
+
+        // History buffers (circular)
+        vec2d sh(m, n), yh(m, n);
+        vec1d rho(m), ah(m);
+        uint_t nh = 0, ih = 0;
+
+        vec1d x = start, g(n), d(n), xn(n), gn(n);
+        project(x);
+
+        minimize_result ret;
+        double f = lbfgs_eval(func, x, g, w, opts, kind{});
+        ++ret.neval;
+
+        // Is parameter 'i' held at a bound by the gradient?
+        auto is_active = [&](uint_t i, const vec1d& tx, const vec1d& tg) {
+            return (tx.safe[i] <= w.lower.safe[i] && tg.safe[i] > 0.0) ||
+                   (tx.safe[i] >= w.upper.safe[i] && tg.safe[i] < 0.0);
+        };
+
+        auto pgnorm = [&]() {
+            double r = 0.0;
+            for (uint_t i : range(n)) {
+                if (!is_active(i, x, g)) r = std::max(r, abs(g.safe[i]));
+            }
+
+            return r;
+        };
+
+        const double c1 = 1e-4, c2 = 0.9;
+
+        while (true) {
+            if (!is_finite(f)) break;
+
+            if (pgnorm() <= opts.gtol) {
+                ret.success = true;
+                break;
+            }
+
+            if (ret.niter >= opts.max_iter) break;
+            ++ret.niter;
+
+            // Search direction with the two-loop recursion, d = -H*g, ignoring the parameters
+            // held at their bounds
+            for (uint_t i : range(n)) {
+                d.safe[i] = (is_active(i, x, g) ? 0.0 : -g.safe[i]);
+            }
+
+            for (uint_t k : range(nh)) {
+                uint_t j = (ih + m - 1 - k) % m;
+                double a = 0.0;
+                for (uint_t i : range(n)) {
+                    a += sh.safe(j,i)*d.safe[i];
+                }
+
+                a *= rho.safe[j];
+                ah.safe[j] = a;
+                for (uint_t i : range(n)) {
+                    d.safe[i] -= a*yh.safe(j,i);
+                }
+            }
+
+            if (nh > 0) {
+                // Initial Hessian scaling from the last step
+                uint_t j = (ih + m - 1) % m;
+                double yy = 0.0;
+                for (uint_t i : range(n)) {
+                    yy += sqr(yh.safe(j,i));
+                }
+
+                const double gamma = 1.0/(rho.safe[j]*yy);
+                for (uint_t i : range(n)) {
+                    d.safe[i] *= gamma;
+                }
+            }
+
+            for (uint_t k : range(nh)) {
+                uint_t j = (ih + m - nh + k) % m;
+                double b = 0.0;
+                for (uint_t i : range(n)) {
+                    b += yh.safe(j,i)*d.safe[i];
+                }
+
+                b = ah.safe[j] - rho.safe[j]*b;
+                for (uint_t i : range(n)) {
+                    d.safe[i] += b*sh.safe(j,i);
+                }
+            }
+
+            if (bounded) {
+                for (uint_t i : range(n)) {
+                    if (is_active(i, x, g)) d.safe[i] = 0.0;
+                }
+            }
+
+            double dg = lbfgs_dot(d, g);
+            if (!(dg < 0.0)) {
+                // Not a descent direction, restart from steepest descent
+                nh = 0;
+                for (uint_t i : range(n)) {
+                    d.safe[i] = (is_active(i, x, g) ? 0.0 : -g.safe[i]);
+                }
+
+                dg = lbfgs_dot(d, g);
+            }
+
+            // Initial step: unit step, except on the first iteration
+            double step = 1.0;
+            if (nh == 0) {
+                step = std::min(1.0, 1.0/sqrt(-dg));
+            }
+
+            // Line search
+            double fn = dnan;
+            bool found = false;
+            if (!bounded) {
+                // Strong Wolfe conditions (Nocedal & Wright 2006, algorithms 3.5 and 3.6)
+                auto phi = [&](double a, double& dphi) {
+                    for (uint_t i : range(n)) {
+                        xn.safe[i] = x.safe[i] + a*d.safe[i];
+                    }
+
+                    double v = lbfgs_eval(func, xn, gn, w, opts, kind{});
+                    ++ret.neval;
+                    dphi = lbfgs_dot(gn, d);
+                    return v;
+                };
+
+                double a0 = 0.0, f0 = f, d0 = dg;
+                double a1 = step;
+                double lo = 0.0, flo = f, dlo = dg, hi = 0.0, fhi = 0.0, dhi = 0.0;
+                bool zoom = false;
+                for (uint_t it = 0; it < 20; ++it) {
+                    double d1;
+                    double f1 = phi(a1, d1);
+                    if (!is_finite(f1) || f1 > f + c1*a1*dg || (it > 0 && f1 >= f0)) {
+                        lo = a0; flo = f0; dlo = d0;
+                        hi = a1; fhi = f1; dhi = d1;
+                        zoom = true;
+                        break;
+                    }
+
+                    if (abs(d1) <= -c2*dg) {
+                        fn = f1;
+                        found = true;
+                        break;
+                    }
+
+                    if (d1 >= 0.0) {
+                        lo = a1; flo = f1; dlo = d1;
+                        hi = a0; fhi = f0; dhi = d0;
+                        zoom = true;
+                        break;
+                    }
+
+                    a0 = a1; f0 = f1; d0 = d1;
+                    a1 *= 2.0;
+                }
+
+                for (uint_t it = 0; zoom && it < 30; ++it) {
+                    double a;
+                    if (is_finite(fhi)) {
+                        a = lbfgs_cubic_min(lo, flo, dlo, hi, fhi, dhi,
+                            std::min(lo, hi), std::max(lo, hi));
+                    } else {
+                        a = 0.5*(lo + hi);
+                    }
+
+                    double da;
+                    double fa = phi(a, da);
+                    if (!is_finite(fa) || fa > f + c1*a*dg || fa >= flo) {
+                        hi = a; fhi = fa; dhi = da;
+                    } else {
+                        if (abs(da) <= -c2*dg) {
+                            fn = fa;
+                            found = true;
+                            break;
+                        }
+
+                        if (da*(hi - lo) >= 0.0) {
+                            hi = lo; fhi = flo; dhi = dlo;
+                        }
+
+                        lo = a; flo = fa; dlo = da;
+                    }
+
+                    if (abs(hi - lo) <= 1e-16*std::max(1.0, abs(lo))) break;
+                }
+
+                if (!found && lo > 0.0 && flo < f) {
+                    // Accept the best point found, even if the curvature condition is not met
+                    fn = phi(lo, dlo);
+                    found = true;
+                }
+            } else {
+                // Backtracking along the projected path, with the Armijo condition
+                for (uint_t it = 0; it < 40; ++it) {
+                    double dgp = 0.0;
+                    for (uint_t i : range(n)) {
+                        xn.safe[i] = x.safe[i] + step*d.safe[i];
+                    }
+
+                    project(xn);
+                    for (uint_t i : range(n)) {
+                        dgp += g.safe[i]*(xn.safe[i] - x.safe[i]);
+                    }
+
+                    fn = lbfgs_eval(func, xn, gn, w, opts, kind{});
+                    ++ret.neval;
+                    if (is_finite(fn) && fn <= f + c1*dgp) {
+                        found = true;
+                        break;
+                    }
+
+                    step *= 0.5;
+                }
+            }
+
+            if (!found) {
+                // No progress possible, local minimum found
+                ret.success = true;
+                break;
+            }
+
+            // Update history
+            double sy = 0.0;
+            for (uint_t i : range(n)) {
+                sh.safe(ih,i) = xn.safe[i] - x.safe[i];
+                yh.safe(ih,i) = gn.safe[i] - g.safe[i];
+                sy += sh.safe(ih,i)*yh.safe(ih,i);
+            }
+
+            if (sy > std::numeric_limits<double>::epsilon()*lbfgs_dot(gn, gn)) {
+                rho.safe[ih] = 1.0/sy;
+                ih = (ih + 1) % m;
+                nh = std::min(nh + 1, m);
+            }
+
+            const double fo = f;
+            std::swap(x, xn);
+            std::swap(g, gn);
+            f = fn;
+
+            if (fo - f <= opts.ftol*std::max(std::max(abs(fo), abs(f)), 1.0)) {
+                ret.success = true;
+                break;
+            }
+        }
+
+        ret.params = x;
+        ret.value = f;
+
+        return ret;
+    }
 }
 
 #endif
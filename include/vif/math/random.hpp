@@ -2,6 +2,7 @@
 #define VIF_MATH_RANDOM_HPP
 
 #include <random>
+#include <cstdint>
 #include "vif/core/vec.hpp"
 #include "vif/core/error.hpp"
 #include "vif/math/base.hpp"
@@ -14,6 +15,207 @@ namespace vif {
         return std::mt19937(seed);
     }
 
+    // xoshiro256++ generator (Blackman & Vigna 2019). It is much faster than std::mt19937,
+    // has a small state (32 bytes), and can be advanced by 2^128 draws with jump() to create
+    // independent streams of random numbers (e.g., one per thread).
+    // This is a standard uniform random bit generator, so it can be used with all the
+    // functions below, and with the distributions of the C++ standard library.
+    struct xoshiro256pp {
+        using result_type = std::uint64_t;
+
+        explicit xoshiro256pp(std::uint64_t tseed = 0) {
+            seed(tseed);
+        }
+
+        void seed(std::uint64_t tseed) {
+            // Initialize the state with splitmix64, as recommended
+            for (uint_t i : range(4)) {
+                std::uint64_t z = (tseed += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+                state[i] = z ^ (z >> 31);
+            }
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return ~result_type(0);
+        }
+
+        result_type operator()() {
+            const std::uint64_t r = rotl(state[0] + state[3], 23) + state[0];
+            const std::uint64_t t = state[1] << 17;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotl(state[3], 45);
+
+            return r;
+        }
+
+        // Equivalent to 2^128 calls to operator(), to generate non-overlapping streams
+        void jump() {
+            static const std::uint64_t poly[] = {
+                0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+                0xa9582618e03fc9aaull, 0x39abdc4529b1661cull
+            };
+
+            jump_(poly);
+        }
+
+        // Equivalent to 2^192 calls to operator(), to generate non-overlapping groups of streams
+        void long_jump() {
+            static const std::uint64_t poly[] = {
+                0x76e15d3efefdcbbfull, 0xc5004e441c522fb3ull,
+                0x77710069854ee241ull, 0x39109bb02acbe635ull
+            };
+
+            jump_(poly);
+        }
+
+        // Uniform double in [0,1)
+        double uniform() {
+            return ((*this)() >> 11)*(1.0/9007199254740992.0);
+        }
+
+    private :
+        std::uint64_t state[4];
+
+        static std::uint64_t rotl(std::uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        void jump_(const std::uint64_t* poly) {
+            std::uint64_t s[4] = {0, 0, 0, 0};
+            for (uint_t i : range(4))
+            for (uint_t b : range(64)) {
+                if (poly[i] & (std::uint64_t(1) << b)) {
+                    for (uint_t j : range(4)) {
+                        s[j] ^= state[j];
+                    }
+                }
+
+                (*this)();
+            }
+
+            for (uint_t j : range(4)) {
+                state[j] = s[j];
+            }
+        }
+    };
+
+    using fast_seed_t = xoshiro256pp;
+
+    // Create a fast random generator. Generators created with the same seed but a different
+    // 'stream' produce independent sequences of random numbers. Creating stream 'n' costs 'n'
+    // jumps; use make_fast_seed_streams() to create many streams at once.
+    template<typename T>
+    fast_seed_t make_fast_seed(T seed, uint_t stream = 0) {
+        fast_seed_t s(seed);
+        for (uint_t i = 0; i < stream; ++i) {
+            s.jump();
+        }
+
+        return s;
+    }
+
+    // Create 'n' independent fast random generators, e.g., one for each thread
+    template<typename T>
+    std::vector<fast_seed_t> make_fast_seed_streams(T seed, uint_t n) {
+        std::vector<fast_seed_t> v;
+        v.reserve(n);
+
+        fast_seed_t s(seed);
+        for (uint_t i = 0; i < n; ++i) {
+            v.push_back(s);
+            s.jump();
+        }
+
+        return v;
+    }
+
+namespace impl {
+namespace random_impl {
+    // Tables for the Ziggurat method of Marsaglia & Tsang (2000), in the form given by
+    // Doornik (2005) which only uses uniform variates
+    struct ziggurat_table {
+        static const uint_t nlayer = 128;
+        const double r = 3.442619855899;
+        const double v = 9.91256303526217e-3;
+        double x[nlayer+1];
+        double ratio[nlayer];
+
+        ziggurat_table() {
+            double f = std::exp(-0.5*r*r);
+            x[0] = v/f;
+            x[1] = r;
+            x[nlayer] = 0.0;
+            for (uint_t i = 2; i < nlayer; ++i) {
+                x[i] = std::sqrt(-2.0*std::log(v/x[i-1] + f));
+                f = std::exp(-0.5*x[i]*x[i]);
+            }
+
+            for (uint_t i = 0; i < nlayer; ++i) {
+                ratio[i] = x[i+1]/x[i];
+            }
+        }
+    };
+
+    inline const ziggurat_table& ziggurat() {
+        static const ziggurat_table table;
+        return table;
+    }
+
+    // Uniform double in (0,1]
+    inline double uniform_open(fast_seed_t& seed) {
+        return ((seed() >> 11) + 1)*(1.0/9007199254740992.0);
+    }
+
+    inline double normal_tail(fast_seed_t& seed, double r, bool negative) {
+        double x, y;
+        do {
+            x = std::log(uniform_open(seed))/r;
+            y = std::log(uniform_open(seed));
+        } while (-2.0*y < x*x);
+
+        return negative ? x - r : r - x;
+    }
+
+    inline double normal(fast_seed_t& seed, const ziggurat_table& z) {
+        while (true) {
+            // One draw gives both the layer (lowest bits) and the position in the layer
+            const std::uint64_t b = seed();
+            const uint_t i = b & (ziggurat_table::nlayer - 1);
+            const double u = 2.0*((b >> 11)*(1.0/9007199254740992.0)) - 1.0;
+
+            // Inside the rectangle (most cases)
+            if (std::abs(u) < z.ratio[i]) {
+                return u*z.x[i];
+            }
+
+            // Base layer: draw from the tail
+            if (i == 0) {
+                return normal_tail(seed, z.r, u < 0.0);
+            }
+
+            // In the wedge
+            const double x = u*z.x[i];
+            const double f0 = std::exp(-0.5*(z.x[i]*z.x[i] - x*x));
+            const double f1 = std::exp(-0.5*(z.x[i+1]*z.x[i+1] - x*x));
+            if (f1 + seed.uniform()*(f0 - f1) < 1.0) {
+                return x;
+            }
+        }
+    }
+}
+}
+
     template<typename T>
     double randomn(T& seed) {
         std::normal_distribution<double> distribution(0.0, 1.0);
@@ -31,6 +233,22 @@ namespace vif {
         return v;
     }
 
+    // Faster versions for the xoshiro256++ generator, using the Ziggurat method
+    inline double randomn(fast_seed_t& seed) {
+        return impl::random_impl::normal(seed, impl::random_impl::ziggurat());
+    }
+
+    template<typename ... Args>
+    vec<meta::dim_total<Args...>::value,double> randomn(fast_seed_t& seed, Args&& ... args) {
+        vec<meta::dim_total<Args...>::value,double> v(std::forward<Args>(args)...);
+        const auto& z = impl::random_impl::ziggurat();
+        for (uint_t i : range(v)) {
+            v.safe[i] = impl::random_impl::normal(seed, z);
+        }
+
+        return v;
+    }
+
     template<typename T>
     double randomu(T& seed) {
         std::uniform_real_distribution<double> distribution(0.0, 1.0);
@@ -48,6 +266,21 @@ namespace vif {
         return v;
     }
 
+    // Faster versions for the xoshiro256++ generator
+    inline double randomu(fast_seed_t& seed) {
+        return seed.uniform();
+    }
+
+    template<typename ... Args>
+    vec<meta::dim_total<Args...>::value,double> randomu(fast_seed_t& seed, Args&& ... args) {
+        vec<meta::dim_total<Args...>::value,double> v(std::forward<Args>(args)...);
+        for (uint_t i : range(v)) {
+            v.safe[i] = seed.uniform();
+        }
+
+        return v;
+    }
+
     template<typename T, typename TMi, typename TMa>
     auto randomi(T& seed, TMi mi, TMa ma) -> decltype(mi + ma) {
         using rtype = decltype(mi + ma);
@@ -103,6 +336,158 @@ namespace vif {
         return v;
     }
 
+    // Reusable sampler for a continuous piecewise linear probability density, defined by its
+    // (non-normalized) values 'py' at the (sorted) positions 'px'. This draws from the same
+    // distribution as random_pdf(), but the cumulative distribution is only computed once, and
+    // each draw is done in constant time on average (inverse CDF with a guide table).
+    struct random_pdf_sampler {
+        vec1d x, y;    // positions and density at the nodes
+        vec1d cdf;     // normalized cumulative distribution at the nodes
+        vec1u guide;   // guide[j] = first segment containing the quantile j/nseg
+
+        random_pdf_sampler() = default;
+
+        template<typename TypeX, typename TypeY>
+        random_pdf_sampler(const vec<1,TypeX>& px, const vec<1,TypeY>& py) : x(px), y(py) {
+            vif_check(x.size() == y.size(), "incompatible dimensions between X and Y arrays (",
+                x.dims, " vs. ", y.dims, ")");
+            vif_check(x.size() >= 2, "need at least two points to define the distribution");
+
+            const uint_t nseg = x.size() - 1;
+            cdf.resize(nseg+1);
+            cdf.safe[0] = 0.0;
+            for (uint_t k : range(nseg)) {
+                vif_check(x.safe[k+1] >= x.safe[k], "X array must be sorted");
+                vif_check(y.safe[k] >= 0.0 && y.safe[k+1] >= 0.0,
+                    "probability density must be positive");
+                cdf.safe[k+1] = cdf.safe[k] + 0.5*(y.safe[k] + y.safe[k+1])*(x.safe[k+1] - x.safe[k]);
+            }
+
+            const double norm = cdf.safe[nseg];
+            vif_check(norm > 0.0, "probability density must not be zero everywhere");
+            cdf /= norm;
+            y /= norm;
+            cdf.safe[nseg] = 1.0;
+
+            guide.resize(nseg);
+            uint_t k = 0;
+            for (uint_t j : range(nseg)) {
+                const double q = double(j)/nseg;
+                while (k+1 < nseg && cdf.safe[k+1] <= q) ++k;
+                guide.safe[j] = k;
+            }
+        }
+
+        // Transform a uniform variate in [0,1) into a value of the distribution
+        double quantile(double u) const {
+            const uint_t nseg = guide.size();
+            uint_t k = guide.safe[std::min(uint_t(u*nseg), nseg-1)];
+            while (k+1 < nseg && cdf.safe[k+1] <= u) ++k;
+
+            // Solve y[k]*t + 0.5*slope*t^2 = (u - cdf[k]) for t in [0,dx]
+            const double dx = x.safe[k+1] - x.safe[k];
+            const double r = u - cdf.safe[k];
+            const double slope = (dx > 0.0 ? (y.safe[k+1] - y.safe[k])/dx : 0.0);
+            const double den = y.safe[k] + sqrt(std::max(0.0, sqr(y.safe[k]) + 2.0*slope*r));
+            const double t = (den > 0.0 ? 2.0*r/den : 0.0);
+
+            return x.safe[k] + std::min(std::max(t, 0.0), dx);
+        }
+
+        template<typename T>
+        double operator() (T& seed) const {
+            return quantile(randomu(seed));
+        }
+
+        template<typename T, typename ... Args>
+        vec<meta::dim_total<Args...>::value,double> operator() (T& seed, Args&& ... args) const {
+            auto v = randomu(seed, std::forward<Args>(args)...);
+            for (auto& u : v) {
+                u = quantile(u);
+            }
+
+            return v;
+        }
+    };
+
+    // Reusable sampler for a discrete probability distribution, defined by the
+    // (non-normalized) weights 'w'. This draws from the same distribution as
+    // random_pdf_discrete(), but uses the alias method of Walker (1977), in the form given by
+    // Vose (1991): after an O(n) setup, each draw is done in constant time.
+    struct random_pdf_discrete_sampler {
+        vec1d prob;  // probability to keep the drawn bin
+        vec1u alias; // bin to use otherwise
+
+        random_pdf_discrete_sampler() = default;
+
+        template<typename TypeX>
+        explicit random_pdf_discrete_sampler(const vec<1,TypeX>& w) {
+            const uint_t n = w.size();
+            vif_check(n > 0, "need at least one weight to define the distribution");
+
+            double norm = 0.0;
+            for (uint_t i : range(n)) {
+                vif_check(w.safe[i] >= 0.0, "weights must be positive");
+                norm += w.safe[i];
+            }
+
+            vif_check(norm > 0.0, "weights must not all be zero");
+
+            prob.resize(n);
+            alias.resize(n);
+            for (uint_t i : range(n)) {
+                prob.safe[i] = w.safe[i]*n/norm;
+                alias.safe[i] = i;
+            }
+
+            // Pair each bin with less than the average weight with a bin with more
+            std::vector<uint_t> small, large;
+            for (uint_t i : range(n)) {
+                (prob.safe[i] < 1.0 ? small : large).push_back(i);
+            }
+
+            while (!small.empty() && !large.empty()) {
+                uint_t s = small.back(); small.pop_back();
+                uint_t l = large.back();
+
+                alias.safe[s] = l;
+                prob.safe[l] -= 1.0 - prob.safe[s];
+                if (prob.safe[l] < 1.0) {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+
+            // Remaining bins are full (up to round-off errors)
+            for (uint_t i : large) prob.safe[i] = 1.0;
+            for (uint_t i : small) prob.safe[i] = 1.0;
+        }
+
+        // Transform a uniform variate in [0,1) into a bin index
+        uint_t quantile(double u) const {
+            const uint_t n = prob.size();
+            const double x = u*n;
+            const uint_t i = std::min(uint_t(x), n-1);
+            return (x - i < prob.safe[i] ? i : alias.safe[i]);
+        }
+
+        template<typename T>
+        uint_t operator() (T& seed) const {
+            return quantile(randomu(seed));
+        }
+
+        template<typename T, typename ... Args>
+        vec<meta::dim_total<Args...>::value,uint_t> operator() (T& seed, Args&& ... args) const {
+            auto u = randomu(seed, std::forward<Args>(args)...);
+            vec<meta::dim_total<Args...>::value,uint_t> v(u.dims);
+            for (uint_t i : range(v)) {
+                v.safe[i] = quantile(u.safe[i]);
+            }
+
+            return v;
+        }
+    };
+
     template<typename TSeed>
     bool random_coin(TSeed& seed, double prob) {
         std::uniform_real_distribution<double> distribution(0.0, 1.0);
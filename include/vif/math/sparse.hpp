@@ -0,0 +1,696 @@
+#ifndef VIF_MATH_SPARSE_HPP
+#define VIF_MATH_SPARSE_HPP
+
+#include "vif/core/vec.hpp"
+#include "vif/core/error.hpp"
+#include "vif/core/range.hpp"
+#include "vif/math/base.hpp"
+#include "vif/math/matrix.hpp"
+#include <set>
+
+namespace vif {
+namespace matrix {
+    // Sparse symmetric matrix. Only the lower triangle (including the diagonal) is stored, in
+    // compressed sparse row format: the elements of row 'i' are stored in 'col' and 'val' at
+    // the positions [rowptr[i], rowptr[i+1]), sorted by increasing column index.
+    // Elements are first accumulated with add(), then the compressed storage is built by calling
+    // assemble(). Elements added several times are summed.
+    struct sparse_symmetric {
+        uint_t n = 0;
+        vec1u rowptr, col;
+        vec1d val;
+
+    private :
+        // Elements not yet assembled
+        std::vector<uint_t> ti, tj;
+        std::vector<double> tv;
+
+    public :
+        sparse_symmetric() = default;
+
+        explicit sparse_symmetric(uint_t tn) : n(tn), rowptr(tn+1) {}
+
+        // Build from the lower triangle of a dense matrix, keeping only non-zero elements
+        template<typename T, typename enable = typename std::enable_if<
+            meta::is_matrix<T>::value
+        >::type>
+        explicit sparse_symmetric(const T& m) : sparse_symmetric(m.dims[0]) {
+            vif_check(m.dims[0] == m.dims[1], "cannot build a symmetric matrix from a non square "
+                "matrix (", m.dims, ")");
+
+            for (uint_t i : range(n))
+            for (uint_t j : range(i+1)) {
+                if (m.safe(i,j) != 0.0) {
+                    add(i, j, m.safe(i,j));
+                }
+            }
+
+            assemble();
+        }
+
+        uint_t size() const {
+            return n;
+        }
+
+        // Number of stored elements (lower triangle only)
+        uint_t nonzero_count() const {
+            return val.size();
+        }
+
+        bool assembled() const {
+            return tv.empty();
+        }
+
+        // Add 'v' to the element (i,j), and (j,i)
+        void add(uint_t i, uint_t j, double v) {
+            vif_check(i < n && j < n, "element (", i, ",", j, ") is out of bounds (", n, ")");
+
+            if (i < j) std::swap(i, j);
+            ti.push_back(i);
+            tj.push_back(j);
+            tv.push_back(v);
+        }
+
+        // Merge the elements added with add() into the compressed storage
+        void assemble() {
+            if (tv.empty()) return;
+
+            // Count elements per row, from the compressed storage and the new elements
+            vec1u nrp(n+1);
+            for (uint_t i : range(n)) {
+                nrp.safe[i+1] = rowptr.safe[i+1] - rowptr.safe[i];
+            }
+            for (uint_t i : ti) {
+                ++nrp.safe[i+1];
+            }
+            for (uint_t i : range(n)) {
+                nrp.safe[i+1] += nrp.safe[i];
+            }
+
+            // Scatter elements into rows
+            vec1u ncol(nrp.back());
+            vec1d nval(nrp.back());
+            vec1u pos = nrp;
+            for (uint_t i : range(n))
+            for (uint_t p : range(rowptr.safe[i], rowptr.safe[i+1])) {
+                uint_t q = pos.safe[i]++;
+                ncol.safe[q] = col.safe[p];
+                nval.safe[q] = val.safe[p];
+            }
+            for (uint_t k : range(tv)) {
+                uint_t q = pos.safe[ti[k]]++;
+                ncol.safe[q] = tj[k];
+                nval.safe[q] = tv[k];
+            }
+
+            ti.clear(); tj.clear(); tv.clear();
+            ti.shrink_to_fit(); tj.shrink_to_fit(); tv.shrink_to_fit();
+
+            // Sort each row by column and sum duplicates
+            rowptr.resize(n+1);
+            rowptr.safe[0] = 0;
+            col.resize(ncol.size());
+            val.resize(nval.size());
+
+            uint_t q = 0;
+            std::vector<std::pair<uint_t,double>> row;
+            for (uint_t i : range(n)) {
+                row.clear();
+                for (uint_t p : range(nrp.safe[i], nrp.safe[i+1])) {
+                    row.push_back(std::make_pair(ncol.safe[p], nval.safe[p]));
+                }
+
+                std::stable_sort(row.begin(), row.end(),
+                    [](const std::pair<uint_t,double>& p1, const std::pair<uint_t,double>& p2) {
+                        return p1.first < p2.first;
+                    }
+                );
+
+                for (uint_t p : range(row)) {
+                    if (p != 0 && row[p].first == row[p-1].first) {
+                        val.safe[q-1] += row[p].second;
+                    } else {
+                        col.safe[q] = row[p].first;
+                        val.safe[q] = row[p].second;
+                        ++q;
+                    }
+                }
+
+                rowptr.safe[i+1] = q;
+            }
+
+            col.resize(q);
+            val.resize(q);
+        }
+
+        // Get the value of element (i,j), or zero if it is not stored
+        double operator() (uint_t i, uint_t j) const {
+            vif_check(assembled(), "matrix must be assembled first");
+            vif_check(i < n && j < n, "element (", i, ",", j, ") is out of bounds (", n, ")");
+
+            if (i < j) std::swap(i, j);
+            auto b = col.data.begin() + rowptr.safe[i];
+            auto e = col.data.begin() + rowptr.safe[i+1];
+            auto p = std::lower_bound(b, e, j);
+            if (p == e || *p != j) return 0.0;
+
+            return val.safe[p - col.data.begin()];
+        }
+
+        vec1d diagonal() const {
+            vif_check(assembled(), "matrix must be assembled first");
+
+            vec1d d(n);
+            for (uint_t i : range(n)) {
+                uint_t p = rowptr.safe[i+1];
+                if (p != rowptr.safe[i] && col.safe[p-1] == i) {
+                    d.safe[i] = val.safe[p-1];
+                }
+            }
+
+            return d;
+        }
+
+        mat2d to_dense() const {
+            vif_check(assembled(), "matrix must be assembled first");
+
+            mat2d m(n, n);
+            for (uint_t i : range(n))
+            for (uint_t p : range(rowptr.safe[i], rowptr.safe[i+1])) {
+                m.safe(i,col.safe[p]) = m.safe(col.safe[p],i) = val.safe[p];
+            }
+
+            return m;
+        }
+    };
+
+    // sparse matrix * scalar
+    inline sparse_symmetric operator * (sparse_symmetric a, double s) {
+        vif_check(a.assembled(), "matrix must be assembled first");
+        a.val *= s;
+        return a;
+    }
+
+    // scalar * sparse matrix
+    inline sparse_symmetric operator * (double s, sparse_symmetric a) {
+        return std::move(a)*s;
+    }
+
+    // sparse matrix * 1D vector, stored in 'r' (which is resized if needed, and can be reused
+    // between calls to avoid allocations)
+    inline void product(const sparse_symmetric& a, const vec1d& x, vec1d& r) {
+        vif_check(a.assembled(), "matrix must be assembled first");
+        vif_check(a.n == x.size(), "incompatible dimensions in matrix-vector multiplication "
+            "(", a.n, " x ", x.dims, ")");
+
+        r.resize(a.n);
+        for (uint_t i : range(a.n)) {
+            r.safe[i] = 0.0;
+        }
+
+        for (uint_t i : range(a.n)) {
+            double s = 0.0;
+            for (uint_t p : range(a.rowptr.safe[i], a.rowptr.safe[i+1])) {
+                uint_t j = a.col.safe[p];
+                s += a.val.safe[p]*x.safe[j];
+                if (j != i) {
+                    r.safe[j] += a.val.safe[p]*x.safe[i];
+                }
+            }
+
+            r.safe[i] += s;
+        }
+    }
+
+    // sparse matrix * 1D vector
+    inline vec1d operator * (const sparse_symmetric& a, const vec1d& x) {
+        vec1d r;
+        product(a, x, r);
+        return r;
+    }
+}
+
+namespace impl {
+namespace sparse_impl {
+    // Minimum degree ordering of the (symmetric) adjacency graph of 'a'. Returns 'perm' such that
+    // perm[k] is the k-th row to eliminate. Dense rows (connected to more than 10*sqrt(n)
+    // other rows) are ordered last.
+    inline vec1u minimum_degree(const matrix::sparse_symmetric& a) {
+        const uint_t n = a.n;
+
+        std::vector<std::vector<uint_t>> adj(n);
+        for (uint_t i : range(n))
+        for (uint_t p : range(a.rowptr.safe[i], a.rowptr.safe[i+1])) {
+            uint_t j = a.col.safe[p];
+            if (j != i) {
+                adj[i].push_back(j);
+                adj[j].push_back(i);
+            }
+        }
+
+        const uint_t dense = std::max(16.0, 10.0*sqrt(double(n)));
+        std::vector<bool> is_dense(n);
+        for (uint_t i : range(n)) {
+            is_dense[i] = adj[i].size() > dense;
+        }
+
+        std::set<std::pair<uint_t,uint_t>> queue;
+        for (uint_t i : range(n)) {
+            if (is_dense[i]) continue;
+
+            auto& ai = adj[i];
+            ai.erase(std::remove_if(ai.begin(), ai.end(), [&](uint_t j) {
+                return is_dense[j];
+            }), ai.end());
+            std::sort(ai.begin(), ai.end());
+            ai.erase(std::unique(ai.begin(), ai.end()), ai.end());
+
+            queue.insert(std::make_pair(ai.size(), i));
+        }
+
+        vec1u perm;
+        perm.reserve(n);
+
+        std::vector<uint_t> merged;
+        while (!queue.empty()) {
+            uint_t v = queue.begin()->second;
+            queue.erase(queue.begin());
+            perm.push_back(v);
+
+            // Eliminate 'v': its neighbors become connected to each other
+            const std::vector<uint_t>& av = adj[v];
+            for (uint_t u : av) {
+                auto& au = adj[u];
+                queue.erase(std::make_pair(au.size(), u));
+
+                merged.clear();
+                std::set_union(au.begin(), au.end(), av.begin(), av.end(),
+                    std::back_inserter(merged));
+                merged.erase(std::remove_if(merged.begin(), merged.end(), [&](uint_t j) {
+                    return j == u || j == v;
+                }), merged.end());
+
+                au.swap(merged);
+                queue.insert(std::make_pair(au.size(), u));
+            }
+
+            std::vector<uint_t>().swap(adj[v]);
+        }
+
+        for (uint_t i : range(n)) {
+            if (is_dense[i]) {
+                perm.push_back(i);
+            }
+        }
+
+        return perm;
+    }
+
+    // Find the non-zero pattern of row 'k' of the Cholesky factor from the elimination tree.
+    // The pattern is stored in s[top..n), in topological order, and 'top' is returned.
+    // 'c' and 'ci' are the upper triangle of the (permuted) matrix in compressed sparse
+    // column format.
+    inline uint_t cholesky_reach(uint_t k, const vec1u& cp, const vec1u& ci,
+        const vec1u& parent, vec1u& s, vec1u& w) {
+
+        const uint_t n = parent.size();
+        uint_t top = n;
+        w.safe[k] = k;
+        for (uint_t p : range(cp.safe[k], cp.safe[k+1])) {
+            uint_t i = ci.safe[p];
+            if (i > k) continue;
+
+            uint_t len = 0;
+            for (; w.safe[i] != k; i = parent.safe[i]) {
+                s.safe[len++] = i;
+                w.safe[i] = k;
+            }
+
+            while (len > 0) {
+                s.safe[--top] = s.safe[--len];
+            }
+        }
+
+        return top;
+    }
+}
+}
+
+namespace matrix {
+    // Cholesky decomposition of a sparse symmetric positive definite matrix, P*A*P^T = L*L^T,
+    // where P is a fill-reducing permutation (minimum degree ordering).
+    // Adapted from the up-looking algorithm of CSparse (T. Davis, "Direct Methods for Sparse
+    // Linear Systems", SIAM 2006).
+    struct decompose_sparse_cholesky {
+        // Options
+        bool reorder = true;
+
+        // Outputs
+        // Row 'k' of the factor corresponds to row perm[k] of the input matrix.
+        // The factor is stored in compressed sparse column format: the elements of column 'j'
+        // are stored in 'li' (row index) and 'lx' (value) at the positions [lp[j], lp[j+1]),
+        // sorted by increasing row, the diagonal coming first.
+        vec1u perm;
+        vec1u lp, li;
+        vec1d lx;
+        bool bad = false;
+
+    public:
+        uint_t size() const {
+            return perm.size();
+        }
+
+        uint_t nonzero_count() const {
+            return lx.size();
+        }
+
+        bool decompose(const sparse_symmetric& a) {
+            vif_check(a.assembled(), "matrix must be assembled first");
+
+            const uint_t n = a.n;
+            bad = false;
+
+            perm = (reorder ? impl::sparse_impl::minimum_degree(a) : indgen(n));
+            vec1u iperm(n);
+            for (uint_t k : range(n)) {
+                iperm.safe[perm.safe[k]] = k;
+            }
+
+            // Upper triangle of P*A*P^T in compressed sparse column format
+            vec1u cp(n+1);
+            for (uint_t i : range(n))
+            for (uint_t p : range(a.rowptr.safe[i], a.rowptr.safe[i+1])) {
+                ++cp.safe[std::max(iperm.safe[i], iperm.safe[a.col.safe[p]])+1];
+            }
+            for (uint_t k : range(n)) {
+                cp.safe[k+1] += cp.safe[k];
+            }
+
+            vec1u ci(cp.back());
+            vec1d cx(cp.back()); {
+                vec1u pos = cp;
+                for (uint_t i : range(n))
+                for (uint_t p : range(a.rowptr.safe[i], a.rowptr.safe[i+1])) {
+                    uint_t pi = iperm.safe[i], pj = iperm.safe[a.col.safe[p]];
+                    uint_t q = pos.safe[std::max(pi, pj)]++;
+                    ci.safe[q] = std::min(pi, pj);
+                    cx.safe[q] = a.val.safe[p];
+                }
+            }
+
+            // Elimination tree
+            vec1u parent(n), ancestor(n);
+            parent[_] = npos;
+            ancestor[_] = npos;
+            for (uint_t k : range(n))
+            for (uint_t p : range(cp.safe[k], cp.safe[k+1])) {
+                uint_t i = ci.safe[p];
+                while (i != npos && i < k) {
+                    uint_t inext = ancestor.safe[i];
+                    ancestor.safe[i] = k;
+                    if (inext == npos) parent.safe[i] = k;
+                    i = inext;
+                }
+            }
+
+            // Column counts of the factor
+            vec1u s(n), w(n);
+            w[_] = npos;
+            lp.resize(n+1);
+            lp[_] = 0;
+            for (uint_t k : range(n)) {
+                ++lp.safe[k+1];
+                uint_t top = impl::sparse_impl::cholesky_reach(k, cp, ci, parent, s, w);
+                for (uint_t t : range(top, n)) {
+                    ++lp.safe[s.safe[t]+1];
+                }
+            }
+            for (uint_t k : range(n)) {
+                lp.safe[k+1] += lp.safe[k];
+            }
+
+            // Numerical factorization, one row at a time
+            li.resize(lp.back());
+            lx.resize(lp.back());
+            vec1u c(n);
+            for (uint_t k : range(n)) {
+                c.safe[k] = lp.safe[k];
+            }
+
+            vec1d x(n);
+            w[_] = npos;
+            for (uint_t k : range(n)) {
+                uint_t top = impl::sparse_impl::cholesky_reach(k, cp, ci, parent, s, w);
+
+                for (uint_t p : range(cp.safe[k], cp.safe[k+1])) {
+                    x.safe[ci.safe[p]] += cx.safe[p];
+                }
+
+                double d = x.safe[k];
+                x.safe[k] = 0.0;
+                for (; top < n; ++top) {
+                    uint_t i = s.safe[top];
+                    double lki = x.safe[i]/lx.safe[lp.safe[i]];
+                    x.safe[i] = 0.0;
+                    for (uint_t p : range(lp.safe[i]+1, c.safe[i])) {
+                        x.safe[li.safe[p]] -= lx.safe[p]*lki;
+                    }
+
+                    d -= lki*lki;
+                    uint_t p = c.safe[i]++;
+                    li.safe[p] = k;
+                    lx.safe[p] = lki;
+                }
+
+                if (d <= 0.0) {
+                    bad = true;
+                    return false;
+                }
+
+                uint_t p = c.safe[k]++;
+                li.safe[p] = k;
+                lx.safe[p] = sqrt(d);
+            }
+
+            return true;
+        }
+
+        void solve_inplace(vec1d& b) const {
+            vif_check(size() == b.size(), "matrix and vector must have the same "
+                "dimensions (got ", size(), " and ", b.size(), ")");
+
+            const uint_t n = size();
+            vec1d x(n);
+            for (uint_t k : range(n)) {
+                x.safe[k] = b.safe[perm.safe[k]];
+            }
+
+            // Solve L*y = x
+            for (uint_t j : range(n)) {
+                x.safe[j] /= lx.safe[lp.safe[j]];
+                for (uint_t p : range(lp.safe[j]+1, lp.safe[j+1])) {
+                    x.safe[li.safe[p]] -= lx.safe[p]*x.safe[j];
+                }
+            }
+
+            // Solve L^T*z = y
+            uint_t j = n;
+            while (j > 0) {
+                --j;
+                for (uint_t p : range(lp.safe[j]+1, lp.safe[j+1])) {
+                    x.safe[j] -= lx.safe[p]*x.safe[li.safe[p]];
+                }
+
+                x.safe[j] /= lx.safe[lp.safe[j]];
+            }
+
+            for (uint_t k : range(n)) {
+                b.safe[perm.safe[k]] = x.safe[k];
+            }
+        }
+
+        vec1d solve(vec1d x) const {
+            solve_inplace(x);
+            return x;
+        }
+
+        // Diagonal of the inverse of the input matrix, computed without building the full
+        // inverse: only the elements of the inverse matching the non-zero pattern of the factor
+        // are computed (Takahashi et al. 1973), from the last column to the first.
+        vec1d inverse_diagonal() const {
+            const uint_t n = size();
+
+            // Element (i,j) of the inverse, i >= j, stored with the same layout as the factor
+            vec1d z(lx.size());
+
+            // Position of each row in the current column
+            vec1u pos(n), mark(n);
+            mark[_] = npos;
+            vec1d acc(n);
+
+            uint_t j = n;
+            while (j > 0) {
+                --j;
+
+                const uint_t p0 = lp.safe[j], p1 = lp.safe[j+1];
+                const double ljj = lx.safe[p0];
+                if (p1 == p0+1) {
+                    z.safe[p0] = 1.0/(ljj*ljj);
+                    continue;
+                }
+
+                for (uint_t p : range(p0+1, p1)) {
+                    pos.safe[li.safe[p]] = p;
+                    mark.safe[li.safe[p]] = j;
+                    acc.safe[p-p0] = 0.0;
+                }
+
+                // z(i,j) = -sum over k of l(k,j)*z(i,k)/l(j,j), with i and k in the pattern of
+                // column j. All the z(r,c) needed, r >= c, are in column c of the pattern and
+                // have already been computed.
+                const uint_t rmax = li.safe[p1-1];
+                for (uint_t q : range(p0+1, p1)) {
+                    const uint_t c = li.safe[q];
+                    const double lcj = lx.safe[q];
+                    for (uint_t pc : range(lp.safe[c], lp.safe[c+1])) {
+                        const uint_t r = li.safe[pc];
+                        if (r > rmax) break;
+                        if (mark.safe[r] != j) continue;
+
+                        const double zrc = z.safe[pc];
+                        acc.safe[pos.safe[r]-p0] += lcj*zrc;
+                        if (r != c) {
+                            acc.safe[q-p0] += lx.safe[pos.safe[r]]*zrc;
+                        }
+                    }
+                }
+
+                double sum = 0.0;
+                for (uint_t p : range(p0+1, p1)) {
+                    z.safe[p] = -acc.safe[p-p0]/ljj;
+                    sum += lx.safe[p]*z.safe[p];
+                }
+
+                z.safe[p0] = (1.0/ljj - sum)/ljj;
+            }
+
+            vec1d d(n);
+            for (uint_t k : range(n)) {
+                d.safe[perm.safe[k]] = z.safe[lp.safe[k]];
+            }
+
+            return d;
+        }
+
+        double log_lower_determinant() const {
+            double d = 0.0;
+            for (uint_t j : range(size())) {
+                d += log(lx.safe[lp.safe[j]]);
+            }
+
+            return d;
+        }
+    };
+
+    struct solve_cg_params {
+        // Convergence criterion on the norm of the residual, relative to the norm of 'b'
+        double tolerance = 1e-10;
+        uint_t max_iter = 1000;
+    };
+
+    struct solve_cg_result {
+        bool success = false;
+        uint_t niter = 0;
+        double residual = dnan;
+    };
+
+    // Solve a*x = b for a symmetric positive definite sparse matrix, using the conjugate gradient
+    // method with a diagonal (Jacobi) preconditioner. If 'x' has the right size, it is used as
+    // starting point, else the iterations start from zero.
+    inline solve_cg_result solve_cg(const sparse_symmetric& a, const vec1d& b, vec1d& x,
+        const solve_cg_params& opts = solve_cg_params()) {
+
+        vif_check(a.n == b.size(), "matrix and vector must have the same "
+            "dimensions (got ", a.n, " and ", b.size(), ")");
+
+        const uint_t n = a.n;
+        solve_cg_result res;
+
+        // Work vectors, allocated once and updated in place at each iteration
+        vec1d r(n), z(n), p(n), ap(n);
+
+        if (x.size() == n) {
+            product(a, x, ap);
+            for (uint_t k : range(n)) {
+                r.safe[k] = b.safe[k] - ap.safe[k];
+            }
+        } else {
+            x = replicate(0.0, n);
+            r = b;
+        }
+
+        vec1d id = a.diagonal();
+        for (auto& v : id) {
+            v = (v > 0.0 ? 1.0/v : 1.0);
+        }
+
+        const double bnorm = sqrt(total(sqr(b)));
+        const double tol = opts.tolerance*(bnorm > 0.0 ? bnorm : 1.0);
+
+        res.residual = sqrt(total(sqr(r)));
+        if (res.residual <= tol) {
+            res.success = true;
+            return res;
+        }
+
+        double rz = 0.0;
+        for (uint_t k : range(n)) {
+            z.safe[k] = id.safe[k]*r.safe[k];
+            p.safe[k] = z.safe[k];
+            rz += r.safe[k]*z.safe[k];
+        }
+
+        for (res.niter = 1; res.niter <= opts.max_iter; ++res.niter) {
+            product(a, p, ap);
+
+            double pap = 0.0;
+            for (uint_t k : range(n)) {
+                pap += p.safe[k]*ap.safe[k];
+            }
+
+            const double alpha = rz/pap;
+            double rr = 0.0;
+            for (uint_t k : range(n)) {
+                x.safe[k] += alpha*p.safe[k];
+                r.safe[k] -= alpha*ap.safe[k];
+                rr += sqr(r.safe[k]);
+            }
+
+            res.residual = sqrt(rr);
+            if (res.residual <= tol) {
+                res.success = true;
+                break;
+            }
+
+            double nrz = 0.0;
+            for (uint_t k : range(n)) {
+                z.safe[k] = id.safe[k]*r.safe[k];
+                nrz += r.safe[k]*z.safe[k];
+            }
+
+            const double beta = nrz/rz;
+            for (uint_t k : range(n)) {
+                p.safe[k] = z.safe[k] + beta*p.safe[k];
+            }
+
+            rz = nrz;
+        }
+
+        if (res.niter > opts.max_iter) res.niter = opts.max_iter;
+
+        return res;
+    }
+}
+}
+
+#endif
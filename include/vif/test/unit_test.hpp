@@ -5,6 +5,8 @@
 #include "vif/core/print.hpp"
 #include "vif/core/string_conversion.hpp"
 #include "vif/math/base.hpp"
+#include "vif/math/reduce.hpp"
+#include "vif/utility/generic.hpp"
 
 namespace vif {
     uint_t tested = 0u;
@@ -60,6 +62,28 @@ namespace vif {
         return impl::is_same_(v1, v2, is_float<T1,T2>{});
     }
 
+    // Maximum absolute difference between 'v' and 'ref', relative to the maximum absolute value
+    // of 'ref' (or absolute if 'ref' is zero). NaN values must be at the same positions in both
+    // arrays, and only the finite values of 'ref' are compared. Returns infinity if the arrays
+    // do not have the same dimensions or NaN values.
+    template<std::size_t D, typename T1, typename T2>
+    double max_rel_diff(const vec<D,T1>& v, const vec<D,T2>& ref) {
+        if (v.dims != ref.dims) return dinf;
+        if (count(is_nan(v) != is_nan(ref)) != 0) return dinf;
+
+        vec1u idf = where(is_finite(ref));
+        if (idf.empty()) return 0.0;
+        double m = max(abs(ref[idf]));
+        return max(abs(v[idf] - ref[idf]))/(m > 0.0 ? m : 1.0);
+    }
+
+    // Check that 'v' and 'ref' are strictly identical, including the positions of NaN values
+    template<std::size_t D, typename T1, typename T2>
+    bool same(const vec<D,T1>& v, const vec<D,T2>& ref) {
+        return v.dims == ref.dims && count(is_nan(v) != is_nan(ref)) == 0 &&
+            count(!is_nan(ref) && v != ref) == 0;
+    }
+
     static bool check_show_line = false;
 
     #define check_base_(cond, msg, file, line) do { \
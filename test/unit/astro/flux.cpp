@@ -0,0 +1,162 @@
+#include <vif.hpp>
+#include <vif/astro/template_fit.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+astro::filter_t make_filter(double l0, double l1, uint_t n) {
+    astro::filter_t f;
+    f.lam = rgen(l0, l1, n);
+    f.res = 1.0 + sin(dpi*(f.lam - l0)/(l1 - l0));
+    f.res /= integrate(f.lam, f.res);
+    f.rlam = integrate(f.lam, f.lam*f.res);
+    return f;
+}
+
+// Filters inside the SED grid (wide, narrower than the grid spacing, with a point on a grid
+// node), partially covered on either side, and outside of the grid
+vec<1,astro::filter_t> make_filters(const vec1d& lam) {
+    vec<1,astro::filter_t> filters;
+    filters.push_back(make_filter(0.5, 1.5, 40));
+    filters.push_back(make_filter(3.0, 12.0, 100));
+    filters.push_back(make_filter(100.0, 100.3, 7));
+    filters.push_back(make_filter(lam[30], lam[30]*1.5, 20));
+    filters.push_back(make_filter(0.5*lam.front(), 2.0*lam.front(), 30));
+    filters.push_back(make_filter(0.5*lam.back(), 2.0*lam.back(), 30));
+    filters.push_back(make_filter(1e-3*lam.front(), 2e-3*lam.front(), 30));
+    filters.push_back(make_filter(20.0, 600.0, 200));
+    return filters;
+}
+
+void test_sed2flux_operator() {
+    print("sed2flux_operator vs. sed2flux()");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(42);
+
+    // Irregular grid
+    vec1d lam = e10(rgen(-1.0, 3.0, 500) + 0.002*randomn(seed, 500));
+    inplace_sort(lam);
+    const uint_t nsed = 20;
+    vec2d sed = randomu(seed, nsed, lam.size());
+
+    vec<1,astro::filter_t> filters = make_filters(lam);
+    const uint_t nfil = filters.size();
+
+    vec2d ref(nsed, nfil);
+    for (uint_t s : range(nsed))
+    for (uint_t f : range(nfil)) {
+        ref(s,f) = astro::sed2flux(filters[f], lam, vec1d{sed(s,_)});
+    }
+
+    // Partially covered and uncovered filters give NaN
+    check(count(is_nan(ref(0,_))), 3u);
+
+    astro::sed2flux_operator op = astro::make_sed2flux_operator(filters, lam);
+    check(op.nfilter(), nfil);
+    check(op.nlam, lam.size());
+    check(op.valid, is_finite(ref(0,_)));
+
+    vec2d flx = op(sed);
+    double d = max_rel_diff(flx, ref);
+    check_base(d < tol, "  failed: operator (diff="+to_string(d)+")");
+
+    // Single SED and single filter
+    bool ok = true;
+    for (uint_t s : range(nsed)) {
+        vec1d fs = op(vec1d{sed(s,_)});
+        if (!same(fs, flx(s,_))) ok = false;
+
+        for (uint_t f : range(nfil)) {
+            double v = op.flux(f, vec1d{sed(s,_)});
+            if (!(v == flx(s,f) || (is_nan(v) && is_nan(flx(s,f))))) ok = false;
+
+            astro::sed2flux_operator op1 = astro::make_sed2flux_operator(filters[f], lam);
+            if (op1.nfilter() != 1) ok = false;
+            v = op1.flux(0, vec1d{sed(s,_)});
+            if (!(v == flx(s,f) || (is_nan(v) && is_nan(flx(s,f))))) ok = false;
+        }
+    }
+
+    check(ok, true);
+
+    // Single precision SEDs
+    vec2f sedf = sed;
+    d = max_rel_diff(op(sedf), op(vec2d{sedf}));
+    check_base(d < tol, "  failed: float (diff="+to_string(d)+")");
+
+    // Rest-frame SEDs observed at redshift z
+    for (double z : {0.0, 0.5, 3.0}) {
+        double dl = (z == 0.0 ? 10.0 : 1e3 + 1e4*z);
+        vec1d olam = lam*(1.0 + z);
+        for (uint_t s : range(nsed))
+        for (uint_t f : range(nfil)) {
+            ref(s,f) = astro::sed2flux(filters[f], olam,
+                astro::lsun2uJy(z, dl, lam, vec1d{sed(s,_)}));
+        }
+
+        astro::sed2flux_operator opz = astro::make_sed2flux_operator(filters, lam, z, dl);
+        d = max_rel_diff(opz(sed), ref);
+        check_base(d < tol, "  failed: operator, z="+to_string(z)+" (diff="+to_string(d)+")");
+    }
+}
+
+void test_template_observed() {
+    print("template_observed() vs. sed2flux()");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(43);
+
+    vec1d lam = e10(rgen(-1.0, 3.0, 400));
+    const uint_t nsed = 15;
+
+    // Library with a shared wavelength grid, and with one grid per SED
+    struct {
+        vec2d lam, sed;
+    } lib, lib2;
+
+    lib.lam = replicate(lam, nsed);
+    lib.sed = randomu(seed, nsed, lam.size());
+    lib2 = lib;
+    lib2.lam(3,_) *= 1.001;
+    lib2.lam(7,_) *= 0.98;
+
+    vec<1,astro::filter_t> filters = make_filters(lam);
+    const uint_t nfil = filters.size();
+
+    for (auto* l : {&lib, &lib2}) {
+        std::string what = (l == &lib ? "shared grid" : "per-SED grid");
+
+        vec2d ref(nsed, nfil);
+        for (uint_t s : range(nsed))
+        for (uint_t f : range(nfil)) {
+            ref(s,f) = astro::sed2flux(filters[f], vec1d{l->lam(s,_)}, vec1d{l->sed(s,_)});
+        }
+
+        double d = max_rel_diff(astro::template_observed(*l, filters), ref);
+        check_base(d < tol, "  failed: "+what+" (diff="+to_string(d)+")");
+
+        for (double z : {0.2, 2.0}) {
+            double dl = 1e3 + 1e4*z;
+            for (uint_t s : range(nsed))
+            for (uint_t f : range(nfil)) {
+                vec1d tlam = l->lam(s,_);
+                ref(s,f) = astro::sed2flux(filters[f], tlam*(1.0 + z),
+                    astro::lsun2uJy(z, dl, tlam, vec1d{l->sed(s,_)}));
+            }
+
+            d = max_rel_diff(astro::template_observed(*l, z, dl, filters), ref);
+            check_base(d < tol, "  failed: "+what+", z="+to_string(z)+" (diff="+to_string(d)+")");
+        }
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_sed2flux_operator();
+    test_template_observed();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
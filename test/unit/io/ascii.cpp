@@ -0,0 +1,286 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+using namespace vif;
+
+void test_parallel_read() {
+    print("Threaded read matches serial read");
+
+    // Large enough to be split into several chunks
+    const uint_t n = 100000;
+    auto seed = make_seed(42);
+    vec1u id = indgen(n);
+    vec1d x = randomn(seed, n);
+    vec2f y = randomu(seed, n, 2);
+    vec1s name = "src"+to_string_vector(id);
+
+    std::string filename = "ascii_parallel.txt";
+    {
+        std::ofstream out(filename);
+        out << "# id x y1 y2 name\n";
+        out << "header line to skip\n";
+        for (uint_t i : range(n)) {
+            if (i % 1000 == 0) out << "# comment in the middle\n\n";
+            out << id[i] << " " << format::precision(x[i], 17) << "\t"
+                << y(i,0) << " " << y(i,1) << " " << name[i] << "\n";
+        }
+    }
+
+    ascii::input_format opts;
+    opts.skip_first = 1;
+
+    vec1u sid, pid;
+    vec1d sx, px;
+    vec2f sy, py;
+    vec1s sname, pname;
+
+    opts.nthread = 1;
+    ascii::read_table(filename, opts, sid, sx, ascii::columns(2, sy), sname);
+
+    opts.nthread = 4;
+    check(impl::ascii_impl::mapped_file(filename).size() > 2*1024*1024, true);
+    ascii::read_table(filename, opts, pid, px, ascii::columns(2, py), pname);
+
+    check(sid.size(), n);
+    check(count(sid != id), 0u);
+    check(count(sx != x), 0u);
+    check(sy.dims, y.dims);
+    check(count(sname != name), 0u);
+
+    check(pid.size(), sid.size());
+    check(count(pid != sid), 0u);
+    check(count(px != sx), 0u);
+    check(py.dims, sy.dims);
+    check(count(py != sy), 0u);
+    check(count(pname != sname), 0u);
+
+    file::remove(filename);
+}
+
+void test_chunk_errors() {
+    print("Errors in threaded chunks");
+
+    // The error of the first chunk in the file is reported, whatever the thread order,
+    // and exceptions other than ascii::exception are forwarded as well. Chunks that come
+    // after a failed one may be skipped, but none of those before it.
+    for (uint_t nthread : {1u, 2u, 4u}) {
+        std::string what;
+        std::atomic<uint_t> ndone(0);
+        try {
+            impl::ascii_impl::for_each_chunk_(nthread, 16, [&](uint_t k) {
+                ++ndone;
+                if (k == 11) throw ascii::exception("chunk 11");
+                if (k == 5) throw std::runtime_error("chunk 5");
+            });
+        } catch (std::exception& e) {
+            what = e.what();
+        }
+
+        check(what, "chunk 5");
+        check(uint_t(ndone) >= 6u, true);
+    }
+}
+
+void test_write_round_trip() {
+    print("Writing and reading back a table");
+
+    const uint_t n = 1000;
+    auto seed = make_seed(42);
+    vec1i id = indgen<int>(n) - 500;
+    vec1u uid = indgen<uint_t>(n)*uint_t(1e12);
+    vec1d x = randomn(seed, n)*pow(10.0, randomu(seed, n)*600.0 - 300.0);
+    vec1f f = randomn(seed, n);
+    vec2d y = randomn(seed, n, 3);
+    vec1b flag = randomu(seed, n) > 0.5;
+    vec1s name = "src_"+to_string_vector(indgen(n));
+
+    // Special values
+    x[0] = 0.0; x[1] = -0.0; x[2] = dnan; x[3] = dinf; x[4] = -dinf;
+    x[5] = std::numeric_limits<double>::denorm_min(); x[6] = std::numeric_limits<double>::max();
+
+    std::string filename = "ascii_write.txt";
+
+    // Full precision: values must be read back exactly
+    ascii::output_format wopts;
+    wopts.full_precision = true;
+    wopts.header = {"id", "uid", "x", "f", "y1", "y2", "y3", "flag", "name"};
+    ascii::write_table(filename, wopts, id, uid, x, f, ascii::columns(3, y), flag, name);
+
+    vec1i rid;
+    vec1u ruid;
+    vec1d rx;
+    vec1f rf;
+    vec2d ry;
+    vec1b rflag;
+    vec1s rname;
+    ascii::read_table(filename, rid, ruid, rx, rf, ascii::columns(3, ry), rflag, rname);
+
+    check(count(rid != id), 0u);
+    check(count(ruid != uid), 0u);
+    check(count(rx != x), 1u); // NaN != NaN
+    check(std::isnan(rx[2]), true);
+    check(std::signbit(rx[1]), true);
+    check(count(rf != f), 0u);
+    check(ry.dims, y.dims);
+    check(count(ry != y), 0u);
+    check(count(rflag != flag), 0u);
+    check(count(rname != name), 0u);
+
+    std::string line;
+    std::ifstream in(filename);
+    ascii::getline(in, line);
+    check(line.substr(0, 4), "# id");
+
+    // Default format: same as std::ostream, with aligned columns
+    {
+        vec1i a = {1, -20, 300};
+        vec1d b = {0.1, 1.0/3.0, 1e-20};
+        vec1f c = {2.5f, -1.0f, 123456789.0f};
+        vec1s d = {"a", "bcd", "ef"};
+
+        ascii::write_table(filename, a, b, c, d, format::precision(b, 3));
+        std::ifstream tin(filename);
+        std::string content((std::istreambuf_iterator<char>(tin)), std::istreambuf_iterator<char>());
+        check(content,
+            "  1      0.1         2.5   a   0.1\n"
+            "-20 0.333333          -1 bcd 0.333\n"
+            "300    1e-20 1.23457e+08  ef 1e-20\n");
+
+        // CSV
+        ascii::write_table(filename, ascii::output_format::csv(), a, b, d);
+        std::ifstream cin(filename);
+        content = std::string((std::istreambuf_iterator<char>(cin)), std::istreambuf_iterator<char>());
+        check(content, "1,0.1,a\n-20,0.333333,bcd\n300,1e-20,ef\n");
+    }
+
+    file::remove(filename);
+}
+
+void test_cache() {
+    print("Binary cache of ASCII tables");
+
+    std::string filename = "ascii_cache.txt";
+    auto clean = [&]() {
+        for (auto& f : file::list_files(".", filename+".*.vifcache")) {
+            file::remove(f);
+        }
+    };
+
+    clean();
+
+    const uint_t n = 2000;
+    auto seed = make_seed(42);
+    vec1u id = indgen(n);
+    vec1d x = randomn(seed, n);
+    vec2f y = randomu(seed, n, 2);
+    vec1s name = "src"+to_string_vector(id);
+
+    ascii::output_format wopts;
+    wopts.full_precision = true;
+    ascii::write_table(filename, wopts, id, x, ascii::columns(2, y), name);
+
+    ascii::input_format opts;
+    opts.cache = true;
+
+    // First read creates the cache
+    vec1u id1; vec1d x1; vec2f y1; vec1s name1;
+    ascii::read_table(filename, opts, id1, x1, ascii::columns(2, y1), name1);
+    vec1s caches = file::list_files(".", filename+".*.vifcache");
+    check(caches.size(), 1u);
+    check(count(id1 != id), 0u);
+    check(count(x1 != x), 0u);
+    check(count(y1 != y), 0u);
+
+    // Second read comes from the cache, and gives the same result
+    vec1u id2; vec1d x2; vec2f y2; vec1s name2;
+    ascii::read_table(filename, opts, id2, x2, ascii::columns(2, y2), name2);
+    check(count(id2 != id), 0u);
+    check(count(x2 != x), 0u);
+    check(y2.dims, y.dims);
+    check(count(y2 != y), 0u);
+    check(count(name2 != name), 0u);
+
+    // The cache is identified by the size and modification time of the file: if the file is
+    // modified in place without changing these, the (now outdated) cache is used, which shows
+    // that the data did come from the cache
+    {
+        struct stat st;
+        ::stat(filename.c_str(), &st);
+
+        std::string content; {
+            std::ifstream in(filename);
+            content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        std::size_t p = content.find("src1999");
+        content[p+3] = 'X';
+        {
+            std::ofstream out(filename, std::ios::trunc);
+            out << content;
+        }
+
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        ::utimensat(AT_FDCWD, filename.c_str(), times, 0);
+
+        ascii::read_table(filename, opts, id2, x2, ascii::columns(2, y2), name2);
+        check(name2[n-1], "src1999");
+
+        ascii::input_format nopts;
+        ascii::read_table(filename, nopts, id2, x2, ascii::columns(2, y2), name2);
+        check(name2[n-1], "srcX999");
+
+        // Restore the file (this time with a new modification time)
+        ascii::write_table(filename, wopts, id, x, ascii::columns(2, y), name);
+    }
+
+    // A different column layout uses a different cache file
+    vec1u id3; vec1f y3;
+    ascii::read_table(filename, opts, id3, _, _, y3);
+    check(file::list_files(".", filename+".*.vifcache").size(), 2u);
+    check(count(id3 != id), 0u);
+    check(count(y3 != y(_,1)), 0u);
+
+    // A corrupted cache file is ignored (and replaced)
+    {
+        std::ofstream out(caches[0], std::ios::binary | std::ios::trunc);
+        out << "VIFASCC1garbage";
+    }
+
+    vec1u id4; vec1d x4; vec2f y4; vec1s name4;
+    ascii::read_table(filename, opts, id4, x4, ascii::columns(2, y4), name4);
+    check(count(x4 != x), 0u);
+    check(count(name4 != name), 0u);
+    ascii::read_table(filename, opts, id4, x4, ascii::columns(2, y4), name4);
+    check(count(x4 != x), 0u);
+    check(count(name4 != name), 0u);
+
+    // Modifying the file invalidates the cache
+    x[0] = 42.0;
+    ascii::write_table(filename, wopts, id, x, ascii::columns(2, y), name);
+    vec1u id5; vec1d x5; vec2f y5; vec1s name5;
+    ascii::read_table(filename, opts, id5, x5, ascii::columns(2, y5), name5);
+    check(x5[0], 42.0);
+    check(count(x5 != x), 0u);
+
+    // Without the option, no cache is created
+    clean();
+    opts.cache = false;
+    ascii::read_table(filename, opts, id5, x5, ascii::columns(2, y5), name5);
+    check(file::list_files(".", filename+".*.vifcache").size(), 0u);
+
+    file::remove(filename);
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_parallel_read();
+    test_chunk_errors();
+    test_write_round_trip();
+    test_cache();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Reference implementations, using the generic astro::boxcar()
+
+vec1d finite_values(const vec1d& v) {
+    return v[where(is_finite(v))];
+}
+
+double reference_sum(const vec1d& v) {
+    return total(finite_values(v));
+}
+
+double reference_mean(const vec1d& v) {
+    vec1d f = finite_values(v);
+    return f.empty() ? dnan : mean(f);
+}
+
+double reference_variance(const vec1d& v) {
+    vec1d f = finite_values(v);
+    return f.empty() ? dnan : mean(sqr(f - mean(f)));
+}
+
+double reference_min(const vec1d& v) {
+    vec1d f = finite_values(v);
+    return f.empty() ? dnan : min(f);
+}
+
+double reference_max(const vec1d& v) {
+    vec1d f = finite_values(v);
+    return f.empty() ? dnan : max(f);
+}
+
+vec2d make_image(uint_t nx, uint_t ny) {
+    // Include NaN values, and a few identical values for the percentiles
+    auto seed = make_seed(42);
+    vec2d img = randomn(seed, nx, ny);
+    img[where(randomu(seed, nx, ny) < 0.1)] = dnan;
+    img[where(randomu(seed, nx, ny) < 0.05)] = 0.5;
+    return img;
+}
+
+void test_boxcar() {
+    print("Fast boxcar filters vs. generic boxcar()");
+
+    const double tol = 1e-10;
+
+    // Images larger and smaller than the window, single line images
+    for (auto dims : {std::array<uint_t,2>{{30,45}}, std::array<uint_t,2>{{1,20}},
+        std::array<uint_t,2>{{17,1}}, std::array<uint_t,2>{{5,3}}}) {
+        vec2d img = make_image(dims[0], dims[1]);
+
+        for (uint_t hsize : {0u, 1u, 3u, 10u}) {
+            std::string what = "dims="+to_string(dims)+", hsize="+to_string(hsize);
+
+            vec2d rsum = astro::boxcar(img, hsize, reference_sum);
+            vec2d rmean = astro::boxcar(img, hsize, reference_mean);
+            vec2d rvar = astro::boxcar(img, hsize, reference_variance);
+            vec2d rmin = astro::boxcar(img, hsize, reference_min);
+            vec2d rmax = astro::boxcar(img, hsize, reference_max);
+
+            for (uint_t thread : {1u, 3u}) {
+                std::string twhat = what+", thread="+to_string(thread);
+
+                double d = max_rel_diff(astro::boxcar_sum(img, hsize, thread), rsum);
+                check_base(d < tol, "  failed: boxcar_sum, "+twhat+" (diff="+to_string(d)+")");
+                d = max_rel_diff(astro::boxcar_mean(img, hsize, thread), rmean);
+                check_base(d < tol, "  failed: boxcar_mean, "+twhat+" (diff="+to_string(d)+")");
+                d = max_rel_diff(astro::boxcar_variance(img, hsize, thread), rvar);
+                check_base(d < tol, "  failed: boxcar_variance, "+twhat+" (diff="+to_string(d)+")");
+
+                check_base(same(astro::boxcar_min(img, hsize, thread), rmin),
+                    "  failed: boxcar_min, "+twhat);
+                check_base(same(astro::boxcar_max(img, hsize, thread), rmax),
+                    "  failed: boxcar_max, "+twhat);
+
+                for (double p : {0.0, 0.1, 0.25, 0.5, 0.9}) {
+                    vec2d rp = astro::boxcar(img, hsize, [p](const vec1d& v) {
+                        return percentile(v, p);
+                    });
+
+                    check_base(same(astro::boxcar_percentile(img, hsize, p, thread), rp),
+                        "  failed: boxcar_percentile, p="+to_string(p)+", "+twhat);
+                }
+
+                check_base(same(astro::boxcar_percentile(img, hsize, 1.0, thread), rmax),
+                    "  failed: boxcar_percentile, p=1, "+twhat);
+                check_base(same(astro::boxcar_median(img, hsize, thread),
+                    astro::boxcar(img, hsize, [](const vec1d& v) { return median(v); })),
+                    "  failed: boxcar_median, "+twhat);
+            }
+        }
+    }
+
+    // Windows with no valid pixel give NaN
+    vec2d img = replicate(dnan, 6, 6);
+    img(0,0) = 1.0;
+    vec2d m = astro::boxcar_mean(img, 1);
+    check(m(0,0), 1.0);
+    check(is_nan(m(5,5)), true);
+    check(is_nan(astro::boxcar_median(img, 1)(5,5)), true);
+    check(astro::boxcar_sum(img, 1)(5,5), 0.0);
+
+    // Infinite values are kept by the running minimum and maximum, even in windows that
+    // contain only infinite and NaN values
+    img = replicate(dnan, 6, 6);
+    img(0,0) = dinf;
+    img(5,5) = -dinf;
+    img(2,3) = 1.0;
+    auto not_nan = [](const vec1d& v) { return v[where(!is_nan(v))]; };
+    vec2d rmin = astro::boxcar(img, 1, [&](const vec1d& v) {
+        vec1d f = not_nan(v);
+        return f.empty() ? dnan : min(f);
+    });
+    vec2d rmax = astro::boxcar(img, 1, [&](const vec1d& v) {
+        vec1d f = not_nan(v);
+        return f.empty() ? dnan : max(f);
+    });
+    check_base(same(astro::boxcar_min(img, 1), rmin), "  failed: boxcar_min with inf");
+    check_base(same(astro::boxcar_max(img, 1), rmax), "  failed: boxcar_max with inf");
+    check(astro::boxcar_max(img, 1)(0,0) == dinf, true);
+    check(astro::boxcar_min(img, 1)(5,5) == -dinf, true);
+
+    // Infinite values are ranked by the percentiles, as in percentile()
+    img = make_image(9, 11);
+    img(0-_-2,0-_-2) = dinf;
+    img(7,8) = -dinf; img(4,5) = dinf;
+    for (double p : {0.0, 0.3, 0.5, 0.9}) {
+        vec2d rp = astro::boxcar(img, 1, [p](const vec1d& v) {
+            return percentile(v, p);
+        });
+
+        check_base(same(astro::boxcar_percentile(img, 1, p), rp),
+            "  failed: boxcar_percentile with inf, p="+to_string(p));
+    }
+
+    check_base(same(astro::boxcar_percentile(img, 1, 1.0), astro::boxcar_max(img, 1)),
+        "  failed: boxcar_percentile with inf, p=1");
+    check(astro::boxcar_percentile(img, 1, 0.0)(7,8) == -dinf, true);
+    check(astro::boxcar_median(img, 1)(1,1) == dinf, true);
+
+    // Integer images
+    vec2i iimg = indgen<int>(7, 9);
+    vec2d isum = astro::boxcar(iimg, 2, [](const vec1i& v) { return double(total(v)); });
+    check(count(astro::boxcar_sum(iimg, 2) != isum), 0u);
+    vec2i imax = astro::boxcar(iimg, 2, [](const vec1i& v) { return max(v); });
+    check(count(astro::boxcar_max(iimg, 2) != imax), 0u);
+    vec2i imed = astro::boxcar(iimg, 2, [](const vec1i& v) { return median(v); });
+    check(count(astro::boxcar_median(iimg, 2) != imed), 0u);
+}
+
+void test_thread_errors() {
+    print("Errors in boxcar worker threads");
+
+    // Exceptions thrown in a worker thread are forwarded to the caller
+    for (uint_t nthread : {1u, 4u}) {
+        std::string what;
+        try {
+            impl::astro_impl::for_each_band(100, nthread, [](uint_t i0, uint_t i1) {
+                if (i0 <= 60 && 60 < i1) throw std::runtime_error("band 60");
+            });
+        } catch (std::runtime_error& e) {
+            what = e.what();
+        }
+
+        check(what, "band 60");
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_boxcar();
+    test_thread_errors();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
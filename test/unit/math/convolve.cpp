@@ -0,0 +1,248 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Reference convolution by direct summation, assuming zeros outside the map. The kernel center
+// is at pixel (dims[0]/2, dims[1]/2), for both odd and even kernel dimensions.
+vec2d convolve_reference(const vec2d& map, const vec2d& kernel) {
+    const int_t hsx = kernel.dims[0]/2, hsy = kernel.dims[1]/2;
+    vec2d r(map.dims);
+    for (int_t x : range(map.dims[0]))
+    for (int_t y : range(map.dims[1])) {
+        double s = 0.0;
+        for (int_t kx : range(kernel.dims[0]))
+        for (int_t ky : range(kernel.dims[1])) {
+            int_t mx = x - kx + hsx, my = y - ky + hsy;
+            if (mx < 0 || my < 0 || mx >= int_t(map.dims[0]) || my >= int_t(map.dims[1])) {
+                continue;
+            }
+
+            s += map.safe(mx,my)*kernel.safe(kx,ky);
+        }
+
+        r.safe(x,y) = s;
+    }
+
+    return r;
+}
+
+vec2d make_map(uint_t nx, uint_t ny) {
+    // Non-zero on the edges, so that edge effects are tested
+    auto seed = make_seed(42);
+    return 1.0 + randomu(seed, nx, ny);
+}
+
+vec2d make_kernel(uint_t nx, uint_t ny) {
+    // Asymmetric kernel, to catch flips and off-by-one shifts
+    auto seed = make_seed(12);
+    vec2d k = randomu(seed, nx, ny);
+    k(0,_) *= 3.0;
+    return k/total(k);
+}
+
+void test_fft_convolution() {
+    print("FFT convolution vs. direct summation");
+
+    const double tol = 1e-12;
+    vec2d map = make_map(37, 52);
+
+    // Odd and even kernels, including kernels larger than the map in one dimension. Without
+    // FFTW, convolve2d_fft() falls back to convolve2d_naive(), which only supports odd kernels.
+    std::vector<std::array<uint_t,2>> kernels = {{{5,5}}, {{7,3}}, {{41,11}}};
+#ifndef NO_FFTW
+    kernels.push_back({{4,4}});
+    kernels.push_back({{6,3}});
+    kernels.push_back({{1,8}});
+#endif
+
+    for (auto kdims : kernels) {
+        vec2d kernel = make_kernel(kdims[0], kdims[1]);
+        vec2d ref = convolve_reference(map, kernel);
+
+        double d = max_rel_diff(astro::convolve2d_fft(map, kernel), ref);
+        check_base(d < tol, "  failed: convolve2d_fft with kernel "+to_string(kdims)+
+            " (diff="+to_string(d)+")");
+
+        d = max_rel_diff(astro::convolve2d(map, kernel), ref);
+        check_base(d < tol, "  failed: convolve2d with kernel "+to_string(kdims)+
+            " (diff="+to_string(d)+")");
+
+        if (kdims[0] % 2 == 1 && kdims[1] % 2 == 1) {
+            d = max_rel_diff(astro::convolve2d_naive(map, kernel), ref);
+            check_base(d < tol, "  failed: convolve2d_naive with kernel "+to_string(kdims)+
+                " (diff="+to_string(d)+")");
+        }
+    }
+}
+
+void test_tiled_convolution() {
+    print("Tiled convolution vs. direct summation");
+
+    const double tol = 1e-12;
+    vec2d map = make_map(97, 130);
+
+    for (auto kdims : {std::array<uint_t,2>{{5,5}}, std::array<uint_t,2>{{9,3}},
+        std::array<uint_t,2>{{1,15}}}) {
+        vec2d kernel = make_kernel(kdims[0], kdims[1]);
+        vec2d ref = convolve_reference(map, kernel);
+
+        // Single tile, then small tiles (including partial tiles on the edges), serial and
+        // multithreaded
+        for (uint_t tile : {0u, 32u, 45u}) {
+            for (uint_t thread : {1u, 3u}) {
+                astro::convolve2d_tiled_params p;
+                p.tile_size = tile;
+                p.thread = thread;
+
+                double d = max_rel_diff(astro::convolve2d_tiled(map, kernel, p), ref);
+                check_base(d < tol, "  failed: convolve2d_tiled with kernel "+to_string(kdims)+
+                    ", tile="+to_string(tile)+", thread="+to_string(thread)+
+                    " (diff="+to_string(d)+")");
+            }
+        }
+
+        double d = max_rel_diff(astro::convolve2d_tiled(map, kernel),
+            astro::convolve2d(map, kernel));
+        check_base(d < tol, "  failed: convolve2d_tiled vs convolve2d with kernel "+
+            to_string(kdims)+" (diff="+to_string(d)+")");
+    }
+}
+
+void test_batch_convolution() {
+#ifndef NO_FFTW
+    print("Batch convolution with changing map dimensions");
+
+    const double tol = 1e-12;
+    vec2d kernel = make_kernel(5, 7);
+    auto conv = astro::batch_convolve2d(kernel);
+
+    // The kernel is prepared again whenever the map or slice dimensions change
+    for (auto mdims : {std::array<uint_t,2>{{37,52}}, std::array<uint_t,2>{{20,25}},
+        std::array<uint_t,2>{{64,40}}}) {
+        vec2d map = make_map(mdims[0], mdims[1]);
+        vec2d ref = convolve_reference(map, kernel);
+
+        double d = max_rel_diff(conv.convolve(map), ref);
+        check_base(d < tol, "  failed: convolver2d with map "+to_string(mdims)+
+            " (diff="+to_string(d)+")");
+
+        vec3d cube(3, mdims[0], mdims[1]);
+        for (uint_t i : range(cube.dims[0])) {
+            cube(i,_,_) = (i+1.0)*map;
+        }
+
+        cube = conv.convolve(cube);
+        for (uint_t i : range(cube.dims[0])) {
+            d = max_rel_diff(vec2d(cube(i,_,_)), (i+1.0)*ref);
+            check_base(d < tol, "  failed: convolver2d with cube slices "+to_string(mdims)+
+                " (diff="+to_string(d)+")");
+        }
+    }
+#endif
+}
+
+void test_direct_convolution() {
+    print("Direct and separable convolution vs. direct summation");
+
+    const double tol = 1e-12;
+
+    // Maps smaller and larger than the kernel, and wider than one block of columns
+    for (auto mdims : {std::array<uint_t,2>{{37,52}}, std::array<uint_t,2>{{4,6}},
+        std::array<uint_t,2>{{5,2100}}}) {
+        vec2d map = make_map(mdims[0], mdims[1]);
+
+        for (auto kdims : {std::array<uint_t,2>{{1,1}}, std::array<uint_t,2>{{3,3}},
+            std::array<uint_t,2>{{5,7}}, std::array<uint_t,2>{{9,9}},
+            std::array<uint_t,2>{{1,15}}, std::array<uint_t,2>{{15,1}},
+            std::array<uint_t,2>{{21,21}}}) {
+            vec2d kernel = make_kernel(kdims[0], kdims[1]);
+            vec2d ref = convolve_reference(map, kernel);
+
+            double d = max_rel_diff(astro::convolve2d_direct(map, kernel), ref);
+            check_base(d < tol, "  failed: convolve2d_direct with map "+to_string(mdims)+
+                " and kernel "+to_string(kdims)+" (diff="+to_string(d)+")");
+        }
+
+        // Separable kernels, exact (Gaussian, random outer product) and almost separable
+        vec2d gauss = astro::gaussian_profile({{31,31}}, 4.0);
+        auto seed = make_seed(7);
+        vec1d kx = randomu(seed, 7), ky = randomu(seed, 11);
+        vec2d outer(7, 11);
+        for (uint_t ix : range(7))
+        for (uint_t iy : range(11)) {
+            outer.safe(ix,iy) = kx.safe[ix]*ky.safe[iy];
+        }
+
+        vec2d almost = outer;
+        almost(3,5) *= 1.01;
+
+        for (auto kernel : {gauss, outer, almost}) {
+            vec2d ref = convolve_reference(map, kernel);
+            double d = max_rel_diff(astro::convolve2d_direct(map, kernel), ref);
+            check_base(d < tol, "  failed: separable convolve2d_direct with map "+to_string(mdims)+
+                " and kernel "+to_string(kernel.dims)+" (diff="+to_string(d)+")");
+        }
+    }
+
+    // Single precision maps give single precision results
+    vec2f fmap = make_map(40, 30);
+    vec2f fkernel = make_kernel(5, 5);
+    vec2f fres = astro::convolve2d_direct(fmap, fkernel);
+    double d = max_rel_diff(fres, convolve_reference(fmap, fkernel));
+    check_base(d < 1e-6, "  failed: convolve2d_direct with float (diff="+to_string(d)+")");
+}
+
+void test_best_method() {
+    print("Choice of convolution method");
+
+    std::array<uint_t,2> small = {{100, 100}}, large = {{2000, 2000}};
+    vec2d gauss = astro::gaussian_profile({{31,31}}, 4.0);
+
+    // Even kernels are only supported by the FFT
+    check(astro::convolve2d_best_method(large, make_kernel(4, 4)) ==
+        astro::convolve2d_method::fft, true);
+    // Small kernels use direct summation
+    check(astro::convolve2d_best_method(large, make_kernel(3, 3)) ==
+        astro::convolve2d_method::direct, true);
+    check(astro::convolve2d_best_method(small, make_kernel(5, 5)) ==
+        astro::convolve2d_method::direct, true);
+    // Separable kernels are convolved in two passes
+    check(astro::convolve2d_best_method(large, gauss) ==
+        astro::convolve2d_method::separable, true);
+#ifndef NO_FFTW
+    // Large, non-separable kernels use the FFT
+    check(astro::convolve2d_best_method(large, make_kernel(41, 41)) ==
+        astro::convolve2d_method::fft, true);
+#else
+    // Large, non-separable kernels use direct summation if the FFT is not available
+    check(astro::convolve2d_best_method(large, make_kernel(41, 41)) ==
+        astro::convolve2d_method::direct, true);
+#endif
+
+    // Whatever the method, convolve2d() gives the same result as the direct summation
+    vec2d map = make_map(120, 90);
+    std::vector<vec2d> kernels = {make_kernel(3, 3), gauss, make_kernel(41, 41)};
+#ifndef NO_FFTW
+    kernels.push_back(make_kernel(4, 4));
+#endif
+
+    for (auto& kernel : kernels) {
+        double d = max_rel_diff(astro::convolve2d(map, kernel), convolve_reference(map, kernel));
+        check_base(d < 1e-12, "  failed: convolve2d with kernel "+to_string(kernel.dims)+
+            " (diff="+to_string(d)+")");
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_fft_convolution();
+    test_tiled_convolution();
+    test_batch_convolution();
+    test_direct_convolution();
+    test_best_method();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
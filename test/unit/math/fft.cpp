@@ -1,10 +1,46 @@
 #include <vif.hpp>
-#include <vif/unit_test.hpp>
+#include <vif/test/unit_test.hpp>
 
 using namespace vif;
 
-int vif_main(int argc, char* argv[]) {
-    vec2d v = gaussian_profile({{41,41}}, 4.0) + 0.1*gaussian_profile({{41,41}}, 10.0);
+// Reference discrete Fourier transform by direct summation, on the full (redundant) 2D
+// array. 1D transforms are computed with dims[0] = 1.
+vec2cd dft_reference(const vec2d& v) {
+    const uint_t nx = v.dims[0], ny = v.dims[1];
+    vec2cd r(nx, ny);
+    for (uint_t kx : range(nx))
+    for (uint_t ky : range(ny)) {
+        complex<double> s = 0.0;
+        for (uint_t x : range(nx))
+        for (uint_t y : range(ny)) {
+            double a = -2.0*dpi*(double(kx*x)/nx + double(ky*y)/ny);
+            s += v.safe(x,y)*complex<double>(cos(a), sin(a));
+        }
+
+        r.safe(kx,ky) = s;
+    }
+
+    return r;
+}
+
+// Compare the non-redundant half of a transform, as stored by fft(), with the reference
+double max_rel_diff_half(const complex<double>* f, const vec2cd& ref) {
+    const uint_t nx = ref.dims[0], ny = ref.dims[1], nh = ny/2 + 1;
+    double d = 0.0, m = 0.0;
+    for (uint_t x : range(nx))
+    for (uint_t y : range(nh)) {
+        d = std::max(d, abs(f[x*nh + y] - ref.safe(x,y)));
+        m = std::max(m, abs(ref.safe(x,y)));
+    }
+
+    return d/m;
+}
+
+void test_round_trip() {
+    print("FFT round trip and convolution");
+
+    vec2d v = astro::gaussian_profile({{41,41}}, 4.0) +
+        0.1*astro::gaussian_profile({{41,41}}, 10.0);
     vec2cd cv = fft(v);
     vec2d iv = ifft(cv)/v.size();
 
@@ -17,10 +53,10 @@ int vif_main(int argc, char* argv[]) {
     vec2d psf = v;
 
     double st = now();
-    vec2d cimg1 = convolve2d(img, psf);
+    vec2d cimg1 = astro::convolve2d(img, psf);
     double fast = now() - st;
     st = now();
-    vec2d cimg2 = convolve2d_naive(img, psf);
+    vec2d cimg2 = astro::convolve2d_naive(img, psf);
     double slow = now() - st;
 
     // TODO: investigate expected numerical precision of the FFT convolution algorithm
@@ -30,6 +66,209 @@ int vif_main(int argc, char* argv[]) {
 
     print("fast version: ", fast);
     print("slow version: ", slow);
+}
+
+void test_fft() {
+    print("FFT vs. direct summation");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(42);
+
+    // Various sizes, including odd and prime ones; each transform is done twice so that the
+    // second call uses the cached plan
+    for (uint_t n : {1u, 2u, 15u, 97u, 128u}) {
+        vec1d v = randomn(seed, n);
+        vec2cd ref = dft_reference(reform(v, 1, n));
+
+        vec1cd f = fft(v);
+        double d = max_rel_diff_half(f.raw_data(), ref);
+        check_base(d < tol, "  failed: 1D fft, n="+to_string(n)+" (diff="+to_string(d)+")");
+        check(count(fft(v) != f), 0u);
+
+        vec1d b = ifft(f)/n;
+        d = max_rel_diff(b, v);
+        check_base(d < tol, "  failed: 1D ifft, n="+to_string(n)+" (diff="+to_string(d)+")");
+    }
+
+    for (auto dims : {std::array<uint_t,2>{{12,10}}, std::array<uint_t,2>{{7,9}},
+        std::array<uint_t,2>{{1,16}}, std::array<uint_t,2>{{16,1}}}) {
+        vec2d v = randomn(seed, dims[0], dims[1]);
+        vec2cd ref = dft_reference(v);
+
+        vec2cd f = fft(v);
+        double d = max_rel_diff_half(f.raw_data(), ref);
+        check_base(d < tol, "  failed: 2D fft, dims="+to_string(dims)+" (diff="+to_string(d)+")");
+        check(count(fft(v) != f), 0u);
+
+        vec2d b = ifft(f)/v.size();
+        d = max(abs(b - v))/max(abs(v));
+        check_base(d < tol, "  failed: 2D ifft, dims="+to_string(dims)+" (diff="+to_string(d)+")");
+
+        // Complex to complex transforms, full array
+        vec2cd fc = fft_c2c(vec2cd(v));
+        d = max(abs(fc - ref))/max(abs(ref));
+        check_base(d < tol, "  failed: 2D fft_c2c, dims="+to_string(dims)+" (diff="+to_string(d)+")");
+        d = max(abs(ifft_c2c(fc)/double(v.size()) - v))/max(abs(v));
+        check_base(d < tol, "  failed: 2D ifft_c2c, dims="+to_string(dims)+" (diff="+to_string(d)+")");
+    }
+}
+
+void test_plan_cache() {
+    print("FFTW plan cache");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(43);
+    vec2d v = randomn(seed, 24, 30);
+    vec2cd f = fft(v);
+
+    // Clearing the cache creates new plans, with the same result
+    fftw::clear_plans();
+    check(count(fft(v) != f), 0u);
+
+    // Measured plans may use a different algorithm, but must give the same result
+    fftw::set_planning(fftw::planning::measure);
+    vec2cd fm = fft(v);
+    double d = max(abs(fm - f))/max(abs(f));
+    check_base(d < tol, "  failed: measured plan (diff="+to_string(d)+")");
+    check(count(fft(v) != fm), 0u);
+    fftw::set_planning(fftw::planning::estimate);
+
+    // Wisdom files
+    std::string wisdom = "fftw_wisdom.txt";
+    check(fftw::save_wisdom(wisdom), true);
+    check(file::exists(wisdom), true);
+    check(fftw::load_wisdom(wisdom), true);
+    check(fftw::load_wisdom("fftw_wisdom_not_there.txt"), false);
+    file::remove(wisdom);
+
+    // Plans shared between threads, each thread using several sizes: the results must be
+    // identical to those of the main thread
+    vec1u sizes = {16, 17, 64, 100};
+    std::vector<vec1d> inputs;
+    std::vector<vec1cd> outputs;
+    for (uint_t n : sizes) {
+        inputs.push_back(randomn(seed, n));
+        outputs.push_back(fft(inputs.back()));
+    }
+
+    const uint_t nthread = 4;
+    vec1u nbad(nthread);
+    std::vector<std::thread> threads;
+    for (uint_t t : range(nthread)) {
+        threads.emplace_back([&, t]() {
+            for (uint_t i : range(200)) {
+                uint_t k = (i + t) % sizes.size();
+                if (count(fft(inputs[k]) != outputs[k]) != 0) ++nbad.safe[t];
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    check(total(nbad), 0u);
+}
+
+void test_fft_many() {
+    print("Batched, 3D and multithreaded FFTs");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(44);
+
+    // Batched 1D transforms vs. one transform per row
+    for (auto dims : {std::array<uint_t,2>{{5,32}}, std::array<uint_t,2>{{7,15}},
+        std::array<uint_t,2>{{1,8}}}) {
+        vec2d v = randomn(seed, dims[0], dims[1]);
+        vec2cd f = fft_many(v);
+        vec2d b = ifft_many(f);
+
+        const uint_t nh = dims[1]/2 + 1;
+        double d = 0.0, db = 0.0;
+        for (uint_t i : range(dims[0])) {
+            vec1cd fr = fft(vec1d(v(i,_)));
+            vec1cd fi = f(i,_);
+            d = std::max(d, max(abs(fi[_-(nh-1)] - fr[_-(nh-1)]))/max(abs(fr[_-(nh-1)])));
+            vec1d br = ifft(fr);
+            db = std::max(db, max(abs(vec1d(b(i,_)) - br))/max(abs(br)));
+        }
+
+        check_base(d < tol, "  failed: fft_many, dims="+to_string(dims)+" (diff="+to_string(d)+")");
+        check_base(db < tol, "  failed: ifft_many, dims="+to_string(dims)+" (diff="+to_string(db)+")");
+        d = max(abs(b/double(dims[1]) - v))/max(abs(v));
+        check_base(d < tol, "  failed: fft_many round trip, dims="+to_string(dims)+
+            " (diff="+to_string(d)+")");
+    }
+
+    // Batched 2D transforms vs. one transform per slice
+    {
+        vec3d v = randomn(seed, 4, 6, 10);
+        vec3cd f = fft_many(v);
+        vec3d b = ifft_many(f);
+
+        double d = 0.0, ds = 0.0;
+        for (uint_t i : range(v.dims[0])) {
+            vec2d s = v(i,_,_);
+            d = std::max(d, max_rel_diff_half(&f(i,0,0), dft_reference(s)));
+
+            // Same layout as fft() of the slice
+            vec2cd fs = fft(s);
+            const complex<double>* fi = &f(i,0,0);
+            for (uint_t j : range(v.dims[1]*(v.dims[2]/2 + 1))) {
+                ds = std::max(ds, abs(fi[j] - fs.safe[j]));
+            }
+        }
+
+        ds /= max(abs(f));
+        check_base(d < tol, "  failed: 3D fft_many (diff="+to_string(d)+")");
+        check_base(ds < tol, "  failed: 3D fft_many vs fft (diff="+to_string(ds)+")");
+        d = max(abs(b/60.0 - v))/max(abs(v));
+        check_base(d < tol, "  failed: 3D ifft_many (diff="+to_string(d)+")");
+    }
+
+    // 3D transforms: with dims[0] = 1 this is a 2D transform, otherwise check the round trip
+    {
+        vec3d v = randomn(seed, 1, 9, 8);
+        vec2d s = v(0,_,_);
+        double d = max_rel_diff_half(fft(v).raw_data(), dft_reference(s));
+        check_base(d < tol, "  failed: 3D fft (diff="+to_string(d)+")");
+
+        vec3d w = randomn(seed, 5, 6, 7);
+        d = max(abs(ifft(fft(w))/double(w.size()) - w))/max(abs(w));
+        check_base(d < tol, "  failed: 3D round trip (diff="+to_string(d)+")");
+    }
+
+    // Multithreaded transforms give the same result as single threaded ones
+    {
+        vec2d v = randomn(seed, 256, 300);
+        vec3d w = randomn(seed, 32, 40, 50);
+        vec2cd f1 = fft(v);
+        vec3cd g1 = fft(w);
+        vec2cd m1 = fft_many(v);
+
+        fftw::set_threads(3);
+        vec2cd f3 = fft(v);
+        vec3cd g3 = fft(w);
+        vec2cd m3 = fft_many(v);
+        fftw::set_threads(1);
+
+        double d = max(abs(f3 - f1))/max(abs(f1));
+        check_base(d < tol, "  failed: threaded 2D fft (diff="+to_string(d)+")");
+        d = max(abs(g3 - g1))/max(abs(g1));
+        check_base(d < tol, "  failed: threaded 3D fft (diff="+to_string(d)+")");
+        d = max(abs(m3 - m1))/max(abs(m1));
+        check_base(d < tol, "  failed: threaded fft_many (diff="+to_string(d)+")");
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_round_trip();
+    test_fft();
+    test_plan_cache();
+    test_fft_many();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
 
-    return 0;
+    return failed == 0u ? 0 : 1;
 }
@@ -0,0 +1,112 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+void test_interpolator() {
+    print("interpolator vs. interpolate() and interpolate_3spline()");
+
+    const double tol = 1e-12;
+    auto seed = make_seed(42);
+
+    // Irregular grid, regular grid, and the smallest possible grid
+    vec1d xirr = 10.0*randomu(seed, 50);
+    inplace_sort(xirr);
+    vec1d xreg = 3.0 + 0.5*indgen<double>(40);
+    vec1d xtwo = {1.0, 2.0};
+
+    for (auto x : {xirr, xreg, xtwo}) {
+        vec1d y = sin(x) + 0.1*randomn(seed, x.size());
+        const double xmin = x.front(), xmax = x.back(), dx = xmax - xmin;
+
+        // Unsorted positions inside and outside of the range, the grid nodes, NaN, and
+        // enough positions to span several evaluation blocks
+        vec1d t = xmin - 0.5*dx + 2.0*dx*randomu(seed, 1000);
+        append(t, x);
+        append(t, vec1d{xmin - 1e3, xmax + 1e3, dnan, xmin, xmax, dnan, 0.5*(xmin + xmax)});
+        vec1d ts = t[where(is_finite(t))];
+        inplace_sort(ts);
+
+        std::string what = "n="+to_string(x.size());
+
+        // Linear
+        interpolator lin(y, x);
+        check(lin.size(), x.size());
+
+        double d = max_rel_diff(lin(t), interpolate(y, x, t));
+        check_base(d < tol, "  failed: linear, "+what+" (diff="+to_string(d)+")");
+        d = max_rel_diff(lin(ts), interpolate(y, x, ts));
+        check_base(d < tol, "  failed: linear sorted, "+what+" (diff="+to_string(d)+")");
+        d = max_rel_diff(lin(reverse(ts)), interpolate(y, x, reverse(ts)));
+        check_base(d < tol, "  failed: linear reversed, "+what+" (diff="+to_string(d)+")");
+
+        // Cubic spline
+        interpolator cub(y, x, interpolator::method::cubic_spline);
+        d = max_rel_diff(cub(t), interpolate_3spline(y, x, t));
+        check_base(d < tol, "  failed: cubic, "+what+" (diff="+to_string(d)+")");
+        d = max_rel_diff(cub(ts), interpolate_3spline(y, x, ts));
+        check_base(d < tol, "  failed: cubic sorted, "+what+" (diff="+to_string(d)+")");
+
+        // Values at the nodes are the data
+        d = max_rel_diff(lin(x), y);
+        check_base(d < tol, "  failed: linear at nodes, "+what+" (diff="+to_string(d)+")");
+        d = max_rel_diff(cub(x), y);
+        check_base(d < tol, "  failed: cubic at nodes, "+what+" (diff="+to_string(d)+")");
+
+        // Scalar and vector evaluation agree exactly
+        vec1d sl(t.dims), sc(t.dims), sdl(t.dims), sdc(t.dims);
+        for (uint_t i : range(t)) {
+            sl[i] = lin(t[i]);
+            sc[i] = cub(t[i]);
+            sdl[i] = lin.derivative(t[i]);
+            sdc[i] = cub.derivative(t[i]);
+        }
+
+        check_base(same(lin(t), sl), "  failed: linear scalar vs vector, "+what);
+        check_base(same(cub(t), sc), "  failed: cubic scalar vs vector, "+what);
+        check_base(same(lin.derivative(t), sdl),
+            "  failed: linear derivative scalar vs vector, "+what);
+        check_base(same(cub.derivative(t), sdc),
+            "  failed: cubic derivative scalar vs vector, "+what);
+
+        // Scalar evaluation agrees with the scalar free functions
+        double tmid = 0.5*(x[0] + x[1]);
+        check_base(abs(lin(tmid) - interpolate(y, x, tmid)) < tol*max(abs(y)),
+            "  failed: linear scalar, "+what);
+        check_base(abs(cub(tmid) - interpolate_3spline(y, x, tmid)) < tol*max(abs(y)),
+            "  failed: cubic scalar, "+what);
+
+        // NaN positions give NaN
+        check(is_nan(lin(dnan)), true);
+        check(is_nan(cub(dnan)), true);
+
+        // Derivatives vs. finite differences, away from the nodes
+        vec1d td;
+        for (double tt : xmin - 0.2*dx + 1.4*dx*randomu(seed, 200)) {
+            if (min(abs(x - tt)) > 1e-4) td.push_back(tt);
+        }
+
+        const double h = 1e-6;
+        d = max_rel_diff(lin.derivative(td), (lin(td + h) - lin(td - h))/(2.0*h));
+        check_base(d < 1e-6, "  failed: linear derivative, "+what+" (diff="+to_string(d)+")");
+        d = max_rel_diff(cub.derivative(td), (cub(td + h) - cub(td - h))/(2.0*h));
+        check_base(d < 1e-6, "  failed: cubic derivative, "+what+" (diff="+to_string(d)+")");
+    }
+
+    // Single precision input
+    vec1f fx = {0.0f, 1.0f, 2.5f, 4.0f};
+    vec1f fy = {1.0f, -2.0f, 0.5f, 3.0f};
+    vec1f ft = {-1.0f, 0.2f, 1.7f, 3.9f, 5.0f};
+    interpolator flin(fy, fx);
+    double d = max_rel_diff(flin(ft), interpolate(vec1d(fy), vec1d(fx), vec1d(ft)));
+    check_base(d < tol, "  failed: linear float (diff="+to_string(d)+")");
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_interpolator();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
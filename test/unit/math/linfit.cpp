@@ -0,0 +1,274 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Cosine model components, [nparam,npt]
+vec2d make_components(uint_t np, uint_t npt) {
+    vec1d t = rgen(0.0, 1.0, npt);
+    vec2d x(np, npt);
+    for (uint_t i : range(np)) {
+        x(i,_) = cos(dpi*i*t);
+    }
+
+    return x;
+}
+
+void test_linfit_many() {
+    print("linfit_many vs. linfit_pack");
+
+    const double tol = 1e-10;
+    auto seed = make_seed(42);
+
+    // More fits than a single thread chunk, to exercise the threads
+    const uint_t nfit = 150, npt = 40, np = 5;
+    vec2d x = make_components(np, npt);
+    vec2d ptrue = randomn(seed, nfit, np);
+    vec2d ye = 0.1 + randomu(seed, nfit, npt);
+    vec2d y(nfit, npt);
+    for (uint_t k : range(nfit)) {
+        y(k,_) = ye(k,_)*randomn(seed, npt);
+        for (uint_t i : range(np)) {
+            y(k,_) += ptrue(k,i)*x(i,_);
+        }
+    }
+
+    for (uint_t thread : {1u, 3u}) {
+        linfit_many_params opts;
+        opts.thread = thread;
+        opts.covariance = true;
+
+        // Uncertainties per fit, and shared uncertainties
+        linfit_many_result r = linfit_many(y, ye, x, opts);
+        vec1d yes = ye(0,_);
+        linfit_many_result rs = linfit_many(y, yes, x, opts);
+
+        check(r.cov.dims[0], nfit);
+        check(rs.cov.dims[0], nfit);
+
+        uint_t nbad = 0, nbads = 0;
+        for (uint_t k : range(nfit)) {
+            linfit_result fr = linfit_pack(vec1d{y(k,_)}, vec1d{ye(k,_)}, x);
+            linfit_result frs = linfit_pack(vec1d{y(k,_)}, yes, x);
+
+            if (!r.success[k] ||
+                max_rel_diff(r.params(k,_), fr.params) > tol ||
+                max_rel_diff(r.errors(k,_), fr.errors) > tol ||
+                max_rel_diff(flatten(r.cov(k,_,_)), flatten(fr.cov.base)) > tol ||
+                abs(r.chi2[k] - fr.chi2)/fr.chi2 > tol) {
+                ++nbad;
+            }
+
+            if (!rs.success[k] ||
+                max_rel_diff(rs.params(k,_), frs.params) > tol ||
+                max_rel_diff(rs.errors(k,_), frs.errors) > tol ||
+                max_rel_diff(flatten(rs.cov(k,_,_)), flatten(frs.cov.base)) > tol ||
+                abs(rs.chi2[k] - frs.chi2)/frs.chi2 > tol) {
+                ++nbads;
+            }
+        }
+
+        std::string what = "thread="+to_string(thread);
+        check_base(nbad == 0, "  failed: "+what+" ("+to_string(nbad)+" fits differ)");
+        check_base(nbads == 0, "  failed: shared errors, "+what+" ("+to_string(nbads)+
+            " fits differ)");
+    }
+
+    // Without covariance
+    linfit_many_result r = linfit_many(y, ye, x);
+    check(r.cov.empty(), true);
+    check(r.params.dims[0], nfit);
+    check(r.params.dims[1], np);
+
+    // Degenerate components: fits fail
+    vec2d xd = x;
+    xd(1,_) = 2.0*x(0,_);
+    r = linfit_many(y, ye, xd);
+    check(count(r.success), 0u);
+    check(count(is_finite(r.params)), 0u);
+    check(count(is_finite(r.chi2)), 0u);
+
+    r = linfit_many(y, vec1d{ye(0,_)}, xd);
+    check(count(r.success), 0u);
+    check(count(is_finite(r.params)), 0u);
+
+    // Components that are only degenerate for one fit: the other fits are unaffected
+    xd = x;
+    xd(1,_) = x(0,_);
+    xd(1,npt-1) += 1.0;
+    vec2d yed = ye;
+    yed(3,npt-1) = dinf;
+    r = linfit_many(y, yed, xd);
+    check(r.success[3], false);
+    check(count(is_finite(r.params(3,_))), 0u);
+    check(count(r.success), nfit - 1);
+}
+
+void test_linfit_many_errors() {
+    print("Errors in linfit_many worker threads");
+
+    // Exceptions thrown in a worker thread are forwarded, and the one of the first failing
+    // chunk is reported whatever the thread order
+    for (uint_t nthread : {1u, 2u, 4u}) {
+        std::string what;
+        try {
+            impl::linfit_many_parallel_(1000, nthread, [](uint_t i0, uint_t i1, uint_t) {
+                for (uint_t i = i0; i < i1; ++i) {
+                    if (i == 900) throw std::runtime_error("fit 900");
+                    if (i == 300) throw std::runtime_error("fit 300");
+                }
+            });
+        } catch (std::runtime_error& e) {
+            what = e.what();
+        }
+
+        check(what, "fit 300");
+    }
+}
+
+// Brute force non-negative fit: try all the subsets of free parameters, and keep the best
+// solution among those with no negative parameter
+linfit_nn_result brute_force_nn(const vec1d& y, const vec1d& ye, const vec2d& x) {
+    const uint_t np = x.dims[0];
+
+    linfit_nn_result best;
+    best.success = true;
+    best.params = replicate(0.0, np);
+    best.chi2 = total(sqr(y/ye));
+
+    for (uint_t s : range(1u, 1u << np)) {
+        vec1u ids;
+        for (uint_t i : range(np)) {
+            if ((s >> i) & 1u) ids.push_back(i);
+        }
+
+        vec2d xs(ids.size(), x.dims[1]);
+        for (uint_t i : range(ids)) {
+            xs(i,_) = x(ids[i],_);
+        }
+
+        linfit_result fr = linfit_pack(y, ye, xs);
+        if (!fr.success || count(fr.params < 0.0) != 0 || fr.chi2 >= best.chi2) continue;
+
+        best.chi2 = fr.chi2;
+        best.params[_] = 0.0;
+        best.params[ids] = fr.params;
+    }
+
+    return best;
+}
+
+void test_linfit_nn() {
+    print("linfit_nn vs. brute force");
+
+    auto seed = make_seed(43);
+    const uint_t npt = 30, np = 6;
+    vec2d x = make_components(np, npt);
+    vec1d ye = 0.1 + randomu(seed, npt);
+
+    auto batch = linfit_pack_batch(ye, x);
+
+    uint_t nbad = 0, nbadb = 0, nconstrained = 0;
+    for (uint_t k : range(200)) {
+        // True parameters of both signs, so that some are constrained and some are not
+        vec1d ptrue = randomn(seed, np) + (k % 2 == 0 ? 1.0 : 0.0);
+        vec1d y = ye*randomn(seed, npt);
+        for (uint_t i : range(np)) {
+            y += ptrue[i]*x(i,_);
+        }
+
+        linfit_nn_result ref = brute_force_nn(y, ye, x);
+        if (count(ref.params == 0.0) != 0) ++nconstrained;
+
+        // Active set, from scratch and from the previous passive set
+        linfit_nn_result fr = linfit_nn_pack(y, ye, x);
+        batch.fit_nn(y);
+
+        if (!fr.success || abs(fr.chi2 - ref.chi2)/ref.chi2 > 1e-10 ||
+            max(abs(fr.params - ref.params)) > 1e-8*max(abs(ref.params)) ||
+            count(fr.params < 0.0) != 0) {
+            ++nbad;
+        }
+
+        if (!batch.fr_nn.success || abs(batch.fr_nn.chi2 - ref.chi2)/ref.chi2 > 1e-10 ||
+            max(abs(batch.fr_nn.params - ref.params)) > 1e-8*max(abs(ref.params))) {
+            ++nbadb;
+        }
+    }
+
+    check_base(nconstrained > 20 && nconstrained < 180,
+        "  failed: constrained fits ("+to_string(nconstrained)+")");
+    check_base(nbad == 0, "  failed: active set ("+to_string(nbad)+" fits differ)");
+    check_base(nbadb == 0, "  failed: batch active set ("+to_string(nbadb)+" fits differ)");
+
+    // All parameters positive: same as the unconstrained fit
+    vec1d y = ye*randomn(seed, npt);
+    for (uint_t i : range(np)) {
+        y += (10.0 + i)*x(i,_);
+    }
+
+    linfit_result frl = linfit_pack(y, ye, x);
+    linfit_nn_result frn = linfit_nn_pack(y, ye, x);
+    check(count(frl.params < 0.0), 0u);
+    check(frn.success, true);
+    double e = max_rel_diff(frn.params, frl.params);
+    check_base(e < 1e-10, "  failed: positive params (diff="+to_string(e)+")");
+
+    // Same as the variadic interface
+    linfit_nn_result frv = linfit_nn(y, ye, x(0,_), x(1,_), x(2,_), x(3,_), x(4,_), x(5,_));
+    e = max_rel_diff(frv.params, frn.params);
+    check_base(e < 1e-10, "  failed: variadic (diff="+to_string(e)+")");
+
+    // Negative data with positive components: null solution
+    vec2d xp = 1.0 + x;
+    frn = linfit_nn_pack(vec1d{-abs(y)}, ye, xp);
+    check(frn.success, true);
+    check(count(frn.params != 0.0), 0u);
+    check(frn.chi2, total(sqr(y/ye)));
+
+    // Multiplicative updates, which require positive components and data: approximate
+    // solution, and never better than the exact solution
+    uint_t nbadm = 0;
+    for (uint_t k : range(50)) {
+        vec1d ptrue = abs(randomn(seed, np));
+        ptrue[k % np] = 0.0;
+        y = 0.01*randomu(seed, npt);
+        for (uint_t i : range(np)) {
+            y += ptrue[i]*xp(i,_);
+        }
+
+        linfit_nn_result ref = brute_force_nn(y, ye, xp);
+        linfit_nn_result fr = linfit_nn_pack(y, ye, xp, linfit_nn_method::multiplicative);
+        if (count(fr.params < 0.0) != 0 || fr.chi2 < ref.chi2*(1.0 - 1e-10) ||
+            fr.chi2 > ref.chi2 + 1e-2*total(sqr(y/ye))) {
+            ++nbadm;
+        }
+    }
+
+    check_base(nbadm == 0, "  failed: multiplicative ("+to_string(nbadm)+" fits differ)");
+
+    // Choice of method in the variadic interface
+    linfit_nn_result frm = linfit_nn(linfit_nn_method::multiplicative, y, ye,
+        xp(0,_), xp(1,_), xp(2,_), xp(3,_), xp(4,_), xp(5,_));
+    linfit_nn_result frp = linfit_nn_pack(y, ye, xp, linfit_nn_method::multiplicative);
+    check(frm.success, frp.success);
+    e = max_rel_diff(frm.params, frp.params);
+    check_base(e < 1e-10, "  failed: variadic multiplicative (diff="+to_string(e)+")");
+
+    frv = linfit_nn(linfit_nn_method::active_set, y, ye,
+        xp(0,_), xp(1,_), xp(2,_), xp(3,_), xp(4,_), xp(5,_));
+    frp = linfit_nn_pack(y, ye, xp);
+    e = max_rel_diff(frv.params, frp.params);
+    check_base(e < 1e-10, "  failed: variadic active set (diff="+to_string(e)+")");
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_linfit_many();
+    test_linfit_many_errors();
+    test_linfit_nn();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
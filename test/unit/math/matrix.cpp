@@ -0,0 +1,170 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Unblocked, single threaded reference implementations of the matrix kernels, working on
+// row-major matrices
+
+vec2d reference_gemm(const vec2d& a, const vec2d& b) {
+    vec2d c(a.dims[0], b.dims[1]);
+    for (uint_t i : range(a.dims[0]))
+    for (uint_t j : range(b.dims[1])) {
+        double s = 0.0;
+        for (uint_t p : range(a.dims[1])) {
+            s += a.safe(i,p)*b.safe(p,j);
+        }
+
+        c.safe(i,j) = s;
+    }
+
+    return c;
+}
+
+bool reference_potrf(vec2d& a) {
+    const uint_t n = a.dims[0];
+    for (uint_t j : range(n)) {
+        double s = a.safe(j,j);
+        for (uint_t p : range(j)) {
+            s -= a.safe(j,p)*a.safe(j,p);
+        }
+
+        if (s <= 0.0) return false;
+        a.safe(j,j) = sqrt(s);
+
+        for (uint_t i = j+1; i < n; ++i) {
+            double t = a.safe(i,j);
+            for (uint_t p : range(j)) {
+                t -= a.safe(i,p)*a.safe(j,p);
+            }
+
+            a.safe(i,j) = t/a.safe(j,j);
+        }
+
+        for (uint_t i = j+1; i < n; ++i) {
+            a.safe(j,i) = 0.0;
+        }
+    }
+
+    return true;
+}
+
+// Crout LU with partial pivoting, same conventions as impl::matrix_impl::getrf()
+void reference_getrf(vec2d& a, vec1u& ipiv) {
+    const uint_t n = a.dims[0];
+    ipiv = indgen(n);
+    for (uint_t k : range(n)) {
+        for (uint_t i = k+1; i < n; ++i) {
+            if (std::abs(a.safe(ipiv[k],k)) < std::abs(a.safe(i,k))) {
+                ipiv[k] = i;
+            }
+        }
+
+        if (ipiv[k] != k) {
+            for (uint_t j : range(n)) {
+                std::swap(a.safe(k,j), a.safe(ipiv[k],j));
+            }
+        }
+
+        for (uint_t j = k+1; j < n; ++j) {
+            a.safe(k,j) /= a.safe(k,k);
+        }
+
+        for (uint_t i = k+1; i < n; ++i)
+        for (uint_t j = k+1; j < n; ++j) {
+            a.safe(i,j) -= a.safe(i,k)*a.safe(k,j);
+        }
+    }
+}
+
+void test_kernels(uint_t nthread) {
+    print("Blocked matrix kernels, ", nthread, " thread(s)");
+    matrix::set_threads(nthread);
+
+    const double tol = 1e-12;
+    auto seed = make_seed(42);
+
+    // Sizes below and above the block sizes, and not multiples of four
+    for (uint_t n : {1u, 5u, 67u, 130u, 263u}) {
+        const uint_t m = n + 3, k = 2*n + 1;
+        vec2d a = randomn(seed, m, k);
+        vec2d b = randomn(seed, k, n);
+
+        // gemm, with alpha and beta
+        vec2d c0 = randomn(seed, m, n);
+        vec2d c = c0;
+        impl::matrix_impl::gemm(m, n, k, 2.0, a.raw_data(), k, b.raw_data(), n,
+            0.5, c.raw_data(), n);
+        double d = max_rel_diff(c, 2.0*reference_gemm(a, b) + 0.5*c0);
+        check_base(d < tol, "  failed: gemm, n="+to_string(n)+" (diff="+to_string(d)+")");
+
+        // gemv, normal and transposed
+        vec1d x = randomn(seed, k);
+        vec1d y(m);
+        impl::matrix_impl::gemv(false, m, k, 1.0, a.raw_data(), k, x.raw_data(),
+            0.0, y.raw_data());
+        vec2d yref = reference_gemm(a, reform(x, k, 1));
+        d = max_rel_diff(reform(y, m, 1), yref);
+        check_base(d < tol, "  failed: gemv, n="+to_string(n)+" (diff="+to_string(d)+")");
+
+        vec1d xt = randomn(seed, m);
+        vec1d yt(k);
+        impl::matrix_impl::gemv(true, m, k, 1.0, a.raw_data(), k, xt.raw_data(),
+            0.0, yt.raw_data());
+        yref = reference_gemm(transpose(a), reform(xt, m, 1));
+        d = max_rel_diff(reform(yt, k, 1), yref);
+        check_base(d < tol, "  failed: gemv^T, n="+to_string(n)+" (diff="+to_string(d)+")");
+
+        // syrk (both triangles are filled)
+        vec2d s(m, m);
+        impl::matrix_impl::syrk(m, k, 1.0, a.raw_data(), k, 0.0, s.raw_data(), m);
+        vec2d sref = reference_gemm(a, transpose(a));
+        d = max_rel_diff(s, sref);
+        check_base(d < tol, "  failed: syrk, n="+to_string(n)+" (diff="+to_string(d)+")");
+        check(count(s != transpose(s)), 0u);
+
+        // potrf on a well conditioned positive definite matrix
+        vec2d l = sref;
+        for (uint_t i : range(m)) {
+            l.safe(i,i) += k;
+        }
+
+        vec2d lref = l;
+        check(impl::matrix_impl::potrf(m, l.raw_data(), m), true);
+        check(reference_potrf(lref), true);
+        d = max_rel_diff(l, lref);
+        check_base(d < tol, "  failed: potrf, n="+to_string(n)+" (diff="+to_string(d)+")");
+
+        // potrf must fail on a non positive definite matrix
+        vec2d nl(m, m);
+        for (uint_t i : range(m)) {
+            nl.safe(i,i) = -1.0;
+        }
+
+        check(impl::matrix_impl::potrf(m, nl.raw_data(), m), false);
+
+        // getrf with partial pivoting
+        vec2d g = randomn(seed, m, m);
+        vec2d gref = g;
+        vec1u ipiv(m), ipref;
+        uint_t ns = 0;
+        check(impl::matrix_impl::getrf(m, g.raw_data(), m, ipiv.raw_data(), ns, false), true);
+        reference_getrf(gref, ipref);
+        check(count(ipiv != ipref), 0u);
+        check(ns, count(ipref != indgen(m)));
+        d = max_rel_diff(g, gref);
+        check_base(d < 1e3*tol, "  failed: getrf, n="+to_string(n)+" (diff="+to_string(d)+")");
+    }
+
+    matrix::set_threads(1);
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_kernels(1);
+    test_kernels(4);
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
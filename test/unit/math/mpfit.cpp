@@ -0,0 +1,310 @@
+#include <vif.hpp>
+#include <vif/math/mpfit.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Gaussian profile on a constant background, p = {amplitude, center, width, background}
+vec1d gauss_model(const vec1d& x, const vec1d& p) {
+    return p[0]*exp(-sqr(x - p[1])/(2.0*sqr(p[2]))) + p[3];
+}
+
+// Derivatives of the model with respect to each parameter, [nparam,npt]
+vec2d gauss_derivatives(const vec1d& x, const vec1d& p) {
+    vec1d e = exp(-sqr(x - p[1])/(2.0*sqr(p[2])));
+    vec2d d(4, x.size());
+    d(0,_) = e;
+    d(1,_) = p[0]*e*(x - p[1])/sqr(p[2]);
+    d(2,_) = p[0]*e*sqr(x - p[1])/pow(p[2], 3);
+    d(3,_) = 1.0;
+    return d;
+}
+
+struct gauss_data {
+    vec1d x, y, ye;
+};
+
+gauss_data make_gauss_data(seed_t& seed, const vec1d& p) {
+    gauss_data d;
+    d.x = rgen(-5.0, 5.0, 80);
+    d.ye = 0.05 + 0.05*randomu(seed, d.x.size());
+    d.y = gauss_model(d.x, p) + d.ye*randomn(seed, d.x.size());
+    return d;
+}
+
+void test_jacobian() {
+    print("mpfit with explicit Jacobian vs. finite differences");
+
+    auto seed = make_seed(42);
+    vec1d ptrue = {2.0, 0.3, 1.2, 0.5};
+    vec1d pstart = {1.0, -0.5, 2.0, 0.0};
+
+    for (uint_t i : range(5)) {
+        gauss_data d = make_gauss_data(seed, ptrue);
+        std::string what = "data set "+to_string(i);
+
+        auto deviate = [&](const vec1d& p) {
+            return (d.y - gauss_model(d.x, p))/d.ye;
+        };
+
+        uint_t njac = 0;
+        auto jacobian = [&](const vec1d& p) {
+            ++njac;
+            vec2d j = gauss_derivatives(d.x, p);
+            for (uint_t k : range(j.dims[0])) {
+                j(k,_) /= -d.ye;
+            }
+            return j;
+        };
+
+        mpfit_options opts(4);
+        mpfit_result rn = mpfit(deviate, pstart, opts);
+        mpfit_result ra = mpfit(deviate, jacobian, pstart, opts);
+
+        check(rn.success, true);
+        check(ra.success, true);
+        check(ra.dof, rn.dof);
+        check_base(njac > 0 && njac <= ra.iter + 1,
+            "  failed: Jacobian calls, "+what+" ("+to_string(njac)+")");
+
+        double e = max_rel_diff(ra.params, rn.params);
+        check_base(e < 1e-7, "  failed: params, "+what+" (diff="+to_string(e)+")");
+        e = abs(ra.chi2 - rn.chi2)/rn.chi2;
+        check_base(e < 1e-8, "  failed: chi2, "+what+" (diff="+to_string(e)+")");
+        e = max_rel_diff(ra.errors, rn.errors);
+        check_base(e < 1e-5, "  failed: errors, "+what+" (diff="+to_string(e)+")");
+
+        // Close to the true parameters
+        check_base(count(abs(ra.params - ptrue) > 5.0*ra.errors) == 0,
+            "  failed: accuracy, "+what+" ("+to_string(ra.params)+")");
+
+        // Same as the wrapper
+        mpfit_result rf = mpfitfun(d.y, d.ye, d.x, gauss_model, pstart, opts);
+        check(count(rf.params != rn.params), 0u);
+        check(rf.chi2, rn.chi2);
+
+        // Frozen parameter: its row of the Jacobian is ignored
+        opts.frozen[3] = true;
+        vec1d pfrozen = pstart;
+        pfrozen[3] = ptrue[3];
+        rn = mpfit(deviate, pfrozen, opts);
+        ra = mpfit(deviate, [&](const vec1d& p) {
+            vec2d j = jacobian(p);
+            j(3,_) = dnan;
+            return j;
+        }, pfrozen, opts);
+
+        check(rn.success, true);
+        check(ra.success, true);
+        check(ra.dof, rn.dof);
+        check(ra.params[3], ptrue[3]);
+        check(rn.params[3], ptrue[3]);
+        check(ra.errors[3], 0.0);
+        e = max_rel_diff(ra.params, rn.params);
+        check_base(e < 1e-7, "  failed: frozen params, "+what+" (diff="+to_string(e)+")");
+    }
+}
+
+void test_threads() {
+    print("mpfit with multithreaded finite differences");
+
+    auto seed = make_seed(43);
+    vec1d ptrue = {2.0, 0.3, 1.2, 0.5};
+    vec1d pstart = {1.0, -0.5, 2.0, 0.0};
+
+    for (uint_t i : range(3)) {
+        gauss_data d = make_gauss_data(seed, ptrue);
+        std::string what = "data set "+to_string(i);
+
+        auto deviate = [&](const vec1d& p) {
+            return (d.y - gauss_model(d.x, p))/d.ye;
+        };
+
+        mpfit_options opts(4);
+        // Exercise all derivative types and a limit, so each parameter uses a different
+        // code path in the finite differences
+        opts.deriv[1] = mpfit_options::deriv_symmetric;
+        opts.deriv[2] = mpfit_options::deriv_backward;
+        opts.lower_limit[2] = 0.1;
+        mpfit_result r1 = mpfit(deviate, pstart, opts);
+
+        for (uint_t thread : {2u, 3u, 8u}) {
+            std::string twhat = what+", thread="+to_string(thread);
+
+            opts.thread = thread;
+            mpfit_result rt = mpfit(deviate, pstart, opts);
+
+            // Each derivative is computed in the same way whatever the thread that computes
+            // it, so results must be identical
+            check(rt.success, r1.success);
+            check(rt.iter, r1.iter);
+            check_base(count(rt.params != r1.params) == 0, "  failed: params, "+twhat);
+            check_base(count(rt.errors != r1.errors) == 0, "  failed: errors, "+twhat);
+            check_base(rt.chi2 == r1.chi2, "  failed: chi2, "+twhat);
+        }
+
+        // Frozen parameters are skipped
+        opts.thread = 3;
+        opts.frozen[0] = true;
+        mpfit_result rt = mpfit(deviate, pstart, opts);
+        opts.thread = 1;
+        r1 = mpfit(deviate, pstart, opts);
+        check(rt.params[0], pstart[0]);
+        check(count(rt.params != r1.params), 0u);
+    }
+
+    // Exceptions thrown by the deviate function in a worker thread are forwarded
+    gauss_data d = make_gauss_data(seed, ptrue);
+    mpfit_options opts(4);
+    opts.thread = 3;
+
+    bool caught = false;
+    std::string msg;
+    try {
+        mpfit([&](const vec1d& p) {
+            if (p[2] != pstart[2]) throw std::runtime_error("bad width");
+            return (d.y - gauss_model(d.x, p))/d.ye;
+        }, pstart, opts);
+    } catch (std::runtime_error& e) {
+        caught = true;
+        msg = e.what();
+    }
+
+    check(caught, true);
+    check(msg, "bad width");
+}
+
+void test_many() {
+    print("mpfit_many vs. mpfit");
+
+    auto seed = make_seed(44);
+    const uint_t nfit = 20;
+    vec1d pstart = {1.0, -0.5, 2.0, 0.0};
+
+    // Each fit with different true parameters and uncertainties
+    vec1d x = rgen(-5.0, 5.0, 60);
+    vec2d y(nfit, x.size()), ye(nfit, x.size()), params(nfit, 4);
+    for (uint_t k : range(nfit)) {
+        vec1d ptrue = {1.0 + randomu(seed), 1.5*randomn(seed), 0.8 + randomu(seed), randomn(seed)};
+        ye(k,_) = 0.05 + 0.1*randomu(seed, x.size());
+        y(k,_) = gauss_model(x, ptrue) + ye(k,_)*randomn(seed, x.size());
+        params(k,_) = pstart + 0.1*randomn(seed, 4);
+    }
+
+    auto deviate = [&](uint_t k, const vec1d& p) {
+        return (y(k,_) - gauss_model(x, p))/ye(k,_);
+    };
+
+    mpfit_options opts(4);
+    opts.lower_limit[2] = 0.1;
+    opts.max_iter = 10; // some fits do not converge
+
+    for (uint_t thread : {1u, 3u}) {
+        std::string what = "thread="+to_string(thread);
+
+        mpfit_many_result rm = mpfit_many(deviate, params, opts, thread);
+        mpfit_many_result rf = mpfitfun_many(y, ye, x, gauss_model, params, opts, thread);
+
+        check(rm.success.size(), nfit);
+        check(rm.params.dims[0], nfit);
+        check(rm.params.dims[1], 4u);
+        check(rm.errors.dims[0], nfit);
+
+        // The fits are solved exactly as with mpfit(), one at a time
+        uint_t nbad = 0, nfail = 0;
+        for (uint_t k : range(nfit)) {
+            mpfit_result r = mpfit([&](const vec1d& p) {
+                return deviate(k, p);
+            }, params(k,_), opts);
+
+            if (!r.success) ++nfail;
+
+            if (rm.success[k] != r.success || rm.iter[k] != r.iter || rm.chi2[k] != r.chi2 ||
+                count(rm.params(k,_) != r.params) != 0 ||
+                count(rm.errors(k,_) != r.errors) != 0) {
+                ++nbad;
+            }
+
+            if (rf.success[k] != r.success || rf.chi2[k] != r.chi2 ||
+                count(rf.params(k,_) != r.params) != 0) {
+                ++nbad;
+            }
+        }
+
+        check_base(nbad == 0, "  failed: "+what+" ("+to_string(nbad)+" fits differ)");
+        check_base(nfail > 0 && nfail < nfit,
+            "  failed: "+what+", expected some failures ("+to_string(nfail)+")");
+    }
+
+    // Fits with different numbers of deviates, solved by the same thread (the work arrays are
+    // resized between fits)
+    {
+        auto sub_deviate = [&](uint_t k, const vec1d& p) {
+            uint_t npt = (k % 2 == 0 ? x.size() : x.size()/2);
+            return (y(k,_-(npt-1)) - gauss_model(x[_-(npt-1)], p))/ye(k,_-(npt-1));
+        };
+
+        mpfit_many_result rm = mpfit_many(sub_deviate, params, opts);
+
+        uint_t nbad = 0;
+        for (uint_t k : range(nfit)) {
+            mpfit_result r = mpfit([&](const vec1d& p) {
+                return sub_deviate(k, p);
+            }, params(k,_), opts);
+
+            if (rm.success[k] != r.success || rm.iter[k] != r.iter || rm.chi2[k] != r.chi2 ||
+                count(rm.params(k,_) != r.params) != 0) {
+                ++nbad;
+            }
+        }
+
+        check_base(nbad == 0, "  failed: varying deviates ("+to_string(nbad)+" fits differ)");
+    }
+
+    // No covariance: errors not computed
+    opts.max_iter = 200;
+    opts.nocovar = true;
+    mpfit_many_result rm = mpfit_many(deviate, params, opts, 3);
+    check(rm.errors.empty(), true);
+    check(count(rm.success), nfit);
+
+    // Global options are kept when no per-parameter option is given, including the threads
+    // used for the derivatives of each fit
+    mpfit_options gopts;
+    gopts.max_iter = 2;
+    gopts.thread = 2;
+    const std::thread::id main_id = std::this_thread::get_id();
+    std::atomic<uint_t> nworker(0);
+    rm = mpfit_many([&](uint_t k, const vec1d& p) {
+        // Slow deviate, so that the worker thread has time to start
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (std::this_thread::get_id() != main_id) ++nworker;
+        return deviate(k, p);
+    }, vec2d{params(0-_-0,_)}, gopts);
+    check(rm.iter[0] <= 2u, true);
+    check(uint_t(nworker) > 0u, true);
+
+    // Exceptions thrown in a worker thread are forwarded
+    bool caught = false;
+    try {
+        mpfit_many([&](uint_t k, const vec1d& p) {
+            if (k == nfit/2) throw std::runtime_error("bad fit");
+            return deviate(k, p);
+        }, params, opts, 3);
+    } catch (std::runtime_error&) {
+        caught = true;
+    }
+
+    check(caught, true);
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_jacobian();
+    test_threads();
+    test_many();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+#include <vif.hpp>
+#include <vif/math/optimize.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Rosenbrock function, minimum at (1,1)
+double rosenbrock(const vec1d& x) {
+    return sqr(1.0 - x[0]) + 100.0*sqr(x[1] - sqr(x[0]));
+}
+
+vec1d rosenbrock_gradient(const vec1d& x) {
+    return {-2.0*(1.0 - x[0]) - 400.0*x[0]*(x[1] - sqr(x[0])), 200.0*(x[1] - sqr(x[0]))};
+}
+
+void test_unbounded() {
+    print("L-BFGS without bounds");
+
+    minimize_lbfgs_params opts;
+    vec1d start = {-1.2, 1.0};
+
+    // Gradient written in an output vector
+    uint_t ncall = 0;
+    auto res = minimize_lbfgs(opts, start, [&](const vec1d& x, vec1d& g) {
+        ++ncall;
+        g = rosenbrock_gradient(x);
+        return rosenbrock(x);
+    });
+
+    check(res.success, true);
+    check_base(max(abs(res.params - 1.0)) < 1e-5, "  failed: params = "+to_string(res.params));
+    check_base(res.value < 1e-10, "  failed: value = "+to_string(res.value));
+    check(res.neval, ncall);
+    check_base(res.niter > 0 && res.niter < opts.max_iter,
+        "  failed: niter = "+to_string(res.niter));
+
+    // Same as minimize_bfgs(): value and gradient in a single vector
+    ncall = 0;
+    auto res2 = minimize_lbfgs(opts, start, [&](const vec1d& x, minimize_function_output) {
+        ++ncall;
+        vec1d r = {rosenbrock(x)};
+        append(r, rosenbrock_gradient(x));
+        return r;
+    });
+
+    check(res2.success, true);
+    check(res2.neval, ncall);
+    check(count(res2.params != res.params), 0u);
+
+    // Higher dimension quadratic, exact solution known
+    const uint_t n = 50;
+    vec1d c = indgen<double>(n)/n - 0.3;
+    vec1d w = 1.0 + indgen<double>(n);
+    auto res3 = minimize_lbfgs(opts, vec1d(n), [&](const vec1d& x, vec1d& g) {
+        g = 2.0*w*(x - c);
+        return total(w*sqr(x - c));
+    });
+
+    check(res3.success, true);
+    check_base(max(abs(res3.params - c)) < 1e-6, "  failed: quadratic params");
+}
+
+void test_bounded() {
+    print("L-BFGS with bounds");
+
+    // Upper bound on x[0] excludes the minimum: solution on the bound
+    minimize_lbfgs_params opts;
+    opts.lower = {dnan, dnan};
+    opts.upper = {0.5, dnan};
+
+    auto func = [](const vec1d& x, vec1d& g) {
+        g = rosenbrock_gradient(x);
+        return rosenbrock(x);
+    };
+
+    auto res = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, func);
+    check(res.success, true);
+    check(res.params[0], 0.5);
+    check_base(abs(res.params[1] - 0.25) < 1e-5, "  failed: params = "+to_string(res.params));
+
+    // Start outside of the bounds: the starting point is projected
+    res = minimize_lbfgs(opts, vec1d{3.0, 1.0}, func);
+    check(res.success, true);
+    check(res.params[0], 0.5);
+    check_base(abs(res.params[1] - 0.25) < 1e-5, "  failed: params = "+to_string(res.params));
+
+    // Bounds that do not exclude the minimum must not change the result
+    opts.lower = {-2.0, -2.0};
+    opts.upper = {2.0, 2.0};
+    res = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, func);
+    check(res.success, true);
+    check_base(max(abs(res.params - 1.0)) < 1e-5, "  failed: params = "+to_string(res.params));
+
+    // Quadratic with half of the parameters at their bounds
+    const uint_t n = 20;
+    vec1d c = indgen<double>(n) - 10.0;
+    opts.lower = replicate(-5.0, n);
+    opts.upper = replicate(5.0, n);
+    auto res2 = minimize_lbfgs(opts, vec1d(n), [&](const vec1d& x, vec1d& g) {
+        g = 2.0*(x - c);
+        return total(sqr(x - c));
+    });
+
+    check(res2.success, true);
+    check_base(max(abs(res2.params - clamp(c, -5.0, 5.0))) < 1e-6,
+        "  failed: params = "+to_string(res2.params));
+}
+
+void test_numerical_gradient() {
+    print("L-BFGS with numerical gradient");
+
+    minimize_lbfgs_params opts;
+    opts.gtol = 1e-5;
+
+    uint_t ncall = 0;
+    auto res = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, [&](const vec1d& x) {
+        ++ncall;
+        return rosenbrock(x);
+    });
+
+    check(res.success, true);
+    check_base(max(abs(res.params - 1.0)) < 1e-4, "  failed: params = "+to_string(res.params));
+    // One evaluation for the value, plus four for the central differences
+    check(ncall, 5*res.neval);
+
+    // Multithreaded gradient, with bounds (one-sided differences on the bound)
+    opts.upper = {0.5, dnan};
+    minimize_lbfgs_params opts1 = opts;
+    opts.thread = 3;
+
+    auto func = [](const vec1d& x) {
+        return rosenbrock(x);
+    };
+
+    auto res1 = minimize_lbfgs(opts1, vec1d{-1.2, 1.0}, func);
+    auto res3 = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, func);
+    check(res1.success, true);
+    check(res1.params[0], 0.5);
+    check_base(abs(res1.params[1] - 0.25) < 1e-4, "  failed: params = "+to_string(res1.params));
+    check(count(res3.params != res1.params), 0u);
+    check(res3.neval, res1.neval);
+
+    // Bounds narrower than the finite-difference step, and a parameter fixed by its bounds:
+    // the function is never evaluated outside of the bounds
+    opts = minimize_lbfgs_params();
+    opts.gradient_step = 1e-3;
+    opts.lower = {0.2, 0.3, -1.0};
+    opts.upper = {0.2 + 1e-4, 0.3, 1.0};
+
+    uint_t nout = 0;
+    auto res4 = minimize_lbfgs(opts, vec1d{0.2, 0.3, 0.0}, [&](const vec1d& x) {
+        if (count(x < opts.lower || x > opts.upper) != 0) ++nout;
+        return sqr(x[0] - 1.0) + sqr(x[1]) + sqr(x[2] - 0.5);
+    });
+
+    check(nout, 0u);
+    check(res4.success, true);
+    check(res4.params[0], 0.2 + 1e-4);
+    check(res4.params[1], 0.3);
+    check_base(abs(res4.params[2] - 0.5) < 1e-5, "  failed: params = "+to_string(res4.params));
+}
+
+void test_failures() {
+    print("L-BFGS stopping conditions");
+
+    minimize_lbfgs_params opts;
+
+    // Wrong gradient: no lower value can be found along the search direction, the
+    // minimizer stops where it is and reports success (no progress possible)
+    auto res = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, [](const vec1d& x, vec1d& g) {
+        g = -rosenbrock_gradient(x);
+        return rosenbrock(x);
+    });
+
+    check(res.success, true);
+    check(res.niter, 1u);
+    check(res.params, (vec1d{-1.2, 1.0}));
+    check(res.value, rosenbrock(vec1d{-1.2, 1.0}));
+
+    // Maximum number of iterations reached: failure
+    opts.max_iter = 3;
+    res = minimize_lbfgs(opts, vec1d{-1.2, 1.0}, [](const vec1d& x, vec1d& g) {
+        g = rosenbrock_gradient(x);
+        return rosenbrock(x);
+    });
+
+    check(res.success, false);
+    check(res.niter, 3u);
+    check_base(res.value < rosenbrock(vec1d{-1.2, 1.0}), "  failed: no progress");
+
+    // Non-finite value at the starting point: failure
+    opts.max_iter = 1000;
+    res = minimize_lbfgs(opts, vec1d{-1.0, 1.0}, [](const vec1d& x, vec1d& g) {
+        g = {1.0, 1.0};
+        return x[0] < 0.0 ? dnan : x[0];
+    });
+
+    check(res.success, false);
+    check(res.niter, 0u);
+    check(res.neval, 1u);
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_unbounded();
+    test_bounded();
+    test_numerical_gradient();
+    test_failures();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
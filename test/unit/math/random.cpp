@@ -0,0 +1,329 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Draw 'n' raw 64 bit values
+vec1u draw(fast_seed_t& seed, uint_t n) {
+    vec1u v(n);
+    for (auto& r : v) {
+        r = seed();
+    }
+
+    return v;
+}
+
+void test_xoshiro() {
+    print("xoshiro256++ reference outputs");
+
+    // Reference values computed with the reference C implementation of xoshiro256++ and
+    // splitmix64 (Blackman & Vigna), for the states obtained from seeds 0 and 42
+    {
+        fast_seed_t seed(0);
+        check(draw(seed, 4), (vec1u{0x53175d61490b23dfull, 0x61da6f3dc380d507ull,
+            0x5c0fdf91ec9a7bfcull, 0x02eebf8c3bbe5e1aull}));
+    }
+    {
+        fast_seed_t seed = make_fast_seed(42);
+        check(draw(seed, 4), (vec1u{0xd0764d4f4476689full, 0x519e4174576f3791ull,
+            0xfbe07cfb0c24ed8cull, 0xb37d9f600cd835b8ull}));
+    }
+
+    // Reseeding restarts the sequence
+    {
+        fast_seed_t seed(42);
+        seed();
+        seed.seed(42);
+        check(draw(seed, 1), (vec1u{0xd0764d4f4476689full}));
+    }
+
+    // Jumps
+    {
+        fast_seed_t seed(42);
+        seed.jump();
+        check(draw(seed, 2), (vec1u{0xc0b6f4be293b1ae5ull, 0x5db3dd9683e7bb33ull}));
+
+        seed.seed(42);
+        seed.jump();
+        seed.jump();
+        check(draw(seed, 2), (vec1u{0xbd1a801454ff844bull, 0x5f49e6691eb48a68ull}));
+
+        seed.seed(42);
+        seed.long_jump();
+        check(draw(seed, 2), (vec1u{0x02019a87bfc0bb07ull, 0x25bee49209717963ull}));
+
+        seed.seed(0);
+        seed.jump();
+        check(draw(seed, 1), (vec1u{0x2107d23f5380538bull}));
+        seed.seed(0);
+        seed.long_jump();
+        check(draw(seed, 1), (vec1u{0x708919b147f78af3ull}));
+    }
+
+    // Uniform values from the top 53 bits
+    {
+        fast_seed_t seed(42);
+        check(randomu(seed), (0xd0764d4f4476689full >> 11)/9007199254740992.0);
+        check(seed.uniform(), (0x519e4174576f3791ull >> 11)/9007199254740992.0);
+    }
+}
+
+void test_streams() {
+    print("xoshiro256++ streams");
+
+    const uint_t nstream = 4, ndraw = 20000;
+
+    // Streams created one by one or all at once are the same
+    std::vector<fast_seed_t> streams = make_fast_seed_streams(42, nstream);
+    check(streams.size(), nstream);
+
+    bool same = true;
+    for (uint_t s : range(nstream)) {
+        fast_seed_t seed = make_fast_seed(42, s);
+        fast_seed_t seed2 = streams[s];
+        if (count(draw(seed, 100) != draw(seed2, 100)) != 0) same = false;
+    }
+
+    check(same, true);
+
+    fast_seed_t seed1 = make_fast_seed(42, 1);
+    check(draw(seed1, 1), (vec1u{0xc0b6f4be293b1ae5ull}));
+
+    // Streams do not share any value, and are not correlated
+    vec2d u(nstream, ndraw);
+    std::vector<std::uint64_t> all;
+    for (uint_t s : range(nstream)) {
+        fast_seed_t seed = streams[s];
+        for (uint_t i : range(ndraw)) {
+            std::uint64_t r = seed();
+            all.push_back(r);
+            u(s,i) = (r >> 11)/9007199254740992.0;
+        }
+    }
+
+    std::sort(all.begin(), all.end());
+    check(std::unique(all.begin(), all.end()) == all.end(), true);
+
+    double maxcor = 0.0;
+    for (uint_t s1 : range(nstream))
+    for (uint_t s2 : range(s1+1, nstream)) {
+        vec1d d1 = u(s1,_) - 0.5, d2 = u(s2,_) - 0.5;
+        maxcor = std::max(maxcor, abs(total(d1*d2))/sqrt(total(sqr(d1))*total(sqr(d2))));
+    }
+
+    check_base(maxcor < 5.0/sqrt(ndraw), "  failed: correlation (cor="+to_string(maxcor)+")");
+
+    // Streams used concurrently reproduce the serial draws
+    vec2d ut(nstream, ndraw);
+    std::vector<std::thread> threads;
+    for (uint_t s : range(nstream)) {
+        threads.emplace_back([&,s]() {
+            fast_seed_t seed = streams[s];
+            for (uint_t i : range(ndraw)) {
+                ut.safe(s,i) = randomu(seed);
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    check(count(ut != u), 0u);
+}
+
+void test_fast_distributions() {
+    print("xoshiro256++ uniform and normal distributions");
+
+    const uint_t n = 1000000;
+    auto seed = make_fast_seed(43);
+
+    vec1d u = randomu(seed, n);
+    check(min(u) >= 0.0 && max(u) < 1.0, true);
+    double d = abs(mean(u) - 0.5)/sqrt(1.0/12.0/n);
+    check_base(d < 5.0, "  failed: uniform mean ("+to_string(d)+" sigma)");
+    d = abs(mean(sqr(u - 0.5)) - 1.0/12.0)/sqrt(1.0/180.0/n);
+    check_base(d < 5.0, "  failed: uniform variance ("+to_string(d)+" sigma)");
+
+    // Normal values, including the tails handled separately by the Ziggurat method
+    vec1d g = randomn(seed, n);
+    d = abs(mean(g))/sqrt(1.0/n);
+    check_base(d < 5.0, "  failed: normal mean ("+to_string(d)+" sigma)");
+    d = abs(mean(sqr(g)) - 1.0)/sqrt(2.0/n);
+    check_base(d < 5.0, "  failed: normal variance ("+to_string(d)+" sigma)");
+    d = abs(mean(pow(g, 4)) - 3.0)/sqrt(96.0/n);
+    check_base(d < 5.0, "  failed: normal kurtosis ("+to_string(d)+" sigma)");
+
+    for (double x : {0.5, 1.0, 2.0, 3.0, 3.5}) {
+        // P(|g| > x)
+        double p = erfc(x/sqrt(2.0));
+        double f = count(abs(g) > x)/double(n);
+        d = abs(f - p)/sqrt(p*(1.0 - p)/n);
+        check_base(d < 5.0, "  failed: normal tail, x="+to_string(x)+" ("+to_string(d)+" sigma)");
+    }
+
+    // Scalar and vector draws are the same
+    auto seed1 = make_fast_seed(44);
+    auto seed2 = make_fast_seed(44);
+    vec1d g1 = randomn(seed1, 1000);
+    vec1d g2(1000);
+    for (uint_t i : range(g2)) {
+        g2[i] = randomn(seed2);
+    }
+
+    check(count(g1 != g2), 0u);
+
+    // Standard distributions accept the generator
+    std::uniform_int_distribution<int> dist(1, 6);
+    vec1i dice(10000);
+    for (auto& v : dice) {
+        v = dist(seed);
+    }
+
+    check(min(dice), 1);
+    check(max(dice), 6);
+}
+
+// Cumulative distribution of a piecewise linear density, computed independently of
+// random_pdf_sampler
+double reference_cdf(const vec1d& px, const vec1d& py, double x) {
+    double norm = 0.0, c = 0.0;
+    for (uint_t k : range(px.size()-1)) {
+        double dx = px[k+1] - px[k];
+        double area = 0.5*(py[k] + py[k+1])*dx;
+        norm += area;
+        if (x >= px[k+1]) {
+            c += area;
+        } else if (x > px[k]) {
+            double t = x - px[k];
+            c += py[k]*t + 0.5*(py[k+1] - py[k])/dx*t*t;
+        }
+    }
+
+    return c/norm;
+}
+
+void test_discrete_sampler() {
+    print("Alias table sampler");
+
+    // Zero weights, a dominant weight, and many small ones
+    vec1d w = {0.0, 1.0, 2.5, 0.0, 30.0, 0.1, 0.7, 5.0, 1e-3, 1.0};
+    vec1d p = w/total(w);
+    const uint_t nb = w.size();
+
+    random_pdf_discrete_sampler sampler(w);
+
+    // Exact probability of each bin implied by the alias table
+    vec1d pt = sampler.prob/nb;
+    for (uint_t i : range(nb)) {
+        pt[sampler.alias[i]] += (1.0 - sampler.prob[i])/nb;
+    }
+
+    double d = max(abs(pt - p));
+    check_base(d < 1e-14, "  failed: alias table probabilities (diff="+to_string(d)+")");
+
+    // Observed frequencies, with both generators
+    const uint_t n = 2000000;
+    auto fseed = make_fast_seed(42);
+    auto seed = make_seed(42);
+    for (bool fast : {true, false}) {
+        vec1u ids = (fast ? sampler(fseed, n) : sampler(seed, n));
+        vec1d f = histogram(ids, make_bins_from_edges(indgen<double>(nb+1) - 0.5))/double(n);
+        vec1u idn = where(p > 0.0);
+        d = max(abs(f[idn] - p[idn])/sqrt(p[idn]*(1.0 - p[idn])/n));
+        check_base(d < 5.0, "  failed: frequencies, fast="+to_string(fast)+" ("+
+            to_string(d)+" sigma)");
+        check(count(f[where(p == 0.0)] != 0.0), 0u);
+    }
+
+    // Scalar and vector draws are the same
+    auto seed1 = make_fast_seed(43);
+    auto seed2 = make_fast_seed(43);
+    vec1u v1 = sampler(seed1, 100);
+    vec1u v2(100);
+    for (auto& v : v2) {
+        v = sampler(seed2);
+    }
+
+    check(count(v1 != v2), 0u);
+
+    // Quantile edges
+    check(sampler.quantile(0.0), sampler.prob[0] > 0.0 ? 0u : sampler.alias[0]);
+    check(sampler.quantile(std::nextafter(1.0, 0.0)) < nb, true);
+
+    // Uniform and single weights
+    random_pdf_discrete_sampler uniform(replicate(2.0, 5));
+    check(count(uniform.prob != 1.0), 0u);
+    random_pdf_discrete_sampler single(vec1d{3.0});
+    check(count(single(fseed, 100) != 0u), 0u);
+}
+
+void test_pdf_sampler() {
+    print("Inverse CDF sampler");
+
+    // Irregular grid, with a zero density segment, a zero width segment, and linearly
+    // increasing and decreasing segments
+    vec1d px = {-1.0, 0.0, 0.5, 0.5, 1.0, 2.0, 2.2, 4.0};
+    vec1d py = {0.0,  2.0, 2.0, 0.5, 0.0, 0.0, 3.0, 1.0};
+
+    random_pdf_sampler sampler(px, py);
+    check(sampler.cdf.front(), 0.0);
+    check(sampler.cdf.back(), 1.0);
+
+    // Quantiles invert the cumulative distribution
+    vec1d u = (indgen<double>(10000) + 0.5)/10000.0;
+    vec1d q(u.dims);
+    vec1d cq(u.dims);
+    for (uint_t i : range(u)) {
+        q[i] = sampler.quantile(u[i]);
+        cq[i] = reference_cdf(px, py, q[i]);
+    }
+
+    double d = max(abs(cq - u));
+    check_base(d < 1e-12, "  failed: quantile vs. CDF (diff="+to_string(d)+")");
+    check(count(q[1-_] < q[_-(q.size()-2)]), 0u);
+    check(count(q > 1.0 && q < 2.0), 0u);
+    check(sampler.quantile(0.0), -1.0);
+    check(min(q) >= px.front() && max(q) <= px.back(), true);
+
+    // Observed frequencies in bins
+    const uint_t n = 2000000;
+    vec2d bins = make_bins(-1.0, 4.0, 25);
+    vec1d p(bins.dims[1]);
+    for (uint_t i : range(p)) {
+        p[i] = reference_cdf(px, py, bins(1,i)) - reference_cdf(px, py, bins(0,i));
+    }
+
+    auto fseed = make_fast_seed(44);
+    auto seed = make_seed(44);
+    for (bool fast : {true, false}) {
+        vec1d v = (fast ? sampler(fseed, n) : sampler(seed, n));
+        vec1d f = histogram(v, bins)/double(n);
+        vec1u idn = where(p > 0.0);
+        d = max(abs(f[idn] - p[idn])/sqrt(p[idn]*(1.0 - p[idn])/n));
+        check_base(d < 5.0, "  failed: frequencies, fast="+to_string(fast)+" ("+
+            to_string(d)+" sigma)");
+        check(count(f[where(p == 0.0)] != 0.0), 0u);
+    }
+
+    // Same distribution as random_pdf()
+    auto seed1 = make_seed(45);
+    vec1d v = random_pdf(seed1, px, py, n);
+    vec1d f = histogram(v, bins)/double(n);
+    vec1u idn = where(p > 0.0);
+    d = max(abs(f[idn] - p[idn])/sqrt(p[idn]*(1.0 - p[idn])/n));
+    check_base(d < 5.0, "  failed: random_pdf frequencies ("+to_string(d)+" sigma)");
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_xoshiro();
+    test_streams();
+    test_fast_distributions();
+    test_discrete_sampler();
+    test_pdf_sampler();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
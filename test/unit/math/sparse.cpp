@@ -0,0 +1,180 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+
+using namespace vif;
+
+// Symmetric positive definite test matrices
+
+// 2D Laplacian on a nx*ny grid, plus a diagonal term to make it positive definite
+matrix::sparse_symmetric make_laplacian(uint_t nx, uint_t ny) {
+    matrix::sparse_symmetric a(nx*ny);
+    for (uint_t x : range(nx))
+    for (uint_t y : range(ny)) {
+        uint_t i = x*ny + y;
+        a.add(i, i, 4.5);
+        if (x > 0) a.add(i, i - ny, -1.0);
+        if (y > 0) a.add(i, i - 1, -1.0);
+    }
+
+    a.assemble();
+    return a;
+}
+
+// Random sparse matrix, made positive definite by diagonal dominance. Some elements are added
+// several times. If 'dense_row' is set, the last row is connected to all the others.
+matrix::sparse_symmetric make_random(uint_t n, uint_t nelem, bool dense_row) {
+    auto seed = make_seed(42);
+    vec1u i = randomi(seed, 0, n-1, nelem);
+    vec1u j = randomi(seed, 0, n-1, nelem);
+    vec1d v = randomu(seed, nelem) - 0.5;
+
+    matrix::sparse_symmetric a(n);
+    vec1d diag = replicate(1.0, n);
+    for (uint_t k : range(nelem)) {
+        if (i[k] == j[k]) continue;
+        a.add(i[k], j[k], v[k]);
+        diag[i[k]] += abs(v[k]);
+        diag[j[k]] += abs(v[k]);
+    }
+
+    if (dense_row) {
+        for (uint_t k : range(n-1)) {
+            a.add(n-1, k, 0.01);
+            diag[n-1] += 0.01;
+            diag[k] += 0.01;
+        }
+    }
+
+    for (uint_t k : range(n)) {
+        a.add(k, k, diag[k]);
+    }
+
+    a.assemble();
+    return a;
+}
+
+void test_sparse_matrix() {
+    print("Sparse symmetric matrix");
+
+    matrix::sparse_symmetric a(4);
+    a.add(0, 0, 2.0);
+    a.add(1, 0, 1.0);
+    a.add(0, 1, 0.5); // same element as (1,0)
+    a.add(3, 2, -1.0);
+    a.add(3, 3, 5.0);
+    check(a.assembled(), false);
+    a.assemble();
+
+    check(a.assembled(), true);
+    check(a.nonzero_count(), 4u);
+    check(a(1,0), 1.5);
+    check(a(0,1), 1.5);
+    check(a(2,3), -1.0);
+    check(a(2,2), 0.0);
+    check(a.diagonal(), (vec1d{2.0, 0.0, 0.0, 5.0}));
+
+    // Adding to an assembled matrix
+    a.add(2, 2, 1.0);
+    a.add(1, 0, 1.0);
+    a.assemble();
+    check(a.nonzero_count(), 5u);
+    check(a(1,0), 2.5);
+    check(a(2,2), 1.0);
+
+    // Dense conversion, and back
+    matrix::mat2d d = a.to_dense();
+    check(d(0,1), 2.5);
+    check(d(1,0), 2.5);
+    matrix::sparse_symmetric b(d);
+    check(b.nonzero_count(), a.nonzero_count());
+    check(count(b.to_dense().base != d.base), 0u);
+
+    // Products
+    vec1d x = {1.0, -2.0, 3.0, 0.5};
+    check(a*x, d*x);
+    check((2.0*a)*x, 2.0*(d*x));
+}
+
+void test_sparse_cholesky() {
+    print("Sparse Cholesky vs. dense inversion");
+
+    const double tol = 1e-10;
+    auto seed = make_seed(43);
+
+    std::vector<std::string> names = {"laplacian", "random", "random+dense row"};
+    std::vector<matrix::sparse_symmetric> mats = {
+        make_laplacian(12, 15), make_random(150, 600, false), make_random(300, 900, true)
+    };
+
+    for (uint_t m : range(mats)) {
+        const matrix::sparse_symmetric& a = mats[m];
+        const uint_t n = a.size();
+
+        matrix::mat2d d = a.to_dense();
+        matrix::mat2d inv;
+        check(matrix::invert(d, inv), true);
+
+        matrix::decompose_cholesky dc;
+        check(dc.decompose(d), true);
+
+        vec1d b = randomn(seed, n);
+        vec1d xref = inv*b;
+
+        for (bool reorder : {true, false}) {
+            std::string what = names[m]+(reorder ? "" : ", no reordering");
+
+            matrix::decompose_sparse_cholesky sc;
+            sc.reorder = reorder;
+            check(sc.decompose(a), true);
+            check(sc.bad, false);
+            check(sc.size(), n);
+            check(count(sc.perm[sort(sc.perm)] != indgen(n)), 0u);
+
+            double e = max_rel_diff(sc.solve(b), xref);
+            check_base(e < tol, "  failed: solve, "+what+" (diff="+to_string(e)+")");
+
+            e = max_rel_diff(sc.inverse_diagonal(), matrix::diagonal(inv));
+            check_base(e < tol, "  failed: inverse_diagonal, "+what+" (diff="+to_string(e)+")");
+
+            e = abs(sc.log_lower_determinant() - dc.log_lower_determinant())/
+                abs(dc.log_lower_determinant());
+            check_base(e < tol, "  failed: log determinant, "+what+" (diff="+to_string(e)+")");
+
+            if (reorder && m == 0) {
+                // Reordering reduces the fill-in of the Laplacian
+                check_base(sc.nonzero_count() < 0.8*(n*(n+1)/2), "  failed: fill-in");
+            }
+        }
+
+        // Conjugate gradient
+        vec1d x;
+        auto res = matrix::solve_cg(a, b, x);
+        check(res.success, true);
+        double e = max_rel_diff(x, xref);
+        check_base(e < 1e-8, "  failed: solve_cg, "+names[m]+" (diff="+to_string(e)+")");
+
+        // Warm start from the solution: immediate convergence
+        res = matrix::solve_cg(a, b, x);
+        check(res.success, true);
+        check(res.niter, 0u);
+    }
+
+    // Not positive definite
+    matrix::sparse_symmetric a = make_laplacian(5, 5);
+    a.add(7, 7, -10.0);
+    a.assemble();
+
+    matrix::decompose_sparse_cholesky sc;
+    check(sc.decompose(a), false);
+    check(sc.bad, true);
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_sparse_matrix();
+    test_sparse_cholesky();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
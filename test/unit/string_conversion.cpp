@@ -0,0 +1,163 @@
+#include <vif.hpp>
+#include <vif/test/unit_test.hpp>
+#include <clocale>
+
+using namespace vif;
+
+template<typename T>
+bool parse(const std::string& s, T& v) {
+    return from_string(s.data(), s.data() + s.size(), v);
+}
+
+template<typename T>
+void test_parse_round_trip(uint_t n) {
+    // Values spread over the whole exponent range, printed with enough digits to be exact,
+    // must be parsed back to the same value, and agree with strtod()
+    auto seed = make_seed(42);
+    vec1d mant = randomu(seed, n);
+    vec1d expo = randomu(seed, n);
+
+    const int max_exp = std::numeric_limits<T>::max_exponent10 - 1;
+    const int min_exp = std::numeric_limits<T>::min_exponent10 + 1;
+
+    uint_t nfail = 0;
+    for (uint_t i : range(n)) {
+        T v = T((1.0 + 9.0*mant[i])*std::pow(10.0, int(min_exp + expo[i]*(max_exp - min_exp))));
+        if (i % 2 == 1) v = -v;
+
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "%.*g",
+            std::numeric_limits<T>::max_digits10, double(v));
+
+        T r;
+        if (!parse(std::string(buffer), r) || r != v) {
+            if (nfail == 0) print(buffer);
+            ++nfail;
+        }
+    }
+
+    check(nfail, 0u);
+}
+
+void test_parse() {
+    print("Parsing floating point numbers");
+    double d = 0.0;
+    check(parse("3.1415", d) && d == 3.1415, true);
+    check(parse("  -2.5e-3 \t", d) && d == -2.5e-3, true);
+    check(parse("+0.1", d) && d == 0.1, true);
+    check(parse(".5", d) && d == 0.5, true);
+    check(parse("5.", d) && d == 5.0, true);
+    check(parse("1E5", d) && d == 1e5, true);
+    check(parse("-0", d) && d == 0.0 && std::signbit(d), true);
+    check(parse("1e308", d) && d == 1e308, true);
+    check(parse("4.9406564584124654e-324", d) && d == std::numeric_limits<double>::denorm_min(), true);
+    check(parse("123456789012345678901234567890", d) && d == 123456789012345678901234567890.0, true);
+    check(parse("0.30000000000000004", d) && d == 0.1 + 0.2, true);
+    check(parse("nan", d) && std::isnan(d), true);
+    check(parse("-inf", d) && d == -std::numeric_limits<double>::infinity(), true);
+
+    check(parse("1e309", d), false);
+    check(parse("", d), false);
+    check(parse("1.5.2", d), false);
+    check(parse("1,5", d), false);
+    check(parse("1e", d), false);
+    check(parse("e5", d), false);
+    check(parse("0x10", d), false);
+
+    float f = 0.0f;
+    check(parse("3.1415", f) && f == 3.1415f, true);
+    check(parse("1e39", f), false);
+    check(parse("16777217", f) && f == 16777216.0f, true);
+
+    print("Parsing round trip");
+    test_parse_round_trip<float>(10000);
+    test_parse_round_trip<double>(10000);
+
+    // The parser must not depend on the global locale
+    if (std::setlocale(LC_NUMERIC, "de_DE.UTF-8") || std::setlocale(LC_NUMERIC, "fr_FR.UTF-8")) {
+        print("Parsing with a non-C locale");
+        check(parse("1.2345678901234567e-300", d) && d == 1.2345678901234567e-300, true);
+        check(parse("0.30000000000000004", d) && d == 0.1 + 0.2, true);
+        check(parse("2.5", d) && d == 2.5, true);
+        check(parse("2,5", d), false);
+        check(parse("3.4028234e38", f) && f == std::numeric_limits<float>::max(), true);
+        std::setlocale(LC_NUMERIC, "C");
+    } else {
+        print("no locale with ',' as decimal separator, skipping locale test");
+    }
+}
+
+template<typename T>
+void test_format_round_trip(uint_t n) {
+    // The shortest representation must read back to the identical value
+    auto seed = make_seed(43);
+    vec1d mant = randomu(seed, n);
+    vec1d expo = randomu(seed, n);
+
+    const int max_exp = std::numeric_limits<T>::max_exponent10 - 1;
+    const int min_exp = std::numeric_limits<T>::min_exponent10 + 1;
+
+    uint_t nfail = 0;
+    for (uint_t i : range(n)) {
+        T v = T((1.0 + 9.0*mant[i])*std::pow(10.0, int(min_exp + expo[i]*(max_exp - min_exp))));
+        if (i % 2 == 1) v = -v;
+
+        char buffer[64];
+        std::size_t l = impl::string_conversion_impl::format_float_exact(
+            buffer, sizeof(buffer), v);
+
+        T r;
+        if (l >= sizeof(buffer) || !from_string(buffer, buffer + l, r) || r != v) {
+            if (nfail == 0) print(std::string(buffer, std::min(l, sizeof(buffer)-1)));
+            ++nfail;
+        }
+    }
+
+    check(nfail, 0u);
+}
+
+template<typename T>
+std::string format_exact(T v) {
+    char buffer[64];
+    std::size_t l = impl::string_conversion_impl::format_float_exact(buffer, sizeof(buffer), v);
+    return std::string(buffer, l);
+}
+
+void test_format() {
+    print("Formatting floating point numbers");
+    check(to_string(2.5), "2.5");
+    check(to_string(-1e-20), "-1e-20");
+    check(to_string(1.0/3.0), "0.333333");
+    check(to_string(format::precision(1.0/3.0, 3)), "0.333");
+    check(format_exact(0.1), "0.1");
+    check(format_exact(0.1 + 0.2), "0.30000000000000004");
+    check(format_exact(0.1f), "0.1");
+    check(format_exact(16777216.0f), "16777216");
+    check(format_exact(std::numeric_limits<double>::denorm_min()), "4.94065645841247e-324");
+    check(format_exact(std::numeric_limits<double>::max()), "1.7976931348623157e+308");
+
+    print("Formatting round trip");
+    test_format_round_trip<float>(10000);
+    test_format_round_trip<double>(10000);
+
+    // The output must not depend on the global locale
+    if (std::setlocale(LC_NUMERIC, "de_DE.UTF-8") || std::setlocale(LC_NUMERIC, "fr_FR.UTF-8")) {
+        print("Formatting with a non-C locale");
+        check(to_string(2.5), "2.5");
+        check(format_exact(0.1 + 0.2), "0.30000000000000004");
+        test_format_round_trip<double>(1000);
+        std::setlocale(LC_NUMERIC, "C");
+    } else {
+        print("no locale with ',' as decimal separator, skipping locale test");
+    }
+}
+
+int vif_main(int argc, char* argv[]) {
+    test_parse();
+    test_format();
+
+    print("total:");
+    print("> ", tested - failed, "/", tested," passed");
+
+    return failed == 0u ? 0 : 1;
+}
@@ -1,4 +1,6 @@
 #include <vif.hpp>
+#include <unistd.h>
+#include <sys/wait.h>
 
 using namespace vif;
 
@@ -9,6 +11,25 @@ using namespace vif;
     assert(st == s); \
 }
 
+// Run 'f' in a child process, and return true if it exited with an error (e.g., vif_check)
+template<typename F>
+bool exits_with_error(F&& f) {
+    std::cout.flush();
+    fflush(stdout);
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        // Hide the error message
+        std::cout.rdbuf(nullptr);
+        f();
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
 int vif_main(int argc, char* argv[]) {
     double start = now();
 
@@ -304,11 +325,128 @@ int vif_main(int argc, char* argv[]) {
         check(fits::getkey(hdr, "MYAXIS3", axis), "1");
         check(axis, "12");
 
+        print("Indexed header");
+        auto card = [](const std::string& c) {
+            return c + std::string(80 - c.size(), ' ');
+        };
+
+        fits::header rhdr =
+            card("SIMPLE  =                    T / conforms to FITS standard") +
+            card("NAXIS1  =                  161") +
+            card("COMMENT x = 5 / not a keyword") +
+            card("HISTORY CRPIX1 = 12 / neither is this") +
+            card("CRPIX1  =     80.5  / reference pixel") +
+            card("OBJECT  = 'long value &'") +
+            card("CONTINUE  'which continues'") +
+            card("") +
+            card("END");
+
+        fits::indexed_header ihdr(rhdr);
+        check(ihdr.str() == rhdr, "1");
+        check(ihdr.size(), "7");
+        check(ihdr.has_key("COMMENT x"), "0");
+        check(ihdr.has_key("HISTORY CRPIX1"), "0");
+        check(fits::getkey(ihdr, "NAXIS1", axis), "1");
+        check(axis, "161");
+
+        double crpix = 0;
+        check(fits::getkey(ihdr, "CRPIX1", crpix), "1");
+        check(crpix, "80.5");
+
+        std::string obj;
+        check(fits::getkey(ihdr, "OBJECT", obj), "1");
+        check(obj, "long value which continues");
+
+        // Modifying a keyword only rewrites its card, and keeps the comment
+        check(fits::setkey(ihdr, "CRPIX1", 12), "1");
+        check(fits::getkey(ihdr, "CRPIX1", crpix), "1");
+        check(crpix, "12");
+        fits::header nhdr = ihdr.str();
+        check(nhdr.size(), to_string(rhdr.size()));
+        check(nhdr.substr(0, 4*80) == rhdr.substr(0, 4*80), "1");
+        check(nhdr.substr(5*80) == rhdr.substr(5*80), "1");
+        check(trim(nhdr.substr(4*80, 80)), "CRPIX1  =                   12 / reference pixel");
+
+        // New keywords are added before END
+        check(fits::setkey(ihdr, "CRPIX2", 3, "second axis"), "1");
+        nhdr = ihdr.str();
+        check(nhdr.size(), to_string(rhdr.size() + 80));
+        check(trim(nhdr.substr(8*80, 80)), "CRPIX2  =                    3 / second axis");
+        check(trim(nhdr.substr(9*80, 80)), "END");
+        check(fits::getkey(nhdr, "CRPIX2", axis), "1");
+        check(axis, "3");
+
+        // Removing keywords leaves the other cards untouched
+        ihdr.remove_key("CRPIX2");
+        ihdr.remove_key("NAXIS1");
+        check(ihdr.has_key("NAXIS1"), "0");
+        nhdr = ihdr.str();
+        check(nhdr.substr(0, 80) == rhdr.substr(0, 80), "1");
+        check(nhdr.substr(80, 2*80) == rhdr.substr(2*80, 2*80), "1");
+
+        // Value cards without a space after '=' are still parsed
+        fits::indexed_header chdr(card("CRVAL1  =12.5 / no space") + card("END"));
+        check(chdr.size(), "1");
+        double crval = 0;
+        check(fits::getkey(chdr, "CRVAL1", crval), "1");
+        check(crval, "12.5");
+        check(chdr.card(0) == card("CRVAL1  =12.5 / no space"), "1");
+        check(exits_with_error([&]() { chdr.card(1); }), "1");
+
         print("FITS image writing");
         fits::write("out/image_saved.fits", v, hdr);
         vec2d nv;
         fits::read("out/image_saved.fits", nv);
         check(count(nv != v) == 0, "1");
+
+        print("FITS asynchronous writing");
+        for (bool background : {false, true}) {
+            fits::async_writer writer(1, background);
+            vec2d av = v;
+            for (uint_t i : range(3)) {
+                writer.write("out/image_async"+to_string(i)+".fits", av, hdr);
+                // The writer owns a copy, this must not change the file
+                av += 1.0;
+            }
+
+            vec1d tcol = {1.0, 2.0, 3.0};
+            writer.write_table("out/table_async.fits", "tcol", tcol);
+            tcol[0] = 0.0;
+            writer.flush();
+            check(writer.pending(), "0");
+
+            for (uint_t i : range(3)) {
+                fits::read("out/image_async"+to_string(i)+".fits", nv);
+                check(count(nv != v + double(i)) == 0, "1");
+            }
+
+            vec1d rcol;
+            fits::read_table("out/table_async.fits", "tcol", rcol);
+            check(rcol, "{1, 2, 3}");
+
+            // Errors are reported by flush(), once
+            writer.write("out/not_a_directory/image_async.fits", v);
+            bool thrown = false;
+            try {
+                writer.flush();
+            } catch (...) {
+                thrown = true;
+            }
+            check(thrown, "1");
+            writer.flush();
+        }
+
+        {
+            // Errors not reported by flush() are printed when the writer is destroyed
+            std::ostringstream out;
+            std::streambuf* old_buf = std::cout.rdbuf(out.rdbuf());
+            {
+                fits::async_writer writer;
+                writer.write("out/not_a_directory/image_async.fits", vec1d{1, 2, 3});
+            }
+            std::cout.rdbuf(old_buf);
+            check(out.str().find("warning: async_writer") != std::string::npos, "1");
+        }
     }
 
     {
@@ -354,6 +492,39 @@ int vif_main(int argc, char* argv[]) {
         str = {};
         fits::read_table("out/stable.fits", ftable(str));
         check(where(str != ostr).empty(), "1");
+
+        print("String type with padding and empty strings");
+        // White spaces on both ends are trimmed when reading back
+        str = {"  lead", "trail  ", "", " both ", "", "x"};
+        fits::write_table("out/stable_pad.fits", ftable(str));
+        vec1s rstr;
+        fits::read_table("out/stable_pad.fits", "str", rstr);
+        check(rstr.size(), "6");
+        check(where(rstr != trim(str)).empty(), "1");
+
+        // Column with only empty strings
+        vec1s estr = {"", "", ""};
+        fits::write_table("out/stable_empty.fits", ftable(estr));
+        rstr = {"a"};
+        fits::read_table("out/stable_empty.fits", "estr", rstr);
+        check(rstr.size(), "3");
+        check(where(rstr != std::string()).empty(), "1");
+
+        print("String type written from a view");
+        vec1u ids = {4, 0, 3, 5};
+        fits::write_table("out/stable_view.fits", "str", ostr[ids]);
+        rstr = {};
+        fits::read_table("out/stable_view.fits", "str", rstr);
+        check(rstr.size(), "4");
+        check(where(rstr != ostr[ids]).empty(), "1");
+
+        // Non contiguous 2D view, with padded and empty strings
+        vec2s str2 = {{"a", " b ", "cc"}, {"", "dddd", "e"}, {"ff", "", "  g"}};
+        fits::write_table("out/stable_view2d.fits", "str", str2(_,1-_-2));
+        vec2s rstr2;
+        fits::read_table("out/stable_view2d.fits", "str", rstr2);
+        check(rstr2.dims, "{3, 2}");
+        check(where(rstr2 != trim(vec2s{str2(_,1-_-2)})).empty(), "1");
     }
 
     {
@@ -370,6 +541,48 @@ int vif_main(int argc, char* argv[]) {
         check(s, "toto");
     }
 
+    {
+        print("FITS table written in chunks");
+        vec1u id = indgen(10);
+        vec2f flux = indgen<float>(10, 3);
+        vec1s name = {"a", "bb", "ccc", "dddd", "e", "f", "g", "h", "i", "jjjjj"};
+
+        {
+            fits::output_table_stream otbl("out/stream_tbl.fits");
+            otbl.add_column<uint_t>("id");
+            otbl.add_column<float>("flux", {3});
+            otbl.add_string_column("name", 5);
+            for (uint_t i0 = 0; i0 < id.size(); i0 += 4) {
+                uint_t i1 = std::min(i0 + 4, id.size());
+                otbl.append_rows(
+                    "id", id[i0-_-(i1-1)], "flux", flux(i0-_-(i1-1),_), "name", name[i0-_-(i1-1)]
+                );
+            }
+
+            check(otbl.row_count(), "10");
+
+            // Invalid columns are detected before anything is written, and leave the file
+            // unchanged (checked when reading it back below)
+            otbl.flush();
+            check(exits_with_error([&]() {
+                otbl.append_rows("id", id[0-_-1], "flux", flux(0-_-2,_), "name", name[0-_-1]);
+            }), "1");
+            check(exits_with_error([&]() {
+                otbl.append_rows("id", id[0-_-1], "flux", flux(0-_-1,_), "name", vec1s{"a", "toolong"});
+            }), "1");
+            check(otbl.row_count(), "10");
+        }
+
+        vec1u rid;
+        vec2f rflux;
+        vec1s rname;
+        fits::read_table("out/stream_tbl.fits", "id", rid, "flux", rflux, "name", rname);
+        check(where(rid != id).empty(), "1");
+        check(rflux.dims, "{10, 3}");
+        check(where(rflux != flux).empty(), "1");
+        check(where(rname != name).empty(), "1");
+    }
+
     {
         print("'match' function");
         vec1i t1 = {4,5,6,7,8,9};
@@ -973,6 +1186,84 @@ int vif_main(int argc, char* argv[]) {
         vec1d r1 = astro::lumdist(v[0-_-750], cosmo);
         append(r1, astro::lumdist(v[751-_-1499], cosmo));
         check(max(abs(r - r1)/r1) < 1e-5, "1");
+
+        astro::cosmo_table tab(cosmo);
+        check(float(tab.lookback_time(0.5)), "5.09887");
+        check(max(abs(tab.lumdist(v) - r)) == 0, "1");
+    }
+
+    {
+        print("Cosmology table vs. direct integration");
+
+        // Reference: direct integration in log(1+z) of the same integrands
+        auto ref_lumdist = [](const astro::cosmo_t& c, double z) {
+            auto f = [&](double u) {
+                double z1 = exp(u);
+                return z1/sqrt(z1*z1*z1*c.wm + c.wL);
+            };
+            return (1.0 + z)*(2.99792458e5/c.H0)*integrate_func(f, 0.0, log(1.0 + z), 1e-13);
+        };
+
+        auto ref_lookback = [](const astro::cosmo_t& c, double z) {
+            auto f = [&](double u) {
+                double z1 = exp(u);
+                return 1.0/sqrt(z1*z1*z1*c.wm + c.wL + z1*z1*c.wk);
+            };
+            return (3.09/(c.H0*3.155e-3))*integrate_func(f, 0.0, log(1.0 + z), 1e-13);
+        };
+
+        // Small 'zmax' so that the fall back to direct integration is tested as well
+        for (auto cosmo : {astro::cosmo_wmap(), astro::cosmo_plank()}) {
+            astro::cosmo_table tab(cosmo, 8.0);
+            vec1d z = {1e-4, 0.01, 0.1, 0.5, 1.0, 2.345, 7.99, 8.0, 8.5, 12.0, 100.0};
+
+            vec1d d = tab.lumdist(z);
+            vec1d t = tab.lookback_time(z);
+            vec1d rd(z.dims), rt(z.dims);
+            for (uint_t i : range(z)) {
+                rd[i] = ref_lumdist(cosmo, z[i]);
+                rt[i] = ref_lookback(cosmo, z[i]);
+            }
+
+            check(max(abs(d - rd)/rd) < 1e-9, "1");
+            check(max(abs(t - rt)/rt) < 1e-9, "1");
+            check(tab.lumdist(0.0), "0");
+            check(tab.lumdist(-1.0), "0");
+            check(is_nan(tab.lumdist(dnan)), "1");
+            check(is_nan(tab.lookback_time(dnan)), "1");
+            check(is_nan(tab.propsize(dnan)), "1");
+        }
+    }
+
+    {
+        print("Shared cosmology tables");
+        auto wmap = astro::cosmo_wmap();
+        auto plank = astro::cosmo_plank();
+
+        // Same cosmology: same table; different cosmologies: different tables, also when
+        // alternating between the two (the per-thread shortcut must not return the wrong one)
+        const astro::cosmo_table* t1 = &astro::get_cosmo_table(wmap);
+        const astro::cosmo_table* t2 = &astro::get_cosmo_table(plank);
+        check(t1 != t2, "1");
+        check(&astro::get_cosmo_table(wmap) == t1, "1");
+        check(&astro::get_cosmo_table(plank) == t2, "1");
+        check(&astro::get_cosmo_table(astro::cosmo_wmap()) == t1, "1");
+        check(t1->cosmo.H0 == wmap.H0 && t1->cosmo.wm == wmap.wm, "1");
+        check(t2->cosmo.H0 == plank.H0 && t2->cosmo.wm == plank.wm, "1");
+
+        // Same table from another thread
+        const astro::cosmo_table* t3 = nullptr;
+        std::thread th([&]() { t3 = &astro::get_cosmo_table(plank); });
+        th.join();
+        check(t3 == t2, "1");
+
+        // Alternating queries give the values of each cosmology
+        astro::cosmo_table ref1(wmap), ref2(plank);
+        vec1d z = {0.5, 1.0, 3.0};
+        check(max(abs(astro::lumdist(z, wmap) - ref1.lumdist(z))) == 0, "1");
+        check(max(abs(astro::lumdist(z, plank) - ref2.lumdist(z))) == 0, "1");
+        check(max(abs(astro::lookback_time(z, wmap) - ref1.lookback_time(z))) == 0, "1");
+        check(max(abs(astro::lumdist(z, wmap) - astro::lumdist(z, plank))) > 0, "1");
     }
 
     {
@@ -1067,6 +1358,36 @@ int vif_main(int argc, char* argv[]) {
         check(tmp2.t.v, to_string(tmp.t.v));
     }
 
+    {
+        print("Reflection: write a structure in chunks");
+        struct {
+            vec1u id;
+            double z = 0.0;
+            std::string name;
+        } tmp;
+
+        {
+            fits::output_table_stream otbl("out/reflex_stream_tbl.fits");
+            tmp.name = "toto";
+            otbl.add_columns(tmp);
+
+            for (uint_t i : range(3)) {
+                tmp.id = {i};
+                tmp.z = 0.5*i;
+                tmp.name = (i == 1 ? "tat" : "toto");
+                otbl.append_rows(tmp);
+            }
+        }
+
+        vec1u rid;
+        vec1d rz;
+        vec1s rname;
+        fits::read_table("out/reflex_stream_tbl.fits", "id", rid, "z", rz, "name", rname);
+        check(rid, "{0, 1, 2}");
+        check(rz, "{0, 0.5, 1}");
+        check(rname, "{\"toto\", \"tat\", \"toto\"}");
+    }
+
     {
         print("Reflection: merge two structures");
         struct {
@@ -207,6 +207,10 @@ int vif_main(int argc, char* argv[]) {
     //     bands = bands[where(is_any_of(bands, mname))];
     // }
 
+    // Write cutouts in the background while the next image is processed; this is only
+    // done if cfitsio is reentrant, since we keep reading images in the meantime
+    fits::async_writer writer;
+
     vec1b covered(bands.size());
     uint_t ib = 0;
     for (auto& img : imgs) {
@@ -298,11 +302,12 @@ int vif_main(int argc, char* argv[]) {
             if (filename == img.filename) {
                 error("this operation would overwrite the image '", filename, "'");
                 note("aborting");
+                writer.flush();
                 return 1;
             }
 
             if (verbose) print("writing ", filename);
-            fits::write(filename, cube(i,_,_), nhdr);
+            writer.write(filename, cube(i,_,_), nhdr);
         }
 
         // Create empty cutouts for non covered sources
@@ -329,14 +334,17 @@ int vif_main(int argc, char* argv[]) {
             if (filename == img.filename) {
                 error("this operation would overwrite the image '", filename, "'");
                 note("aborting");
+                writer.flush();
                 return 1;
             }
 
             if (verbose) print("writing ", filename);
-            fits::write(filename, empty, nhdr);
+            writer.write(filename, empty, nhdr);
         }
     }
 
+    writer.flush();
+
     if (count(!covered) > 0) {
         for (auto i : where(!covered)) {
             warning("no band named '", bands[i], "', skipping");
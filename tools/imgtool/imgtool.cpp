@@ -54,6 +54,8 @@ void print_convolve_help() {
 
     header("List of available command line options:");
     bullet("normalize", "[flag] normalize kernel to unit integral before convolution");
+    bullet("threads", "[unsigned integer] number of concurrent threads used to convolve large "
+        "images, which are processed by tiles (default: 1)");
     bullet("help", "[flag] print this text");
     print("");
 }
@@ -66,7 +68,8 @@ bool convolve(int argc, char* argv[]) {
 
     bool help = false;
     bool normalize = false;
-    read_args(argc-3, argv+3, arg_list(help, normalize));
+    uint_t nthread = 1;
+    read_args(argc-3, argv+3, arg_list(help, normalize, name(nthread, "threads")));
 
     if (help) {
         print_convolve_help();
@@ -79,7 +82,16 @@ bool convolve(int argc, char* argv[]) {
         kernel /= total(kernel);
     }
 
-    map = convolve2d(map, kernel);
+    if (map.size() > 4096*4096 && kernel.dims[0]%2 == 1 && kernel.dims[1]%2 == 1 &&
+        convolve2d_best_method(map.dims, kernel) == convolve2d_method::fft) {
+        // Large kernel: convolve by tiles to avoid allocating several copies of the
+        // padded image
+        convolve2d_tiled_params p;
+        p.thread = nthread;
+        map = convolve2d_tiled(map, kernel, p);
+    } else {
+        map = convolve2d(map, kernel);
+    }
 
     file::mkdir(file::get_directory(argv[3]));
     fits::write(argv[3], map);
@@ -29,6 +29,8 @@ int vif_main(int argc, char* argv[]) {
     bool save_covariance = false;
     // Do not compute the whole covariance matrix, just invert some sub-matrices
     bool cell_approx = false;
+    // Store the fit matrix in sparse format and use a sparse solver
+    bool sparse = false;
     // Use a flux prior
     bool flux_prior = false;
     // Reduce image fit area to regions covered by the input prior list
@@ -52,7 +54,7 @@ int vif_main(int argc, char* argv[]) {
         name(cat_file, "cat"), name(img_file, "img"), name(psf_file, "psf"),
         name(err_file, "err"), name(out_file, "out"), name(res_file, "out_res"),
         name(mod_file, "out_model"), name(grp_file, "out_gmap"), name(map_file, "maps"),
-        help, fconv, verbose, fixed_bg, save_covariance, cell_approx, flux_prior,
+        help, fconv, verbose, fixed_bg, save_covariance, cell_approx, sparse, flux_prior,
         make_groups, group_fit_threshold, group_aper_threshold, group_aper_size,
         group_cov_threshold, group_post_process, name(nthread, "threads"),
         beam_smeared, beam_size, trim_image, beam_flux
@@ -67,6 +69,12 @@ int vif_main(int argc, char* argv[]) {
         cell_approx = false;
     }
 
+    if (sparse && (save_covariance || make_groups || cell_approx)) {
+        warning("cannot use the 'sparse' option with 'save_covariance', 'make_groups' or "
+            "'cell_approx', which need the full matrix");
+        sparse = false;
+    }
+
     if (cat_file.empty()) {
         error("missing input catalog name (cat=...)");
         return 1;
@@ -576,12 +584,28 @@ int vif_main(int argc, char* argv[]) {
 
         uint_t nelem = nobs + (free_bg ? 1 : 0);
 
-        matrix::mat2d alpha(nelem, nelem);
+        matrix::mat2d alpha;
+        matrix::sparse_symmetric salpha;
         vec1d beta(nelem);
 
         // Alpha is symmetric, so only compute one side
         // This matrix measures the overlap between the different fit components
         // Beta measures the product of each component with the actual data
+        // In sparse mode, only the non-zero overlaps are stored
+        if (sparse) {
+            salpha = matrix::sparse_symmetric(nelem);
+        } else {
+            alpha = matrix::mat2d(nelem, nelem);
+        }
+
+        auto add_alpha = [&](uint_t i, uint_t j, double v) {
+            if (sparse) {
+                salpha.add(i, j, v);
+            } else {
+                alpha.safe(i,j) += v;
+                if (i != j) alpha.safe(j,i) += v;
+            }
+        };
 
         // Source terms
         vec1f local_error(nsrc);
@@ -609,17 +633,17 @@ int vif_main(int argc, char* argv[]) {
 
             // Alpha terms
             // The source with itself: alpha(i,i) = (x[i]/err)^2
-            alpha(i,i) = total(sqr(tpsf));
+            add_alpha(i, i, total(sqr(tpsf)));
 
             if (flux_prior) {
                 // If requested, add a prior on the flux of each source
                 beta[i] += fprior[i]/sqr(fprior_err[i]);
-                alpha(i,i) += 1.0/sqr(fprior_err[i]);
+                add_alpha(i, i, 1.0/sqr(fprior_err[i]));
             }
 
             if (free_bg) {
                 // Source x Background: alpha(i,bg) = x[i]/err^2
-                alpha(i,nobs) = alpha(nobs,i) = total(tpsf/terr);
+                add_alpha(i, nobs, total(tpsf/terr));
             }
 
             // Source x Source: alpha(j,i) = x[i]*x[j]/err^2
@@ -642,7 +666,7 @@ int vif_main(int argc, char* argv[]) {
                             tpsf2_j[idpc_j] = 0;
                         }
 
-                        alpha(j,i) = alpha(i,j) = total(tpsf2_j[pidj]*tpsf2[pidi]);
+                        add_alpha(j, i, total(tpsf2_j[pidj]*tpsf2[pidi]));
                     }
                 }
 
@@ -656,7 +680,7 @@ int vif_main(int argc, char* argv[]) {
             beta[nobs] = total(snr/err);
 
             // Background x Background: alpha(bg,bg) = 1/err^2
-            alpha(nobs, nobs) = total(1.0/sqr(err));
+            add_alpha(nobs, nobs, total(1.0/sqr(err)));
         }
 
         // Solve the system
@@ -698,7 +722,42 @@ int vif_main(int argc, char* argv[]) {
             inplace_symmetrize(covar);
         }
 
-        if (cell_approx) {
+        if (sparse) {
+            if (verbose) {
+                print("factorize sparse matrix...");
+            }
+
+            salpha.assemble();
+
+            matrix::decompose_sparse_cholesky chol;
+            if (!chol.decompose(salpha)) {
+                error("could not factorize covariance matrix, it is singular");
+                note("there are probably some prior source positions which are too close and "
+                    "cannot be deblended");
+                return 1;
+            }
+
+            // Solve the system to get the best fit values, and only compute the diagonal of the
+            // inverted alpha to get the errors
+            best_fit = chol.solve(beta);
+            best_fit_err = sqrt(chol.inverse_diagonal());
+
+            // Extract the background value if needed
+            if (free_bg) {
+                background = best_fit[nobs]/map.fconv;
+                background_err = best_fit_err[nobs]/map.fconv;
+            } else {
+                background = fixed_bg;
+                background_err = 0.0;
+            }
+
+            // Extract the fluxes and associated errors
+            flux[idin] = best_fit[_-(nobs-1)];
+            flux_err[idin] = best_fit_err[_-(nobs-1)];
+
+            // Save to disk
+            save_fit_basics();
+        } else if (cell_approx) {
             if (verbose) {
                 print("compute approximated covariance errors...");
             }
@@ -1162,5 +1221,7 @@ void print_help() {
         "catalog (default: no)");
     bullet("cell_approx", "[flag] use a fitting approximation for non blended sources "
         "to make the fit significantly faster (default: no)");
+    bullet("sparse", "[flag] store the fit matrix in sparse format and use a sparse solver, "
+        "to fit large numbers of sources with less memory (default: no)");
     print("");
 }
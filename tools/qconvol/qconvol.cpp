@@ -13,7 +13,9 @@ void print_help() {
         "to 2 x radius [pixels] (or [arcsec] if the 'arcsec' keyword is provided), and "
         "save the result in a new FITS file.\n\n"
         "Alternatively, one may provide a 'kernel' image in FITS format which will be "
-        "used directly to perform the convolution."
+        "used directly to perform the convolution.\n\n"
+        "Large images are convolved by tiles to limit memory usage. The tiles can be "
+        "processed in parallel by setting 'threads' to the number of concurrent threads."
     );
 }
 
@@ -28,9 +30,10 @@ int vif_main(int argc, char* argv[]) {
     std::string kernel_file = "";
     double radius = 1.0;
     bool arcsec = false;
+    uint_t nthread = 1;
 
     read_args(argc-1, argv+1, arg_list(
-        name(fout, "out"), radius, arcsec, name(kernel_file, "kernel")
+        name(fout, "out"), radius, arcsec, name(kernel_file, "kernel"), name(nthread, "threads")
     ));
 
     if (fout.empty()) {
@@ -88,7 +91,18 @@ int vif_main(int argc, char* argv[]) {
     fits::header hdr;
     fits::read(fimg, img, hdr);
 
-    vec2d out = astro::convolve2d(img, beam);
+    vec2d out;
+    if (img.size() > 4096*4096 &&
+        astro::convolve2d_best_method(img.dims, beam) == astro::convolve2d_method::fft) {
+        // Large kernel: convolve by tiles to avoid allocating several copies of the
+        // padded image
+        astro::convolve2d_tiled_params p;
+        p.thread = nthread;
+        out = astro::convolve2d_tiled(img, beam, p);
+    } else {
+        out = astro::convolve2d(img, beam);
+    }
+
     fits::write(fout, out, hdr);
 
     return 0;